@@ -0,0 +1,345 @@
+// Microbenchmarks of the simulator components: ns per operation of the decoder,
+// the executor per ALU function, the register file, guest memory and whole
+// instructions. Each case warms up, then times a number of samples of a fixed
+// batch of operations; the median and the p99 of the samples are reported.
+//
+//   riscv_microbench [--samples N] [--filter SUBSTR] [--json FILE]
+//
+// The JSON output is meant to be kept per commit and compared between them.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Benchmarks.h"
+#include "Cpu.h"
+#include "Decoder.h"
+#include "Executor.h"
+#include "Memory.h"
+#include "RegisterFile.h"
+
+namespace
+{
+
+// Keeps the compiler from dropping a computation whose result is unused
+template <typename T>
+inline void Keep(const T& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct Result
+{
+    std::string name;
+    uint64_t opsPerSample = 0;
+    size_t samples = 0;
+    double median = 0;      // ns per operation
+    double p99 = 0;
+    double min = 0;
+};
+
+class Harness
+{
+public:
+    Harness(unsigned samples, std::string filter)
+        : _samples(std::max(samples, 1u))
+        , _filter(std::move(filter))
+    {
+
+    }
+
+    // sample() does `ops` operations; it is run a few times untimed first
+    void Run(const std::string& name, uint64_t ops, const std::function<void()>& sample)
+    {
+        if (!_filter.empty() && name.find(_filter) == std::string::npos)
+            return;
+
+        for (unsigned i = 0; i < warmupSamples; ++i)
+            sample();
+
+        std::vector<double> times;
+        times.reserve(_samples);
+        for (unsigned i = 0; i < _samples; ++i)
+        {
+            auto start = std::chrono::steady_clock::now();
+            sample();
+            auto stop = std::chrono::steady_clock::now();
+            times.push_back(std::chrono::duration<double, std::nano>(stop - start).count() / ops);
+        }
+        std::sort(times.begin(), times.end());
+
+        Result result;
+        result.name = name;
+        result.opsPerSample = ops;
+        result.samples = times.size();
+        result.median = times[times.size() / 2];
+        // Nearest rank
+        result.p99 = times[size_t(std::ceil(0.99 * times.size())) - 1];
+        result.min = times.front();
+        printf("%-28s %10.2f %10.2f %10.2f\n", name.c_str(), result.median, result.p99, result.min);
+        _results.push_back(result);
+    }
+
+    bool WriteJson(const char* path) const
+    {
+        std::FILE* file = std::fopen(path, "w");
+        if (!file)
+            return false;
+        fprintf(file, "{\n  \"unit\": \"ns/op\",\n  \"benchmarks\": [\n");
+        for (size_t i = 0; i < _results.size(); ++i)
+        {
+            auto& r = _results[i];
+            fprintf(file, "    {\"name\": \"%s\", \"ops_per_sample\": %llu, \"samples\": %zu, "
+                          "\"median\": %.3f, \"p99\": %.3f, \"min\": %.3f}%s\n",
+                    r.name.c_str(), static_cast<unsigned long long>(r.opsPerSample), r.samples,
+                    r.median, r.p99, r.min, i + 1 < _results.size() ? "," : "");
+        }
+        fprintf(file, "  ]\n}\n");
+        return std::fclose(file) == 0;
+    }
+
+private:
+    static constexpr unsigned warmupSamples = 3;
+
+    unsigned _samples;
+    std::string _filter;
+    std::vector<Result> _results;
+};
+
+// Host xorshift, so that operand and address streams do not follow a pattern
+uint32_t NextRandom(uint32_t& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// The code of all bench kernels back to back: the instruction mix of real programs
+std::vector<Word> KernelCode()
+{
+    std::vector<Word> words;
+    for (auto& kernel : BenchKernels())
+    {
+        Memory mem;
+        Assembler as{benchCodeAddr};
+        kernel.build(as, mem, 1);
+        auto& code = as.Code();
+        words.insert(words.end(), code.begin(), code.end());
+    }
+    return words;
+}
+
+void BenchDecoder(Harness& harness)
+{
+    std::vector<Word> code = KernelCode();
+    Decoder decoder;
+    // The kernels are short, a sample decodes them a number of times over
+    constexpr unsigned passes = 32;
+    harness.Run("decode/kernel-mix", passes * code.size(), [&] {
+        for (unsigned pass = 0; pass < passes; ++pass)
+        {
+            for (Word word : code)
+            {
+                InstructionPtr instr = decoder.Decode(word);
+                Keep(instr->_type);
+            }
+        }
+    });
+}
+
+void BenchExecutor(Harness& harness)
+{
+    static const std::pair<const char*, AluFunc> funcs[] = {
+        {"add", AluFunc::Add},       {"sub", AluFunc::Sub},       {"sll", AluFunc::Sll},
+        {"slt", AluFunc::Slt},       {"sltu", AluFunc::Sltu},     {"xor", AluFunc::Xor},
+        {"and", AluFunc::And},       {"or", AluFunc::Or},         {"sra", AluFunc::Sra},
+        {"srl", AluFunc::Srl},       {"andn", AluFunc::Andn},     {"orn", AluFunc::Orn},
+        {"xnor", AluFunc::Xnor},     {"min", AluFunc::Min},       {"max", AluFunc::Max},
+        {"minu", AluFunc::Minu},     {"maxu", AluFunc::Maxu},     {"rol", AluFunc::Rol},
+        {"ror", AluFunc::Ror},       {"clz", AluFunc::Clz},       {"ctz", AluFunc::Ctz},
+        {"cpop", AluFunc::Cpop},     {"sext.b", AluFunc::SextB},  {"sext.h", AluFunc::SextH},
+        {"zext.h", AluFunc::ZextH},  {"orc.b", AluFunc::OrcB},    {"rev8", AluFunc::Rev8},
+        {"sh1add", AluFunc::Sh1add}, {"sh2add", AluFunc::Sh2add}, {"sh3add", AluFunc::Sh3add},
+    };
+    constexpr size_t ops = 4096;
+
+    // Operands are drawn up front, so the loop only loads them
+    std::vector<Word> operands(2 * ops);
+    uint32_t state = 0x12345678;
+    for (auto& value : operands)
+        value = NextRandom(state);
+
+    Assembler as{0};
+    as.Add(reg::a0, reg::a1, reg::a2);
+    Decoder decoder;
+    Executor executor;
+    for (auto& [name, func] : funcs)
+    {
+        InstructionPtr instr = decoder.Decode(as.Code()[0]);
+        instr->_aluFunc = func;
+        harness.Run(std::string("execute/") + name, ops, [&] {
+            for (size_t i = 0; i < ops; ++i)
+            {
+                instr->_src1Val = operands[2 * i];
+                instr->_src2Val = operands[2 * i + 1];
+                executor.Execute(instr, 0x200);
+                Keep(instr->_data);
+            }
+        });
+    }
+}
+
+void BenchRegisterFile(Harness& harness)
+{
+    constexpr size_t ops = 4096;
+    Assembler as{0};
+    as.Add(reg::a0, reg::a1, reg::a2);
+    Decoder decoder;
+    InstructionPtr instr = decoder.Decode(as.Code()[0]);
+    RegisterFile rf;
+
+    harness.Run("regfile/read-operands", ops, [&] {
+        for (size_t i = 0; i < ops; ++i)
+        {
+            rf.Read(instr);
+            Keep(instr->_src1Val);
+            Keep(instr->_src2Val);
+        }
+    });
+    harness.Run("regfile/write-result", ops, [&] {
+        for (size_t i = 0; i < ops; ++i)
+        {
+            instr->_data = Word(i);
+            rf.Write(instr);
+            Keep(rf.Read(reg::a0));
+        }
+    });
+}
+
+void BenchMemory(Harness& harness)
+{
+    // All of guest ram, word by word in order and then in a shuffled order
+    constexpr size_t words = Memory::ramBytes / sizeof(Word);
+    std::vector<Word> sequential(words);
+    for (size_t i = 0; i < words; ++i)
+        sequential[i] = Word(i * sizeof(Word));
+    std::vector<Word> shuffled = sequential;
+    uint32_t state = 0x9e3779b9;
+    for (size_t i = words - 1; i > 0; --i)
+        std::swap(shuffled[i], shuffled[NextRandom(state) % (i + 1)]);
+
+    Memory mem;
+    Assembler as{0};
+    as.Lw(reg::a0, reg::a1, 0);
+    as.Sw(reg::a0, reg::a1, 0);
+    Decoder decoder;
+    InstructionPtr load = decoder.Decode(as.Code()[0]);
+    InstructionPtr store = decoder.Decode(as.Code()[1]);
+
+    for (auto [name, addrs] : {std::make_pair("sequential", &sequential), std::make_pair("random", &shuffled)})
+    {
+        harness.Run(std::string("memory/load-") + name, words, [&, addrs = addrs] {
+            for (Word addr : *addrs)
+            {
+                load->_addr = addr;
+                mem.Request(load);
+                Keep(load->_data);
+            }
+        });
+        harness.Run(std::string("memory/store-") + name, words, [&, addrs = addrs] {
+            for (Word addr : *addrs)
+            {
+                store->_addr = addr;
+                store->_data = addr;
+                mem.Request(store);
+            }
+        });
+    }
+}
+
+// Whole instructions of a kernel: fetch, decode, execute and retire, with both engines
+void BenchCpu(Harness& harness)
+{
+    const BenchKernel* kernel = FindKernel("crc32");
+    constexpr uint64_t ops = 100000;
+    Memory mem;
+    LoadKernel(*kernel, mem, kernel->defaultReps);
+    mem.Snapshot();
+    Cpu cpu{mem};
+    cpu.Reset(benchCodeAddr);
+
+    // The kernel starts over whenever it finishes, so every sample runs the same code
+    auto restart = [&] {
+        if (cpu.GetMessage() || cpu.GetFault())
+        {
+            mem.Restore();
+            cpu.Reset(benchCodeAddr);
+        }
+    };
+    harness.Run("cpu/process-instruction", ops, [&] {
+        for (uint64_t i = 0; i < ops; ++i)
+        {
+            cpu.ProcessInstruction();
+            restart();
+        }
+    });
+    // The block engine retires a block at a time, so the batch is only about `ops` long
+    harness.Run("cpu/process-block", ops, [&] {
+        uint64_t end = cpu.Instret() + ops;
+        while (cpu.Instret() < end)
+        {
+            cpu.ProcessBlock();
+            if (cpu.GetMessage() || cpu.GetFault())
+            {
+                end -= cpu.Instret();
+                restart();
+                end += cpu.Instret();
+            }
+        }
+    });
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    unsigned samples = 31;
+    std::string filter;
+    const char* json = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "--samples") && i + 1 < argc)
+            samples = std::strtoul(argv[++i], nullptr, 0);
+        else if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+            filter = argv[++i];
+        else if (!strcmp(argv[i], "--json") && i + 1 < argc)
+            json = argv[++i];
+        else
+        {
+            fprintf(stderr, "Usage: %s [--samples N] [--filter SUBSTR] [--json FILE]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    Harness harness{samples, filter};
+    printf("%-28s %10s %10s %10s\n", "benchmark, ns/op", "median", "p99", "min");
+    BenchDecoder(harness);
+    BenchExecutor(harness);
+    BenchRegisterFile(harness);
+    BenchMemory(harness);
+    BenchCpu(harness);
+
+    if (json && !harness.WriteJson(json))
+    {
+        fprintf(stderr, "ERROR: cannot write %s\n", json);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,257 @@
+
+#ifndef RISCV_SIM_ACCESSPROFILER_H
+#define RISCV_SIM_ACCESSPROFILER_H
+
+#include <algorithm>
+#include <array>
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "BaseTypes.h"
+
+struct AccessProfilerConfig
+{
+    unsigned rate = 64;             // one in rate accesses and one in rate lines is sampled
+    uint64_t interval = 1000000;    // accesses per point of the working set curve
+};
+
+// Estimated accesses, the sampled ones times the rate
+struct AccessCounts
+{
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+};
+
+struct WorkingSetPoint
+{
+    uint64_t accesses;  // at the end of the interval
+    uint64_t lines;     // distinct lines touched in the interval, estimated
+};
+
+// Profile of the guest data accesses without a cache model. Two samplers, each
+// where it is unbiased:
+//  - every rate-th access goes to the page and line heatmaps;
+//  - the lines whose address hashes below 1/rate are followed on every access,
+//    for reuse distances (distinct lines touched since the last access to the
+//    same line, an LRU stack distance) and the working set of every interval.
+//    Distances and set sizes among the sampled lines are scaled up by the rate.
+// Unsampled accesses cost a counter decrement and a multiplicative hash.
+class AccessProfiler
+{
+public:
+    static constexpr Word lineBytes = 64;
+    static constexpr Word pageBytes = 4096;
+    static constexpr size_t buckets = 33;   // distance 0, then [2^(b-1), 2^b) sampled lines
+
+    explicit AccessProfiler(const AccessProfilerConfig& config = {})
+        : _rate(std::max(1u, config.rate))
+        , _interval(std::max<uint64_t>(1, config.interval))
+        , _threshold(uint32_t(UINT32_MAX / _rate))
+        , _countdown(_rate)
+        , _intervalEnd(_interval)
+    {
+
+    }
+
+    void Access(Word addr, bool write)
+    {
+        _accesses++;
+        if (--_countdown == 0)
+            Sample(addr, write);
+        Word line = addr / lineBytes;
+        if (Word(line * hashMultiplier) <= _threshold)
+            Follow(line);
+        if (_accesses == _intervalEnd)
+            EndInterval();
+    }
+
+    // Closes the last, partial interval of the working set curve
+    void Finish()
+    {
+        if (_accesses > _intervalEnd - _interval)
+            EndInterval();
+    }
+
+    uint64_t Accesses() const { return _accesses; }
+    unsigned Rate() const { return _rate; }
+
+    const std::unordered_map<Word, AccessCounts>& Pages() const { return _pages; }
+    const std::unordered_map<Word, AccessCounts>& Lines() const { return _lines; }
+    const std::vector<WorkingSetPoint>& WorkingSet() const { return _workingSet; }
+
+    // Estimated accesses by reuse distance bucket, and to lines never accessed before
+    const std::array<uint64_t, buckets>& ReuseHistogram() const { return _histogram; }
+    uint64_t ColdAccesses() const { return _cold; }
+
+    // Distances in lines of a histogram bucket, [from, to)
+    std::pair<uint64_t, uint64_t> BucketLines(size_t bucket) const
+    {
+        if (bucket == 0)
+            return {0, _rate};
+        return {(uint64_t(1) << (bucket - 1)) * _rate, (uint64_t(1) << bucket) * _rate};
+    }
+
+    // prefix-pages.csv, prefix-lines.csv, prefix-reuse.csv and prefix-wss.csv
+    bool WriteCsv(const std::string& prefix) const
+    {
+        return WriteHeatmap(prefix + "-pages.csv", "page", _pages) &&
+               WriteHeatmap(prefix + "-lines.csv", "line", _lines) &&
+               WriteReuse(prefix + "-reuse.csv") &&
+               WriteWorkingSet(prefix + "-wss.csv");
+    }
+
+private:
+    static constexpr Word hashMultiplier = 0x9e3779b1u;
+    static constexpr size_t minTimes = 1u << 16;
+
+    __attribute__((noinline)) void Sample(Word addr, bool write)
+    {
+        _countdown = _rate;
+        auto& page = _pages[addr & ~(pageBytes - 1)];
+        auto& line = _lines[addr & ~(lineBytes - 1)];
+        (write ? page.writes : page.reads) += _rate;
+        (write ? line.writes : line.reads) += _rate;
+    }
+
+    // Olken's algorithm: a Fenwick tree over the sampled access times has a one at
+    // the last access of every line, so the distinct lines since a time are a sum
+    __attribute__((noinline)) void Follow(Word line)
+    {
+        if (_now == _tree.size())
+            Compact();
+        auto [last, cold] = _lastAccess.try_emplace(line, _now);
+        if (cold)
+        {
+            _cold += _rate;
+        }
+        else
+        {
+            uint64_t distance = Count(last->second + 1);
+            _histogram[Bucket(distance)] += _rate;
+            Add(last->second, -1);
+            last->second = _now;
+        }
+        Add(_now++, 1);
+    }
+
+    void EndInterval()
+    {
+        _workingSet.push_back({_accesses, Count(_intervalStart) * _rate});
+        _intervalStart = _now;
+        _intervalEnd = _accesses + _interval;
+    }
+
+    static size_t Bucket(uint64_t distance)
+    {
+        return distance == 0 ? 0 : 64 - __builtin_clzll(distance);
+    }
+
+    // Lines whose last access was at or after time `from`
+    uint64_t Count(size_t from) const
+    {
+        return Prefix(_now) - Prefix(from);
+    }
+
+    // Ones before time `end`
+    uint64_t Prefix(size_t end) const
+    {
+        int64_t sum = 0;
+        for (; end > 0; end &= end - 1)
+            sum += _tree[end - 1];
+        return uint64_t(sum);
+    }
+
+    void Add(size_t time, int32_t delta)
+    {
+        for (size_t i = time + 1; i <= _tree.size(); i += i & -i)
+            _tree[i - 1] += delta;
+    }
+
+    // Out of times: number the lines 0, 1, ... in the order of their last access
+    void Compact()
+    {
+        std::vector<std::pair<size_t, Word>> order;
+        order.reserve(_lastAccess.size());
+        for (auto& [line, time] : _lastAccess)
+            order.emplace_back(time, line);
+        std::sort(order.begin(), order.end());
+
+        size_t intervalStart = 0;
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            _lastAccess[order[i].second] = i;
+            intervalStart += order[i].first < _intervalStart;
+        }
+        _intervalStart = intervalStart;
+        _now = order.size();
+        _tree.assign(std::max(minTimes, 2 * order.size()), 0);
+        for (size_t time = 0; time < _now; ++time)
+            Add(time, 1);
+    }
+
+    static bool WriteHeatmap(const std::string& path, const char* unit,
+                             const std::unordered_map<Word, AccessCounts>& map)
+    {
+        std::vector<std::pair<Word, AccessCounts>> rows(map.begin(), map.end());
+        std::sort(rows.begin(), rows.end(), [](auto& a, auto& b) { return a.first < b.first; });
+        std::FILE* file = std::fopen(path.c_str(), "w");
+        if (!file)
+            return false;
+        fprintf(file, "%s,reads,writes\n", unit);
+        for (auto& [addr, counts] : rows)
+            fprintf(file, "0x%08x,%" PRIu64 ",%" PRIu64 "\n", addr, counts.reads, counts.writes);
+        return std::fclose(file) == 0;
+    }
+
+    bool WriteReuse(const std::string& path) const
+    {
+        std::FILE* file = std::fopen(path.c_str(), "w");
+        if (!file)
+            return false;
+        fprintf(file, "from_lines,to_lines,accesses\n");
+        for (size_t bucket = 0; bucket < buckets; ++bucket)
+        {
+            if (!_histogram[bucket])
+                continue;
+            auto [from, to] = BucketLines(bucket);
+            fprintf(file, "%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n", from, to, _histogram[bucket]);
+        }
+        fprintf(file, "cold,cold,%" PRIu64 "\n", _cold);
+        return std::fclose(file) == 0;
+    }
+
+    bool WriteWorkingSet(const std::string& path) const
+    {
+        std::FILE* file = std::fopen(path.c_str(), "w");
+        if (!file)
+            return false;
+        fprintf(file, "accesses,lines,bytes\n");
+        for (auto& point : _workingSet)
+            fprintf(file, "%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n", point.accesses, point.lines, point.lines * lineBytes);
+        return std::fclose(file) == 0;
+    }
+
+    unsigned _rate;
+    uint64_t _interval;
+    uint32_t _threshold;
+    unsigned _countdown;
+    uint64_t _accesses = 0;
+    uint64_t _intervalEnd;
+
+    std::unordered_map<Word, AccessCounts> _pages;
+    std::unordered_map<Word, AccessCounts> _lines;
+
+    std::unordered_map<Word, size_t> _lastAccess;
+    std::vector<int32_t> _tree;
+    size_t _now = 0;
+    size_t _intervalStart = 0;
+    std::array<uint64_t, buckets> _histogram{};
+    uint64_t _cold = 0;
+    std::vector<WorkingSetPoint> _workingSet;
+};
+
+#endif //RISCV_SIM_ACCESSPROFILER_H
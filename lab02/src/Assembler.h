@@ -0,0 +1,336 @@
+
+#ifndef RISCV_SIM_ASSEMBLER_H
+#define RISCV_SIM_ASSEMBLER_H
+
+#include <vector>
+
+#include "Instruction.h"
+
+// ABI register names
+namespace reg
+{
+    constexpr RId zero = 0, ra = 1, sp = 2, gp = 3, tp = 4;
+    constexpr RId t0 = 5, t1 = 6, t2 = 7, t3 = 28, t4 = 29, t5 = 30, t6 = 31;
+    constexpr RId s0 = 8, s1 = 9, s2 = 18, s3 = 19, s4 = 20, s5 = 21, s6 = 22, s7 = 23;
+    constexpr RId a0 = 10, a1 = 11, a2 = 12, a3 = 13, a4 = 14, a5 = 15, a6 = 16, a7 = 17;
+}
+
+// Tiny RV32IAFD + Zba/Zbb + RVV subset encoder for building guest programs in tests and benchmarks
+// without a RISC-V toolchain.
+// Branch and jump targets are labels, resolved when the code is taken.
+class Assembler
+{
+public:
+    using Label = size_t;
+
+    explicit Assembler(Word base)
+        : _base(base)
+    {
+
+    }
+
+    Label NewLabel()
+    {
+        _labels.push_back(noAddr);
+        return _labels.size() - 1;
+    }
+
+    void Bind(Label label) { _labels[label] = Ip(); }
+
+    Word Ip() const { return _base + 4 * _code.size(); }
+
+    // R-type
+    void Add(RId rd, RId rs1, RId rs2)  { R(Opcode::Op, 0b000, 0, rd, rs1, rs2); }
+    void Sub(RId rd, RId rs1, RId rs2)  { R(Opcode::Op, 0b000, 0b0100000, rd, rs1, rs2); }
+    void Sll(RId rd, RId rs1, RId rs2)  { R(Opcode::Op, 0b001, 0, rd, rs1, rs2); }
+    void Xor(RId rd, RId rs1, RId rs2)  { R(Opcode::Op, 0b100, 0, rd, rs1, rs2); }
+    void Srl(RId rd, RId rs1, RId rs2)  { R(Opcode::Op, 0b101, 0, rd, rs1, rs2); }
+    void Or(RId rd, RId rs1, RId rs2)   { R(Opcode::Op, 0b110, 0, rd, rs1, rs2); }
+    void And(RId rd, RId rs1, RId rs2)  { R(Opcode::Op, 0b111, 0, rd, rs1, rs2); }
+    void Slt(RId rd, RId rs1, RId rs2)  { R(Opcode::Op, 0b010, 0, rd, rs1, rs2); }
+    void Sltu(RId rd, RId rs1, RId rs2) { R(Opcode::Op, 0b011, 0, rd, rs1, rs2); }
+
+    // I-type
+    void Addi(RId rd, RId rs1, int32_t imm) { I(Opcode::OpImm, 0b000, rd, rs1, imm); }
+    void Andi(RId rd, RId rs1, int32_t imm) { I(Opcode::OpImm, 0b111, rd, rs1, imm); }
+    void Xori(RId rd, RId rs1, int32_t imm) { I(Opcode::OpImm, 0b100, rd, rs1, imm); }
+    void Slli(RId rd, RId rs1, int32_t sh)  { I(Opcode::OpImm, 0b001, rd, rs1, sh); }
+    void Srli(RId rd, RId rs1, int32_t sh)  { I(Opcode::OpImm, 0b101, rd, rs1, sh); }
+    void Srai(RId rd, RId rs1, int32_t sh)  { I(Opcode::OpImm, 0b101, rd, rs1, sh | 0x400); }
+    void Slti(RId rd, RId rs1, int32_t imm) { I(Opcode::OpImm, 0b010, rd, rs1, imm); }
+    void Lb(RId rd, RId rs1, int32_t imm)   { I(Opcode::Load, fnLB, rd, rs1, imm); }
+    void Lh(RId rd, RId rs1, int32_t imm)   { I(Opcode::Load, fnLH, rd, rs1, imm); }
+    void Lw(RId rd, RId rs1, int32_t imm)   { I(Opcode::Load, fnLW, rd, rs1, imm); }
+    void Lbu(RId rd, RId rs1, int32_t imm)  { I(Opcode::Load, fnLBU, rd, rs1, imm); }
+    void Lhu(RId rd, RId rs1, int32_t imm)  { I(Opcode::Load, fnLHU, rd, rs1, imm); }
+    void Jalr(RId rd, RId rs1, int32_t imm) { I(Opcode::Jalr, 0b000, rd, rs1, imm); }
+    void Csrr(RId rd, CsrIdx csr)           { I(Opcode::System, fnCSRRS, rd, 0, int32_t(csr)); }
+    void Csrw(CsrIdx csr, RId rs1)          { I(Opcode::System, fnCSRRW, 0, rs1, int32_t(csr)); }
+    void Ecall()                            { I(Opcode::System, fnPRIV, 0, 0, privSCALL); }
+    void Mret()                             { I(Opcode::System, fnPRIV, 0, 0, privMRET); }
+    void Wfi()                              { I(Opcode::System, fnPRIV, 0, 0, privWFI); }
+
+    // S-type
+    void Sb(RId rs2, RId rs1, int32_t imm) { S(Opcode::Store, fnSB, rs1, rs2, imm); }
+    void Sh(RId rs2, RId rs1, int32_t imm) { S(Opcode::Store, fnSH, rs1, rs2, imm); }
+    void Sw(RId rs2, RId rs1, int32_t imm) { S(Opcode::Store, fnSW, rs1, rs2, imm); }
+
+    // A-type with aq and rl clear: amoadd.w rd, rs2, (rs1) is Amo(AmoFunc::Add, rd, rs2, rs1)
+    void LrW(RId rd, RId rs1)                           { A(AmoFunc::Lr, rd, rs1, 0); }
+    void ScW(RId rd, RId rs2, RId rs1)                  { A(AmoFunc::Sc, rd, rs1, rs2); }
+    void Amo(AmoFunc func, RId rd, RId rs2, RId rs1)    { A(func, rd, rs1, rs2); }
+    void Fence()                                        { I(Opcode::MiscMem, fnFENCE, 0, 0, 0x0ff); }
+    void FenceI()                                       { I(Opcode::MiscMem, fnFENCEI, 0, 0, 0); }
+
+    // Zba and Zbb
+    void Sh1add(RId rd, RId rs1, RId rs2) { R(Opcode::Op, 0b010, fnZBA, rd, rs1, rs2); }
+    void Sh2add(RId rd, RId rs1, RId rs2) { R(Opcode::Op, 0b100, fnZBA, rd, rs1, rs2); }
+    void Sh3add(RId rd, RId rs1, RId rs2) { R(Opcode::Op, 0b110, fnZBA, rd, rs1, rs2); }
+    void Andn(RId rd, RId rs1, RId rs2)   { R(Opcode::Op, 0b111, fnZBBNEG, rd, rs1, rs2); }
+    void Orn(RId rd, RId rs1, RId rs2)    { R(Opcode::Op, 0b110, fnZBBNEG, rd, rs1, rs2); }
+    void Xnor(RId rd, RId rs1, RId rs2)   { R(Opcode::Op, 0b100, fnZBBNEG, rd, rs1, rs2); }
+    void Min(RId rd, RId rs1, RId rs2)    { R(Opcode::Op, 0b100, fnZBBMINMAX, rd, rs1, rs2); }
+    void Minu(RId rd, RId rs1, RId rs2)   { R(Opcode::Op, 0b101, fnZBBMINMAX, rd, rs1, rs2); }
+    void Max(RId rd, RId rs1, RId rs2)    { R(Opcode::Op, 0b110, fnZBBMINMAX, rd, rs1, rs2); }
+    void Maxu(RId rd, RId rs1, RId rs2)   { R(Opcode::Op, 0b111, fnZBBMINMAX, rd, rs1, rs2); }
+    void Rol(RId rd, RId rs1, RId rs2)    { R(Opcode::Op, 0b001, fnZBB, rd, rs1, rs2); }
+    void Ror(RId rd, RId rs1, RId rs2)    { R(Opcode::Op, 0b101, fnZBB, rd, rs1, rs2); }
+    void ZextH(RId rd, RId rs1)           { R(Opcode::Op, 0b100, fnZEXTH, rd, rs1, 0); }
+    void Rori(RId rd, RId rs1, int32_t sh) { I(Opcode::OpImm, 0b101, rd, rs1, fnZBB << 5 | sh); }
+    void Clz(RId rd, RId rs1)             { I(Opcode::OpImm, 0b001, rd, rs1, fnZBB << 5 | 0); }
+    void Ctz(RId rd, RId rs1)             { I(Opcode::OpImm, 0b001, rd, rs1, fnZBB << 5 | 1); }
+    void Cpop(RId rd, RId rs1)            { I(Opcode::OpImm, 0b001, rd, rs1, fnZBB << 5 | 2); }
+    void SextB(RId rd, RId rs1)           { I(Opcode::OpImm, 0b001, rd, rs1, fnZBB << 5 | 4); }
+    void SextH(RId rd, RId rs1)           { I(Opcode::OpImm, 0b001, rd, rs1, fnZBB << 5 | 5); }
+    void OrcB(RId rd, RId rs1)            { I(Opcode::OpImm, 0b101, rd, rs1, immORCB); }
+    void Rev8(RId rd, RId rs1)            { I(Opcode::OpImm, 0b101, rd, rs1, immREV8); }
+
+    // F and D: Fp(FpFunc::Add, true, rd, rs1, rs2) is fadd.d with the dynamic rounding mode.
+    // Operands that are integer registers in the ISA are integer registers here too.
+    void Flw(RId rd, RId rs1, int32_t imm)  { I(Opcode::LoadFp, fnFW, rd, rs1, imm); }
+    void Fld(RId rd, RId rs1, int32_t imm)  { I(Opcode::LoadFp, fnFD, rd, rs1, imm); }
+    void Fsw(RId rs2, RId rs1, int32_t imm) { S(Opcode::StoreFp, fnFW, rs1, rs2, imm); }
+    void Fsd(RId rs2, RId rs1, int32_t imm) { S(Opcode::StoreFp, fnFD, rs1, rs2, imm); }
+    void Fp(FpFunc func, bool dbl, RId rd, RId rs1, RId rs2 = 0, RoundingMode rm = RoundingMode::Dyn)
+    {
+        Word f5 = 0, f3 = Word(rm);
+        switch (func)
+        {
+            case FpFunc::Add:    f5 = 0b00000; break;
+            case FpFunc::Sub:    f5 = 0b00001; break;
+            case FpFunc::Mul:    f5 = 0b00010; break;
+            case FpFunc::Div:    f5 = 0b00011; break;
+            case FpFunc::Sqrt:   f5 = 0b01011; rs2 = 0; break;
+            case FpFunc::SgnJ:   f5 = 0b00100; f3 = 0; break;
+            case FpFunc::SgnJn:  f5 = 0b00100; f3 = 1; break;
+            case FpFunc::SgnJx:  f5 = 0b00100; f3 = 2; break;
+            case FpFunc::Min:    f5 = 0b00101; f3 = 0; break;
+            case FpFunc::Max:    f5 = 0b00101; f3 = 1; break;
+            case FpFunc::CvtFF:  f5 = 0b01000; rs2 = !dbl; break;
+            case FpFunc::Le:     f5 = 0b10100; f3 = 0; break;
+            case FpFunc::Lt:     f5 = 0b10100; f3 = 1; break;
+            case FpFunc::Eq:     f5 = 0b10100; f3 = 2; break;
+            case FpFunc::CvtWF:  f5 = 0b11000; rs2 = 0; break;
+            case FpFunc::CvtWuF: f5 = 0b11000; rs2 = 1; break;
+            case FpFunc::CvtFW:  f5 = 0b11010; rs2 = 0; break;
+            case FpFunc::CvtFWu: f5 = 0b11010; rs2 = 1; break;
+            case FpFunc::MvXW:   f5 = 0b11100; f3 = 0; rs2 = 0; break;
+            case FpFunc::Class:  f5 = 0b11100; f3 = 1; rs2 = 0; break;
+            case FpFunc::MvWX:   f5 = 0b11110; f3 = 0; rs2 = 0; break;
+            default: break;
+        }
+        R(Opcode::OpFp, f3, f5 << 2u | Word(dbl), rd, rs1, rs2);
+    }
+    // Fused multiply-add: Madd, Msub, Nmsub or Nmadd
+    void Fma(FpFunc func, bool dbl, RId rd, RId rs1, RId rs2, RId rs3, RoundingMode rm = RoundingMode::Dyn)
+    {
+        Opcode op = func == FpFunc::Msub ? Opcode::Msub : func == FpFunc::Nmsub ? Opcode::Nmsub
+                  : func == FpFunc::Nmadd ? Opcode::Nmadd : Opcode::Madd;
+        R(op, Word(rm), Word(rs3) << 2u | Word(dbl), rd, rs1, rs2);
+    }
+
+    // RVV: vsetvli rd, rs1, e32, m2 is Vsetvli(rd, rs1, VType(32, 2)), vadd.vx vd, vs2, rs1
+    // is Vx(VecFunc::Add, vd, vs2, rs1); masked operations use v0.t
+    static Word VType(unsigned sew, unsigned lmul = 1)
+    {
+        Word vsew = sew >= 32 ? 2 : sew >= 16 ? 1 : 0;
+        Word vlmul = lmul >= 8 ? 3 : lmul >= 4 ? 2 : lmul >= 2 ? 1 : 0;
+        return vsew << 3u | vlmul;
+    }
+    void Vsetvli(RId rd, RId rs1, Word vtype)   { I(Opcode::OpV, fnOPCFG, rd, rs1, int32_t(vtype)); }
+    void Vsetivli(RId rd, Word avl, Word vtype) { I(Opcode::OpV, fnOPCFG, rd, RId(avl), int32_t(0xc00u | vtype)); }
+    void Vle(unsigned eew, RId vd, RId rs1, bool masked = false)           { VMem(Opcode::LoadFp, eew, vd, rs1, 0, 0, masked); }
+    void Vse(unsigned eew, RId vs3, RId rs1, bool masked = false)          { VMem(Opcode::StoreFp, eew, vs3, rs1, 0, 0, masked); }
+    void Vlse(unsigned eew, RId vd, RId rs1, RId rs2, bool masked = false) { VMem(Opcode::LoadFp, eew, vd, rs1, 0b10, rs2, masked); }
+    void Vsse(unsigned eew, RId vs3, RId rs1, RId rs2, bool masked = false){ VMem(Opcode::StoreFp, eew, vs3, rs1, 0b10, rs2, masked); }
+    void Vv(VecFunc func, RId vd, RId vs2, RId vs1, bool masked = false)       { V(func, false, vd, vs2, vs1, masked); }
+    void Vx(VecFunc func, RId vd, RId vs2, RId rs1, bool masked = false)       { V(func, true, vd, vs2, rs1, masked); }
+    void Vi(VecFunc func, RId vd, RId vs2, int32_t simm5, bool masked = false) { V(func, true, vd, vs2, RId(simm5 & 0x1f), masked, true); }
+    void VmvXS(RId rd, RId vs2) { Vv(VecFunc::MvXS, rd, vs2, 0); }
+    void VmvSX(RId vd, RId rs1) { Vx(VecFunc::MvSX, vd, 0, rs1); }
+
+    // U-type
+    void Lui(RId rd, Word imm)   { Emit((imm & 0xfffff000u) | rd << 7u | Word(Opcode::Lui)); }
+    void Auipc(RId rd, Word imm) { Emit((imm & 0xfffff000u) | rd << 7u | Word(Opcode::Auipc)); }
+
+    // Branches and jumps
+    void Beq(RId rs1, RId rs2, Label l)  { B(BrFunc::Eq, rs1, rs2, l); }
+    void Bne(RId rs1, RId rs2, Label l)  { B(BrFunc::Neq, rs1, rs2, l); }
+    void Blt(RId rs1, RId rs2, Label l)  { B(BrFunc::Lt, rs1, rs2, l); }
+    void Bge(RId rs1, RId rs2, Label l)  { B(BrFunc::Ge, rs1, rs2, l); }
+    void Bltu(RId rs1, RId rs2, Label l) { B(BrFunc::Ltu, rs1, rs2, l); }
+    void Bgeu(RId rs1, RId rs2, Label l) { B(BrFunc::Geu, rs1, rs2, l); }
+    void Jal(RId rd, Label l)
+    {
+        _fixups.push_back({_code.size(), l});
+        Emit(rd << 7u | Word(Opcode::Jal));
+    }
+
+    // Pseudo-instructions
+    void Li(RId rd, int32_t imm)
+    {
+        if (imm >= -2048 && imm < 2048)
+        {
+            Addi(rd, 0, imm);
+            return;
+        }
+        Word hi = (Word(imm) + 0x800u) & 0xfffff000u;
+        Lui(rd, hi);
+        if (Word(imm) != hi)
+            Addi(rd, rd, int32_t(Word(imm) - hi));
+    }
+    void La(RId rd, Label l)
+    {
+        _fixups.push_back({_code.size(), l});
+        Emit(rd << 7u | Word(Opcode::Auipc));
+        Emit(rd << 15u | rd << 7u | Word(Opcode::OpImm));
+    }
+    void Mv(RId rd, RId rs) { Addi(rd, rs, 0); }
+    void Neg(RId rd, RId rs){ Sub(rd, 0, rs); }
+    void J(Label l)         { Jal(0, l); }
+    void Ret()              { Jalr(0, 1, 0); }
+    void Word32(Word w)     { Emit(w); }
+    void Call(Label l)      { Jal(reg::ra, l); }
+
+    const std::vector<Word>& Code()
+    {
+        for (auto& fixup : _fixups)
+            Resolve(fixup);
+        _fixups.clear();
+        return _code;
+    }
+
+private:
+    static constexpr Word noAddr = 0xffffffff;
+
+    struct Fixup
+    {
+        size_t index;
+        Label label;
+    };
+
+    void Emit(Word w) { _code.push_back(w); }
+
+    void R(Opcode op, Word f3, Word f7, RId rd, RId rs1, RId rs2)
+    {
+        Emit(f7 << 25u | Word(rs2) << 20u | Word(rs1) << 15u | f3 << 12u | Word(rd) << 7u | Word(op));
+    }
+    void A(AmoFunc func, RId rd, RId rs1, RId rs2)
+    {
+        R(Opcode::Amo, fnAMOW, Word(func) << 2u, rd, rs1, rs2);
+    }
+    void VMem(Opcode op, unsigned eew, RId vd, RId rs1, Word mop, RId rs2, bool masked)
+    {
+        Word width = eew == 8 ? fnVE8 : eew == 16 ? fnVE16 : fnVE32;
+        Emit(mop << 26u | Word(!masked) << 25u | Word(rs2) << 20u | Word(rs1) << 15u | width << 12u |
+             Word(vd) << 7u | Word(op));
+    }
+    void V(VecFunc func, bool scalar, RId vd, RId vs2, RId src, bool masked, bool imm = false)
+    {
+        // funct6, and whether it is in the OPM group
+        Word f6 = 0;
+        bool m = false;
+        switch (func)
+        {
+            case VecFunc::Add:     f6 = 0b000000; break;
+            case VecFunc::Sub:     f6 = 0b000010; break;
+            case VecFunc::Rsub:    f6 = 0b000011; break;
+            case VecFunc::Minu:    f6 = 0b000100; break;
+            case VecFunc::Min:     f6 = 0b000101; break;
+            case VecFunc::Maxu:    f6 = 0b000110; break;
+            case VecFunc::Max:     f6 = 0b000111; break;
+            case VecFunc::And:     f6 = 0b001001; break;
+            case VecFunc::Or:      f6 = 0b001010; break;
+            case VecFunc::Xor:     f6 = 0b001011; break;
+            case VecFunc::Merge:   f6 = 0b010111; break;
+            case VecFunc::Seq:     f6 = 0b011000; break;
+            case VecFunc::Sne:     f6 = 0b011001; break;
+            case VecFunc::Sltu:    f6 = 0b011010; break;
+            case VecFunc::Slt:     f6 = 0b011011; break;
+            case VecFunc::Sleu:    f6 = 0b011100; break;
+            case VecFunc::Sle:     f6 = 0b011101; break;
+            case VecFunc::Sgtu:    f6 = 0b011110; break;
+            case VecFunc::Sgt:     f6 = 0b011111; break;
+            case VecFunc::RedSum:  f6 = 0b000000; m = true; break;
+            case VecFunc::RedMinu: f6 = 0b000100; m = true; break;
+            case VecFunc::RedMin:  f6 = 0b000101; m = true; break;
+            case VecFunc::RedMaxu: f6 = 0b000110; m = true; break;
+            case VecFunc::RedMax:  f6 = 0b000111; m = true; break;
+            case VecFunc::Mul:     f6 = 0b100101; m = true; break;
+            case VecFunc::Macc:    f6 = 0b101101; m = true; break;
+            case VecFunc::MvXS:
+            case VecFunc::MvSX:    f6 = 0b010000; m = true; break;
+            default: break;
+        }
+        Word f3 = imm ? fnOPIVI : m ? (scalar ? fnOPMVX : fnOPMVV) : (scalar ? fnOPIVX : fnOPIVV);
+        R(Opcode::OpV, f3, f6 << 1u | Word(!masked), vd, src, vs2);
+    }
+    void I(Opcode op, Word f3, RId rd, RId rs1, int32_t imm)
+    {
+        Emit(Word(imm) << 20u | Word(rs1) << 15u | f3 << 12u | Word(rd) << 7u | Word(op));
+    }
+    void S(Opcode op, Word f3, RId rs1, RId rs2, int32_t imm)
+    {
+        Word u = Word(imm);
+        Emit((u >> 5u & 0x7fu) << 25u | Word(rs2) << 20u | Word(rs1) << 15u | f3 << 12u |
+             (u & 0x1fu) << 7u | Word(op));
+    }
+    void B(BrFunc f, RId rs1, RId rs2, Label l)
+    {
+        _fixups.push_back({_code.size(), l});
+        Emit(Word(rs2) << 20u | Word(rs1) << 15u | Word(f) << 12u | Word(Opcode::Branch));
+    }
+
+    void Resolve(const Fixup& fixup)
+    {
+        Word& w = _code[fixup.index];
+        Word offset = _labels[fixup.label] - (_base + 4 * fixup.index);
+        switch (static_cast<Opcode>(w & 0x7fu))
+        {
+            case Opcode::Branch:
+                w |= (offset >> 12u & 1u) << 31u | (offset >> 5u & 0x3fu) << 25u |
+                     (offset >> 1u & 0xfu) << 8u | (offset >> 11u & 1u) << 7u;
+                break;
+            case Opcode::Jal:
+                w |= (offset >> 20u & 1u) << 31u | (offset >> 1u & 0x3ffu) << 21u |
+                     (offset >> 11u & 1u) << 20u | (offset >> 12u & 0xffu) << 12u;
+                break;
+            case Opcode::Auipc:
+            {
+                Word hi = (offset + 0x800u) & 0xfffff000u;
+                w |= hi;
+                _code[fixup.index + 1] |= (offset - hi) << 20u;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    Word _base;
+    std::vector<Word> _code;
+    std::vector<Word> _labels;
+    std::vector<Fixup> _fixups;
+};
+
+#endif //RISCV_SIM_ASSEMBLER_H
@@ -12,7 +12,8 @@ enum class CpuToHostType : uint16_t
     ExitCode = 0,
     PrintChar = 1,
     PrintIntLow = 2,
-    PrintIntHigh = 3
+    PrintIntHigh = 3,
+    ConsoleFlush = 4  // drain the console ring registered in mconsole
 };
 
 union CpuToHostData
@@ -0,0 +1,671 @@
+
+#ifndef RISCV_SIM_BENCHMARKS_H
+#define RISCV_SIM_BENCHMARKS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Assembler.h"
+#include "Cpu.h"
+#include "LockstepChecker.h"
+#include "OooModel.h"
+#include "TracePipe.h"
+
+// Compute-heavy guest kernels for measuring simulator throughput.
+// They are assembled in-process, so no RISC-V toolchain is needed to run them.
+// Each kernel leaves a checksum at benchResultAddr and exits through ecall;
+// the checksum is compared with a host reference implementation.
+
+constexpr Word benchCodeAddr   = 0x200;
+constexpr Word benchResultAddr = 0x100;
+constexpr Word benchHeadAddr   = 0x104;
+constexpr Word benchDataAddr   = 0x10000;
+
+struct BenchKernel
+{
+    const char* name;
+    unsigned defaultReps;
+    // Emits the guest code and fills its input data
+    void (*build)(Assembler& as, Memory& mem, unsigned reps);
+    // Host reference of the checksum
+    Word (*expected)(unsigned reps);
+};
+
+namespace bench
+{
+    using namespace reg;
+
+    // Deterministic input data
+    inline Word XorShift(Word& state)
+    {
+        state ^= state << 13u;
+        state ^= state >> 17u;
+        state ^= state << 5u;
+        return state;
+    }
+
+    inline void Exit(Assembler& as)
+    {
+        as.Li(a0, 0);
+        as.Li(a7, int32_t(Syscall::Exit));
+        as.Ecall();
+    }
+
+    inline void StoreResult(Assembler& as, RId rs)
+    {
+        as.Sw(rs, zero, benchResultAddr);
+        Exit(as);
+    }
+
+    // Galois LFSR stream, 64K steps per rep
+    constexpr Word lfsrTaps = 0x80200003;
+    constexpr Word lfsrSteps = 65536;
+
+    inline void BuildLfsr(Assembler& as, Memory&, unsigned reps)
+    {
+        auto loop = as.NewLabel();
+        auto skip = as.NewLabel();
+        as.Li(t0, 0xace1);
+        as.Li(t1, int32_t(reps * lfsrSteps));
+        as.Li(t2, int32_t(lfsrTaps));
+        as.Li(t3, 0);
+        as.Bind(loop);
+        as.Andi(t4, t0, 1);
+        as.Srli(t0, t0, 1);
+        as.Beq(t4, zero, skip);
+        as.Xor(t0, t0, t2);
+        as.Bind(skip);
+        as.Add(t3, t3, t0);
+        as.Addi(t1, t1, -1);
+        as.Bne(t1, zero, loop);
+        as.Xor(a0, t0, t3);
+        StoreResult(as, a0);
+    }
+
+    inline Word ExpectedLfsr(unsigned reps)
+    {
+        Word x = 0xace1, acc = 0;
+        for (Word i = 0; i < reps * lfsrSteps; ++i)
+        {
+            Word lsb = x & 1u;
+            x >>= 1u;
+            if (lsb)
+                x ^= lfsrTaps;
+            acc += x;
+        }
+        return x ^ acc;
+    }
+
+    // Bitwise CRC-32 of a 4 KB buffer, one pass per rep
+    constexpr Word crcPoly = 0xedb88320;
+    constexpr Word crcLen = 4096;
+
+    inline uint8_t CrcByte(Word i) { return (i * 2654435761u) >> 24u; }
+
+    inline void BuildCrc(Assembler& as, Memory& mem, unsigned reps)
+    {
+        for (Word i = 0; i < crcLen; ++i)
+            mem.Store<uint8_t>(benchDataAddr + i, CrcByte(i));
+
+        auto pass = as.NewLabel();
+        auto byte = as.NewLabel();
+        auto bit = as.NewLabel();
+        as.Li(t0, -1);
+        as.Li(t5, int32_t(crcPoly));
+        as.Li(s0, int32_t(reps));
+        as.Bind(pass);
+        as.Li(t1, benchDataAddr);
+        as.Li(t2, benchDataAddr + crcLen);
+        as.Bind(byte);
+        as.Lbu(t3, t1, 0);
+        as.Xor(t0, t0, t3);
+        as.Li(t4, 8);
+        as.Bind(bit);
+        as.Andi(t6, t0, 1);
+        as.Neg(t6, t6);
+        as.And(t6, t6, t5);
+        as.Srli(t0, t0, 1);
+        as.Xor(t0, t0, t6);
+        as.Addi(t4, t4, -1);
+        as.Bne(t4, zero, bit);
+        as.Addi(t1, t1, 1);
+        as.Bne(t1, t2, byte);
+        as.Addi(s0, s0, -1);
+        as.Bne(s0, zero, pass);
+        as.Xori(a0, t0, -1);
+        StoreResult(as, a0);
+    }
+
+    inline Word ExpectedCrc(unsigned reps)
+    {
+        Word crc = 0xffffffff;
+        for (unsigned r = 0; r < reps; ++r)
+        {
+            for (Word i = 0; i < crcLen; ++i)
+            {
+                crc ^= CrcByte(i);
+                for (int b = 0; b < 8; ++b)
+                    crc = (crc >> 1u) ^ (crcPoly & (0u - (crc & 1u)));
+            }
+        }
+        return ~crc;
+    }
+
+    // Insertion sort of 512 signed words, re-copied from the source every rep
+    constexpr Word sortLen = 512;
+    constexpr Word sortSrc = benchDataAddr;
+    constexpr Word sortWork = benchDataAddr + 4 * sortLen;
+
+    inline std::vector<SignedWord> SortInput()
+    {
+        std::vector<SignedWord> v(sortLen);
+        Word state = 0x12345678;
+        for (auto& x : v)
+            x = SignedWord(XorShift(state));
+        return v;
+    }
+
+    inline void BuildSort(Assembler& as, Memory& mem, unsigned reps)
+    {
+        auto input = SortInput();
+        for (Word i = 0; i < sortLen; ++i)
+            mem.Store<SignedWord>(sortSrc + 4 * i, input[i]);
+
+        auto rep = as.NewLabel();
+        auto copy = as.NewLabel();
+        auto outer = as.NewLabel();
+        auto inner = as.NewLabel();
+        auto place = as.NewLabel();
+        auto sum = as.NewLabel();
+        as.Li(s0, int32_t(reps));
+        as.Li(s1, 0);
+        as.Li(a1, sortWork);
+        as.Bind(rep);
+        // copy the source array
+        as.Li(t0, sortSrc);
+        as.Li(t1, sortWork);
+        as.Li(t2, sortLen);
+        as.Bind(copy);
+        as.Lw(t3, t0, 0);
+        as.Sw(t3, t1, 0);
+        as.Addi(t0, t0, 4);
+        as.Addi(t1, t1, 4);
+        as.Addi(t2, t2, -1);
+        as.Bne(t2, zero, copy);
+        // insertion sort
+        as.Li(t0, sortWork + 4);
+        as.Li(t6, sortWork + 4 * sortLen);
+        as.Bind(outer);
+        as.Lw(t1, t0, 0);
+        as.Addi(t2, t0, -4);
+        as.Bind(inner);
+        as.Bltu(t2, a1, place);
+        as.Lw(t3, t2, 0);
+        as.Bge(t1, t3, place);
+        as.Sw(t3, t2, 4);
+        as.Addi(t2, t2, -4);
+        as.J(inner);
+        as.Bind(place);
+        as.Sw(t1, t2, 4);
+        as.Addi(t0, t0, 4);
+        as.Bne(t0, t6, outer);
+        // checksum of a[i] ^ i
+        as.Li(t0, sortWork);
+        as.Li(t2, 0);
+        as.Li(t6, sortLen);
+        as.Bind(sum);
+        as.Lw(t3, t0, 0);
+        as.Xor(t3, t3, t2);
+        as.Add(s1, s1, t3);
+        as.Addi(t0, t0, 4);
+        as.Addi(t2, t2, 1);
+        as.Bne(t2, t6, sum);
+        as.Addi(s0, s0, -1);
+        as.Bne(s0, zero, rep);
+        StoreResult(as, s1);
+    }
+
+    inline Word ExpectedSort(unsigned reps)
+    {
+        auto v = SortInput();
+        std::sort(v.begin(), v.end());
+        Word sum = 0;
+        for (Word i = 0; i < sortLen; ++i)
+            sum += Word(v[i]) ^ i;
+        return sum * reps;
+    }
+
+    // 16x16 matrix multiply, RV32I has no mul so products go through a shift-add subroutine
+    constexpr Word matN = 16;
+    constexpr Word matA = benchDataAddr;
+    constexpr Word matB = matA + 4 * matN * matN;
+    constexpr Word matC = matB + 4 * matN * matN;
+
+    inline Word MatA(Word i) { return (i * 7 + 3) & 15u; }
+    inline Word MatB(Word i) { return (i * 5 + 1) & 15u; }
+
+    // t0 = (row << 4 | col) * 4 + base
+    inline void MatAddr(Assembler& as, RId row, RId col, Word base)
+    {
+        as.Slli(t0, row, 4);
+        as.Add(t0, t0, col);
+        as.Slli(t0, t0, 2);
+        as.Li(t1, base);
+        as.Add(t0, t0, t1);
+    }
+
+    inline void BuildMatmul(Assembler& as, Memory& mem, unsigned reps)
+    {
+        for (Word i = 0; i < matN * matN; ++i)
+        {
+            mem.Store<Word>(matA + 4 * i, MatA(i));
+            mem.Store<Word>(matB + 4 * i, MatB(i));
+        }
+
+        auto rep = as.NewLabel();
+        auto iloop = as.NewLabel();
+        auto jloop = as.NewLabel();
+        auto kloop = as.NewLabel();
+        auto mul = as.NewLabel();
+        auto mulLoop = as.NewLabel();
+        auto mulSkip = as.NewLabel();
+        as.Li(s0, int32_t(reps));
+        as.Li(s7, 0);
+        as.Li(s5, matN);
+        as.Bind(rep);
+        as.Li(s1, 0);
+        as.Bind(iloop);
+        as.Li(s2, 0);
+        as.Bind(jloop);
+        as.Li(s3, 0);
+        as.Li(s4, 0);
+        as.Bind(kloop);
+        MatAddr(as, s1, s3, matA);
+        as.Lw(a0, t0, 0);
+        MatAddr(as, s3, s2, matB);
+        as.Lw(a1, t0, 0);
+        as.Call(mul);
+        as.Add(s4, s4, a0);
+        as.Addi(s3, s3, 1);
+        as.Bne(s3, s5, kloop);
+        MatAddr(as, s1, s2, matC);
+        as.Sw(s4, t0, 0);
+        as.Add(s7, s7, s4);
+        as.Addi(s2, s2, 1);
+        as.Bne(s2, s5, jloop);
+        as.Addi(s1, s1, 1);
+        as.Bne(s1, s5, iloop);
+        as.Addi(s0, s0, -1);
+        as.Bne(s0, zero, rep);
+        StoreResult(as, s7);
+
+        // a0 = a0 * a1
+        as.Bind(mul);
+        as.Li(t0, 0);
+        as.Bind(mulLoop);
+        as.Andi(t1, a1, 1);
+        as.Beq(t1, zero, mulSkip);
+        as.Add(t0, t0, a0);
+        as.Bind(mulSkip);
+        as.Slli(a0, a0, 1);
+        as.Srli(a1, a1, 1);
+        as.Bne(a1, zero, mulLoop);
+        as.Mv(a0, t0);
+        as.Ret();
+    }
+
+    inline Word ExpectedMatmul(unsigned reps)
+    {
+        Word sum = 0;
+        for (Word i = 0; i < matN; ++i)
+            for (Word j = 0; j < matN; ++j)
+                for (Word k = 0; k < matN; ++k)
+                    sum += MatA(i * matN + k) * MatB(k * matN + j);
+        return sum * reps;
+    }
+
+    // Traversal of an 8192-node linked list laid out in shuffled order
+    constexpr Word listLen = 8192;
+
+    inline std::vector<Word> ListOrder()
+    {
+        std::vector<Word> order(listLen);
+        for (Word i = 0; i < listLen; ++i)
+            order[i] = i;
+        Word state = 0xdeadbeef;
+        for (Word i = listLen - 1; i > 0; --i)
+            std::swap(order[i], order[XorShift(state) % (i + 1)]);
+        return order;
+    }
+
+    inline Word ListValue(Word node) { return node * 40503u + 17u; }
+
+    inline void BuildList(Assembler& as, Memory& mem, unsigned reps)
+    {
+        auto order = ListOrder();
+        for (Word i = 0; i < listLen; ++i)
+        {
+            Word node = benchDataAddr + 8 * order[i];
+            Word next = i + 1 < listLen ? benchDataAddr + 8 * order[i + 1] : 0;
+            mem.Store<Word>(node, next);
+            mem.Store<Word>(node + 4, ListValue(order[i]));
+        }
+        mem.Store<Word>(benchHeadAddr, benchDataAddr + 8 * order[0]);
+
+        auto rep = as.NewLabel();
+        auto walk = as.NewLabel();
+        as.Li(s0, int32_t(reps));
+        as.Li(s1, 0);
+        as.Bind(rep);
+        as.Lw(t0, zero, benchHeadAddr);
+        as.Bind(walk);
+        as.Lw(t1, t0, 4);
+        as.Add(s1, s1, t1);
+        as.Lw(t0, t0, 0);
+        as.Bne(t0, zero, walk);
+        as.Addi(s0, s0, -1);
+        as.Bne(s0, zero, rep);
+        StoreResult(as, s1);
+    }
+
+    inline Word ExpectedList(unsigned reps)
+    {
+        Word sum = 0;
+        for (Word i = 0; i < listLen; ++i)
+            sum += ListValue(i);
+        return sum * reps;
+    }
+
+    // 1D convolution y[i] = x[i-1] + 2*x[i] + x[i+1] - x[i+2]/4 over 4096 words
+    constexpr Word convLen = 4096;
+    constexpr Word convX = benchDataAddr;
+    constexpr Word convY = benchDataAddr + 4 * convLen;
+
+    inline std::vector<SignedWord> ConvInput()
+    {
+        std::vector<SignedWord> v(convLen);
+        Word state = 0xc0ffee;
+        for (auto& x : v)
+            x = SignedWord(XorShift(state)) >> 8;
+        return v;
+    }
+
+    inline void BuildConv(Assembler& as, Memory& mem, unsigned reps)
+    {
+        auto input = ConvInput();
+        for (Word i = 0; i < convLen; ++i)
+            mem.Store<SignedWord>(convX + 4 * i, input[i]);
+
+        auto rep = as.NewLabel();
+        auto loop = as.NewLabel();
+        as.Li(s0, int32_t(reps));
+        as.Li(s1, 0);
+        as.Bind(rep);
+        as.Li(t0, convX);
+        as.Li(t6, convX + 4 * (convLen - 3));
+        as.Li(t5, convY + 4);
+        as.Bind(loop);
+        as.Lw(t1, t0, 0);
+        as.Lw(t2, t0, 4);
+        as.Lw(t3, t0, 8);
+        as.Lw(t4, t0, 12);
+        as.Slli(t2, t2, 1);
+        as.Add(t1, t1, t2);
+        as.Add(t1, t1, t3);
+        as.Srai(t4, t4, 2);
+        as.Sub(t1, t1, t4);
+        as.Sw(t1, t5, 0);
+        as.Add(s1, s1, t1);
+        as.Addi(t0, t0, 4);
+        as.Addi(t5, t5, 4);
+        as.Bne(t0, t6, loop);
+        as.Addi(s0, s0, -1);
+        as.Bne(s0, zero, rep);
+        StoreResult(as, s1);
+    }
+
+    inline Word ExpectedConv(unsigned reps)
+    {
+        auto x = ConvInput();
+        Word sum = 0;
+        for (Word i = 1; i < convLen - 2; ++i)
+            sum += Word(x[i - 1]) + (Word(x[i]) << 1u) + Word(x[i + 1]) - Word(x[i + 2] >> 2);
+        return sum * reps;
+    }
+}
+
+inline const std::vector<BenchKernel>& BenchKernels()
+{
+    static const std::vector<BenchKernel> kernels = {
+        {"lfsr",   16, bench::BuildLfsr,   bench::ExpectedLfsr},
+        {"crc32",  16, bench::BuildCrc,    bench::ExpectedCrc},
+        {"sort",   16, bench::BuildSort,   bench::ExpectedSort},
+        {"matmul", 32, bench::BuildMatmul, bench::ExpectedMatmul},
+        {"list",   128, bench::BuildList,  bench::ExpectedList},
+        {"conv",   96, bench::BuildConv,   bench::ExpectedConv},
+    };
+    return kernels;
+}
+
+struct BenchRun
+{
+    bool passed = false;
+    Word result = 0;
+    uint64_t instret = 0;
+    uint64_t cycles = 0;
+    double seconds = 0;
+    std::map<IType, uint64_t> mix;
+};
+
+inline void LoadKernel(const BenchKernel& kernel, Memory& mem, unsigned reps)
+{
+    Assembler as{benchCodeAddr};
+    kernel.build(as, mem, reps);
+    auto& code = as.Code();
+    std::memcpy(mem.HostPtr(benchCodeAddr, 4 * code.size()), code.data(), 4 * code.size());
+}
+
+inline const BenchKernel* FindKernel(const std::string& name)
+{
+    for (auto& kernel : BenchKernels())
+    {
+        if (name == kernel.name)
+            return &kernel;
+    }
+    return nullptr;
+}
+
+// Runs a kernel to completion on a fresh memory with the block engine
+inline BenchRun RunKernel(const BenchKernel& kernel, unsigned reps)
+{
+    Memory mem;
+    LoadKernel(kernel, mem, reps);
+
+    Cpu cpu{mem};
+    cpu.Reset(benchCodeAddr);
+
+    BenchRun run;
+    auto start = std::chrono::steady_clock::now();
+    while (true)
+    {
+        cpu.ProcessBlock();
+        if (cpu.GetMessage())
+            break;
+        if (cpu.GetFault())
+            return run;
+    }
+    run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    run.result = mem.Load<Word>(benchResultAddr);
+    run.passed = run.result == kernel.expected(reps);
+    run.instret = cpu.Instret();
+    run.cycles = cpu.Cycles();
+    run.mix = cpu.GetInstructionMix();
+    return run;
+}
+
+// Guest CPI of a kernel on the in-order timing model, driven by the reference engine
+inline double KernelCpi(const BenchKernel& kernel, unsigned reps)
+{
+    Memory mem;
+    LoadKernel(kernel, mem, reps);
+    Cpu cpu{mem};
+    cpu.Reset(benchCodeAddr);
+    TimingModel model;
+    while (!cpu.GetMessage() && !cpu.GetFault())
+        cpu.ProcessInstruction(model);
+    return model.Stats().Cpi();
+}
+
+// riscv_sim --bench: host MIPS, guest CPI and instruction mix per kernel.
+// Every kernel runs once to warm up and then `repeat` times; the median is reported.
+inline int RunBenchmarks(const std::vector<std::string>& names, unsigned scale, unsigned repeat)
+{
+    int failed = 0;
+    printf("%-8s %10s %6s %9s %8s %8s %6s %6s %6s %6s %6s\n",
+           "kernel", "instret", "CPI", "time,ms", "+-ms", "MIPS", "alu%", "ld%", "st%", "br%", "jmp%");
+    for (auto& kernel : BenchKernels())
+    {
+        if (!names.empty() && std::find(names.begin(), names.end(), kernel.name) == names.end())
+            continue;
+
+        unsigned reps = kernel.defaultReps * scale;
+        BenchRun run = RunKernel(kernel, reps);
+        std::vector<double> times;
+        for (unsigned i = 0; i < repeat && run.passed; ++i)
+        {
+            run = RunKernel(kernel, reps);
+            times.push_back(run.seconds);
+        }
+        if (!run.passed)
+        {
+            printf("%-8s FAILED: checksum 0x%08x, expected 0x%08x\n", kernel.name, run.result, kernel.expected(reps));
+            failed++;
+            continue;
+        }
+
+        std::sort(times.begin(), times.end());
+        double median = times[times.size() / 2];
+        double spread = (times.back() - times.front()) / 2;
+
+        auto share = [&](std::initializer_list<IType> types) {
+            uint64_t n = 0;
+            for (auto type : types)
+                n += run.mix[type];
+            return 100.0 * n / run.instret;
+        };
+        printf("%-8s %10" PRIu64 " %6.2f %9.2f %8.2f %8.1f %6.1f %6.1f %6.1f %6.1f %6.1f\n",
+               kernel.name, run.instret, KernelCpi(kernel, reps),
+               median * 1e3, spread * 1e3, run.instret / median / 1e6,
+               share({IType::Alu, IType::Auipc}), share({IType::Ld}), share({IType::St}),
+               share({IType::Br}), share({IType::J, IType::Jr}));
+    }
+    return failed;
+}
+
+// riscv_sim --ooo: IPC of the kernels on out-of-order cores of each width, driven
+// by the reference engine. Stall columns are shares of all commit slots.
+// pipelined runs the model on a second thread behind the functional cpu.
+inline int RunScaling(const std::vector<std::string>& names, const std::vector<unsigned>& widths, unsigned scale,
+                      bool pipelined = false)
+{
+    int failed = 0;
+    printf("%-8s %5s %4s %6s", "kernel", "width", "rob", "IPC");
+    for (size_t i = 0; i < size_t(Stall::Count); ++i)
+        printf(" %9s", StallName(Stall(i)));
+    printf(" %7s\n", "MIPS");
+
+    for (auto& kernel : BenchKernels())
+    {
+        if (!names.empty() && std::find(names.begin(), names.end(), kernel.name) == names.end())
+            continue;
+
+        // Detailed simulation is much slower than the block engine
+        unsigned reps = std::max(1u, kernel.defaultReps / 8) * scale;
+        for (unsigned width : widths)
+        {
+            OooConfig config = OooConfigForWidth(width);
+            OooModel model{config};
+            Memory mem;
+            LoadKernel(kernel, mem, reps);
+            Cpu cpu{mem};
+            cpu.Reset(benchCodeAddr);
+            auto start = std::chrono::steady_clock::now();
+            if (pipelined)
+            {
+                PipelinedModel<OooModel> pipe{model};
+                while (!cpu.GetMessage() && !cpu.GetFault())
+                    cpu.ProcessInstruction(pipe);
+            }
+            else
+            {
+                while (!cpu.GetMessage() && !cpu.GetFault())
+                    cpu.ProcessInstruction(model);
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            Word result = mem.Load<Word>(benchResultAddr);
+            if (result != kernel.expected(reps))
+            {
+                printf("%-8s FAILED: checksum 0x%08x, expected 0x%08x\n", kernel.name, result, kernel.expected(reps));
+                failed++;
+                break;
+            }
+
+            auto& stats = model.Stats();
+            printf("%-8s %5u %4u %6.2f", kernel.name, width, config.robSize, stats.Ipc());
+            for (size_t i = 0; i < size_t(Stall::Count); ++i)
+                printf(" %8.1f%%", 100.0 * stats.StallShare(Stall(i)));
+            printf(" %7.2f\n", stats.instructions / seconds / 1e6);
+        }
+    }
+    return failed;
+}
+
+// riscv_sim --check --bench: the kernels on the block engine, checked against the
+// reference engine at every block
+inline int CheckKernels(const std::vector<std::string>& names, unsigned scale)
+{
+    int failed = 0;
+    printf("%-8s %10s %8s %8s\n", "kernel", "instret", "blocks", "MIPS");
+    for (auto& kernel : BenchKernels())
+    {
+        if (!names.empty() && std::find(names.begin(), names.end(), kernel.name) == names.end())
+            continue;
+
+        unsigned reps = kernel.defaultReps * scale;
+        Memory mem;
+        LoadKernel(kernel, mem, reps);
+        Cpu cpu{mem};
+        cpu.Reset(benchCodeAddr);
+        LockstepChecker checker;
+        LoadKernel(kernel, checker.RefMemory(), reps);
+
+        auto start = std::chrono::steady_clock::now();
+        bool agree;
+        do
+        {
+            agree = checker.Step(cpu);
+        } while (agree && !cpu.GetMessage() && !cpu.GetFault());
+        agree = agree && checker.Finish(cpu);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        auto& stats = checker.Stats();
+        Word result = mem.Load<Word>(benchResultAddr);
+        if (!agree)
+            printf("%-8s DIVERGED\n%s", kernel.name, checker.Report().c_str());
+        else if (result != kernel.expected(reps))
+            printf("%-8s FAILED: checksum 0x%08x, expected 0x%08x\n", kernel.name, result, kernel.expected(reps));
+        else
+            printf("%-8s %10" PRIu64 " %8" PRIu64 " %8.1f\n", kernel.name, stats.instructions, stats.blocks,
+                   stats.instructions / seconds / 1e6);
+        failed += !agree || result != kernel.expected(reps);
+    }
+    return failed;
+}
+
+#endif //RISCV_SIM_BENCHMARKS_H
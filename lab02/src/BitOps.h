@@ -0,0 +1,92 @@
+
+#ifndef RISCV_SIM_BITOPS_H
+#define RISCV_SIM_BITOPS_H
+
+#include "Instruction.h"
+
+#if defined(__LZCNT__) || defined(__BMI__) || defined(__POPCNT__)
+#include <immintrin.h>
+#endif
+
+// Zba and Zbb on single host instructions. The host features are picked at
+// compile time: lzcnt, tzcnt and popcnt when the target has them (see
+// RISCV_SIM_NATIVE in CMakeLists.txt), portable builtins otherwise.
+// Rotates, byte swaps and min/max compile to one instruction anyway.
+namespace bitops
+{
+    inline Word Clz(Word x)
+    {
+#if defined(__LZCNT__)
+        return _lzcnt_u32(x);
+#else
+        return x ? __builtin_clz(x) : 32;
+#endif
+    }
+
+    inline Word Ctz(Word x)
+    {
+#if defined(__BMI__)
+        return _tzcnt_u32(x);
+#else
+        return x ? __builtin_ctz(x) : 32;
+#endif
+    }
+
+    inline Word Cpop(Word x)
+    {
+#if defined(__POPCNT__)
+        return _mm_popcnt_u32(x);
+#else
+        return __builtin_popcount(x);
+#endif
+    }
+
+    inline Word Rol(Word x, Word s)
+    {
+        return (x << (s & 31)) | (x >> (-s & 31));
+    }
+
+    inline Word Ror(Word x, Word s)
+    {
+        return (x >> (s & 31)) | (x << (-s & 31));
+    }
+
+    // Every non-zero byte becomes 0xff
+    inline Word OrcB(Word x)
+    {
+        Word low = 0x7f7f7f7fu;
+        Word y = ((x & low) + low) | x;
+        return ((y & ~low) >> 7) * 0xff;
+    }
+
+    // b is rs2 or the immediate and is ignored by the unary operations
+    inline Word Execute(AluFunc func, Word a, Word b)
+    {
+        switch (func)
+        {
+            case AluFunc::Andn:   return a & ~b;
+            case AluFunc::Orn:    return a | ~b;
+            case AluFunc::Xnor:   return ~(a ^ b);
+            case AluFunc::Min:    return SignedWord(a) < SignedWord(b) ? a : b;
+            case AluFunc::Max:    return SignedWord(a) < SignedWord(b) ? b : a;
+            case AluFunc::Minu:   return a < b ? a : b;
+            case AluFunc::Maxu:   return a < b ? b : a;
+            case AluFunc::Rol:    return Rol(a, b);
+            case AluFunc::Ror:    return Ror(a, b);
+            case AluFunc::Clz:    return Clz(a);
+            case AluFunc::Ctz:    return Ctz(a);
+            case AluFunc::Cpop:   return Cpop(a);
+            case AluFunc::SextB:  return SignedWord(int8_t(a));
+            case AluFunc::SextH:  return SignedWord(int16_t(a));
+            case AluFunc::ZextH:  return a & 0xffffu;
+            case AluFunc::OrcB:   return OrcB(a);
+            case AluFunc::Rev8:   return __builtin_bswap32(a);
+            case AluFunc::Sh1add: return (a << 1) + b;
+            case AluFunc::Sh2add: return (a << 2) + b;
+            case AluFunc::Sh3add: return (a << 3) + b;
+            default:              return a;
+        }
+    }
+}
+
+#endif //RISCV_SIM_BITOPS_H
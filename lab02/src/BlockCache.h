@@ -0,0 +1,191 @@
+
+#ifndef RISCV_SIM_BLOCKCACHE_H
+#define RISCV_SIM_BLOCKCACHE_H
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "Instruction.h"
+
+struct Block;
+
+// Inline cache of an indirect jump (jalr) call site.
+// The last seen target is checked first (monomorphic case), then a small
+// table of older targets filled round-robin (polymorphic case).
+struct IndirectTargetCache
+{
+    static constexpr size_t polySize = 4;
+
+    Block* Lookup(Word target) const;
+
+    void Insert(Word target, Block* block)
+    {
+        if (_mono)
+        {
+            _poly[_polyNext] = {_monoIp, _mono};
+            _polyNext = (_polyNext + 1) % polySize;
+        }
+        _monoIp = target;
+        _mono = block;
+    }
+
+    void Reset()
+    {
+        _mono = nullptr;
+        _poly.fill({0, nullptr});
+        _polyNext = 0;
+    }
+
+    Word _monoIp = 0;
+    Block* _mono = nullptr;
+    std::array<std::pair<Word, Block*>, polySize> _poly{};
+    size_t _polyNext = 0;
+};
+
+// Straight-line run of predecoded instructions ending with a control transfer,
+// a host message (CSR write or ecall), a fence or an instruction the simulator does not support.
+struct Block
+{
+    static constexpr size_t maxLength = 64;
+
+    Word _ip;
+    std::vector<InstructionPtr> _instrs;
+    uint64_t _execCount = 0;
+
+    // Chained successors of a conditional branch or a direct jump
+    Block* _taken = nullptr;
+    Block* _fallThrough = nullptr;
+
+    // Successors of the jalr ending this block
+    IndirectTargetCache _jrCache;
+
+    const Instruction& Last() const { return *_instrs.back(); }
+    Word EndIp() const { return _ip + 4 * _instrs.size(); }
+};
+
+inline Block* IndirectTargetCache::Lookup(Word target) const
+{
+    if (_mono && _monoIp == target)
+        return _mono;
+    for (auto& [ip, block] : _poly)
+    {
+        if (block && ip == target)
+            return block;
+    }
+    return nullptr;
+}
+
+// Shadow return address stack: calls push the block that follows the call,
+// returns pop it and jump there directly if the target matches.
+class ReturnAddressStack
+{
+public:
+    static constexpr size_t size = 16;
+
+    void Push(Block* caller)
+    {
+        _top = (_top + 1) % size;
+        _entries[_top] = caller;
+    }
+
+    Block* Pop()
+    {
+        Block* caller = _entries[_top];
+        _entries[_top] = nullptr;
+        _top = (_top + size - 1) % size;
+        return caller;
+    }
+
+    void Reset()
+    {
+        _entries.fill(nullptr);
+        _top = 0;
+    }
+
+private:
+    std::array<Block*, size> _entries{};
+    size_t _top = 0;
+};
+
+struct BlockCacheStats
+{
+    uint64_t blocks = 0;     // blocks executed
+    uint64_t lookups = 0;    // full lookups in the block map
+    uint64_t chained = 0;    // direct successors taken from the chain links
+    uint64_t jrHits = 0;     // jalr targets found in the inline cache
+    uint64_t rasHits = 0;    // returns predicted by the shadow stack
+    uint64_t dropped = 0;    // blocks dropped because their code was stored to
+};
+
+class BlockCache
+{
+public:
+    Block* Find(Word ip)
+    {
+        auto it = _blocks.find(ip);
+        return it == _blocks.end() ? nullptr : it->second.get();
+    }
+
+    Block* Insert(std::unique_ptr<Block> block)
+    {
+        Block* ret = block.get();
+        _blocks[block->_ip] = std::move(block);
+        return ret;
+    }
+
+    void Flush()
+    {
+        _blocks.clear();
+    }
+
+    // Drops the blocks overlapping [begin, end) and the chain links into them;
+    // returns how many were dropped
+    size_t Invalidate(Word begin, Word end)
+    {
+        auto stale = [&](const Block* block) { return block && block->_ip < end && block->EndIp() > begin; };
+        for (auto& [ip, block] : _blocks)
+        {
+            if (stale(block->_taken))
+                block->_taken = nullptr;
+            if (stale(block->_fallThrough))
+                block->_fallThrough = nullptr;
+            auto& jr = block->_jrCache;
+            if (stale(jr._mono) || std::any_of(jr._poly.begin(), jr._poly.end(), [&](auto& e) { return stale(e.second); }))
+                jr.Reset();
+        }
+        size_t dropped = 0;
+        for (auto it = _blocks.begin(); it != _blocks.end();)
+        {
+            if (stale(it->second.get()))
+            {
+                it = _blocks.erase(it);
+                dropped++;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        return dropped;
+    }
+
+    size_t Size() const
+    {
+        return _blocks.size();
+    }
+
+    template <typename Func>
+    void ForEach(Func func) const
+    {
+        for (auto& [ip, block] : _blocks)
+            func(*block);
+    }
+
+private:
+    std::unordered_map<Word, std::unique_ptr<Block>> _blocks;
+};
+
+#endif //RISCV_SIM_BLOCKCACHE_H
@@ -0,0 +1,111 @@
+
+#ifndef RISCV_SIM_CLINT_H
+#define RISCV_SIM_CLINT_H
+
+#include <functional>
+
+#include "CsrFile.h"
+#include "DeviceBus.h"
+#include "Scheduler.h"
+
+// Core local interruptor with the SiFive register layout: msip, mtimecmp and
+// mtime. mtime counts cycles and is read-only. Instead of comparing mtime on
+// every tick the timer schedules one event at mtimecmp and raises MTIP when it fires.
+class Clint : public Device
+{
+public:
+    static constexpr Word base = 0x02000000;
+    static constexpr Word size = 0x10000;
+
+    static constexpr Word msipOffset     = 0x0000;
+    static constexpr Word mtimecmpOffset = 0x4000;
+    static constexpr Word mtimeOffset    = 0xbff8;
+
+    using TimeSource = std::function<uint64_t()>;
+    using InterruptLine = std::function<void(Word bits, bool set)>;
+
+    Clint(Scheduler& scheduler, TimeSource time, InterruptLine irq)
+        : _scheduler(scheduler)
+        , _time(std::move(time))
+        , _irq(std::move(irq))
+    {
+
+    }
+
+    Word Read(Word offset, unsigned size) override
+    {
+        Word val = Register(offset & ~3u) >> (8 * (offset & 3u));
+        return size == 4 ? val : val & ((1u << (8 * size)) - 1);
+    }
+
+    void Write(Word offset, Word data, unsigned size) override
+    {
+        Word reg = offset & ~3u;
+        Word shift = 8 * (offset & 3u);
+        Word mask = size == 4 ? ~0u : ((1u << (8 * size)) - 1) << shift;
+        Word val = (Register(reg) & ~mask) | ((data << shift) & mask);
+
+        if (reg == msipOffset)
+        {
+            _msip = val & 1u;
+            _irq(CsrFile::mipMSIP, _msip);
+        }
+        else if (reg == mtimecmpOffset || reg == mtimecmpOffset + 4)
+        {
+            uint64_t cmp = reg == mtimecmpOffset
+                         ? (_mtimecmp & ~uint64_t(0xffffffff)) | val
+                         : (_mtimecmp & 0xffffffff) | uint64_t(val) << 32;
+            SetTimeCmp(cmp);
+        }
+    }
+
+    uint64_t TimeCmp() const
+    {
+        return _mtimecmp;
+    }
+
+private:
+    Word Register(Word reg)
+    {
+        switch (reg)
+        {
+            case msipOffset:         return _msip;
+            case mtimecmpOffset:     return Word(_mtimecmp);
+            case mtimecmpOffset + 4: return Word(_mtimecmp >> 32);
+            case mtimeOffset:        return Word(_time());
+            case mtimeOffset + 4:    return Word(_time() >> 32);
+            default:                 return 0;
+        }
+    }
+
+    // MTIP follows mtime >= mtimecmp, so a new compare value may clear it
+    void SetTimeCmp(uint64_t cmp)
+    {
+        _mtimecmp = cmp;
+        if (_armed)
+            _scheduler.Cancel(_event);
+        _armed = false;
+
+        bool expired = _time() >= cmp;
+        _irq(CsrFile::mipMTIP, expired);
+        if (expired)
+            return;
+
+        _armed = true;
+        _event = _scheduler.Schedule(cmp, [this] {
+            _armed = false;
+            _irq(CsrFile::mipMTIP, true);
+        });
+    }
+
+    Scheduler& _scheduler;
+    TimeSource _time;
+    InterruptLine _irq;
+
+    Word _msip = 0;
+    uint64_t _mtimecmp = ~uint64_t(0);
+    bool _armed = false;
+    Scheduler::EventId _event = 0;
+};
+
+#endif //RISCV_SIM_CLINT_H
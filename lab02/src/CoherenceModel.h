@@ -0,0 +1,263 @@
+
+#ifndef RISCV_SIM_COHERENCEMODEL_H
+#define RISCV_SIM_COHERENCEMODEL_H
+
+#include <vector>
+
+#include "Instruction.h"
+#include "Memory.h"
+#include "TimingModel.h"
+
+enum class CoherenceProtocol
+{
+    Msi,
+    Mesi,
+};
+
+enum class LineState : uint8_t
+{
+    I,
+    S,
+    E,
+    M,
+};
+
+struct CoherenceStats
+{
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    uint64_t misses = 0;            // all misses, including coherence misses
+    uint64_t trueSharing = 0;       // coherence misses on a word another hart wrote
+    uint64_t falseSharing = 0;      // coherence misses on a line another hart wrote elsewhere
+    uint64_t upgrades = 0;          // S -> M bus upgrades
+    uint64_t invalidations = 0;     // lines of this hart invalidated by other harts
+    uint64_t writebacks = 0;        // dirty lines written back on eviction or downgrade
+    uint64_t interventions = 0;     // misses of other harts served from this cache
+
+    uint64_t CoherenceMisses() const
+    {
+        return trueSharing + falseSharing;
+    }
+};
+
+// Private per-hart L1 data caches kept coherent by a snooping MSI or MESI
+// protocol on a shared bus. Only states and tags are kept, data lives in the
+// guest memory. An invalidated line keeps its tag, so a later miss on it is
+// told apart as a coherence miss; the words other harts wrote since then tell
+// true from false sharing.
+class CoherenceModel
+{
+public:
+    CoherenceModel(unsigned harts, CoherenceProtocol protocol, const CacheConfig& config = {})
+        : _protocol(protocol)
+        , _config(config)
+        , _caches(harts, std::vector<Line>(config.sets * config.ways))
+        , _stats(harts)
+    {
+
+    }
+
+    // Data access of one hart, line by line for accesses straddling a line boundary
+    void Access(unsigned hart, Word addr, unsigned size, bool write)
+    {
+        Word last = addr + size - 1;
+        for (Word line = addr / _config.lineBytes; line <= last / _config.lineBytes; ++line)
+        {
+            Word offset = line == addr / _config.lineBytes ? addr % _config.lineBytes : 0;
+            AccessLine(hart, line, offset / 4, write);
+            if (write)
+                NoteRemoteWrite(hart, line, 1u << (offset / 4 % 32));
+        }
+        (write ? _stats[hart].writes : _stats[hart].reads)++;
+    }
+
+    // Timing observer of a hart's retired instructions; atomics other than LR take the line for writing
+    void operator()(unsigned hart, const Instruction& instr)
+    {
+        if ((instr._type == IType::Ld || instr._type == IType::St) && instr._addr < Memory::ramBytes)
+            Access(hart, instr._addr, AccessSize(instr._memFunc), instr._type == IType::St);
+        else if (instr._type == IType::Amo && instr._addr < Memory::ramBytes)
+            Access(hart, instr._addr, 4, instr._amoFunc != AmoFunc::Lr);
+    }
+
+    LineState State(unsigned hart, Word addr) const
+    {
+        Word line = addr / _config.lineBytes;
+        const Line* set = Set(hart, line);
+        for (unsigned w = 0; w < _config.ways; ++w)
+        {
+            if (set[w].tag == line && set[w].state != LineState::I)
+                return set[w].state;
+        }
+        return LineState::I;
+    }
+
+    const CoherenceStats& Stats(unsigned hart) const
+    {
+        return _stats[hart];
+    }
+
+    uint64_t BusTransactions() const
+    {
+        return _busTransactions;
+    }
+
+private:
+    struct Line
+    {
+        Word tag = 0;
+        LineState state = LineState::I;
+        bool present = false;       // tag is meaningful, possibly invalidated
+        bool invalidated = false;   // lost to another hart's write
+        uint32_t remoteWrites = 0;  // words written by other harts since the invalidation
+        uint64_t lastUse = 0;
+    };
+
+    Line* Set(unsigned hart, Word line)
+    {
+        return &_caches[hart][(line % _config.sets) * _config.ways];
+    }
+
+    const Line* Set(unsigned hart, Word line) const
+    {
+        return &_caches[hart][(line % _config.sets) * _config.ways];
+    }
+
+    Line* Find(unsigned hart, Word line)
+    {
+        Line* set = Set(hart, line);
+        for (unsigned w = 0; w < _config.ways; ++w)
+        {
+            if (set[w].present && set[w].tag == line)
+                return &set[w];
+        }
+        return nullptr;
+    }
+
+    void AccessLine(unsigned hart, Word line, unsigned word, bool write)
+    {
+        CoherenceStats& stats = _stats[hart];
+        uint32_t wordBit = 1u << (word % 32);
+        Line* l = Find(hart, line);
+
+        if (l && l->state != LineState::I)
+        {
+            l->lastUse = ++_clock;
+            if (!write || l->state == LineState::M)
+                return;
+            if (l->state == LineState::E)
+            {
+                l->state = LineState::M;    // silent upgrade
+                return;
+            }
+            // S -> M
+            stats.upgrades++;
+            _busTransactions++;
+            Invalidate(hart, line);
+            l->state = LineState::M;
+            return;
+        }
+
+        stats.misses++;
+        if (l && l->invalidated)
+            (l->remoteWrites & wordBit ? stats.trueSharing : stats.falseSharing)++;
+        if (!l)
+            l = Allocate(hart, line);
+
+        _busTransactions++;
+        bool shared = Snoop(hart, line, write);
+        *l = {line, write ? LineState::M : shared || _protocol == CoherenceProtocol::Msi ? LineState::S : LineState::E,
+              true, false, 0, ++_clock};
+    }
+
+    // Bus read (write = false) or read for ownership; returns whether another cache keeps a copy
+    bool Snoop(unsigned hart, Word line, bool write)
+    {
+        bool shared = false;
+        for (unsigned other = 0; other < _caches.size(); ++other)
+        {
+            if (other == hart)
+                continue;
+            Line* l = Find(other, line);
+            if (!l || l->state == LineState::I)
+                continue;
+
+            if (l->state == LineState::M || l->state == LineState::E)
+                _stats[other].interventions++;
+            if (l->state == LineState::M)
+                _stats[other].writebacks++;
+
+            if (write)
+            {
+                InvalidateLine(other, *l);
+            }
+            else
+            {
+                l->state = LineState::S;
+                shared = true;
+            }
+        }
+        return shared;
+    }
+
+    void Invalidate(unsigned hart, Word line)
+    {
+        for (unsigned other = 0; other < _caches.size(); ++other)
+        {
+            Line* l = other == hart ? nullptr : Find(other, line);
+            if (l && l->state != LineState::I)
+                InvalidateLine(other, *l);
+        }
+    }
+
+    void InvalidateLine(unsigned hart, Line& l)
+    {
+        _stats[hart].invalidations++;
+        l.state = LineState::I;
+        l.invalidated = true;
+        l.remoteWrites = 0;
+    }
+
+    // Other harts holding the line invalidated remember which words changed
+    void NoteRemoteWrite(unsigned hart, Word line, uint32_t wordBit)
+    {
+        for (unsigned other = 0; other < _caches.size(); ++other)
+        {
+            Line* l = other == hart ? nullptr : Find(other, line);
+            if (l && l->invalidated)
+                l->remoteWrites |= wordBit;
+        }
+    }
+
+    // An invalid way if there is one, the least recently used otherwise; a dirty victim is written back
+    Line* Allocate(unsigned hart, Word line)
+    {
+        Line* set = Set(hart, line);
+        Line* victim = set;
+        for (unsigned w = 0; w < _config.ways; ++w)
+        {
+            if (set[w].state == LineState::I)
+            {
+                victim = &set[w];
+                break;
+            }
+            if (set[w].lastUse < victim->lastUse)
+                victim = &set[w];
+        }
+        if (victim->state == LineState::M)
+        {
+            _stats[hart].writebacks++;
+            _busTransactions++;
+        }
+        return victim;
+    }
+
+    CoherenceProtocol _protocol;
+    CacheConfig _config;
+    std::vector<std::vector<Line>> _caches;
+    std::vector<CoherenceStats> _stats;
+    uint64_t _clock = 0;
+    uint64_t _busTransactions = 0;
+};
+
+#endif //RISCV_SIM_COHERENCEMODEL_H
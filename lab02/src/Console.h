@@ -0,0 +1,169 @@
+
+#ifndef RISCV_SIM_CONSOLE_H
+#define RISCV_SIM_CONSOLE_H
+
+#include <mutex>
+#include <string>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <utility>
+
+#include "Memory.h"
+
+// Header of the console ring the guest keeps in its own memory and registers
+// by writing its address to the mconsole CSR. The guest appends bytes at
+// data[head % size] and advances head; the host consumes up to head and
+// advances tail. The guest requests a drain with a ConsoleFlush message
+// when the ring is full (head - tail == size) or the output must be seen.
+struct ConsoleRing
+{
+    Word head;
+    Word tail;
+    Word size; // a power of two, data[size] follows the header
+};
+
+// Host side of guest output. Both the ring and the old per-character mtohost
+// messages are buffered and written out with a single writev(2) per flush.
+// Harts on other host threads may flush their own rings (write(2) to stdout).
+class Console
+{
+public:
+    explicit Console(Memory& mem, int fd = STDERR_FILENO)
+        : _mem(mem)
+        , _fd(fd)
+    {
+
+    }
+
+    // mtohost PrintChar; ring contents written before it keep their order
+    void PutChar(char c, Word ringAddr)
+    {
+        std::lock_guard<std::mutex> lock{_lock};
+        Put(c, ringAddr);
+    }
+
+    // mtohost PrintIntLow/PrintIntHigh pair
+    void PutInt(int32_t val, Word ringAddr)
+    {
+        std::lock_guard<std::mutex> lock{_lock};
+        for (char c : std::to_string(val))
+            Put(c, ringAddr);
+    }
+
+    void Flush(Word ringAddr)
+    {
+        std::lock_guard<std::mutex> lock{_lock};
+        WriteOut(ringAddr);
+    }
+
+private:
+    static constexpr size_t bufLimit = 4096;
+
+    void Put(char c, Word ringAddr)
+    {
+        if (!RingData(ringAddr).empty())
+            DrainRing(ringAddr);
+        _buf.push_back(c);
+        if (_buf.size() >= bufLimit)
+            WriteOut(ringAddr);
+    }
+
+    void WriteOut(Word ringAddr)
+    {
+        iovec iov[3];
+        int cnt = 0;
+        if (!_buf.empty())
+            iov[cnt++] = {_buf.data(), _buf.size()};
+
+        ConsoleRing* ring = Ring(ringAddr);
+        Word head = ring ? ring->head : 0;
+        for (auto& part : RingData(ringAddr))
+            iov[cnt++] = part;
+
+        WriteAll(iov, cnt);
+
+        _buf.clear();
+        if (ring)
+            ring->tail = head;
+    }
+
+    struct RingParts
+    {
+        iovec parts[2];
+        int cnt = 0;
+
+        bool empty() const { return cnt == 0; }
+        const iovec* begin() const { return parts; }
+        const iovec* end() const { return parts + cnt; }
+    };
+
+    ConsoleRing* Ring(Word ringAddr)
+    {
+        if (ringAddr == 0)
+            return nullptr;
+        auto ring = reinterpret_cast<ConsoleRing*>(_mem.HostPtr(ringAddr, sizeof(ConsoleRing)));
+        if (!ring || ring->size == 0 || (ring->size & (ring->size - 1)) != 0 ||
+            !std::as_const(_mem).HostPtr(ringAddr + sizeof(ConsoleRing), ring->size))
+            return nullptr;
+        return ring;
+    }
+
+    // Unconsumed bytes of the ring, in at most two pieces because of the wrap-around
+    RingParts RingData(Word ringAddr)
+    {
+        RingParts ret;
+        ConsoleRing* ring = Ring(ringAddr);
+        if (!ring)
+            return ret;
+
+        Word used = std::min(ring->head - ring->tail, ring->size);
+        Word start = (ring->head - used) & (ring->size - 1);
+        char* data = reinterpret_cast<char*>(ring + 1);
+        Word first = std::min(used, ring->size - start);
+        if (first)
+            ret.parts[ret.cnt++] = {data + start, first};
+        if (used > first)
+            ret.parts[ret.cnt++] = {data, used - first};
+        return ret;
+    }
+
+    void DrainRing(Word ringAddr)
+    {
+        ConsoleRing* ring = Ring(ringAddr);
+        for (auto& part : RingData(ringAddr))
+            _buf.append(static_cast<char*>(part.iov_base), part.iov_len);
+        ring->tail = ring->head;
+    }
+
+    void WriteAll(iovec* iov, int cnt)
+    {
+        while (cnt > 0)
+        {
+            ssize_t n = writev(_fd, iov, cnt);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+            while (cnt > 0 && size_t(n) >= iov->iov_len)
+            {
+                n -= iov->iov_len;
+                iov++;
+                cnt--;
+            }
+            if (cnt > 0)
+            {
+                iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+                iov->iov_len -= n;
+            }
+        }
+    }
+
+    Memory& _mem;
+    int _fd;
+    std::string _buf;
+    std::mutex _lock;
+};
+
+#endif //RISCV_SIM_CONSOLE_H
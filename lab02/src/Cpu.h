@@ -7,39 +7,172 @@
 #include "RegisterFile.h"
 #include "CsrFile.h"
 #include "Executor.h"
+#include "BlockCache.h"
+#include "SyscallProxy.h"
+#include "Console.h"
+#include "DeviceBus.h"
+#include "Scheduler.h"
+#include "FpUnit.h"
+#include "VectorUnit.h"
+#include "TimingModel.h"
+#include "AccessProfiler.h"
+
+#include <map>
 
 class Cpu
 {
 public:
-    Cpu(Memory& mem)
+    // Harts sharing a Memory tell themselves apart by mhartid
+    explicit Cpu(Memory& mem, Word hartId = 0)
         : _mem(mem)
+        , _syscalls(mem)
+        , _hartId(hartId)
     {
 
     }
 
+    // Reference engine: fetch, decode and execute a single instruction
     void ProcessInstruction()
+    {
+        ProcessInstruction([](Word, const Instruction&) {});
+    }
+
+    // Same, and then hands the retired instruction and its ip to a timing model
+    template <typename Observer>
+    void ProcessInstruction(Observer&& observe)
     {
         /* YOUR CODE HERE */
+        _nextBlock = nullptr;
         Word ip = _mem.Request(_ip);
+        if (Memory::Faulted())
+        {
+            RaiseFault();
+            return;
+        }
         InstructionPtr instr = _decoder.Decode(ip);
 
-        _rf.Read(instr);
-        _csrf.Read(instr);
+        Word instrIp = _ip;
+        if (Execute(instr))
+        {
+            _ip = instr->_nextIp;
+            if (_csrf.CountingEvents())
+                CountEvents(*instr, instrIp);
+            if (_profiler)
+                Profile(*instr);
+            observe(instrIp, *instr);
+            ServiceEvents();
+        }
+    }
 
-        _exe.Execute(instr, _ip); 
-        _mem.Request(instr);
+    // Under a timing model the hpm counters also see its misses, mispredicts and stalls
+    void ProcessInstruction(TimingModel& model)
+    {
+        auto observe = [&](Word ip, const Instruction& instr) { model(ip, instr); };
+        if (!_csrf.CountingEvents())
+        {
+            ProcessInstruction(observe);
+            return;
+        }
+        TimingStats before = model.Stats();
+        ProcessInstruction(observe);
+        const TimingStats& after = model.Stats();
+        _csrf.CountEvent(HpmEvent::ICacheMisses, after.icacheMisses - before.icacheMisses);
+        _csrf.CountEvent(HpmEvent::DCacheMisses, after.dcacheMisses - before.dcacheMisses);
+        _csrf.CountEvent(HpmEvent::Mispredicts, after.mispredicts - before.mispredicts);
+        _csrf.CountEvent(HpmEvent::LoadUseStalls, after.loadUseStalls - before.loadUseStalls);
+    }
 
-        _rf.Write(instr);
-        _csrf.Write(instr);
+    // Block engine: execute a whole predecoded block and chain to its successor
+    void ProcessBlock()
+    {
+        if (_fault)
+            return;
+        if (_codeEpoch != _mem.CodeEpoch())
+            DropStaleBlocks();
 
-        _csrf.InstructionExecuted();
-        _ip = instr->_nextIp;
+        Block* block = _nextBlock ? _nextBlock : LookupBlock(_ip);
+        if (!block)
+            return;
+
+        if (!(_csrf.CountingEvents() ? ExecuteCounting(*block) : Execute(*block)))
+        {
+            _nextBlock = nullptr;
+            return;
+        }
+        if (_profiler)
+            Profile(*block);
+
+        _blockStats.blocks++;
+        block->_execCount++;
+        _nextBlock = NextBlock(block);
+        if (ServiceEvents())
+            _nextBlock = nullptr;
+    }
+
+    // Devices outside of RAM and the scheduler of their events
+    void Attach(DeviceBus& bus, Scheduler& scheduler)
+    {
+        _bus = &bus;
+        _scheduler = &scheduler;
+    }
+
+    // No devices; accesses outside of RAM fault again
+    void Detach()
+    {
+        _bus = nullptr;
+        _scheduler = nullptr;
+    }
+
+    // Data accesses of retired instructions are fed to the profiler; nullptr detaches it
+    void AttachProfiler(AccessProfiler* profiler)
+    {
+        _profiler = profiler;
+    }
+
+    // Console output of the hart is written out before its write(2)s to stdout and stderr
+    void AttachConsole(Console& console)
+    {
+        _syscalls.SetOutputHook([this, &console] { console.Flush(ConsoleAddr()); });
+    }
+
+    // Host syscalls of the hart are recorded to or replayed from the log
+    void AttachLog(ReplayLog& log)
+    {
+        _syscalls.SetLog(&log, _hartId);
+    }
+
+    // The harts of one program share open files and the program break
+    void ShareProcess(const Cpu& other)
+    {
+        _syscalls.Share(other._syscalls);
+    }
+
+    // mip bits driven by devices
+    void SetInterruptPending(Word bits, bool set)
+    {
+        _csrf.SetPending(bits, set);
     }
 
     void Reset(Word ip)
     {
-        _csrf.Reset();
+        _csrf.Reset(_hartId);
+        _syscalls.Reset();
+        _fault.reset();
+        _exitCode.reset();
+        _reservation = {};
+        _fpu = {};
+        _vpu = {};
         _ip = ip;
+        _nextBlock = nullptr;
+        _ras.Reset();
+        _blocks.Flush();
+        _codeEpoch = _mem.CodeEpoch();
+    }
+
+    // VLEN of the vector unit, 128 or 256 bits; takes effect at the next vsetvl*
+    void SetVlen(Word bits)
+    {
+        _csrf.SetVlenb(bits >= 256 ? VectorUnit::maxVlenb : 16);
     }
 
     std::optional<CpuToHostData> GetMessage()
@@ -47,13 +180,381 @@ public:
         return _csrf.GetMessage();
     }
 
+    // Code passed to the exit syscall, if the guest called it
+    std::optional<Word> ExitCode() const
+    {
+        return _exitCode;
+    }
+
+    // Guest access fault that stopped the cpu, if any
+    const std::optional<MemoryFault>& GetFault() const
+    {
+        return _fault;
+    }
+
+    const BlockCacheStats& GetBlockStats() const
+    {
+        return _blockStats;
+    }
+
+    uint64_t Instret() const { return _csrf.Instret(); }
+    uint64_t Cycles() const { return _csrf.Cycles(); }
+    Word ConsoleAddr() const { return _csrf.ConsoleAddr(); }
+    Word HartId() const { return _hartId; }
+    Word Ip() const { return _ip; }
+    Word Reg(RId id) const { return _rf.Read(id); }
+    uint64_t FReg(RId id) const { return _fpu.Read(id); }
+    bool HasMessage() const { return _csrf.HasMessage(); }
+    bool InterruptsEnabled() const { return _csrf.InterruptsEnabled(); }
+
+    const Memory& GetMemory() const
+    {
+        return _mem;
+    }
+
+    // Block starting at ip if it was already translated
+    const Block* FindBlock(Word ip)
+    {
+        return _blocks.Find(ip);
+    }
+
+    template <typename Func>
+    void ForEachBlock(Func func) const
+    {
+        _blocks.ForEach(func);
+    }
+
+    // Dynamic count of each instruction type retired by the block engine
+    std::map<IType, uint64_t> GetInstructionMix() const
+    {
+        std::map<IType, uint64_t> mix;
+        _blocks.ForEach([&](const Block& block) {
+            for (auto& instr : block._instrs)
+                mix[instr->_type] += block._execCount;
+        });
+        return mix;
+    }
+
 private:
+    // Returns false if an instruction faulted; the ones before it retired
+    bool Execute(Block& block)
+    {
+        for (auto& instr : block._instrs)
+        {
+            if (!Execute(instr))
+                return false;
+            _ip = instr->_nextIp;
+        }
+        return true;
+    }
+
+    // Same, counting the events of each instruction as it retires, so that a
+    // csrr of a counter in the middle of the block sees the ones before it
+    __attribute__((noinline)) bool ExecuteCounting(Block& block)
+    {
+        for (auto& instr : block._instrs)
+        {
+            if (!Execute(instr))
+                return false;
+            CountEvents(*instr, _ip);
+            _ip = instr->_nextIp;
+        }
+        return true;
+    }
+
+    // Returns false if the instruction faulted and was not retired
+    bool Execute(InstructionPtr& instr)
+    {
+        _rf.Read(instr);
+        _csrf.Read(instr);
+
+        _exe.Execute(instr, _ip);
+        if (instr->_type == IType::Fp)
+            ExecuteFp(instr);
+        else if (instr->_type == IType::Vec)
+            ExecuteVec(instr);
+        else
+            _mem.Request(instr, &_reservation);
+        if (Memory::Faulted() && !DeviceAccess(instr))
+            return false;
+
+        _rf.Write(instr);
+        _csrf.Write(instr);
+        if (instr->_type == IType::Ecall)
+            HandleEcall();
+        else if (instr->_type == IType::Wfi)
+            WaitForInterrupt();
+
+        _csrf.InstructionExecuted();
+        return true;
+    }
+
+    void HandleEcall()
+    {
+        if (auto code = _syscalls.Handle(_rf, _csrf.Instret()))
+        {
+            // The message has 16 bits for the code; ExitCode() has all of it
+            _exitCode = *code;
+            CpuToHostData msg{};
+            msg.unpacked.type = CpuToHostType::ExitCode;
+            msg.unpacked.data = *code <= 0xffff ? *code : 0xffff;
+            _csrf.PostMessage(msg);
+        }
+    }
+
+    __attribute__((noinline)) void ExecuteFp(InstructionPtr& instr)
+    {
+        if (!_fpu.Execute(instr, _mem, _csrf) && instr->_dst)
+            instr->_data = _rf.Read(*instr->_dst);
+    }
+
+    __attribute__((noinline)) void ExecuteVec(InstructionPtr& instr)
+    {
+        if (!_vpu.Execute(instr, _mem, _csrf) && instr->_dst)
+            instr->_data = _rf.Read(*instr->_dst);
+    }
+
+    // Accesses of a whole block, once it retired: every instruction still holds
+    // the address it accessed. A block cut short by a fault is not profiled.
+    __attribute__((noinline)) void Profile(const Block& block)
+    {
+        for (auto& instr : block._instrs)
+            Profile(*instr);
+    }
+
+    // Integer and FP loads, stores and AMOs; vector accesses are left out
+    __attribute__((noinline)) void Profile(const Instruction& instr)
+    {
+        bool fp = instr._type == IType::Fp;
+        if (instr._type == IType::Ld || (fp && instr._fpFunc == FpFunc::Load))
+            _profiler->Access(instr._addr, false);
+        else if (instr._type == IType::St || (fp && instr._fpFunc == FpFunc::Store))
+            _profiler->Access(instr._addr, true);
+        else if (instr._type == IType::Amo)
+            _profiler->Access(instr._addr, instr._amoFunc != AmoFunc::Lr);
+    }
+
+    // Functional events of a retired instruction for the hpm counters
+    __attribute__((noinline)) void CountEvents(const Instruction& instr, Word ip)
+    {
+        bool fp = instr._type == IType::Fp;
+        bool vec = instr._type == IType::Vec;
+        if (instr._type == IType::Ld || (fp && instr._fpFunc == FpFunc::Load) ||
+            (vec && (instr._vecFunc == VecFunc::Load || instr._vecFunc == VecFunc::LoadStrided)))
+            _csrf.CountEvent(HpmEvent::Loads);
+        else if (instr._type == IType::St || (fp && instr._fpFunc == FpFunc::Store) ||
+                 (vec && (instr._vecFunc == VecFunc::Store || instr._vecFunc == VecFunc::StoreStrided)))
+            _csrf.CountEvent(HpmEvent::Stores);
+        else if (instr._type == IType::Br)
+        {
+            _csrf.CountEvent(HpmEvent::Branches);
+            if (instr._nextIp != ip + 4)
+                _csrf.CountEvent(HpmEvent::TakenBranches);
+        }
+    }
+
+    // Nothing but a device event can wake the hart, so the idle cycles are skipped.
+    // Cold paths of Execute stay out of line to keep the block loop small.
+    __attribute__((noinline)) void WaitForInterrupt()
+    {
+        if (!_scheduler || _csrf.InterruptPending())
+            return;
+        uint64_t next = _scheduler->NextCheck();
+        if (next != Scheduler::never && next > _csrf.Cycles() + 1)
+            _csrf.SkipCycles(next - _csrf.Cycles() - 1);
+    }
+
+    // Device events and interrupts are only looked at between blocks.
+    // Returns true if the hart entered an interrupt handler.
+    bool ServiceEvents()
+    {
+        if (_scheduler && _csrf.Cycles() >= _scheduler->NextCheck())
+            _scheduler->Advance(_csrf.Cycles());
+        if (!_csrf.InterruptPending())
+            return false;
+        _ip = _csrf.TakeInterrupt(_ip);
+        return true;
+    }
+
+    // A load or store outside of RAM is either a device access or an access fault
+    __attribute__((noinline)) bool DeviceAccess(InstructionPtr& instr)
+    {
+        auto fault = _mem.TakeFault();
+        if (_bus && _bus->Access(instr))
+            return true;
+        _fault = fault;
+        if (_fault)
+            _fault->ip = _ip;
+        return false;
+    }
+
+    // Access faults are not trapped to the guest, they stop the cpu
+    void RaiseFault()
+    {
+        _fault = _mem.TakeFault();
+        if (_fault)
+            _fault->ip = _ip;
+    }
+
+    Block* LookupBlock(Word ip)
+    {
+        _blockStats.lookups++;
+        if (Block* block = _blocks.Find(ip))
+            return block;
+
+        auto block = std::make_unique<Block>();
+        block->_ip = ip;
+        while (block->_instrs.size() < Block::maxLength)
+        {
+            Word word = _mem.Request(ip);
+            if (Memory::Faulted())
+            {
+                // Fetch fault on the first instruction; otherwise stop the block before it
+                if (block->_instrs.empty())
+                {
+                    RaiseFault();
+                    return nullptr;
+                }
+                _mem.TakeFault();
+                break;
+            }
+            block->_instrs.push_back(_decoder.Decode(word));
+            if (EndsBlock(block->Last()))
+                break;
+            ip += 4;
+        }
+        _mem.MarkCode(block->_ip, block->EndIp());
+        return _blocks.Insert(std::move(block));
+    }
+
+    // Stores hit translated code since the last block. A store takes effect at the
+    // next block boundary, so a program writing the code of its own block needs a
+    // FENCE.I (which ends the block), as the ISA asks for anyway.
+    __attribute__((noinline)) void DropStaleBlocks()
+    {
+        uint64_t epoch = _mem.CodeEpoch();
+        for (; _codeEpoch < epoch; ++_codeEpoch)
+        {
+            auto write = _mem.CodeWriteAt(_codeEpoch);
+            if (!write)
+            {
+                // Too many to go through one by one
+                _blockStats.dropped += _blocks.Size();
+                _blocks.Flush();
+                break;
+            }
+            _blockStats.dropped += _blocks.Invalidate(write->begin, write->end);
+        }
+        _codeEpoch = epoch;
+        _nextBlock = nullptr;
+        _ras.Reset();
+    }
+
+    // Successor of a block whose execution just left the new ip in _ip
+    Block* NextBlock(Block* block)
+    {
+        const Instruction& last = block->Last();
+        bool isCall = (last._type == IType::J || last._type == IType::Jr) && IsLinkReg(last._dst);
+        Block* next = nullptr;
+
+        if (last._type == IType::Jr || last._type == IType::Mret)
+        {
+            // jalr rd, rs1 with rs1 = link is a return unless it links to itself (coroutine swap)
+            bool isReturn = last._type == IType::Jr && IsLinkReg(last._src1) &&
+                            !(isCall && last._dst == last._src1);
+            if (isReturn)
+            {
+                Block* caller = _ras.Pop();
+                if (caller && caller->EndIp() == _ip)
+                {
+                    _blockStats.rasHits++;
+                    next = Chain(caller->_fallThrough);
+                }
+            }
+            if (!next)
+            {
+                next = block->_jrCache.Lookup(_ip);
+                if (next)
+                {
+                    _blockStats.jrHits++;
+                }
+                else
+                {
+                    next = LookupBlock(_ip);
+                    if (next)
+                        block->_jrCache.Insert(_ip, next);
+                }
+            }
+        }
+        else if (_ip == block->EndIp())
+        {
+            next = Chain(block->_fallThrough);
+        }
+        else
+        {
+            next = Chain(block->_taken);
+        }
+
+        if (isCall)
+            _ras.Push(block);
+        return next;
+    }
+
+    Block* Chain(Block*& link)
+    {
+        if (link)
+            _blockStats.chained++;
+        else
+            link = LookupBlock(_ip);
+        return link;
+    }
+
+    static bool EndsBlock(const Instruction& instr)
+    {
+        switch (instr._type)
+        {
+            case IType::Br:
+            case IType::J:
+            case IType::Jr:
+            case IType::Csrw:
+            case IType::Ecall:
+            case IType::Mret:
+            case IType::Wfi:
+            case IType::Fence:
+            case IType::Unsupported:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    static bool IsLinkReg(const std::optional<RId>& reg)
+    {
+        return reg == RId(1) || reg == RId(5);
+    }
+
     Reg32 _ip;
     Decoder _decoder;
     RegisterFile _rf;
     CsrFile _csrf;
     Executor _exe;
     Memory& _mem;
+    std::optional<MemoryFault> _fault;
+    std::optional<Word> _exitCode;
+    SyscallProxy _syscalls;
+    Word _hartId;
+    Reservation _reservation;
+    FpUnit _fpu;
+    VectorUnit _vpu;
+    DeviceBus* _bus = nullptr;
+    Scheduler* _scheduler = nullptr;
+    AccessProfiler* _profiler = nullptr;
+
+    BlockCache _blocks;
+    Block* _nextBlock = nullptr;
+    uint64_t _codeEpoch = 0;
+    ReturnAddressStack _ras;
+    BlockCacheStats _blockStats;
 };
 
 
@@ -2,39 +2,133 @@
 #ifndef RISCV_SIM_CSRFILE_H
 #define RISCV_SIM_CSRFILE_H
 
+#include <array>
 #include <optional>
 #include "Instruction.h"
 
 class CsrFile
 {
 public:
-    void Reset()
+    void Reset(Word hartId = 0)
     {
         numInstr = 0;
         numCycles = 0;
-        coreId = 0;
+        coreId = hartId;
+        consoleAddr = 0;
+        mstatus = 0;
+        mie = 0;
+        mip = 0;
+        mtvec = 0;
+        mscratch = 0;
+        mepc = 0;
+        mcause = 0;
+        fcsr = 0;
+        vl = 0;
+        vtype = vtypeVill;
+        hpmCounter = {};
+        hpmEvent = {};
+        hpmSelected = 0;
+        irqPending = false;
         cpuToHostData.reset();
         startReg = true;
     }
     void Read(InstructionPtr& instr)
     {
-        if (!instr->_csr)
-            return;
-
-        switch (static_cast<CsrIdx>(instr->_csr.value()))
+        if (instr->_csr)
+            instr->_csrVal = Read(instr->_csr.value());
+    }
+    // Only csr instructions get here, so the switch stays out of line
+    __attribute__((noinline)) Word Read(CsrIdx csr) const
+    {
+        switch (csr)
         {
-            case CsrIdx::Instret: instr->_csrVal = numInstr; break;
-            case CsrIdx::Cycle  : instr->_csrVal = numCycles; break;
-            case CsrIdx::Mhartid: instr->_csrVal = coreId; break;
-            default: break;
+            case CsrIdx::Instret: return numInstr;
+            case CsrIdx::Cycle  : return numCycles;
+            case CsrIdx::Mhartid: return coreId;
+            case CsrIdx::Mconsole: return consoleAddr;
+            case CsrIdx::Mstatus: return mstatus;
+            case CsrIdx::Mie    : return mie;
+            case CsrIdx::Mip    : return mip;
+            case CsrIdx::Mtvec  : return mtvec;
+            case CsrIdx::Mscratch: return mscratch;
+            case CsrIdx::Mepc   : return mepc;
+            case CsrIdx::Mcause : return mcause;
+            case CsrIdx::Fflags : return fcsr & fcsrFlags;
+            case CsrIdx::Frm    : return fcsr >> 5;
+            case CsrIdx::Fcsr   : return fcsr;
+            case CsrIdx::Vl     : return vl;
+            case CsrIdx::Vtype  : return vtype;
+            case CsrIdx::Vlenb  : return vlenb;
+            case CsrIdx::Mcycle : return numCycles;
+            case CsrIdx::Minstret: return numInstr;
+            case CsrIdx::Cycleh :
+            case CsrIdx::Mcycleh: return numCycles >> 32;
+            case CsrIdx::Instreth:
+            case CsrIdx::Minstreth: return numInstr >> 32;
+            default: return ReadCounter(Word(csr));
         }
     }
     void Write(InstructionPtr& instr)
     {
-        if (instr->_type == IType::Csrw && instr->_csr.value_or(CsrIdx::None) == CsrIdx::Mtohost)
+        if (instr->_type == IType::Mret)
+        {
+            mstatus = (mstatus & mstatusMPIE ? mstatus | mstatusMIE : mstatus & ~mstatusMIE) | mstatusMPIE;
+            UpdatePending();
+            return;
+        }
+        if (instr->_type != IType::Csrw)
+            return;
+
+        auto csr = instr->_csr.value_or(CsrIdx::None);
+        if (csr == CsrIdx::Mtohost)
         {
             cpuToHostData = CpuToHostData{instr->_data};
         }
+        else if (csr == CsrIdx::Mconsole)
+        {
+            consoleAddr = instr->_data;
+        }
+        else if (csr == CsrIdx::Mstatus)
+        {
+            mstatus = instr->_data & (mstatusMIE | mstatusMPIE);
+        }
+        else if (csr == CsrIdx::Mie)
+        {
+            mie = instr->_data & (mipMSIP | mipMTIP);
+        }
+        else if (csr == CsrIdx::Mtvec)
+        {
+            mtvec = instr->_data;
+        }
+        else if (csr == CsrIdx::Mscratch)
+        {
+            mscratch = instr->_data;
+        }
+        else if (csr == CsrIdx::Mepc)
+        {
+            mepc = instr->_data & ~3u;
+        }
+        else if (csr == CsrIdx::Mcause)
+        {
+            mcause = instr->_data;
+        }
+        else if (csr == CsrIdx::Fflags)
+        {
+            fcsr = (fcsr & ~fcsrFlags) | (instr->_data & fcsrFlags);
+        }
+        else if (csr == CsrIdx::Frm)
+        {
+            fcsr = (fcsr & fcsrFlags) | ((instr->_data & 7u) << 5);
+        }
+        else if (csr == CsrIdx::Fcsr)
+        {
+            fcsr = instr->_data & 0xffu;
+        }
+        else
+        {
+            WriteCounter(Word(csr), instr->_data);
+        }
+        UpdatePending();
     }
     void InstructionExecuted()
     {
@@ -42,18 +136,195 @@ public:
         numCycles++;
     }
 
+    uint64_t Instret() const { return numInstr; }
+    uint64_t Cycles() const { return numCycles; }
+    Word ConsoleAddr() const { return consoleAddr; }
+
+    // Cycles spent idle in wfi
+    void SkipCycles(uint64_t cycles)
+    {
+        numCycles += cycles;
+    }
+
+    // Accrued floating point exception flags and the dynamic rounding mode
+    Word FpFlags() const
+    {
+        return fcsr & fcsrFlags;
+    }
+
+    void RaiseFpFlags(Word flags)
+    {
+        fcsr |= flags;
+    }
+
+    RoundingMode FpRounding() const
+    {
+        return static_cast<RoundingMode>(fcsr >> 5);
+    }
+
+    // Vector configuration of the last vsetvl*, and VLEN / 8 chosen by the host
+    Word VectorLength() const { return vl; }
+    Word VectorType() const { return vtype; }
+    Word Vlenb() const { return vlenb; }
+
+    void SetVectorConfig(Word length, Word type)
+    {
+        vl = length;
+        vtype = type;
+    }
+
+    void SetVlenb(Word bytes)
+    {
+        vlenb = bytes;
+        SetVectorConfig(0, vtypeVill);
+    }
+
+    // Adds n occurrences of an event to the hpm counters that select it
+    void CountEvent(HpmEvent event, uint64_t n = 1)
+    {
+        if (!(hpmSelected & (1u << Word(event))))
+            return;
+        for (size_t i = 0; i < hpmCounters; ++i)
+            if (hpmEvent[i] == event)
+                hpmCounter[i] += n;
+    }
+
+    // Some hpm counter selects an event
+    bool CountingEvents() const
+    {
+        return hpmSelected != 0;
+    }
+
+    // mip bits driven by devices
+    void SetPending(Word bits, bool set)
+    {
+        mip = set ? mip | bits : mip & ~bits;
+        UpdatePending();
+    }
+
+    // An enabled interrupt is pending and interrupts are on
+    bool InterruptPending() const
+    {
+        return irqPending;
+    }
+
+    // Interrupts are on and some are enabled, so one may come without a store
+    bool InterruptsEnabled() const
+    {
+        return (mstatus & mstatusMIE) && mie;
+    }
+
+    // Enters the handler of the highest priority pending interrupt, returns its address
+    Word TakeInterrupt(Word epc)
+    {
+        Word cause = (mip & mie & mipMSIP) ? causeMSI : causeMTI;
+        mcause = interruptBit | cause;
+        mepc = epc;
+        mstatus = (mstatus & mstatusMIE ? mstatus | mstatusMPIE : mstatus & ~mstatusMPIE) & ~mstatusMIE;
+        UpdatePending();
+        // Vectored mode jumps to base + 4 * cause
+        Word base = mtvec & ~3u;
+        return (mtvec & 3u) == 1 ? base + 4 * cause : base;
+    }
+
+    // Message from a source other than a write to mtohost, e.g. the syscall proxy
+    void PostMessage(CpuToHostData msg)
+    {
+        cpuToHostData = msg;
+    }
+
+    bool HasMessage() const
+    {
+        return cpuToHostData.has_value();
+    }
+
     std::optional<CpuToHostData> GetMessage()
     {
         std::optional<CpuToHostData> ret;
         cpuToHostData.swap(ret);
         return ret;
     }
+    static constexpr Word mstatusMIE  = 1u << 3;
+    static constexpr Word mstatusMPIE = 1u << 7;
+    static constexpr Word mipMSIP = 1u << 3;
+    static constexpr Word mipMTIP = 1u << 7;
+    static constexpr Word causeMSI = 3;
+    static constexpr Word causeMTI = 7;
+    static constexpr Word interruptBit = 0x80000000;
+    static constexpr Word fcsrFlags = 0x1f;
+    static constexpr Word vtypeVill = 0x80000000;
+    static constexpr size_t hpmCounters = 29;
 private:
-    Word numInstr = 0;
-    Word numCycles = 0;
+    void UpdatePending()
+    {
+        irqPending = (mstatus & mstatusMIE) && (mip & mie);
+    }
+
+    // Index of csr in the block of hpm CSRs starting at first, hpmCounters if outside
+    static size_t HpmIndex(Word csr, CsrIdx first)
+    {
+        Word i = csr - Word(first);
+        return i < hpmCounters ? i : hpmCounters;
+    }
+
+    // The hpm counters and their event selectors; any other CSR reads as zero
+    Word ReadCounter(Word csr) const
+    {
+        size_t i;
+        if ((i = HpmIndex(csr, CsrIdx::Mhpmcounter3)) < hpmCounters ||
+            (i = HpmIndex(csr, CsrIdx::Hpmcounter3)) < hpmCounters)
+            return Word(hpmCounter[i]);
+        if ((i = HpmIndex(csr, CsrIdx::Mhpmcounter3h)) < hpmCounters ||
+            (i = HpmIndex(csr, CsrIdx::Hpmcounter3h)) < hpmCounters)
+            return Word(hpmCounter[i] >> 32);
+        if ((i = HpmIndex(csr, CsrIdx::Mhpmevent3)) < hpmCounters)
+            return Word(hpmEvent[i]);
+        return 0;
+    }
+
+    // Unknown events select nothing; writes to other CSRs are ignored
+    __attribute__((noinline)) void WriteCounter(Word csr, Word value)
+    {
+        size_t i;
+        if ((i = HpmIndex(csr, CsrIdx::Mhpmcounter3)) < hpmCounters)
+        {
+            hpmCounter[i] = (hpmCounter[i] & ~uint64_t(0xffffffff)) | value;
+        }
+        else if ((i = HpmIndex(csr, CsrIdx::Mhpmcounter3h)) < hpmCounters)
+        {
+            hpmCounter[i] = (uint64_t(value) << 32) | Word(hpmCounter[i]);
+        }
+        else if ((i = HpmIndex(csr, CsrIdx::Mhpmevent3)) < hpmCounters)
+        {
+            hpmEvent[i] = value < Word(HpmEvent::Count) ? HpmEvent(value) : HpmEvent::None;
+            hpmSelected = 0;
+            for (HpmEvent event : hpmEvent)
+                if (event != HpmEvent::None)
+                    hpmSelected |= 1u << Word(event);
+        }
+    }
+
+    uint64_t numInstr = 0;
+    uint64_t numCycles = 0;
     Word coreId = 0;
+    Word consoleAddr = 0;
+    Word mstatus = 0;
+    Word mie = 0;
+    Word mip = 0;
+    Word mtvec = 0;
+    Word mscratch = 0;
+    Word mepc = 0;
+    Word mcause = 0;
+    Word fcsr = 0;
+    Word vl = 0;
+    Word vtype = vtypeVill;
+    Word vlenb = 16;
+    bool irqPending = false;
     std::optional<CpuToHostData> cpuToHostData;
     bool startReg = false;
+    Word hpmSelected = 0;     // bit per event selected by some counter
+    std::array<HpmEvent, hpmCounters> hpmEvent{};
+    std::array<uint64_t, hpmCounters> hpmCounter{};
 
 };
 
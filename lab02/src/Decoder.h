@@ -36,6 +36,16 @@ public:
                     instr->_aluFunc = decoded.r.aluSel ? AluFunc::Sra : AluFunc::Srl;
                     instr->_imm.value() &= 31u;
                 }
+                if (data >> 25u == fnZBB && (decoded.i.funct3 == 0b001 || decoded.i.funct3 == 0b101))
+                {
+                    instr->_aluFunc = DecodeZbbImm(decoded);
+                    if (instr->_aluFunc == AluFunc::None)
+                        instr->_type = IType::Unsupported;
+                }
+                else if ((data >> 20u) == immORCB && decoded.i.funct3 == 0b101)
+                    instr->_aluFunc = AluFunc::OrcB;
+                else if ((data >> 20u) == immREV8 && decoded.i.funct3 == 0b101)
+                    instr->_aluFunc = AluFunc::Rev8;
                 instr->_dst = RId(decoded.i.rd);
                 instr->_src1 = RId(decoded.i.rs1);
                 break;
@@ -56,6 +66,8 @@ public:
                 {
                     instr->_aluFunc = funct3;
                 }
+                if (auto zb = DecodeZb(decoded, data >> 25u))
+                    instr->_aluFunc = *zb;
                 instr->_dst = RId(decoded.r.rd);
                 instr->_src1 = RId(decoded.r.rs1);
                 instr->_src2 = RId(decoded.r.rs2);
@@ -105,7 +117,11 @@ public:
             }
             case Opcode::Load:
             {
-                instr->_type = decoded.i.funct3 == fnLW ? IType::Ld : IType::Unsupported;
+                auto funct3 = decoded.i.funct3;
+                bool valid = funct3 == fnLB || funct3 == fnLH || funct3 == fnLW ||
+                             funct3 == fnLBU || funct3 == fnLHU;
+                instr->_type = valid ? IType::Ld : IType::Unsupported;
+                instr->_memFunc = static_cast<MemFunc>(funct3);
                 instr->_aluFunc = AluFunc::Add;
                 instr->_dst = RId(decoded.i.rd);
                 instr->_src1 = RId(decoded.i.rs1);
@@ -114,7 +130,10 @@ public:
             }
             case Opcode::Store:
             {
-                instr->_type = decoded.i.funct3 == fnSW ? IType::St : IType::Unsupported;
+                auto funct3 = decoded.s.funct3;
+                bool valid = funct3 == fnSB || funct3 == fnSH || funct3 == fnSW;
+                instr->_type = valid ? IType::St : IType::Unsupported;
+                instr->_memFunc = static_cast<MemFunc>(funct3);
                 instr->_aluFunc = AluFunc::Add;
                 instr->_src1 = RId(decoded.s.rs1);
                 instr->_src2 = RId(decoded.s.rs2);
@@ -123,6 +142,24 @@ public:
             }
             case Opcode::System:
             {
+                if (decoded.i.funct3 == fnPRIV && decoded.i.rd == 0 && decoded.i.rs1 == 0)
+                {
+                    if (decoded.i.imm11_0 == privSCALL)
+                    {
+                        instr->_type = IType::Ecall;
+                    }
+                    else if (decoded.i.imm11_0 == privMRET)
+                    {
+                        instr->_type = IType::Mret;
+                        instr->_brFunc = BrFunc::AT;
+                        instr->_csr = CsrIdx::Mepc;
+                    }
+                    else if (decoded.i.imm11_0 == privWFI)
+                    {
+                        instr->_type = IType::Wfi;
+                    }
+                    break;
+                }
                 if (decoded.i.funct3 == fnCSRRW && decoded.i.rd == 0)
                 {
                     instr->_type = IType::Csrw;
@@ -136,9 +173,78 @@ public:
                 instr->_csr = static_cast<CsrIdx>(immI & 0xfff);
                 break;
             }
-            // LR SC FENCE AMO not implemented
-            case Opcode::MiscMem:
             case Opcode::Amo:
+            {
+                // aq and rl are implied, host atomics are sequentially consistent
+                auto func = AmoFunc(decoded.a.funct5);
+                bool valid = decoded.a.funct3 == fnAMOW && IsAmoFunc(func);
+                instr->_type = valid ? IType::Amo : IType::Unsupported;
+                instr->_amoFunc = func;
+                instr->_aluFunc = AluFunc::None;
+                instr->_dst = RId(decoded.a.rd);
+                instr->_src1 = RId(decoded.a.rs1);
+                if (func != AmoFunc::Lr)
+                    instr->_src2 = RId(decoded.a.rs2);
+                break;
+            }
+            case Opcode::LoadFp:
+            case Opcode::StoreFp:
+            {
+                bool load = static_cast<Opcode>(decoded.i.opcode) == Opcode::LoadFp;
+                auto funct3 = decoded.i.funct3;
+                if (funct3 == fnVE8 || funct3 == fnVE16 || funct3 == fnVE32)
+                {
+                    DecodeVecMem(decoded, data, *instr, load);
+                    break;
+                }
+                instr->_type = funct3 == fnFW || funct3 == fnFD ? IType::Fp : IType::Unsupported;
+                instr->_fpFunc = load ? FpFunc::Load : FpFunc::Store;
+                instr->_fpDouble = funct3 == fnFD;
+                instr->_aluFunc = AluFunc::None;
+                instr->_src1 = RId(decoded.i.rs1);
+                instr->_imm = load ? immI : immS;
+                if (load)
+                    instr->_fdst = RId(decoded.i.rd);
+                else
+                    instr->_fsrc2 = RId(decoded.s.rs2);
+                break;
+            }
+            case Opcode::Madd:
+            case Opcode::Msub:
+            case Opcode::Nmsub:
+            case Opcode::Nmadd:
+            {
+                static constexpr FpFunc funcs[] = {FpFunc::Madd, FpFunc::Msub, FpFunc::Nmsub, FpFunc::Nmadd};
+                instr->_type = decoded.r4.fmt < 2 && !ReservedRm(decoded.r4.rm) ? IType::Fp : IType::Unsupported;
+                instr->_fpFunc = funcs[(decoded.r4.opcode >> 2) & 3];
+                instr->_fpDouble = decoded.r4.fmt == 1;
+                instr->_rm = RoundingMode(decoded.r4.rm);
+                instr->_aluFunc = AluFunc::None;
+                instr->_fdst = RId(decoded.r4.rd);
+                instr->_fsrc1 = RId(decoded.r4.rs1);
+                instr->_fsrc2 = RId(decoded.r4.rs2);
+                instr->_fsrc3 = RId(decoded.r4.rs3);
+                break;
+            }
+            case Opcode::OpV:
+            {
+                DecodeOpV(decoded, data, *instr);
+                break;
+            }
+            case Opcode::OpFp:
+            {
+                DecodeOpFp(decoded, *instr);
+                break;
+            }
+            case Opcode::MiscMem:
+            {
+                // The fence bits are ignored, every FENCE orders all accesses. FENCE.I is one too:
+                // like every fence it ends the block, and the next one sees the stores to code.
+                bool fence = decoded.i.funct3 == fnFENCE || decoded.i.funct3 == fnFENCEI;
+                instr->_type = fence ? IType::Fence : IType::Unsupported;
+                instr->_aluFunc = AluFunc::None;
+                break;
+            }
             default:
             {
                 instr->_type = IType::Unsupported;
@@ -147,6 +253,8 @@ public:
             }
         }
 
+        // Nothing reads x0 back: the register file sends the write to its sink
+        // and the timing models see no destination
         if (instr->_dst.value_or(0) == 0)
             instr->_dst.reset();
 
@@ -156,6 +264,25 @@ public:
 private:
     using Imm = int32_t;
 
+    static bool IsAmoFunc(AmoFunc func)
+    {
+        switch (func)
+        {
+            case AmoFunc::Add:
+            case AmoFunc::Swap:
+            case AmoFunc::Lr:
+            case AmoFunc::Sc:
+            case AmoFunc::Xor:
+            case AmoFunc::Or:
+            case AmoFunc::And:
+            case AmoFunc::Min:
+            case AmoFunc::Max:
+            case AmoFunc::Minu:
+            case AmoFunc::Maxu: return true;
+            default: return false;
+        }
+    }
+
     Imm SignExtend(Imm i, unsigned sbit)
     {
         return i + ((0xffffffff << (sbit + 1)) * ((i & (1u << sbit)) >> sbit));
@@ -174,6 +301,27 @@ private:
             uint32_t aluSel : 1;
             uint32_t reserved2 : 1;
         } r;
+        struct aType
+        {
+            uint32_t opcode : 7;
+            uint32_t rd : 5;
+            uint32_t funct3 : 3;
+            uint32_t rs1 : 5;
+            uint32_t rs2 : 5;
+            uint32_t rl : 1;
+            uint32_t aq : 1;
+            uint32_t funct5 : 5;
+        } a;
+        struct r4Type
+        {
+            uint32_t opcode : 7;
+            uint32_t rd : 5;
+            uint32_t rm : 3;
+            uint32_t rs1 : 5;
+            uint32_t rs2 : 5;
+            uint32_t fmt : 2;
+            uint32_t rs3 : 5;
+        } r4;
         struct iType
         {
             uint32_t opcode : 7;
@@ -219,6 +367,270 @@ private:
         } j;
 
     };
+
+    // Zba and Zbb register-register operations, by funct7 and funct3
+    static std::optional<AluFunc> DecodeZb(const DecodedInstr& decoded, Word funct7)
+    {
+        switch (funct7 << 3u | decoded.r.funct3)
+        {
+            case fnZBA << 3u | 0b010:    return AluFunc::Sh1add;
+            case fnZBA << 3u | 0b100:    return AluFunc::Sh2add;
+            case fnZBA << 3u | 0b110:    return AluFunc::Sh3add;
+            case fnZBBNEG << 3u | 0b111: return AluFunc::Andn;
+            case fnZBBNEG << 3u | 0b110: return AluFunc::Orn;
+            case fnZBBNEG << 3u | 0b100: return AluFunc::Xnor;
+            case fnZBBMINMAX << 3u | 0b100: return AluFunc::Min;
+            case fnZBBMINMAX << 3u | 0b101: return AluFunc::Minu;
+            case fnZBBMINMAX << 3u | 0b110: return AluFunc::Max;
+            case fnZBBMINMAX << 3u | 0b111: return AluFunc::Maxu;
+            case fnZBB << 3u | 0b001:    return AluFunc::Rol;
+            case fnZBB << 3u | 0b101:    return AluFunc::Ror;
+            case fnZEXTH << 3u | 0b100:  return decoded.r.rs2 == 0 ? std::optional(AluFunc::ZextH) : std::nullopt;
+            default:                     return std::nullopt;
+        }
+    }
+
+    // rori, and the unary operations selected by the rs2 field
+    static AluFunc DecodeZbbImm(const DecodedInstr& decoded)
+    {
+        if (decoded.i.funct3 == 0b101)
+            return AluFunc::Ror;
+        switch (decoded.r.rs2)
+        {
+            case 0b00000: return AluFunc::Clz;
+            case 0b00001: return AluFunc::Ctz;
+            case 0b00010: return AluFunc::Cpop;
+            case 0b00100: return AluFunc::SextB;
+            case 0b00101: return AluFunc::SextH;
+            default:      return AluFunc::None;
+        }
+    }
+
+    // Unit-stride and strided accesses, no segments; indexed ones are not supported
+    static void DecodeVecMem(const DecodedInstr& decoded, Word data, Instruction& instr, bool load)
+    {
+        Word nf = data >> 29u;
+        Word mop = (data >> 26u) & 3u;
+        bool masked = !((data >> 25u) & 1u);
+        bool strided = mop == 0b10;
+        instr._type = nf == 0 && (strided || (mop == 0 && decoded.r.rs2 == 0)) ? IType::Vec : IType::Unsupported;
+        instr._aluFunc = AluFunc::None;
+        instr._memFunc = decoded.r.funct3 == fnVE8 ? MemFunc::B : decoded.r.funct3 == fnVE16 ? MemFunc::H : MemFunc::W;
+        if (load)
+        {
+            instr._vecFunc = strided ? VecFunc::LoadStrided : VecFunc::Load;
+            instr._fdst = decoded.r.rd;
+        }
+        else
+        {
+            instr._vecFunc = strided ? VecFunc::StoreStrided : VecFunc::Store;
+            instr._fsrc2 = decoded.r.rd;
+        }
+        instr._src1 = RId(decoded.r.rs1);
+        if (strided)
+            instr._src2 = RId(decoded.r.rs2);
+        if (masked)
+            instr._fsrc3 = 0;
+    }
+
+    static void DecodeOpV(const DecodedInstr& decoded, Word data, Instruction& instr)
+    {
+        enum Kind : uint8_t { VV = 1, VX = 2, VI = 4 };
+        Word funct3 = decoded.r.funct3;
+        Word funct6 = data >> 26u;
+        bool masked = !((data >> 25u) & 1u);
+        instr._type = IType::Vec;
+        instr._aluFunc = AluFunc::None;
+
+        if (funct3 == fnOPCFG)
+        {
+            instr._dst = RId(decoded.r.rd);
+            if (!(data >> 31u))
+            {
+                instr._vecFunc = VecFunc::SetVli;
+                instr._src1 = RId(decoded.r.rs1);
+                instr._imm = (data >> 20u) & 0x7ffu;
+            }
+            else if (data >> 30u == 0b11)
+            {
+                instr._vecFunc = VecFunc::SetIvli;
+                instr._imm = Word(decoded.r.rs1) << 16u | ((data >> 20u) & 0x3ffu);
+            }
+            else
+            {
+                instr._vecFunc = VecFunc::SetVl;
+                instr._src1 = RId(decoded.r.rs1);
+                instr._src2 = RId(decoded.r.rs2);
+            }
+            return;
+        }
+
+        Kind kind = funct3 == fnOPIVV || funct3 == fnOPMVV ? VV : funct3 == fnOPIVI ? VI : VX;
+        uint8_t allowed = 0;
+        if (funct3 == fnOPIVV || funct3 == fnOPIVX || funct3 == fnOPIVI)
+        {
+            switch (funct6)
+            {
+                case 0b000000: instr._vecFunc = VecFunc::Add;  allowed = VV | VX | VI; break;
+                case 0b000010: instr._vecFunc = VecFunc::Sub;  allowed = VV | VX; break;
+                case 0b000011: instr._vecFunc = VecFunc::Rsub; allowed = VX | VI; break;
+                case 0b000100: instr._vecFunc = VecFunc::Minu; allowed = VV | VX; break;
+                case 0b000101: instr._vecFunc = VecFunc::Min;  allowed = VV | VX; break;
+                case 0b000110: instr._vecFunc = VecFunc::Maxu; allowed = VV | VX; break;
+                case 0b000111: instr._vecFunc = VecFunc::Max;  allowed = VV | VX; break;
+                case 0b001001: instr._vecFunc = VecFunc::And;  allowed = VV | VX | VI; break;
+                case 0b001010: instr._vecFunc = VecFunc::Or;   allowed = VV | VX | VI; break;
+                case 0b001011: instr._vecFunc = VecFunc::Xor;  allowed = VV | VX | VI; break;
+                case 0b010111:
+                    // vmv.v.* has no vs2
+                    instr._vecFunc = VecFunc::Merge;
+                    allowed = masked || decoded.r.rs2 == 0 ? VV | VX | VI : 0;
+                    break;
+                case 0b011000: instr._vecFunc = VecFunc::Seq;  allowed = VV | VX | VI; break;
+                case 0b011001: instr._vecFunc = VecFunc::Sne;  allowed = VV | VX | VI; break;
+                case 0b011010: instr._vecFunc = VecFunc::Sltu; allowed = VV | VX; break;
+                case 0b011011: instr._vecFunc = VecFunc::Slt;  allowed = VV | VX; break;
+                case 0b011100: instr._vecFunc = VecFunc::Sleu; allowed = VV | VX | VI; break;
+                case 0b011101: instr._vecFunc = VecFunc::Sle;  allowed = VV | VX | VI; break;
+                case 0b011110: instr._vecFunc = VecFunc::Sgtu; allowed = VX | VI; break;
+                case 0b011111: instr._vecFunc = VecFunc::Sgt;  allowed = VX | VI; break;
+                default: break;
+            }
+        }
+        else if (funct3 == fnOPMVV || funct3 == fnOPMVX)
+        {
+            switch (funct6)
+            {
+                case 0b000000: instr._vecFunc = VecFunc::RedSum;  allowed = VV; break;
+                case 0b000100: instr._vecFunc = VecFunc::RedMinu; allowed = VV; break;
+                case 0b000101: instr._vecFunc = VecFunc::RedMin;  allowed = VV; break;
+                case 0b000110: instr._vecFunc = VecFunc::RedMaxu; allowed = VV; break;
+                case 0b000111: instr._vecFunc = VecFunc::RedMax;  allowed = VV; break;
+                case 0b100101: instr._vecFunc = VecFunc::Mul;     allowed = VV | VX; break;
+                case 0b101101: instr._vecFunc = VecFunc::Macc;    allowed = VV | VX; break;
+                case 0b010000:
+                    // vmv.x.s and vmv.s.x, never masked
+                    if (kind == VV && decoded.r.rs1 == 0 && !masked)
+                    {
+                        instr._vecFunc = VecFunc::MvXS;
+                        instr._dst = RId(decoded.r.rd);
+                        instr._fsrc2 = decoded.r.rs2;
+                        return;
+                    }
+                    instr._vecFunc = VecFunc::MvSX;
+                    allowed = decoded.r.rs2 == 0 && !masked ? VX : 0;
+                    break;
+                default: break;
+            }
+        }
+        if (!(allowed & kind))
+        {
+            instr._type = IType::Unsupported;
+            return;
+        }
+
+        instr._fdst = decoded.r.rd;
+        instr._fsrc2 = decoded.r.rs2;
+        if (kind == VV)
+            instr._fsrc1 = decoded.r.rs1;
+        else if (kind == VX)
+            instr._src1 = RId(decoded.r.rs1);
+        else
+            instr._imm = Word(SignedWord(Word(decoded.r.rs1) << 27u) >> 27u);
+        if (masked)
+            instr._fsrc3 = 0;
+    }
+
+    // Neither a rounding mode nor a funct3 of any F or D instruction
+    static bool ReservedRm(Word rm)
+    {
+        return rm == 5 || rm == 6;
+    }
+
+    // F and D computational instructions, by funct5 and for some by rm or rs2
+    static void DecodeOpFp(const DecodedInstr& decoded, Instruction& instr)
+    {
+        Word funct5 = decoded.r4.rs3;
+        Word rm = decoded.r4.rm;
+        Word rs2 = decoded.r4.rs2;
+        bool valid = decoded.r4.fmt < 2 && !ReservedRm(rm);
+        instr._type = IType::Fp;
+        instr._fpDouble = decoded.r4.fmt == 1;
+        instr._rm = RoundingMode(rm);
+        instr._aluFunc = AluFunc::None;
+        instr._fdst = RId(decoded.r4.rd);
+        instr._fsrc1 = RId(decoded.r4.rs1);
+        instr._fsrc2 = RId(rs2);
+
+        // Operands that are integer registers or absent
+        auto intDst = [&] { instr._fdst.reset(); instr._dst = RId(decoded.r4.rd); };
+        auto intSrc = [&] { instr._fsrc1.reset(); instr._src1 = RId(decoded.r4.rs1); };
+
+        switch (funct5)
+        {
+            case 0b00000: instr._fpFunc = FpFunc::Add; break;
+            case 0b00001: instr._fpFunc = FpFunc::Sub; break;
+            case 0b00010: instr._fpFunc = FpFunc::Mul; break;
+            case 0b00011: instr._fpFunc = FpFunc::Div; break;
+            case 0b01011:
+                instr._fpFunc = FpFunc::Sqrt;
+                instr._fsrc2.reset();
+                valid &= rs2 == 0;
+                break;
+            case 0b00100:
+                instr._fpFunc = rm == 0 ? FpFunc::SgnJ : rm == 1 ? FpFunc::SgnJn : FpFunc::SgnJx;
+                valid &= rm <= 2;
+                break;
+            case 0b00101:
+                instr._fpFunc = rm == 0 ? FpFunc::Min : FpFunc::Max;
+                valid &= rm <= 1;
+                break;
+            case 0b01000:
+                // fmt is the destination, rs2 the source format
+                instr._fpFunc = FpFunc::CvtFF;
+                instr._fsrc2.reset();
+                valid &= rs2 == Word(!instr._fpDouble);
+                break;
+            case 0b10100:
+                instr._fpFunc = rm == 2 ? FpFunc::Eq : rm == 1 ? FpFunc::Lt : FpFunc::Le;
+                valid &= rm <= 2;
+                intDst();
+                break;
+            case 0b11000:
+                instr._fpFunc = rs2 == 0 ? FpFunc::CvtWF : FpFunc::CvtWuF;
+                instr._fsrc2.reset();
+                valid &= rs2 <= 1;
+                intDst();
+                break;
+            case 0b11010:
+                instr._fpFunc = rs2 == 0 ? FpFunc::CvtFW : FpFunc::CvtFWu;
+                instr._fsrc2.reset();
+                valid &= rs2 <= 1;
+                intSrc();
+                break;
+            case 0b11100:
+                // RV32D has no fmv.x.d
+                instr._fpFunc = rm == 0 ? FpFunc::MvXW : FpFunc::Class;
+                instr._fsrc2.reset();
+                valid &= rs2 == 0 && rm <= 1 && (rm == 1 || !instr._fpDouble);
+                intDst();
+                break;
+            case 0b11110:
+                instr._fpFunc = FpFunc::MvWX;
+                instr._fsrc2.reset();
+                valid &= rs2 == 0 && rm == 0 && !instr._fpDouble;
+                intSrc();
+                break;
+            default:
+                valid = false;
+                break;
+        }
+        if (!valid)
+        {
+            instr._type = IType::Unsupported;
+            instr._dst.reset();
+        }
+    }
 };
 
 #endif //RISCV_SIM_DECODER_H
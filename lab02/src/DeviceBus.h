@@ -0,0 +1,85 @@
+
+#ifndef RISCV_SIM_DEVICEBUS_H
+#define RISCV_SIM_DEVICEBUS_H
+
+#include <vector>
+
+#include "Instruction.h"
+#include "Memory.h"
+
+// Memory mapped device registers
+class Device
+{
+public:
+    virtual ~Device() = default;
+
+    // offset is relative to the start of the device range, size is 1, 2 or 4 bytes
+    virtual Word Read(Word offset, unsigned size) = 0;
+    virtual void Write(Word offset, Word data, unsigned size) = 0;
+};
+
+// Address range dispatch for devices mapped outside of RAM. Loads and stores
+// to RAM never look at the bus: a device access lands on a guard page of the
+// guest memory and the cpu offers it to the bus from the fault path.
+class DeviceBus
+{
+public:
+    // Returns false if the range overlaps RAM or an already mapped device
+    bool Map(Word base, Word size, Device& device)
+    {
+        if (size == 0 || base < Memory::ramBytes || base + size - 1 < base)
+            return false;
+        for (auto& range : _ranges)
+        {
+            if (base <= range.base + (range.size - 1) && range.base <= base + (size - 1))
+                return false;
+        }
+        _ranges.push_back({base, size, &device});
+        return true;
+    }
+
+    // Completes a load or store that missed RAM, false if no device claims it
+    bool Access(InstructionPtr& instr)
+    {
+        if (instr->_type != IType::Ld && instr->_type != IType::St)
+            return false;
+
+        for (auto& range : _ranges)
+        {
+            Word offset = instr->_addr - range.base;
+            if (instr->_addr < range.base || offset >= range.size)
+                continue;
+
+            unsigned size = AccessSize(instr->_memFunc);
+            if (instr->_type == IType::St)
+            {
+                range.device->Write(offset, instr->_data, size);
+                return true;
+            }
+
+            Word data = range.device->Read(offset, size);
+            switch (instr->_memFunc)
+            {
+                case MemFunc::B:  instr->_data = SignedWord(int8_t(data)); break;
+                case MemFunc::H:  instr->_data = SignedWord(int16_t(data)); break;
+                case MemFunc::Bu: instr->_data = uint8_t(data); break;
+                case MemFunc::Hu: instr->_data = uint16_t(data); break;
+                default:          instr->_data = data; break;
+            }
+            return true;
+        }
+        return false;
+    }
+
+private:
+    struct Range
+    {
+        Word base;
+        Word size;
+        Device* device;
+    };
+
+    std::vector<Range> _ranges;
+};
+
+#endif //RISCV_SIM_DEVICEBUS_H
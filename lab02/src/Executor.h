@@ -3,6 +3,7 @@
 #define RISCV_SIM_EXECUTOR_H
 
 #include "Instruction.h"
+#include "BitOps.h"
 
 class Executor
 {
@@ -41,6 +42,7 @@ private:
 		AluFunc::Srl — беззнаковый сдвиг А на В вправо, где В = Б % 32.
 		AluFunc::Sra — знаковый сдвиг А на  В вправо, где В = Б % 32.
 		AluFunc::Sr - разбивается на AluFunc::Srl и AluFunc::Sra в декодере
+		AluFunc::Andn ... AluFunc::Sh3add — операции Zba и Zbb, см. BitOps.h.
 		AluFunc::None - ничего не делать.
 		*/
 		switch (instr->_aluFunc)
@@ -92,6 +94,14 @@ private:
 			}
 			break;
 
+			case AluFunc::Andn: case AluFunc::Orn: case AluFunc::Xnor:
+			case AluFunc::Min: case AluFunc::Max: case AluFunc::Minu: case AluFunc::Maxu:
+			case AluFunc::Rol: case AluFunc::Ror: case AluFunc::Clz: case AluFunc::Ctz: case AluFunc::Cpop:
+			case AluFunc::SextB: case AluFunc::SextH: case AluFunc::ZextH: case AluFunc::OrcB: case AluFunc::Rev8:
+			case AluFunc::Sh1add: case AluFunc::Sh2add: case AluFunc::Sh3add:
+			aluResult = bitops::Execute(instr->_aluFunc, A, B);
+			break;
+
 			default: break;
 		}
 
@@ -105,6 +115,7 @@ private:
 		IType::Csrr — записать _csrVal.
 		IType::Csrw — записать _src1Val.
 		IType::St — записать _src2Val.
+		IType::Amo — записать _src2Val, адрес — _src1Val.
 		IType::J и IType::Jr — записать адрес текущей инструкции увеличенный на 4.
 		IType::Auipc — записать адрес текущей инструкции увеличенный на _imm.
 		IType::<remaining> - записать результат вычислений ALU
@@ -123,6 +134,11 @@ private:
 			instr->_data = instr->_src2Val;
 			break;
 
+			case IType::Amo:
+			instr->_addr = instr->_src1Val;
+			instr->_data = instr->_src2Val;
+			break;
+
 			case IType::J:
 			case IType::Jr:
 			instr->_data = ip + 4;
@@ -215,6 +231,10 @@ private:
 				}
 				break;
 
+				case IType::Mret:
+				instr->_nextIp = instr->_csrVal;
+				break;
+
 				default:
 				instr->_nextIp = ip + 4;
 				break;
@@ -0,0 +1,418 @@
+
+#ifndef RISCV_SIM_FPUNIT_H
+#define RISCV_SIM_FPUNIT_H
+
+#include <array>
+#include <cfenv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#include "CsrFile.h"
+#include "Memory.h"
+
+// fflags bits
+namespace fpflags
+{
+    constexpr Word NX = 1u << 0;
+    constexpr Word UF = 1u << 1;
+    constexpr Word OF = 1u << 2;
+    constexpr Word DZ = 1u << 3;
+    constexpr Word NV = 1u << 4;
+}
+
+// Host floating point environment: exception flags in fflags format and the
+// rounding mode. On x86 it is MXCSR, the control register of the SSE unit
+// doing float and double arithmetic.
+class HostFpEnv
+{
+public:
+#if defined(__SSE2__)
+    static Word Flags()
+    {
+        Word csr = GetCsr();
+        return (csr & 0x01 ? fpflags::NV : 0) | (csr & 0x04 ? fpflags::DZ : 0) | (csr & 0x08 ? fpflags::OF : 0) |
+               (csr & 0x10 ? fpflags::UF : 0) | (csr & 0x20 ? fpflags::NX : 0);
+    }
+
+    // Clears the host flags not in keep; returns the previous control word
+    static Word Prepare(Word keep, RoundingMode rm)
+    {
+        Word csr = GetCsr();
+        Word drop = csr & hostFlags & ~ToHost(keep);
+        Word rc = RoundingBits(rm);
+        if (drop || (csr & rcMask) != rc)
+            SetCsr((csr & ~drop & ~rcMask) | rc);
+        return csr;
+    }
+
+    static void Restore(Word csr)
+    {
+        Word now = GetCsr();
+        if ((now & rcMask) != (csr & rcMask))
+            SetCsr((now & ~rcMask) | (csr & rcMask));
+    }
+
+private:
+    static constexpr Word hostFlags = 0x3d;    // all but denormal operand
+    static constexpr Word rcMask = 0x6000;
+
+    static Word ToHost(Word flags)
+    {
+        return (flags & fpflags::NV ? 0x01 : 0) | (flags & fpflags::DZ ? 0x04 : 0) | (flags & fpflags::OF ? 0x08 : 0) |
+               (flags & fpflags::UF ? 0x10 : 0) | (flags & fpflags::NX ? 0x20 : 0);
+    }
+
+    // x86 has no round to nearest, ties to max magnitude; FpUnit keeps it away
+    static Word RoundingBits(RoundingMode rm)
+    {
+        switch (rm)
+        {
+            case RoundingMode::Rdn: return 0x2000;
+            case RoundingMode::Rup: return 0x4000;
+            case RoundingMode::Rtz: return 0x6000;
+            default:                return 0;
+        }
+    }
+
+    // Volatile, so the arithmetic between two of them is not moved across
+    static Word GetCsr()
+    {
+        Word csr;
+        asm volatile("stmxcsr %0" : "=m"(csr));
+        return csr;
+    }
+
+    static void SetCsr(Word csr)
+    {
+        asm volatile("ldmxcsr %0" : : "m"(csr));
+    }
+#else
+    static Word Flags()
+    {
+        int ex = std::fetestexcept(FE_ALL_EXCEPT);
+        return (ex & FE_INVALID ? fpflags::NV : 0) | (ex & FE_DIVBYZERO ? fpflags::DZ : 0) |
+               (ex & FE_OVERFLOW ? fpflags::OF : 0) | (ex & FE_UNDERFLOW ? fpflags::UF : 0) |
+               (ex & FE_INEXACT ? fpflags::NX : 0);
+    }
+
+    static Word Prepare(Word keep, RoundingMode rm)
+    {
+        std::feclearexcept(FE_ALL_EXCEPT);
+        int prev = std::fegetround();
+        int mode = rm == RoundingMode::Rdn ? FE_DOWNWARD : rm == RoundingMode::Rup ? FE_UPWARD
+                 : rm == RoundingMode::Rtz ? FE_TOWARDZERO : FE_TONEAREST;
+        if (mode != prev)
+            std::fesetround(mode);
+        return Word(prev);
+    }
+
+    static void Restore(Word prev)
+    {
+        if (std::fegetround() != int(prev))
+            std::fesetround(int(prev));
+    }
+#endif
+};
+
+// F and D registers and the instructions using them. Single values are
+// NaN-boxed in the 64-bit registers. Arithmetic is what the compiler emits for
+// float and double, i.e. SSE on x86; fflags collects the host exception flags
+// each instruction raised. The host keeps rounding to nearest even and is
+// switched only around an instruction rounding otherwise, so the common path
+// never writes MXCSR: it only reads the flags back, and clears host flags the
+// guest has not raised yet, which the sticky fflags make rare.
+// Comparisons, min/max, sign injection and conversions to integers are exact
+// and raise their flags themselves.
+class FpUnit
+{
+public:
+    // False for an illegal instruction: a dynamic rounding mode with frm
+    // reserved, or RMM for an operation the host rounds, since the host cannot
+    // round ties away from zero. Nothing is written then, the caller keeps rd
+    // as it was.
+    bool Execute(InstructionPtr& instr, Memory& mem, CsrFile& csrf)
+    {
+        Instruction& in = *instr;
+        switch (in._fpFunc)
+        {
+            case FpFunc::Load:
+                in._addr = in._src1Val + *in._imm;
+                _f[*in._fdst] = in._fpDouble ? mem.Load<uint64_t>(in._addr) : box | mem.Load<uint32_t>(in._addr);
+                return true;
+            case FpFunc::Store:
+                in._addr = in._src1Val + *in._imm;
+                if (in._fpDouble)
+                    mem.Store<uint64_t>(in._addr, _f[*in._fsrc2]);
+                else
+                    mem.Store<uint32_t>(in._addr, uint32_t(_f[*in._fsrc2]));
+                return true;
+            case FpFunc::MvXW:
+                in._data = Word(_f[*in._fsrc1]);
+                return true;
+            case FpFunc::MvWX:
+                _f[*in._fdst] = box | in._src1Val;
+                return true;
+            default:
+                break;
+        }
+
+        RoundingMode rm = in._rm == RoundingMode::Dyn ? csrf.FpRounding() : in._rm;
+        if (rm > RoundingMode::Rmm || (rm == RoundingMode::Rmm && HostRounded(in._fpFunc)))
+            return false;
+        if (in._fpDouble)
+            Compute<double, uint64_t>(in, rm, csrf);
+        else
+            Compute<float, uint32_t>(in, rm, csrf);
+        return true;
+    }
+
+    uint64_t Read(RId id) const
+    {
+        return _f.at(id);
+    }
+
+    void Write(RId id, uint64_t bits)
+    {
+        _f.at(id) = bits;
+    }
+
+private:
+    static constexpr uint64_t box = 0xffffffff00000000ull;
+
+    // Conversions to integers round by themselves, the rest is exact
+    static bool HostRounded(FpFunc func)
+    {
+        switch (func)
+        {
+            case FpFunc::Add:
+            case FpFunc::Sub:
+            case FpFunc::Mul:
+            case FpFunc::Div:
+            case FpFunc::Sqrt:
+            case FpFunc::Madd:
+            case FpFunc::Msub:
+            case FpFunc::Nmsub:
+            case FpFunc::Nmadd:
+            case FpFunc::CvtFF:
+            case FpFunc::CvtFW:
+            case FpFunc::CvtFWu:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    template <typename T, typename Bits>
+    void Compute(Instruction& in, RoundingMode rm, CsrFile& csrf)
+    {
+        using namespace fpflags;
+        constexpr Bits sign = Bits(1) << (8 * sizeof(Bits) - 1);
+        T a = in._fsrc1 ? Get<T, Bits>(*in._fsrc1) : T(0);
+        T b = in._fsrc2 ? Get<T, Bits>(*in._fsrc2) : T(0);
+        Word flags = 0;
+
+        switch (in._fpFunc)
+        {
+            case FpFunc::SgnJ:
+            case FpFunc::SgnJn:
+            case FpFunc::SgnJx:
+            {
+                Bits x = ToBits<Bits>(a), y = ToBits<Bits>(b);
+                Bits s = in._fpFunc == FpFunc::SgnJ ? y : in._fpFunc == FpFunc::SgnJn ? ~y : x ^ y;
+                SetBits<Bits>(*in._fdst, (x & ~sign) | (s & sign));
+                return;
+            }
+            case FpFunc::Min:
+            case FpFunc::Max:
+                Set<T, Bits>(*in._fdst, MinMax<T, Bits>(a, b, in._fpFunc == FpFunc::Max, flags));
+                break;
+            case FpFunc::Eq:
+                if (IsSignaling<T, Bits>(a) || IsSignaling<T, Bits>(b))
+                    flags |= NV;
+                in._data = a == b;
+                break;
+            case FpFunc::Lt:
+            case FpFunc::Le:
+                if (std::isnan(a) || std::isnan(b))
+                    flags |= NV;
+                in._data = in._fpFunc == FpFunc::Lt ? a < b : a <= b;
+                break;
+            case FpFunc::Class:
+                in._data = Classify<T, Bits>(a);
+                break;
+            case FpFunc::CvtWF:
+            case FpFunc::CvtWuF:
+                in._data = ToWord(a, rm, in._fpFunc == FpFunc::CvtWuF, flags);
+                break;
+            case FpFunc::CvtFF:
+            {
+                // The source has the other format
+                Word keep = HostFpEnv::Prepare(csrf.FpFlags(), rm);
+                if (in._fpDouble)
+                    Set<T, Bits>(*in._fdst, Opaque(T(Opaque(Get<float, uint32_t>(*in._fsrc1)))));
+                else
+                    Set<T, Bits>(*in._fdst, Opaque(T(Opaque(Get<double, uint64_t>(*in._fsrc1)))));
+                flags = HostFpEnv::Flags();
+                HostFpEnv::Restore(keep);
+                break;
+            }
+            default:
+            {
+                T c = in._fsrc3 ? Get<T, Bits>(*in._fsrc3) : T(0);
+                Word keep = HostFpEnv::Prepare(csrf.FpFlags(), rm);
+                a = Opaque(a);
+                b = Opaque(b);
+                c = Opaque(c);
+                T r;
+                switch (in._fpFunc)
+                {
+                    case FpFunc::Add:    r = a + b; break;
+                    case FpFunc::Sub:    r = a - b; break;
+                    case FpFunc::Mul:    r = a * b; break;
+                    case FpFunc::Div:    r = a / b; break;
+                    case FpFunc::Sqrt:   r = std::sqrt(a); break;
+                    case FpFunc::Madd:   r = std::fma(a, b, c); break;
+                    case FpFunc::Msub:   r = std::fma(a, b, -c); break;
+                    case FpFunc::Nmsub:  r = std::fma(-a, b, c); break;
+                    case FpFunc::Nmadd:  r = std::fma(-a, b, -c); break;
+                    case FpFunc::CvtFW:  r = T(SignedWord(Opaque(in._src1Val))); break;
+                    case FpFunc::CvtFWu: r = T(Opaque(in._src1Val)); break;
+                    default:             r = a; break;
+                }
+                r = Opaque(r);
+                flags = HostFpEnv::Flags();
+                HostFpEnv::Restore(keep);
+                Set<T, Bits>(*in._fdst, r);
+                break;
+            }
+        }
+        csrf.RaiseFpFlags(flags);
+    }
+
+    // Keeps the compiler from moving or folding arithmetic across the host environment accesses
+    template <typename T>
+    static T Opaque(T v)
+    {
+        if constexpr (std::is_floating_point_v<T>)
+            asm volatile("" : "+x"(v));
+        else
+            asm volatile("" : "+r"(v));
+        return v;
+    }
+
+    template <typename Bits, typename T>
+    static Bits ToBits(T v)
+    {
+        Bits bits;
+        std::memcpy(&bits, &v, sizeof(v));
+        return bits;
+    }
+
+    template <typename T, typename Bits>
+    static T FromBits(Bits bits)
+    {
+        T v;
+        std::memcpy(&v, &bits, sizeof(v));
+        return v;
+    }
+
+    // A single that is not NaN-boxed reads as the canonical NaN
+    template <typename T, typename Bits>
+    T Get(RId id) const
+    {
+        if constexpr (sizeof(Bits) == 4)
+        {
+            if ((_f[id] & box) != box)
+                return FromBits<T, Bits>(0x7fc00000u);
+        }
+        return FromBits<T, Bits>(Bits(_f[id]));
+    }
+
+    template <typename Bits>
+    void SetBits(RId id, Bits bits)
+    {
+        _f[id] = sizeof(Bits) == 4 ? box | bits : uint64_t(bits);
+    }
+
+    // Every NaN result is the canonical one
+    template <typename T, typename Bits>
+    void Set(RId id, T v)
+    {
+        if (std::isnan(v))
+            SetBits<Bits>(id, sizeof(Bits) == 4 ? Bits(0x7fc00000u) : Bits(0x7ff8000000000000ull));
+        else
+            SetBits<Bits>(id, ToBits<Bits>(v));
+    }
+
+    template <typename T, typename Bits>
+    static bool IsSignaling(T v)
+    {
+        constexpr Bits quiet = Bits(1) << (std::numeric_limits<T>::digits - 2);
+        return std::isnan(v) && !(ToBits<Bits>(v) & quiet);
+    }
+
+    template <typename T, typename Bits>
+    static T MinMax(T a, T b, bool max, Word& flags)
+    {
+        if (IsSignaling<T, Bits>(a) || IsSignaling<T, Bits>(b))
+            flags |= fpflags::NV;
+        if (std::isnan(a))
+            return b;   // canonical if both are NaN
+        if (std::isnan(b))
+            return a;
+        if (a == b)     // -0 is below +0
+            return std::signbit(a) == max ? b : a;
+        return (a < b) != max ? a : b;
+    }
+
+    template <typename T, typename Bits>
+    static Word Classify(T v)
+    {
+        bool neg = std::signbit(v);
+        switch (std::fpclassify(v))
+        {
+            case FP_INFINITE:  return neg ? 1u << 0 : 1u << 7;
+            case FP_NORMAL:    return neg ? 1u << 1 : 1u << 6;
+            case FP_SUBNORMAL: return neg ? 1u << 2 : 1u << 5;
+            case FP_ZERO:      return neg ? 1u << 3 : 1u << 4;
+            default:           return IsSignaling<T, Bits>(v) ? 1u << 8 : 1u << 9;
+        }
+    }
+
+    // Rounds with rm and saturates; NaN converts to the largest value
+    template <typename T>
+    static Word ToWord(T v, RoundingMode rm, bool isUnsigned, Word& flags)
+    {
+        double lo = isUnsigned ? 0.0 : -2147483648.0;
+        double hi = isUnsigned ? 4294967295.0 : 2147483647.0;
+        if (std::isnan(v))
+        {
+            flags |= fpflags::NV;
+            return isUnsigned ? ~0u : 0x7fffffffu;
+        }
+
+        double r;
+        switch (rm)
+        {
+            case RoundingMode::Rtz: r = std::trunc(double(v)); break;
+            case RoundingMode::Rdn: r = std::floor(double(v)); break;
+            case RoundingMode::Rup: r = std::ceil(double(v)); break;
+            case RoundingMode::Rmm: r = std::round(double(v)); break;
+            default:                r = std::nearbyint(double(v)); break;
+        }
+        if (r < lo || r > hi)
+        {
+            flags |= fpflags::NV;
+            return r < lo ? Word(int32_t(lo)) : Word(int64_t(hi));
+        }
+        if (r != double(v))
+            flags |= fpflags::NX;
+        return isUnsigned ? Word(uint32_t(r)) : Word(int32_t(r));
+    }
+
+    std::array<uint64_t, 32> _f{};
+};
+
+#endif //RISCV_SIM_FPUNIT_H
@@ -0,0 +1,283 @@
+
+#ifndef RISCV_SIM_HARTSCHEDULER_H
+#define RISCV_SIM_HARTSCHEDULER_H
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Cpu.h"
+
+struct HartSchedulerStats
+{
+    uint64_t quanta = 0;
+    uint64_t parks = 0;
+    uint64_t skipped = 0;   // turns a parked hart did not run
+};
+
+// Runs many harts in turns of a fixed number of instructions. A Cpu is already
+// resumable at any block boundary, so a turn is just a run of blocks.
+// A hart that spins on memory is parked: a block that branches back to itself,
+// only loads and computes, and leaves the registers as they were will do the same
+// until one of the words it loads changes. The parked hart gets no turns until a
+// store from another hart changes one of them.
+// Turns of different harts may run on several host threads at once (Run).
+class HartScheduler
+{
+public:
+    explicit HartScheduler(uint64_t quantum)
+        : _quantum(std::max<uint64_t>(quantum, 1))
+    {
+
+    }
+
+    // One turn of the hart; stops early for a message to the host or a fault
+    void Step(Cpu& cpu)
+    {
+        Hart& hart = State(cpu.HartId());
+        if (hart.parked)
+        {
+            // Everybody waiting means nobody will store, so they all run on as before
+            if (!Changed(hart, cpu.GetMemory()) && _parked < _harts.size())
+            {
+                _skipped++;
+                return;
+            }
+            hart.parked = false;
+            _parked--;
+        }
+
+        _quanta++;
+        hart.spinIp = noSpin;
+        uint64_t end = cpu.Instret() + _quantum;
+        while (cpu.Instret() < end)
+        {
+            Word ip = cpu.Ip();
+            cpu.ProcessBlock();
+            if (cpu.HasMessage() || cpu.GetFault())
+                return;
+            if (cpu.Ip() == ip && Spinning(cpu, hart, ip))
+            {
+                hart.parked = true;
+                _parked++;
+                _parks++;
+                return;
+            }
+        }
+    }
+
+    // Runs the harts on `threads` host threads until host(cpu) returns false. Each
+    // thread but the calling one keeps a queue of harts and steals from the others
+    // when its own is empty. host(cpu) is called on the calling thread for a hart
+    // that stopped for a message to the host or a fault; faulted harts get no more
+    // turns. Devices are not thread-safe: hart 0, which the CLINT drives, only runs
+    // on the calling thread, and the other harts must be detached from the bus.
+    template <typename Host>
+    void Run(std::deque<Cpu>& cpus, unsigned threads, Host&& host)
+    {
+        for (auto& cpu : cpus)
+            State(cpu.HartId());
+        auto turn = [&](Cpu& cpu) {
+            if (cpu.GetFault())
+                return true;
+            Step(cpu);
+            return !(cpu.HasMessage() || cpu.GetFault()) || host(cpu);
+        };
+
+        std::vector<Queue> queues(threads > 1 ? threads - 1 : 0);
+        for (size_t i = 1; i < cpus.size() && !queues.empty(); ++i)
+            queues[i % queues.size()].harts.push_back(&cpus[i]);
+
+        std::atomic<bool> stop{false};
+        std::mutex lock;
+        std::vector<Cpu*> stopped;    // harts left for the host
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < queues.size(); ++i)
+        {
+            workers.emplace_back([&, i] {
+                while (!stop.load(std::memory_order_relaxed))
+                {
+                    Cpu* cpu = Take(queues, i);
+                    if (!cpu)
+                    {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    Step(*cpu);
+                    if (cpu->HasMessage() || cpu->GetFault())
+                    {
+                        std::lock_guard<std::mutex> guard{lock};
+                        stopped.push_back(cpu);
+                    }
+                    else
+                    {
+                        Give(queues[i], cpu);
+                    }
+                }
+            });
+        }
+
+        bool running = true;
+        std::vector<Cpu*> ready;
+        while (running)
+        {
+            running = turn(cpus.front());
+            if (workers.empty())
+            {
+                for (size_t i = 1; i < cpus.size() && running; ++i)
+                    running = turn(cpus[i]);
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> guard{lock};
+                ready.swap(stopped);
+            }
+            for (Cpu* cpu : ready)
+            {
+                running = running && host(*cpu);
+                if (running && !cpu->GetFault())
+                    Give(queues[cpu->HartId() % queues.size()], cpu);
+            }
+            ready.clear();
+        }
+
+        stop = true;
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    HartSchedulerStats Stats() const
+    {
+        return {_quanta.load(), _parks.load(), _skipped.load()};
+    }
+
+private:
+    static constexpr Word noSpin = ~0u;
+
+    struct Hart
+    {
+        bool parked = false;
+        Word spinIp = noSpin;
+        std::array<Word, 32> regs{};
+        std::vector<std::pair<Word, Word>> watched;   // word address, value when parked
+    };
+
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<Cpu*> harts;
+    };
+
+    // The next hart of the thread's own queue, or else of another one
+    static Cpu* Take(std::vector<Queue>& queues, size_t own)
+    {
+        for (size_t k = 0; k < queues.size(); ++k)
+        {
+            Queue& queue = queues[(own + k) % queues.size()];
+            std::lock_guard<std::mutex> guard{queue.lock};
+            if (queue.harts.empty())
+                continue;
+            Cpu* cpu = queue.harts.front();
+            queue.harts.pop_front();
+            return cpu;
+        }
+        return nullptr;
+    }
+
+    static void Give(Queue& queue, Cpu* cpu)
+    {
+        std::lock_guard<std::mutex> guard{queue.lock};
+        queue.harts.push_back(cpu);
+    }
+
+    // Resized only before the harts run on several threads
+    Hart& State(Word hartId)
+    {
+        if (hartId >= _harts.size())
+            _harts.resize(hartId + 1);
+        return _harts[hartId];
+    }
+
+    // The block at ip just ran into itself; parks on the second run with the same registers
+    bool Spinning(Cpu& cpu, Hart& hart, Word ip)
+    {
+        const Block* block = cpu.FindBlock(ip);
+        if (!block || cpu.InterruptsEnabled() || !OnlyLoads(*block))
+        {
+            hart.spinIp = noSpin;
+            return false;
+        }
+
+        std::array<Word, 32> regs;
+        for (RId r = 0; r < 32; ++r)
+            regs[r] = cpu.Reg(r);
+        if (hart.spinIp != ip || regs != hart.regs)
+        {
+            hart.spinIp = ip;
+            hart.regs = regs;
+            return false;
+        }
+
+        hart.watched.clear();
+        for (auto& instr : block->_instrs)
+        {
+            if (instr->_type != IType::Ld)
+                continue;
+            Word addr = instr->_addr & ~3u;
+            if (addr >= Memory::ramBytes)
+                return false;
+            hart.watched.emplace_back(addr, Peek(cpu.GetMemory(), addr));
+        }
+        return !hart.watched.empty();
+    }
+
+    // A watched word; harts on other threads may be storing to it
+    static Word Peek(const Memory& mem, Word addr)
+    {
+        auto word = reinterpret_cast<const Word*>(mem.HostPtr(addr, sizeof(Word)));
+        return __atomic_load_n(word, __ATOMIC_RELAXED);
+    }
+
+    static bool Changed(const Hart& hart, const Memory& mem)
+    {
+        for (auto& [addr, value] : hart.watched)
+        {
+            if (Peek(mem, addr) != value)
+                return true;
+        }
+        return false;
+    }
+
+    // Nothing in the block but loads, arithmetic and the closing branch
+    static bool OnlyLoads(const Block& block)
+    {
+        for (auto& instr : block._instrs)
+        {
+            switch (instr->_type)
+            {
+                case IType::Alu:
+                case IType::Ld:
+                case IType::Auipc:
+                case IType::Br:
+                case IType::Fence:
+                    break;
+                default:
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    uint64_t _quantum;
+    std::vector<Hart> _harts;
+    std::atomic<size_t> _parked{0};
+    std::atomic<uint64_t> _quanta{0};
+    std::atomic<uint64_t> _parks{0};
+    std::atomic<uint64_t> _skipped{0};
+};
+
+#endif //RISCV_SIM_HARTSCHEDULER_H
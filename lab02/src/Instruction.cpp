@@ -1,7 +0,0 @@
-
-#include "Instruction.h"
-
-constexpr unsigned maxInstructionInFlight = 8;
-
-template <>
-PoolAllocator<Instruction> PoolAllocated<Instruction>::allocator{maxInstructionInFlight};
\ No newline at end of file
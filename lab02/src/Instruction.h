@@ -12,13 +12,21 @@
 enum class Opcode : uint8_t
 {
     Load    = 0b0000011,
+    LoadFp  = 0b0000111,
     MiscMem = 0b0001111,
     OpImm   = 0b0010011,
     Auipc   = 0b0010111,
     Store   = 0b0100011,
+    StoreFp = 0b0100111,
     Amo     = 0b0101111,
     Op      = 0b0110011,
     Lui     = 0b0110111,
+    Madd    = 0b1000011,
+    Msub    = 0b1000111,
+    Nmsub   = 0b1001011,
+    Nmadd   = 0b1001111,
+    OpFp    = 0b1010011,
+    OpV     = 0b1010111,
     Branch  = 0b1100011,
     Jalr    = 0b1100111,
     Jal     = 0b1101111,
@@ -31,19 +39,67 @@ enum class CsrIdx : RId
     Cycle   = 0xc00,
     Mhartid = 0xf10,
     Mtohost = 0x780,
+    Mconsole = 0x7c1, // custom: guest address of the console ring, 0 if none
+    Mstatus = 0x300,
+    Mie     = 0x304,
+    Mtvec   = 0x305,
+    Mscratch = 0x340,
+    Mepc    = 0x341,
+    Mcause  = 0x342,
+    Mip     = 0x344,
+    Fflags  = 0x001,
+    Frm     = 0x002,
+    Fcsr    = 0x003,
+    Vl      = 0xc20,
+    Vtype   = 0xc21,
+    Vlenb   = 0xc22,
+    Cycleh  = 0xc80,
+    Instreth = 0xc82,
+    Mcycle  = 0xb00,
+    Minstret = 0xb02,
+    Mcycleh = 0xb80,
+    Minstreth = 0xb82,
+    // First of 29 each; hpmcounter* are the read-only user aliases
+    Mhpmcounter3 = 0xb03,
+    Mhpmcounter3h = 0xb83,
+    Hpmcounter3 = 0xc03,
+    Hpmcounter3h = 0xc83,
+    Mhpmevent3 = 0x323,
     None    = 0xfff,
 };
 
-// LR, SC, FENCE not implemented
-// LB(U), LH(U), SB, SH not implemented
+// Simulator events counted by mhpmcounterN when mhpmeventN selects them.
+// The timing events are only seen by a hart run under a TimingModel.
+enum class HpmEvent : uint8_t
+{
+    None,
+    Loads,
+    Stores,
+    Branches,
+    TakenBranches,
+    ICacheMisses,
+    DCacheMisses,
+    Mispredicts,
+    LoadUseStalls,
+    Count
+};
+
+// RV32A: LR.W, SC.W and the word AMOs run as host atomics on guest memory;
+// FENCE is a full host fence. FENCE.I decodes as a FENCE: it ends the block, so the
+// next block sees the stores to code
+
+// RV32F and RV32D run on the host FPU, see FpUnit
+
+// A subset of RVV for 8, 16 and 32 bit integer elements, see VectorUnit
 
 // For CSR, only following two are implemented
 // CSRR rd csr (i.e. CSRRS rd csr x0)
 // CSRW csr rs1 (i.e. CSRRW x0 csr rs1)
 
-// SCALL, SBREAK not implemented
+// SCALL (ecall) is serviced by the host syscall proxy, SBREAK not implemented
+// MRET returns from a machine mode interrupt handler, WFI idles until the next device event
 
-enum class IType
+enum class IType : uint8_t
 {
     Unsupported,
     Alu,
@@ -54,7 +110,14 @@ enum class IType
     Br,
     Csrr,
     Csrw,
-    Auipc
+    Auipc,
+    Ecall,
+    Mret,
+    Wfi,
+    Amo,
+    Fence,
+    Fp,
+    Vec
 };
 
 enum class BrFunc : uint8_t
@@ -69,7 +132,7 @@ enum class BrFunc : uint8_t
     NT,
 };
 
-enum class AluFunc
+enum class AluFunc : uint8_t
 {
     Add  = 0b000,
     Sll  = 0b001,
@@ -82,17 +145,177 @@ enum class AluFunc
     Sub  = 0b1000,
     Sra,
     Srl,
+    // Zba and Zbb, see BitOps.h
+    Andn,
+    Orn,
+    Xnor,
+    Min,
+    Max,
+    Minu,
+    Maxu,
+    Rol,
+    Ror,
+    Clz,
+    Ctz,
+    Cpop,
+    SextB,
+    SextH,
+    ZextH,
+    OrcB,
+    Rev8,
+    Sh1add,
+    Sh2add,
+    Sh3add,
     None,
 };
 
+// Width of a memory access, values are funct3 of loads and stores
+enum class MemFunc : uint8_t
+{
+    B  = 0b000,
+    H  = 0b001,
+    W  = 0b010,
+    Bu = 0b100,
+    Hu = 0b101,
+};
+
+// RV32A operation, values are funct5 of the Amo opcode
+enum class AmoFunc : uint8_t
+{
+    Add  = 0b00000,
+    Swap = 0b00001,
+    Lr   = 0b00010,
+    Sc   = 0b00011,
+    Xor  = 0b00100,
+    Or   = 0b01000,
+    And  = 0b01100,
+    Min  = 0b10000,
+    Max  = 0b10100,
+    Minu = 0b11000,
+    Maxu = 0b11100,
+};
+
+// RV32F/D operation; the format is Instruction::_fpDouble
+enum class FpFunc : uint8_t
+{
+    Load,
+    Store,
+    Madd,
+    Msub,
+    Nmsub,
+    Nmadd,
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Sqrt,
+    SgnJ,
+    SgnJn,
+    SgnJx,
+    Min,
+    Max,
+    CvtFF,  // to this format from the other one
+    CvtWF,  // to a signed word
+    CvtWuF,
+    CvtFW,  // from a signed word
+    CvtFWu,
+    MvXW,
+    MvWX,
+    Eq,
+    Lt,
+    Le,
+    Class,
+};
+
+// RVV operation. Vector operands are Instruction::_fdst, _fsrc1 (vs1) and
+// _fsrc2 (vs2, or vs3 of a store); _fsrc3 is v0 when the operation is masked.
+// A scalar operand is _src1 (.vx) or _imm (.vi); _memFunc is the element
+// width of loads and stores.
+enum class VecFunc : uint8_t
+{
+    SetVli,     // vsetvli, vtype in _imm
+    SetIvli,    // vsetivli, AVL << 16 | vtype in _imm
+    SetVl,      // vsetvl, vtype in _src2
+    Load,
+    LoadStrided,
+    Store,
+    StoreStrided,
+    Add,
+    Sub,
+    Rsub,
+    And,
+    Or,
+    Xor,
+    Minu,
+    Min,
+    Maxu,
+    Max,
+    Mul,
+    Macc,
+    Merge,      // vmv.v.* when not masked
+    Seq,
+    Sne,
+    Sltu,
+    Slt,
+    Sleu,
+    Sle,
+    Sgtu,
+    Sgt,
+    RedSum,
+    RedMinu,
+    RedMin,
+    RedMaxu,
+    RedMax,
+    MvXS,
+    MvSX,
+};
+
+// Rounding modes, values are the rm field and frm
+enum class RoundingMode : uint8_t
+{
+    Rne = 0b000,
+    Rtz = 0b001,
+    Rdn = 0b010,
+    Rup = 0b011,
+    Rmm = 0b100,
+    Dyn = 0b111,
+};
+
+inline unsigned AccessSize(MemFunc func)
+{
+    switch (func)
+    {
+        case MemFunc::B:
+        case MemFunc::Bu: return 1;
+        case MemFunc::H:
+        case MemFunc::Hu: return 2;
+        default:          return 4;
+    }
+}
+
 struct Instruction : public PoolAllocated<Instruction>
 {
     IType _type = IType::Unsupported;
     BrFunc _brFunc = BrFunc::NT;
     AluFunc _aluFunc;
+    MemFunc _memFunc = MemFunc::W;
+    AmoFunc _amoFunc = AmoFunc::Add;
+    union
+    {
+        FpFunc _fpFunc = FpFunc::Add;
+        VecFunc _vecFunc;
+    };
+    bool _fpDouble = false;
+    RoundingMode _rm = RoundingMode::Rne;
     std::optional<RId> _dst;
     std::optional<RId> _src1;
     std::optional<RId> _src2;
+    // F, D and V registers; integer operands use _dst and _src1.
+    // Byte sized, so that an instruction still fits in a cache line.
+    std::optional<uint8_t> _fdst;
+    std::optional<uint8_t> _fsrc1;
+    std::optional<uint8_t> _fsrc2;
+    std::optional<uint8_t> _fsrc3;
     std::optional<CsrIdx> _csr;
     std::optional<Word> _imm;
 
@@ -108,20 +331,42 @@ using InstructionPtr = std::unique_ptr<Instruction>;
 
 // Load
 constexpr uint8_t fnLW    = 0b010;
-//constexpr uint8_t fnLB    = 0b000;
-//constexpr uint8_t fnLH    = 0b001;
-//constexpr uint8_t fnLBU   = 0b100;
-//constexpr uint8_t fnLHU   = 0b101;
+constexpr uint8_t fnLB    = 0b000;
+constexpr uint8_t fnLH    = 0b001;
+constexpr uint8_t fnLBU   = 0b100;
+constexpr uint8_t fnLHU   = 0b101;
 // Store
 constexpr uint8_t fnSW    = 0b010;
-//constexpr uint8_t fnSB    = 0b000;
-//constexpr uint8_t fnSH    = 0b001;
+constexpr uint8_t fnSB    = 0b000;
+constexpr uint8_t fnSH    = 0b001;
 // Amo
-constexpr uint8_t fnLR    = 0b00010;
-constexpr uint8_t fnSC    = 0b00011;
+constexpr uint8_t fnAMOW  = 0b010;
+// Zba and Zbb, funct7 of Op and of the shift forms of OpImm
+constexpr uint8_t fnZBA       = 0b0010000;
+constexpr uint8_t fnZBBNEG    = 0b0100000;
+constexpr uint8_t fnZBBMINMAX = 0b0000101;
+constexpr uint8_t fnZBB       = 0b0110000;
+constexpr uint8_t fnZEXTH     = 0b0000100;
+// Whole immediates of orc.b and rev8
+constexpr Word immORCB = 0x287;
+constexpr Word immREV8 = 0x698;
+// LoadFp, StoreFp
+constexpr uint8_t fnFW    = 0b010;
+constexpr uint8_t fnFD    = 0b011;
+// Element width of vector loads and stores
+constexpr uint8_t fnVE8   = 0b000;
+constexpr uint8_t fnVE16  = 0b101;
+constexpr uint8_t fnVE32  = 0b110;
+// OpV
+constexpr uint8_t fnOPIVV = 0b000;
+constexpr uint8_t fnOPMVV = 0b010;
+constexpr uint8_t fnOPIVI = 0b011;
+constexpr uint8_t fnOPIVX = 0b100;
+constexpr uint8_t fnOPMVX = 0b110;
+constexpr uint8_t fnOPCFG = 0b111;
 //MiscMem
 constexpr uint8_t fnFENCE  = 0b000;
-//constexpr uint8_t fnFENCEI = 0b001;
+constexpr uint8_t fnFENCEI = 0b001;
 // System
 constexpr uint8_t fnCSRRW  = 0b001;
 constexpr uint8_t fnCSRRS  = 0b010;
@@ -131,6 +376,8 @@ constexpr uint8_t fnCSRRS  = 0b010;
 //constexpr uint8_t fnCSRRCI = 0b111;
 constexpr uint8_t fnPRIV   = 0b000;
 constexpr uint8_t privSCALL    = 0b000;
+constexpr uint16_t privMRET    = 0x302;
+constexpr uint16_t privWFI     = 0x105;
 
 
 #endif //RISCV_SIM_INSTRUCTION_H
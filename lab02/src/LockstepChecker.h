@@ -0,0 +1,244 @@
+
+#ifndef RISCV_SIM_LOCKSTEPCHECKER_H
+#define RISCV_SIM_LOCKSTEPCHECKER_H
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "Console.h"
+#include "Cpu.h"
+#include "ReplayLog.h"
+
+struct LockstepStats
+{
+    uint64_t blocks = 0;
+    uint64_t instructions = 0;
+    uint64_t scans = 0;         // compares of all of ram
+};
+
+// Checks a fast engine against the reference ProcessInstruction. After every block
+// of the fast cpu a reference cpu on a memory of its own retires as many instructions,
+// and the two are compared: ip, integer and FP registers and the bytes written by
+// every store. Vector stores and host syscalls write memory that no store tells
+// about, so all of ram is compared too, every scanInterval instructions and at the end.
+// The reference replays the host syscalls of the fast cpu and mirrors its console
+// into /dev/null, so both see the same inputs. It has no devices: the engines take
+// interrupts at different boundaries, so programs that take them are out of scope.
+class LockstepChecker
+{
+public:
+    static constexpr uint64_t scanInterval = 1u << 20;
+
+    // Load the program of the fast cpu into RefMemory() before the first Step()
+    LockstepChecker()
+        : _ref(_mem)
+        , _devNull(open("/dev/null", O_WRONLY))
+        , _console(_mem, _devNull)
+        , _lead(ReplayLog::Mode::Record)
+        , _follow(ReplayLog::Mode::Replay)
+    {
+        _follow.Follow(_lead);
+        _ref.AttachLog(_follow);
+    }
+
+    ~LockstepChecker()
+    {
+        close(_devNull);
+    }
+
+    LockstepChecker(const LockstepChecker&) = delete;
+    LockstepChecker& operator=(const LockstepChecker&) = delete;
+
+    Memory& RefMemory()
+    {
+        return _mem;
+    }
+
+    // One block of the fast cpu, freshly reset on the first call; false at the first difference
+    bool Step(Cpu& fast)
+    {
+        if (!_diff.empty())
+            return false;
+        if (!_started)
+        {
+            fast.AttachLog(_lead);
+            _ref.Reset(fast.Ip());
+            _started = true;
+        }
+
+        Word ip = fast.Ip();
+        fast.ProcessBlock();
+        _stats.blocks++;
+
+        _stores.clear();
+        while (_ref.Instret() < fast.Instret() && !_ref.GetFault())
+            Retire();
+        // The instruction the fast cpu faulted on
+        if (fast.GetFault() && !_ref.GetFault() && _ref.Instret() == fast.Instret())
+            Retire();
+        _stats.instructions = _ref.Instret();
+
+        Compare(fast, ip);
+        if (_diff.empty() && fast.Instret() >= _nextScan)
+        {
+            Scan(fast, ip);
+            _nextScan = fast.Instret() + scanInterval;
+        }
+        return _diff.empty();
+    }
+
+    // The last compare of all of ram, when the program is done
+    bool Finish(const Cpu& fast)
+    {
+        if (_diff.empty())
+            Scan(fast, fast.Ip());
+        return _diff.empty();
+    }
+
+    // What differed, empty while the engines agree
+    const std::string& Report() const
+    {
+        return _diff;
+    }
+
+    const LockstepStats& Stats() const
+    {
+        return _stats;
+    }
+
+private:
+    static constexpr unsigned maxLines = 16;
+
+    struct Store
+    {
+        Word addr;
+        Word size;
+    };
+
+    void Retire()
+    {
+        _ref.ProcessInstruction([this](Word, const Instruction& instr) { Track(instr); });
+        if (auto msg = _ref.GetMessage())
+            Mirror(*msg);
+    }
+
+    void Track(const Instruction& instr)
+    {
+        if (instr._type == IType::St)
+            _stores.push_back({instr._addr, AccessSize(instr._memFunc)});
+        else if (instr._type == IType::Amo)
+            _stores.push_back({instr._addr, 4});
+        else if (instr._type == IType::Fp && instr._fpFunc == FpFunc::Store)
+            _stores.push_back({instr._addr, instr._fpDouble ? 8u : 4u});
+    }
+
+    // The host side of the console changes guest memory, so the reference gets one too
+    void Mirror(CpuToHostData msg)
+    {
+        auto type = msg.unpacked.type;
+        auto data = msg.unpacked.data;
+        if (type == CpuToHostType::PrintChar)
+            _console.PutChar(char(data), _ref.ConsoleAddr());
+        else if (type == CpuToHostType::PrintIntLow)
+            _printInt = uint32_t(data);
+        else if (type == CpuToHostType::PrintIntHigh)
+            _console.PutInt(_printInt | uint32_t(data) << 16, _ref.ConsoleAddr());
+        else if (type == CpuToHostType::ConsoleFlush)
+            _console.Flush(_ref.ConsoleAddr());
+    }
+
+    template <typename... Args>
+    void Add(const char* format, Args... args)
+    {
+        if (_lines++ >= maxLines)
+            return;
+        char line[128];
+        std::snprintf(line, sizeof(line), format, args...);
+        _lines == maxLines ? _diff += "  ...\n" : _diff += line;
+    }
+
+    void Compare(const Cpu& fast, Word blockIp)
+    {
+        _lines = 0;
+        if (fast.Ip() != _ref.Ip())
+            Add("  ip 0x%08x, reference 0x%08x\n", fast.Ip(), _ref.Ip());
+        if (fast.Instret() != _ref.Instret())
+            Add("  instret %" PRIu64 ", reference %" PRIu64 "\n", fast.Instret(), _ref.Instret());
+        if (bool(fast.GetFault()) != bool(_ref.GetFault()))
+            Add("  %s, reference %s\n", fast.GetFault() ? "fault" : "no fault", _ref.GetFault() ? "fault" : "no fault");
+        if (!_follow.Divergence().empty())
+            Add("  syscalls: %s\n", _follow.Divergence().c_str());
+        for (RId r = 1; r < 32; ++r)
+        {
+            if (fast.Reg(r) != _ref.Reg(r))
+                Add("  x%u 0x%08x, reference 0x%08x\n", r, fast.Reg(r), _ref.Reg(r));
+        }
+        for (RId r = 0; r < 32; ++r)
+        {
+            if (fast.FReg(r) != _ref.FReg(r))
+                Add("  f%u 0x%016" PRIx64 ", reference 0x%016" PRIx64 "\n", r, fast.FReg(r), _ref.FReg(r));
+        }
+        for (auto& store : _stores)
+        {
+            const char* a = fast.GetMemory().HostPtr(store.addr, store.size);
+            const char* b = _mem.HostPtr(store.addr, store.size);
+            if (a && b && std::memcmp(a, b, store.size) != 0)
+                AddWord(fast, store.addr & ~3u);
+        }
+        Explain(fast, blockIp);
+    }
+
+    void Scan(const Cpu& fast, Word blockIp)
+    {
+        _stats.scans++;
+        _lines = 0;
+        const char* a = fast.GetMemory().HostPtr(0, Memory::ramBytes);
+        const char* b = _mem.HostPtr(0, Memory::ramBytes);
+        if (std::memcmp(a, b, Memory::ramBytes) != 0)
+        {
+            for (Word addr = 0; addr < Memory::ramBytes && _lines < maxLines; addr += 4)
+            {
+                if (std::memcmp(a + addr, b + addr, 4) != 0)
+                    AddWord(fast, addr);
+            }
+        }
+        Explain(fast, blockIp);
+    }
+
+    void AddWord(const Cpu& fast, Word addr)
+    {
+        Add("  mem[0x%08x] 0x%08x, reference 0x%08x\n", addr, fast.GetMemory().Load<Word>(addr), _mem.Load<Word>(addr));
+    }
+
+    // Heads the differences found, if any
+    void Explain(const Cpu& fast, Word blockIp)
+    {
+        if (_diff.empty())
+            return;
+        char head[128];
+        std::snprintf(head, sizeof(head), "engines diverged in the block at 0x%08x, instret %" PRIu64 ":\n",
+                      blockIp, fast.Instret());
+        _diff.insert(0, head);
+    }
+
+    Memory _mem;
+    Cpu _ref;
+    int _devNull;
+    Console _console;
+    ReplayLog _lead;
+    ReplayLog _follow;
+    bool _started = false;
+    uint64_t _nextScan = scanInterval;
+    std::vector<Store> _stores;
+    int32_t _printInt = 0;
+    unsigned _lines = 0;
+    std::string _diff;
+    LockstepStats _stats;
+};
+
+#endif //RISCV_SIM_LOCKSTEPCHECKER_H
@@ -3,20 +3,103 @@
 #define RISCV_SIM_DATAMEMORY_H
 
 #include "Instruction.h"
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <elf.h>
 #include <cstring>
 #include <vector>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <csignal>
+#include <sys/mman.h>
+#include <unistd.h>
 
+// Access to a guest address outside of RAM
+struct MemoryFault
+{
+    Word addr;
+    Word ip = 0; // faulting instruction, filled in by the cpu
+};
+
+// LR reservation of a hart. SC succeeds by a host compare-and-swap against the
+// value LR loaded, so it stays atomic with harts running on several host threads;
+// a word changed and changed back in between goes unnoticed.
+struct Reservation
+{
+    Word addr = 0;
+    Word value = 0;
+    bool valid = false;
+};
+
+// Store to guest code that a cpu translated, its blocks over [begin, end) are stale
+struct CodeWrite
+{
+    Word begin;
+    Word end;
+};
+
+// Guest memory is a single 4 GB host reservation, so every 32-bit guest address
+// maps inside it. Only RAM is readable and writable; the rest is PROT_NONE and
+// accesses to it are caught by a SIGSEGV handler instead of explicit checks.
+// An extra guard page after the 4 GB catches accesses wrapping past 0xffffffff.
+//
+// Memory is byte-addressable and little-endian. Misaligned accesses are allowed
+// and behave like a sequence of byte accesses (they are not atomic). Atomics
+// are host atomic instructions and fault unless aligned.
+//
+// Every guest page has a flags byte, and a store only tests the flags of its page:
+// a page holding words that a cpu translated (MarkCode) or a page still clean since
+// the last Snapshot() takes the slow path. There a store to translated words is
+// logged for the cpus to drop their blocks (CodeEpoch), and the first store to a
+// clean page puts it on the dirty list that Restore() copies back. Harts on several
+// host threads may translate code and store to it; the code log and the pageCode
+// flags change under a lock. Taking snapshots is only safe with the harts on one
+// host thread.
 class Memory
 {
 public:
+    static constexpr size_t addressSpace = size_t(1) << 32u;
+    static constexpr unsigned pageShift = 12;
+    static constexpr Word pageBytes = Word(1) << pageShift;
+    static constexpr size_t codeLogSize = 64;
+
     Memory()
     {
-        mem.fill(0);
+        InstallFaultHandler();
+
+        void* base = mmap(nullptr, reservedBytes(), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED || mprotect(base, ramBytes, PROT_READ | PROT_WRITE) != 0)
+        {
+            std::perror("ERROR: memory: failed reserving guest address space");
+            std::abort();
+        }
+        _base = static_cast<char*>(base);
+        RegisterRegion(_base);
+
+        // Flags of all of the 4 GB, so that a store anywhere can test them; untouched they stay zero pages
+        void* pages = mmap(nullptr, pageCount, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (pages == MAP_FAILED)
+        {
+            std::perror("ERROR: memory: failed allocating page flags");
+            std::abort();
+        }
+        _pages = static_cast<uint8_t*>(pages);
+        _pages[ramPages] = pageEdge;
+    }
+
+    ~Memory()
+    {
+        munmap(_pages, pageCount);
+        UnregisterRegion(_base);
+        munmap(_base, reservedBytes());
     }
 
+    Memory(const Memory&) = delete;
+    Memory& operator=(const Memory&) = delete;
+
     bool LoadElf(const std::string& elf_filename)
     {
         std::ifstream elffile;
@@ -69,17 +152,236 @@ public:
     }
     Word Request(Word ip)
     {
-        return mem[ToWordAddr(ip)];
+        return Load<Word>(ToWordAddr(ip));
     }
 
-    void Request(InstructionPtr& instr)
+    // LR and SC need the reservation of the requesting hart, SC fails without one
+    void Request(InstructionPtr& instr, Reservation* reservation = nullptr)
     {
         if (instr->_type == IType::Ld)
-            instr->_data = mem[ToWordAddr(instr->_addr)];
+            instr->_data = LoadData(instr->_addr, instr->_memFunc);
         else if (instr->_type == IType::St)
-            mem[ToWordAddr(instr->_addr)] = instr->_data;
+            StoreData(instr->_addr, instr->_data, instr->_memFunc);
+        else if (instr->_type == IType::Amo || instr->_type == IType::Fence)
+            Atomic(instr, reservation);
+    }
+
+    // Single host load/store of any width and alignment
+    template <typename T>
+    T Load(Word addr) const
+    {
+        T val;
+        std::memcpy(&val, _base + addr, sizeof(T));
+        return val;
+    }
+
+    template <typename T>
+    void Store(Word addr, T val)
+    {
+        uint8_t flags = Flags(addr >> pageShift);
+        // A misaligned store may end on the next page
+        if ((addr & (pageBytes - 1)) > pageBytes - sizeof(T))
+            flags |= Flags(Word(addr + sizeof(T) - 1) >> pageShift);
+        if (flags && !Storing(addr, sizeof(T)))
+            return;
+        std::memcpy(_base + addr, &val, sizeof(T));
+    }
+
+    // Host view of a guest buffer for zero-copy host I/O, nullptr unless it lies in RAM.
+    // The host may write through it, so it counts as a store to all of the buffer.
+    char* HostPtr(Word addr, Word len)
+    {
+        if (addr > ramBytes || len > ramBytes - addr)
+            return nullptr;
+        Written(addr, len);
+        return _base + addr;
+    }
+
+    const char* HostPtr(Word addr, Word len) const
+    {
+        if (addr > ramBytes || len > ramBytes - addr)
+            return nullptr;
+        return _base + addr;
+    }
+
+    // A cpu translated the code in [begin, end) and wants to hear of stores to it
+    void MarkCode(Word begin, Word end)
+    {
+        std::lock_guard<std::mutex> lock{_codeLock};
+        end = std::min<Word>(end, ramBytes);
+        for (Word word = begin / 4; word < (end + 3) / 4; ++word)
+        {
+            __atomic_fetch_or(&_codeWords[word / 64], uint64_t(1) << (word % 64), __ATOMIC_RELAXED);
+            __atomic_fetch_or(&_pages[word * 4 >> pageShift], pageCode, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Number of stores to translated code so far; a cpu that saw fewer has stale blocks
+    uint64_t CodeEpoch() const
+    {
+        return __atomic_load_n(&_codeEpoch, __ATOMIC_ACQUIRE);
+    }
+
+    // The store to code number `epoch`, unless it dropped out of the log already
+    std::optional<CodeWrite> CodeWriteAt(uint64_t epoch) const
+    {
+        std::lock_guard<std::mutex> lock{_codeLock};
+        if (_codeEpoch - epoch > codeLogSize)
+            return std::nullopt;
+        return _codeLog[epoch % codeLogSize];
+    }
+
+    // Copy of RAM to go back to. From now on the first store to a page puts it on
+    // the dirty list, and Restore() copies back only the pages on it.
+    void Snapshot()
+    {
+        _snapshot.assign(_base, _base + ramBytes);
+        _dirty.clear();
+        for (Word page = 0; page < ramPages; ++page)
+            _pages[page] |= pageClean;
+    }
+
+    // Back to the last snapshot; returns the number of pages copied
+    size_t Restore()
+    {
+        size_t restored = _dirty.size();
+        for (Word page : _dirty)
+        {
+            Word addr = page << pageShift;
+            DropCode(addr, addr + pageBytes);
+            std::memcpy(_base + addr, _snapshot.data() + addr, pageBytes);
+            _pages[page] |= pageClean;
+        }
+        _dirty.clear();
+        return restored;
+    }
+
+    // Pages stored to since the last snapshot or restore
+    const std::vector<Word>& DirtyPages() const
+    {
+        return _dirty;
+    }
+
+    // End of the highest segment loaded from the ELF file
+    Word ProgramEnd() const
+    {
+        return _programEnd;
+    }
+
+    Word LoadData(Word addr, MemFunc func) const
+    {
+        switch (func)
+        {
+            case MemFunc::B:  return SignedWord(Load<int8_t>(addr));
+            case MemFunc::H:  return SignedWord(Load<int16_t>(addr));
+            case MemFunc::Bu: return Load<uint8_t>(addr);
+            case MemFunc::Hu: return Load<uint16_t>(addr);
+            default:          return Load<Word>(addr);
+        }
+    }
+
+    void StoreData(Word addr, Word data, MemFunc func)
+    {
+        switch (func)
+        {
+            case MemFunc::B: Store<uint8_t>(addr, data); break;
+            case MemFunc::H: Store<uint16_t>(addr, data); break;
+            default:         Store<Word>(addr, data); break;
+        }
+    }
+
+    // AMOs, LR/SC and FENCE; rarely executed, so kept out of the block loop
+    __attribute__((noinline)) void Atomic(InstructionPtr& instr, Reservation* reservation)
+    {
+        if (instr->_type == IType::Fence)
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return;
+        }
+
+        Word addr = instr->_addr;
+        if (addr % 4)
+        {
+            t_fault = {_base, addr, {nullptr, nullptr}};
+            return;
+        }
+        if (instr->_amoFunc != AmoFunc::Lr && Flags(addr >> pageShift))
+            Written(addr, 4);
+
+        // A guard page faults and is retried like a plain access
+        auto word = reinterpret_cast<Word*>(_base + addr);
+        Word val = instr->_data;
+        constexpr int order = __ATOMIC_SEQ_CST;
+        switch (instr->_amoFunc)
+        {
+            case AmoFunc::Lr:
+                instr->_data = __atomic_load_n(word, order);
+                if (reservation)
+                    *reservation = {addr, instr->_data, true};
+                return;
+            case AmoFunc::Sc:
+            {
+                bool reserved = reservation && reservation->valid && reservation->addr == addr;
+                Word expected = reserved ? reservation->value : 0;
+                bool stored = reserved && __atomic_compare_exchange_n(word, &expected, val, false, order, order);
+                if (reservation)
+                    reservation->valid = false;
+                instr->_data = stored ? 0 : 1;
+                return;
+            }
+            case AmoFunc::Swap: instr->_data = __atomic_exchange_n(word, val, order); return;
+            case AmoFunc::Add:  instr->_data = __atomic_fetch_add(word, val, order); return;
+            case AmoFunc::Xor:  instr->_data = __atomic_fetch_xor(word, val, order); return;
+            case AmoFunc::And:  instr->_data = __atomic_fetch_and(word, val, order); return;
+            case AmoFunc::Or:   instr->_data = __atomic_fetch_or(word, val, order); return;
+            default: break;
+        }
+
+        // No host instruction for min and max, retry until the word did not change under us
+        Word old = __atomic_load_n(word, order);
+        Word desired;
+        do
+        {
+            switch (instr->_amoFunc)
+            {
+                case AmoFunc::Min:  desired = SignedWord(old) < SignedWord(val) ? old : val; break;
+                case AmoFunc::Max:  desired = SignedWord(old) > SignedWord(val) ? old : val; break;
+                case AmoFunc::Minu: desired = std::min(old, val); break;
+                default:            desired = std::max(old, val); break;
+            }
+        } while (!__atomic_compare_exchange_n(word, &old, desired, true, order, order));
+        instr->_data = old;
     }
 
+    // Set by the fault handler when the last access of this thread missed RAM.
+    // The access itself completed on a temporary zero page.
+    static bool Faulted()
+    {
+        return t_fault.region != nullptr;
+    }
+
+    // Returns the pending fault and puts the guard page back
+    std::optional<MemoryFault> TakeFault()
+    {
+        if (t_fault.region != _base)
+            return std::nullopt;
+
+        for (char* page : t_fault.pages)
+        {
+            if (!page)
+                continue;
+            madvise(page, pageSize(), MADV_DONTNEED);
+            mprotect(page, pageSize(), PROT_NONE);
+        }
+
+        MemoryFault fault{Word(t_fault.offset)};
+        t_fault = {};
+        return fault;
+    }
+
+    static constexpr size_t size = 128*1024; // memory size in 4-byte words
+    static constexpr size_t ramBytes = size * sizeof(Word);
+
 private:
     template <typename Elf_Ehdr, typename Elf_Phdr>
     bool load_elf_specific(char* buf, size_t buf_sz) {
@@ -90,14 +392,19 @@ private:
             std::cerr << "ERROR: load_elf: file too small for expected number of program header tables" << std::endl;
             return false;
         }
-        auto memptr = reinterpret_cast<char*>(mem.data());
+        auto memptr = _base;
         // loop through program header tables
         for (int i = 0 ; i < ehdr->e_phnum ; i++) {
             if ((phdr[i].p_type == PT_LOAD) && (phdr[i].p_memsz > 0)) {
+                if (phdr[i].p_paddr + phdr[i].p_memsz > ramBytes) {
+                    std::cerr << "ERROR: load_elf: segment does not fit in memory" << std::endl;
+                    return false;
+                }
                 if (phdr[i].p_memsz < phdr[i].p_filesz) {
                     std::cerr << "ERROR: load_elf: file size is larger than memory size" << std::endl;
                     return false;
                 }
+                Written(phdr[i].p_paddr, phdr[i].p_memsz);
                 if (phdr[i].p_filesz > 0) {
                     if (phdr[i].p_offset + phdr[i].p_filesz > buf_sz) {
                         std::cerr << "ERROR: load_elf: file section overflow" << std::endl;
@@ -114,15 +421,194 @@ private:
                     size_t zeros_sz = phdr[i].p_memsz - phdr[i].p_filesz;
                     std::memset(memptr + phdr[i].p_paddr + phdr[i].p_filesz, 0, zeros_sz);
                 }
+                _programEnd = std::max<Word>(_programEnd, phdr[i].p_paddr + phdr[i].p_memsz);
             }
         }
         return true;
     }
 
 
-    static Word ToWordAddr(Word ip) { return ip >> 2u; }
-    static constexpr size_t size = 128*1024; // memory size in 4-byte words
-    std::array<Word, size> mem;
+    // Pending fault of the current thread (zero-initialized)
+    struct Fault
+    {
+        char* region;
+        size_t offset;
+        char* pages[2]; // an unaligned access may touch two guard pages
+    };
+
+    static constexpr size_t maxRegions = 64;
+    static constexpr size_t pageCount = addressSpace >> pageShift;
+    static constexpr Word ramPages = ramBytes >> pageShift;
+
+    // Page flags
+    static constexpr uint8_t pageCode = 1;  // holds translated code
+    static constexpr uint8_t pageClean = 2; // not stored to since the snapshot
+    static constexpr uint8_t pageEdge = 4;  // first page past RAM
+
+    // Other threads may be changing the pageCode flag
+    uint8_t Flags(Word page) const
+    {
+        return __atomic_load_n(&_pages[page], __ATOMIC_RELAXED);
+    }
+
+    // Slow path of a store to a page with flags; false if the store must not be done.
+    // A store straddling the end of RAM faults without writing its bytes inside RAM.
+    __attribute__((noinline)) bool Storing(Word addr, Word len)
+    {
+        if (addr < ramBytes && len > ramBytes - addr)
+        {
+            t_fault = {_base, ramBytes, {nullptr, nullptr}};
+            return false;
+        }
+        Written(addr, len);
+        return true;
+    }
+
+    // Slow path of a store to a page with flags
+    __attribute__((noinline)) void Written(Word addr, Word len)
+    {
+        if (len == 0 || addr >= ramBytes)
+            return;
+        Word end = addr + std::min<Word>(len, ramBytes - addr);
+        bool code = false;
+        for (Word page = addr >> pageShift; page <= (end - 1) >> pageShift; ++page)
+        {
+            if (_pages[page] & pageClean)
+            {
+                _pages[page] &= ~pageClean;
+                _dirty.push_back(page);
+            }
+            code |= Flags(page) & pageCode;
+        }
+        if (code)
+            DropCode(addr, end);
+    }
+
+    // Logs a store to [begin, end) if it hits translated words, and forgets them:
+    // they are code again only once translated again
+    void DropCode(Word begin, Word end)
+    {
+        bool hit = false;
+        for (Word word = begin / 4; word < (end + 3) / 4; ++word)
+        {
+            uint64_t bit = uint64_t(1) << (word % 64);
+            if (__atomic_load_n(&_codeWords[word / 64], __ATOMIC_RELAXED) & bit)
+                hit |= __atomic_fetch_and(&_codeWords[word / 64], ~bit, __ATOMIC_RELAXED) & bit;
+        }
+        if (!hit)
+            return;
+        // The entry is in the log before a cpu can see the new epoch
+        std::lock_guard<std::mutex> lock{_codeLock};
+        _codeLog[_codeEpoch % codeLogSize] = {begin, end};
+        __atomic_store_n(&_codeEpoch, _codeEpoch + 1, __ATOMIC_RELEASE);
+
+        // Pages left without code stop taking the slow path for it
+        constexpr size_t wordsPerPage = pageBytes / 4 / 64;
+        for (Word page = begin >> pageShift; page <= (end - 1) >> pageShift; ++page)
+        {
+            auto first = _codeWords.begin() + page * wordsPerPage;
+            auto none = [](uint64_t& bits) { return __atomic_load_n(&bits, __ATOMIC_RELAXED) == 0; };
+            if (std::all_of(first, first + wordsPerPage, none))
+                __atomic_fetch_and(&_pages[page], uint8_t(~pageCode), __ATOMIC_RELAXED);
+        }
+    }
+
+    static size_t pageSize()
+    {
+        static const size_t sz = sysconf(_SC_PAGESIZE);
+        return sz;
+    }
+
+    static void InstallFaultHandler()
+    {
+        static std::once_flag once;
+        std::call_once(once, [] {
+            pageSize();
+            struct sigaction sa{};
+            sa.sa_sigaction = HandleFault;
+            sa.sa_flags = SA_SIGINFO;
+            sigemptyset(&sa.sa_mask);
+            sigaction(SIGSEGV, &sa, &s_prevAction);
+        });
+    }
+
+    // The faulting page stays readable and writable until TakeFault(). In that window
+    // accesses of harts on other host threads to the same page do not fault: they
+    // read zeros, and TakeFault() throws their writes away with the page.
+    static void HandleFault(int sig, siginfo_t* info, void* ctx)
+    {
+        auto addr = static_cast<char*>(info->si_addr);
+        for (auto& slot : s_regions)
+        {
+            char* base = slot.load(std::memory_order_acquire);
+            if (base && addr >= base && addr < base + reservedBytes())
+            {
+                // Let the access complete on a fresh zero page and report it afterwards
+                size_t offset = addr - base;
+                char* page = base + (offset & ~(pageSize() - 1));
+                mprotect(page, pageSize(), PROT_READ | PROT_WRITE);
+                if (t_fault.region == nullptr)
+                    t_fault = {base, offset, {page, nullptr}};
+                else
+                    t_fault.pages[1] = page;
+                return;
+            }
+        }
+
+        // Not a guest access: hand over to whoever was there before us
+        if (s_prevAction.sa_flags & SA_SIGINFO)
+            s_prevAction.sa_sigaction(sig, info, ctx);
+        else if (s_prevAction.sa_handler != SIG_DFL && s_prevAction.sa_handler != SIG_IGN)
+            s_prevAction.sa_handler(sig);
+        else
+        {
+            signal(sig, SIG_DFL);
+            raise(sig);
+        }
+    }
+
+    static void RegisterRegion(char* base)
+    {
+        for (auto& slot : s_regions)
+        {
+            char* expected = nullptr;
+            if (slot.compare_exchange_strong(expected, base))
+                return;
+        }
+        std::cerr << "ERROR: memory: too many guest address spaces" << std::endl;
+        std::abort();
+    }
+
+    static void UnregisterRegion(char* base)
+    {
+        for (auto& slot : s_regions)
+        {
+            char* expected = base;
+            if (slot.compare_exchange_strong(expected, nullptr))
+                return;
+        }
+    }
+
+    static size_t reservedBytes()
+    {
+        return addressSpace + pageSize();
+    }
+
+    static Word ToWordAddr(Word ip) { return ip & ~3u; }
+
+    char* _base;
+    Word _programEnd = 0;
+    uint8_t* _pages;
+    std::vector<uint64_t> _codeWords = std::vector<uint64_t>(ramBytes / 4 / 64);
+    std::array<CodeWrite, codeLogSize> _codeLog{};
+    uint64_t _codeEpoch = 0;
+    mutable std::mutex _codeLock;
+    std::vector<char> _snapshot;
+    std::vector<Word> _dirty;
+
+    static inline std::atomic<char*> s_regions[maxRegions] = {};
+    static inline struct sigaction s_prevAction{};
+    static inline thread_local Fault t_fault;
 };
 
 #endif //RISCV_SIM_DATAMEMORY_H
@@ -0,0 +1,361 @@
+
+#ifndef RISCV_SIM_OOOMODEL_H
+#define RISCV_SIM_OOOMODEL_H
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include "TimingModel.h"
+
+struct OooConfig
+{
+    unsigned width = 4;             // fetched, dispatched and committed per cycle
+    unsigned issueWidth = 4;        // issued to functional units per cycle
+    unsigned robSize = 64;
+    unsigned lsqSize = 16;          // loads and stores in flight
+    unsigned physRegs = 96;         // rename registers: physRegs - 32 destinations in flight
+    unsigned frontendDepth = 4;     // fetch to dispatch
+    unsigned fetchQueue = 16;
+
+    unsigned alus = 2;
+    unsigned branchUnits = 1;
+    unsigned memPorts = 1;
+
+    unsigned aluLatency = 1;
+    unsigned branchLatency = 1;
+    unsigned loadLatency = 3;       // L1 hit
+    unsigned storeLatency = 1;
+    unsigned missPenalty = 20;
+
+    CacheConfig icache;
+    CacheConfig dcache;
+};
+
+// A core of the given width with the windows and functional units scaled along
+inline OooConfig OooConfigForWidth(unsigned width)
+{
+    OooConfig config;
+    config.width = width;
+    config.issueWidth = width;
+    config.robSize = 16 * width;
+    config.lsqSize = 4 * width;
+    config.physRegs = 32 + 16 * width;
+    config.fetchQueue = 4 * width;
+    config.alus = width;
+    config.branchUnits = std::max(1u, width / 2);
+    config.memPorts = std::max(1u, width / 2);
+    return config;
+}
+
+// Why the oldest instruction kept the core from committing
+enum class Stall
+{
+    Frontend,   // fetch bandwidth and pipeline refill
+    Icache,
+    Branch,     // refetch after a misprediction
+    Rob,
+    Lsq,
+    Regs,       // no free rename register
+    Serialize,  // CSR writes, ecall, mret, wfi, atomics and fences drain the pipeline
+    Dependency, // waiting for operands
+    Dcache,
+    Unit,       // functional unit or issue port busy
+    Count
+};
+
+inline const char* StallName(Stall stall)
+{
+    static const char* names[] = {"frontend", "icache", "branch", "rob", "lsq", "regs",
+                                  "serialize", "deps", "dcache", "units"};
+    return names[size_t(stall)];
+}
+
+struct OooStats
+{
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    unsigned width = 0;
+    std::array<uint64_t, size_t(Stall::Count)> stalls{};    // unused commit slots, by cause
+    uint64_t mispredicts = 0;
+    uint64_t forwardedLoads = 0;
+
+    double Ipc() const
+    {
+        return cycles ? double(instructions) / cycles : 0;
+    }
+
+    // Share of all commit slots lost to a cause
+    double StallShare(Stall stall) const
+    {
+        return cycles ? double(stalls[size_t(stall)]) / (cycles * width) : 0;
+    }
+};
+
+// Trace driven out-of-order core. The functional cpu is the oracle: every
+// retired instruction is scheduled in program order through fetch, rename
+// and dispatch, issue and commit, taking the earliest cycle each stage allows
+// given the window sizes, the operands and the functional units. Renaming
+// removes false dependencies, so only true data dependencies and the limited
+// number of rename registers hold instructions back. Commit slots left unused
+// before an instruction commits are charged to the cause that delayed it.
+class OooModel
+{
+public:
+    explicit OooModel(const OooConfig& config = {})
+        : _config(config)
+        , _icache(config.icache)
+        , _dcache(config.dcache)
+        , _robCommit(config.robSize)
+        , _lsqCommit(config.lsqSize)
+        , _fetchDispatch(config.fetchQueue)
+    {
+        _stats.width = config.width;
+        for (unsigned i = 32; i < std::max(config.physRegs, 33u); ++i)
+            _freeRegs.push(0);
+    }
+
+    void operator()(Word ip, const Instruction& instr)
+    {
+        uint64_t seq = _stats.instructions++;
+        bool isMem = instr._type == IType::Ld || instr._type == IType::St;
+        bool serializing = IsSerializing(instr._type);
+
+        // Fetch
+        Stall reason = Stall::Frontend;
+        uint64_t fetch = _fetchCycle;
+        if (_fetchedInCycle == _config.width || _redirect)
+            fetch++;
+        if (_redirect && _resolveCycle + 1 > fetch)
+        {
+            fetch = _resolveCycle + 1;
+            reason = Stall::Branch;
+        }
+        fetch = std::max(fetch, _fetchDispatch[seq % _config.fetchQueue]);
+        if (!_icache.Access(ip))
+        {
+            fetch += _config.missPenalty;
+            reason = Stall::Icache;
+        }
+        _fetchedInCycle = fetch == _fetchCycle ? _fetchedInCycle + 1 : 1;
+        _fetchCycle = fetch;
+
+        // Rename and dispatch
+        uint64_t dispatch = fetch + _config.frontendDepth;
+        auto bound = [&](uint64_t cycle, Stall why) {
+            if (cycle > dispatch)
+            {
+                dispatch = cycle;
+                reason = why;
+            }
+        };
+        bound(_robCommit[seq % _config.robSize] + 1, Stall::Rob);
+        if (isMem)
+            bound(_lsqCommit[_memOps % _config.lsqSize] + 1, Stall::Lsq);
+        if (instr._dst)
+            bound(_freeRegs.top(), Stall::Regs);
+        if (serializing || _serializeUntil)
+            bound(std::max(_lastCommit, _serializeUntil) + 1, Stall::Serialize);
+        if (dispatch == _dispatchCycle && _dispatchedInCycle == _config.width)
+            dispatch++;
+        _dispatchedInCycle = dispatch == _dispatchCycle ? _dispatchedInCycle + 1 : 1;
+        _dispatchCycle = dispatch;
+        _fetchDispatch[seq % _config.fetchQueue] = dispatch;
+        if (instr._dst)
+            _freeRegs.pop();
+
+        // Operands
+        uint64_t ready = dispatch + 1;
+        for (auto src : {instr._src1, instr._src2})
+        {
+            if (src && *src != 0 && _regReady[*src] > ready)
+            {
+                ready = _regReady[*src];
+                reason = Stall::Dependency;
+            }
+        }
+
+        // Issue to the first free unit of the right kind
+        Unit unit = UnitOf(instr._type);
+        uint64_t issue = ready;
+        while (_issued.Count(issue) >= _config.issueWidth || _unitBusy[size_t(unit)].Count(issue) >= UnitCount(unit))
+            issue++;
+        if (issue > ready)
+            reason = Stall::Unit;
+        _issued.Take(issue);
+        _unitBusy[size_t(unit)].Take(issue);
+
+        // Execute
+        uint64_t latency = Latency(instr._type);
+        if (instr._type == IType::Ld)
+        {
+            auto store = _storeData.find(instr._addr & ~3u);
+            if (store != _storeData.end() && store->second.commit >= issue)
+            {
+                // Forwarded from a store still in the queue
+                _stats.forwardedLoads++;
+                issue = std::max(issue, store->second.complete);
+                latency = 1;
+            }
+            else if (instr._addr < Memory::ramBytes && !_dcache.Access(instr._addr, AccessSize(instr._memFunc)))
+            {
+                latency += _config.missPenalty;
+                reason = Stall::Dcache;
+            }
+        }
+        uint64_t complete = issue + latency;
+        if (instr._dst)
+            _regReady[*instr._dst] = complete;
+
+        // Commit in order
+        uint64_t commit = std::max(complete, _lastCommit);
+        if (commit == _lastCommit && _committedInCycle == _config.width)
+            commit++;
+        if (commit > _lastCommit)
+        {
+            uint64_t lost = _config.width - _committedInCycle + _config.width * (commit - _lastCommit - 1);
+            _stats.stalls[size_t(reason)] += lost;
+        }
+        _committedInCycle = commit == _lastCommit ? _committedInCycle + 1 : 1;
+        _lastCommit = commit;
+        _stats.cycles = commit + 1;
+
+        _robCommit[seq % _config.robSize] = commit;
+        if (isMem)
+            _lsqCommit[_memOps++ % _config.lsqSize] = commit;
+        // The register that held the old value of dst is free once the new writer commits
+        if (instr._dst)
+            _freeRegs.push(commit + 1);
+        if (instr._type == IType::St)
+        {
+            if (instr._addr < Memory::ramBytes)
+                _dcache.Access(instr._addr, AccessSize(instr._memFunc));
+            _storeData[instr._addr & ~3u] = {complete, commit};
+        }
+        _serializeUntil = serializing ? commit : 0;
+
+        // Control flow: a taken branch ends the fetch group, a misprediction waits for resolution
+        bool taken = instr._nextIp != ip + 4;
+        bool mispredicted = !_predictor.Predict(ip, instr);
+        if (mispredicted)
+            _stats.mispredicts++;
+        _redirect = taken || mispredicted;
+        _resolveCycle = mispredicted ? complete : 0;
+    }
+
+    const OooStats& Stats() const
+    {
+        return _stats;
+    }
+
+private:
+    enum class Unit { Alu, Branch, Mem, Count };
+
+    // Per cycle usage counts for the cycles around the commit point
+    class CycleCounter
+    {
+    public:
+        unsigned Count(uint64_t cycle) const
+        {
+            auto& slot = _slots[cycle % _slots.size()];
+            return slot.first == cycle ? slot.second : 0;
+        }
+
+        void Take(uint64_t cycle)
+        {
+            auto& slot = _slots[cycle % _slots.size()];
+            if (slot.first != cycle)
+                slot = {cycle, 0};
+            slot.second++;
+        }
+
+    private:
+        std::array<std::pair<uint64_t, unsigned>, 4096> _slots{};
+    };
+
+    struct StoreData
+    {
+        uint64_t complete;
+        uint64_t commit;
+    };
+
+    static bool IsSerializing(IType type)
+    {
+        return type == IType::Csrw || type == IType::Ecall || type == IType::Mret ||
+               type == IType::Wfi || type == IType::Amo || type == IType::Fence || type == IType::Unsupported;
+    }
+
+    static Unit UnitOf(IType type)
+    {
+        switch (type)
+        {
+            case IType::Ld:
+            case IType::St:
+            case IType::Amo: return Unit::Mem;
+            case IType::Br:
+            case IType::J:
+            case IType::Jr:
+            case IType::Mret: return Unit::Branch;
+            default: return Unit::Alu;
+        }
+    }
+
+    unsigned UnitCount(Unit unit) const
+    {
+        switch (unit)
+        {
+            case Unit::Mem: return _config.memPorts;
+            case Unit::Branch: return _config.branchUnits;
+            default: return _config.alus;
+        }
+    }
+
+    unsigned Latency(IType type) const
+    {
+        switch (type)
+        {
+            case IType::Ld: return _config.loadLatency;
+            case IType::St: return _config.storeLatency;
+            case IType::Br:
+            case IType::J:
+            case IType::Jr:
+            case IType::Mret: return _config.branchLatency;
+            default: return _config.aluLatency;
+        }
+    }
+
+    OooConfig _config;
+    CacheModel _icache;
+    CacheModel _dcache;
+    BranchPredictor _predictor;
+
+    uint64_t _fetchCycle = 0;
+    unsigned _fetchedInCycle = 0;
+    bool _redirect = false;
+    uint64_t _resolveCycle = 0;
+
+    uint64_t _dispatchCycle = 0;
+    unsigned _dispatchedInCycle = 0;
+    uint64_t _serializeUntil = 0;
+
+    uint64_t _lastCommit = 0;
+    unsigned _committedInCycle = 0;
+
+    std::vector<uint64_t> _robCommit;       // commit cycle of the instruction in each ROB slot
+    std::vector<uint64_t> _lsqCommit;
+    std::vector<uint64_t> _fetchDispatch;   // dispatch cycle of the instruction in each fetch queue slot
+    uint64_t _memOps = 0;
+    std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t>> _freeRegs;
+    std::array<uint64_t, 32> _regReady{};
+    std::unordered_map<Word, StoreData> _storeData;
+
+    CycleCounter _issued;
+    std::array<CycleCounter, size_t(Unit::Count)> _unitBusy;
+
+    OooStats _stats;
+};
+
+#endif //RISCV_SIM_OOOMODEL_H
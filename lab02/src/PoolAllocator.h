@@ -1,122 +1,323 @@
-
 #ifndef RISCV_SIM_POOLALLOCATOR_H
 #define RISCV_SIM_POOLALLOCATOR_H
 
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <new>
+#include <vector>
+
+constexpr size_t cacheLineSize = 64;
 
-template <typename T>
-class PoolAllocator
+struct PoolStats
 {
-public:
-    PoolAllocator(size_t chunksPerBlock)
-            : _chunksPerBlock(chunksPerBlock) {}
+    size_t slabs = 0;
+    size_t bytes = 0;           // held in slabs
+    uint64_t allocations = 0;
+    uint64_t frees = 0;         // chunks of this pool freed; by other threads once collected
+
+    uint64_t Live() const { return allocations - frees; }
+};
 
-    void *allocate(size_t size)
+// Chunks of one size carved from slabs aligned to their size, a power of two, so
+// that every chunk finds the head of its slab. Chunks are whole cache lines and
+// start on one, so that no two share a line. A freed chunk goes to a free list;
+// chunks never handed out are bumped off the current slab, so Reset() makes every
+// chunk free at once without touching them. A pool is not thread-safe: every
+// thread has its own (see PoolAllocated). A chunk freed by another thread than the
+// one that allocated it goes back to the pool it came from, through a lock-free
+// list the pool collects once it runs out of chunks. The pool keeps its slabs until
+// Release(), or until its thread exits for a thread local pool; if chunks are still
+// in use then, the thread freeing the last one releases the slabs.
+// Trivially destructible, so that a thread_local pool costs no guard.
+class SlabPool
+{
+public:
+    // Slabs hold at least chunksPerSlab chunks, as many as fit a power of two bytes
+    constexpr SlabPool(size_t chunkSize, size_t chunksPerSlab, bool threadLocal = false)
+        : _chunkSize(RoundUp(chunkSize < sizeof(Chunk) ? sizeof(Chunk) : chunkSize, cacheLineSize))
+        , _slabSize(PowerOfTwo(cacheLineSize + _chunkSize * (chunksPerSlab ? chunksPerSlab : 1)))
+        , _threadLocal(threadLocal)
     {
 
-        // No chunks left in the current block, or no any block
-        // exists yet. Allocate a new one, passing the chunk size:
+    }
+
+    SlabPool(const SlabPool&) = delete;
+    SlabPool& operator=(const SlabPool&) = delete;
 
-        if (_alloc == nullptr)
+    void* Allocate()
+    {
+        _stats.allocations++;
+        if (Chunk* chunk = _free)
         {
-            _alloc = allocateBlock(size);
+            _free = chunk->next;
+            return chunk;
         }
+        if (_bump == _end)
+            return Refill();
+        void* chunk = _bump;
+        _bump += _chunkSize;
+        return chunk;
+    }
 
-        // The return value is the current position of
-        // the allocation pointer:
-
-        Chunk *freeChunk = _alloc;
-
-        // Advance (bump) the allocation pointer to the next chunk.
-        //
-        // When no chunks left, the `_alloc` will be set to `nullptr`, and
-        // this will cause allocation of a new block on the next request:
+    // Any chunk of a pool of the same size, allocated by any thread
+    void Deallocate(void* ptr)
+    {
+        auto* chunk = static_cast<Chunk*>(ptr);
+        Owner* owner = SlabOf(chunk)->owner;
+        if (owner != _owner)
+        {
+            GiveBack(owner, chunk);
+            return;
+        }
+        _stats.frees++;
+        chunk->next = _free;
+        _free = chunk;
+    }
 
-        _alloc = _alloc->next;
+    // Frees every chunk at once and keeps the slabs, for when none is in use any more
+    void Reset()
+    {
+        _free = nullptr;
+        _current = nullptr;
+        _bump = _end = nullptr;
+        _stats.frees = _stats.allocations;
+        _collected = 0;
+        if (_owner)
+        {
+            _owner->returned.store(nullptr, std::memory_order_relaxed);
+            _owner->balance.store(0, std::memory_order_relaxed);
+        }
+    }
 
-        return freeChunk;
+    // Reset and hands the slabs back to the OS
+    void Release()
+    {
+        Reset();
+        while (Slab* slab = _first)
+        {
+            _first = slab->next;
+            std::free(slab);
+        }
+        delete _owner;
+        _owner = nullptr;
+        _stats.slabs = 0;
+        _stats.bytes = 0;
     }
-    void deallocate(void *chunk, size_t size)
+
+    size_t ChunkSize() const
     {
+        return _chunkSize;
+    }
 
-        // The freed chunk's next pointer points to the
-        // current allocation pointer:
+    const PoolStats& Stats() const
+    {
+        return _stats;
+    }
 
-        reinterpret_cast<Chunk *>(chunk)->next = _alloc;
+private:
+    struct Chunk
+    {
+        Chunk* next;
+    };
 
-        // And the allocation pointer is now set
-        // to the returned (free) chunk:
+    struct Owner;
 
-        _alloc = reinterpret_cast<Chunk *>(chunk);
-    }
+    // Heads a slab; the chunks start on the next cache line
+    struct Slab
+    {
+        Slab* next;
+        Owner* owner;
+    };
 
-private:
-    struct Chunk {
-        /**
-         * When a chunk is free, the `next` contains the
-         * address of the next chunk in a list.
-         *
-         * When it's allocated, this space is used by
-         * the user.
-         */
-        Chunk *next;
+    // What other threads need of a pool: where to give its chunks back and, once
+    // the thread of the pool has exited, which slabs to free after the last one.
+    // balance goes down by one for every chunk given back; when the thread exits it
+    // adds the chunks it handed out and did not get back itself, so the balance
+    // then counts the chunks still in use and reaches zero with the last of them.
+    struct Owner
+    {
+        std::atomic<Chunk*> returned{nullptr};
+        std::atomic<int64_t> balance{0};
+        Slab* slabs = nullptr;
     };
 
-    /**
-     * Number of chunks per larger block.
-     */
-    size_t _chunksPerBlock;
+    // Hands the thread local pools of a thread over to their owners when it exits
+    struct ThreadExit
+    {
+        std::vector<SlabPool*> pools;
 
-    /**
-     * Allocation pointer.
-     */
-    Chunk *_alloc = nullptr;
+        ~ThreadExit()
+        {
+            for (SlabPool* pool : pools)
+                pool->Orphan();
+        }
+    };
 
-    /**
-     * Allocates a larger block (pool) for chunks.
-     */
-    Chunk *allocateBlock(size_t chunkSize)
+    static constexpr size_t RoundUp(size_t n, size_t align)
     {
-//        cout << "\nAllocating block (" << _chunksPerBlock << " chunks):\n\n";
+        return (n + align - 1) / align * align;
+    }
 
-        size_t blockSize = _chunksPerBlock * chunkSize;
+    static constexpr size_t PowerOfTwo(size_t n)
+    {
+        size_t p = cacheLineSize;
+        while (p < n)
+            p *= 2;
+        return p;
+    }
 
-        // The first chunk of the new block.
-        auto *blockBegin = reinterpret_cast<Chunk *>(malloc(blockSize));
+    Slab* SlabOf(Chunk* chunk) const
+    {
+        return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(chunk) & ~uintptr_t(_slabSize - 1));
+    }
 
-        // Once the block is allocated, we need to chain all
-        // the chunks in this block:
+    // A chunk of another pool, freed on this thread
+    __attribute__((noinline)) static void GiveBack(Owner* owner, Chunk* chunk)
+    {
+        chunk->next = owner->returned.load(std::memory_order_relaxed);
+        while (!owner->returned.compare_exchange_weak(chunk->next, chunk, std::memory_order_release,
+                                                      std::memory_order_relaxed))
+        {
+        }
+        if (owner->balance.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            FreeSlabs(owner);
+    }
 
-        Chunk *chunk = blockBegin;
+    static void FreeSlabs(Owner* owner)
+    {
+        while (Slab* slab = owner->slabs)
+        {
+            owner->slabs = slab->next;
+            std::free(slab);
+        }
+        delete owner;
+    }
 
-        for (int i = 0; i < _chunksPerBlock - 1; ++i) {
-            chunk->next =
-                    reinterpret_cast<Chunk *>(reinterpret_cast<char *>(chunk) + chunkSize);
-            chunk = chunk->next;
+    // Out of chunks: the ones other threads gave back, else the next slab
+    __attribute__((noinline)) void* Refill()
+    {
+        if (Collect())
+        {
+            Chunk* chunk = _free;
+            _free = chunk->next;
+            return chunk;
         }
+        NextSlab();
+        void* chunk = _bump;
+        _bump += _chunkSize;
+        return chunk;
+    }
 
-        chunk->next = nullptr;
+    // Takes the chunks other threads gave back onto the free list
+    bool Collect()
+    {
+        if (!_owner || !_owner->returned.load(std::memory_order_relaxed))
+            return false;
+        Chunk* first = _owner->returned.exchange(nullptr, std::memory_order_acquire);
+        Chunk* last = first;
+        uint64_t n = 1;
+        for (; last->next; last = last->next)
+            n++;
+        last->next = _free;
+        _free = first;
+        _stats.frees += n;
+        _collected += n;
+        return true;
+    }
 
-        return blockBegin;
+    // The thread of the pool exits: the slabs go with the owner, freed at once when
+    // no chunk is in use any more, else by the thread giving the last one back
+    void Orphan()
+    {
+        if (!_owner)
+            return;
+        Owner* owner = _owner;
+        owner->slabs = _first;
+        int64_t handedOut = int64_t(_stats.allocations - (_stats.frees - _collected));
+        _owner = nullptr;
+        _first = _current = nullptr;
+        _free = nullptr;
+        _bump = _end = nullptr;
+        if (owner->balance.fetch_add(handedOut, std::memory_order_acq_rel) + handedOut == 0)
+            FreeSlabs(owner);
     }
+
+    // Moves on to the slab after the current one, allocating it when there is none
+    void NextSlab()
+    {
+        Slab* slab = _current ? _current->next : _first;
+        if (!slab)
+        {
+            if (!_owner)
+            {
+                if (_threadLocal)
+                {
+                    thread_local ThreadExit exit;
+                    exit.pools.push_back(this);
+                }
+                _owner = new Owner;
+            }
+            slab = static_cast<Slab*>(std::aligned_alloc(_slabSize, _slabSize));
+            if (!slab)
+                throw std::bad_alloc();
+            slab->next = nullptr;
+            slab->owner = _owner;
+            (_current ? _current->next : _first) = slab;
+            _stats.slabs++;
+            _stats.bytes += _slabSize;
+        }
+        _current = slab;
+        _bump = reinterpret_cast<char*>(slab) + cacheLineSize;
+        _end = _bump + (_slabSize - cacheLineSize) / _chunkSize * _chunkSize;
+    }
+
+    size_t _chunkSize;
+    size_t _slabSize;
+    bool _threadLocal;
+    Chunk* _free = nullptr;
+    char* _bump = nullptr;
+    char* _end = nullptr;
+    Slab* _first = nullptr;
+    Slab* _current = nullptr;
+    Owner* _owner = nullptr;
+    uint64_t _collected = 0;    // of the frees, chunks given back by other threads
+    PoolStats _stats;
 };
 
-template <typename T>
+// new and delete of T from the pool of the calling thread
+template <typename T, size_t chunksPerSlab = 1024>
 class PoolAllocated
 {
 public:
-    static void *operator new(size_t size)
+    static void* operator new(size_t size)
+    {
+        // A derived class of another size
+        if (size != sizeof(T))
+            return ::operator new(size);
+        return t_pool.Allocate();
+    }
+
+    static void operator delete(void* ptr, size_t size)
     {
-        return allocator.allocate(size);
+        if (size != sizeof(T))
+            ::operator delete(ptr);
+        else
+            t_pool.Deallocate(ptr);
     }
 
-    static void operator delete(void *ptr, size_t size)
+    // The pool of the calling thread
+    static SlabPool& Pool()
     {
-        return allocator.deallocate(ptr, size);
+        return t_pool;
     }
+
 private:
-    static PoolAllocator<T> allocator;
+    static thread_local SlabPool t_pool;
 };
 
+template <typename T, size_t chunksPerSlab>
+thread_local SlabPool PoolAllocated<T, chunksPerSlab>::t_pool{sizeof(T), chunksPerSlab, true};
+
 #endif //RISCV_SIM_POOLALLOCATOR_H
@@ -1,9 +1,15 @@
-
 #ifndef RISCV_SIM_REGISTERFILE_H
 #define RISCV_SIM_REGISTERFILE_H
 
 #include "Instruction.h"
 
+#include <array>
+
+// Writes of instructions without a destination, x0 included (the decoder drops
+// rd == 0), go to a 33rd sink register, and a missing source reads x0, so that
+// neither needs a branch. Indices are not checked.
+constexpr RId sinkReg = 32;
+
 class RegisterFile
 {
 public:
@@ -14,19 +20,60 @@ public:
 
     void Read(InstructionPtr& instr)
     {
-        if (instr->_src1)
-            instr->_src1Val = _r.at(instr->_src1.value());
-
-        if (instr->_src2)
-            instr->_src2Val = _r.at(instr->_src2.value());
+        instr->_src1Val = _r[instr->_src1.value_or(0)];
+        instr->_src2Val = _r[instr->_src2.value_or(0)];
     }
     void Write(InstructionPtr& instr)
     {
-        if (instr->_dst)
-            _r.at(instr->_dst.value()) = instr->_data;
+        _r[instr->_dst.value_or(sinkReg)] = instr->_data;
+    }
+
+    Word Read(RId id) const
+    {
+        return _r[id];
+    }
+    void Write(RId id, Word val)
+    {
+        _r[id != 0 ? id : sinkReg] = val;
+    }
+private:
+    std::array<Word, 33> _r;
+};
+
+// The registers of many lanes, register-major ([33][Lanes]), so that an operation
+// on a register across the lanes is a loop the compiler vectorizes. Same sink.
+template <unsigned Lanes>
+class LaneRegisterFile
+{
+public:
+    using LaneWords = std::array<Word, Lanes>;
+
+    void Reset()
+    {
+        for (auto& reg : _r)
+            reg.fill(0);
+    }
+
+    const LaneWords& Read(const std::optional<RId>& id) const
+    {
+        return _r[id.value_or(0)];
+    }
+    // Where the lanes write the result
+    LaneWords& Dst(const std::optional<RId>& id)
+    {
+        return _r[id.value_or(sinkReg)];
+    }
+
+    Word Read(RId id, unsigned lane) const
+    {
+        return _r[id][lane];
+    }
+    void Write(RId id, unsigned lane, Word val)
+    {
+        _r[id != 0 ? id : sinkReg][lane] = val;
     }
 private:
-    std::array<Word, 32> _r;
+    alignas(64) std::array<LaneWords, 33> _r{};
 };
 
 
@@ -0,0 +1,163 @@
+
+#ifndef RISCV_SIM_REPLAYLOG_H
+#define RISCV_SIM_REPLAYLOG_H
+
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "BaseTypes.h"
+
+// One host syscall as the guest saw it: the result and the guest memory it wrote
+struct SyscallRecord
+{
+    Word hart = 0;
+    uint64_t instret = 0;       // of the hart at the ecall, to catch a replay that went elsewhere
+    Word num = 0;
+    SignedWord ret = 0;
+    Word addr = 0;
+    std::vector<char> data;
+};
+
+// Non-deterministic inputs of a run, written while recording and fed back on replay.
+// A logged run has its harts take turns block by block on one host thread and the
+// CLINT timed by guest cycles, so the interleaving and the timer are reproduced by the
+// simulator itself; only host syscalls can answer differently on a rerun. They are
+// rare, so the log stays small and the replay runs at full speed. Harts on several
+// host threads (HartScheduler::Run) interleave differently on every run and cannot
+// be logged.
+class ReplayLog
+{
+public:
+    enum class Mode
+    {
+        Record,
+        Replay
+    };
+
+    // Ok() tells if the file could be opened and, on replay, is a log of as many harts
+    ReplayLog(const char* path, Mode mode, Word harts)
+        : _mode(mode)
+    {
+        _file = std::fopen(path, mode == Mode::Record ? "wb" : "rb");
+        if (!_file)
+            return;
+        Word header[3] = {magic, version, harts};
+        if (mode == Mode::Record)
+        {
+            _ok = std::fwrite(header, sizeof(header), 1, _file) == 1;
+            return;
+        }
+        Word logged[3];
+        _ok = std::fread(logged, sizeof(logged), 1, _file) == 1 &&
+              logged[0] == magic && logged[1] == version && logged[2] == harts;
+    }
+
+    // Without a file the records stay in memory: a recording log hands them on to
+    // the replaying log that follows it, e.g. a second engine in the same process
+    explicit ReplayLog(Mode mode)
+        : _mode(mode)
+        , _ok(true)
+    {
+
+    }
+
+    void Follow(ReplayLog& leader)
+    {
+        leader._follower = this;
+    }
+
+    ~ReplayLog()
+    {
+        if (_file)
+            std::fclose(_file);
+    }
+
+    ReplayLog(const ReplayLog&) = delete;
+    ReplayLog& operator=(const ReplayLog&) = delete;
+
+    bool Ok() const { return _ok; }
+    bool Replaying() const { return _mode == Mode::Replay; }
+    // An in-memory replay follows a run that already wrote the console output
+    bool Echoes() const { return _file != nullptr; }
+
+    void Write(const SyscallRecord& rec)
+    {
+        if (!_file)
+        {
+            if (_follower)
+                _follower->_pending.push_back(rec);
+            return;
+        }
+        Word len = rec.data.size();
+        _ok = _ok &&
+              Put(rec.hart) && Put(rec.instret) && Put(rec.num) && Put(rec.ret) && Put(rec.addr) && Put(len) &&
+              std::fwrite(rec.data.data(), 1, len, _file) == len;
+    }
+
+    // The next syscall of whichever hart made it; nothing at the end of the log
+    std::optional<SyscallRecord> Next()
+    {
+        if (!_file)
+        {
+            if (_pending.empty())
+                return std::nullopt;
+            SyscallRecord rec = std::move(_pending.front());
+            _pending.pop_front();
+            return rec;
+        }
+        SyscallRecord rec;
+        Word len;
+        if (!_ok || !Get(rec.hart) || !Get(rec.instret) || !Get(rec.num) || !Get(rec.ret) ||
+            !Get(rec.addr) || !Get(len))
+            return std::nullopt;
+        rec.data.resize(len);
+        if (std::fread(rec.data.data(), 1, len, _file) != len)
+            return std::nullopt;
+        return rec;
+    }
+
+    // The replay no longer follows the log, e.g. a different program or input
+    void Diverge(Word hart, uint64_t instret)
+    {
+        if (!_divergence.empty())
+            return;
+        char buf[96];
+        std::snprintf(buf, sizeof(buf), "replay diverged at hart %u, instret %llu", hart,
+                      static_cast<unsigned long long>(instret));
+        _divergence = buf;
+    }
+
+    const std::string& Divergence() const
+    {
+        return _divergence;
+    }
+
+private:
+    static constexpr Word magic = 0x4c525652;   // "RVRL"
+    static constexpr Word version = 1;
+
+    template <typename T>
+    bool Put(T value)
+    {
+        return std::fwrite(&value, sizeof(value), 1, _file) == 1;
+    }
+
+    template <typename T>
+    bool Get(T& value)
+    {
+        return std::fread(&value, sizeof(value), 1, _file) == 1;
+    }
+
+    Mode _mode;
+    std::FILE* _file = nullptr;
+    bool _ok = false;
+    std::string _divergence;
+    ReplayLog* _follower = nullptr;
+    std::deque<SyscallRecord> _pending;
+};
+
+#endif //RISCV_SIM_REPLAYLOG_H
@@ -0,0 +1,347 @@
+
+#ifndef RISCV_SIM_SAMPLER_H
+#define RISCV_SIM_SAMPLER_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include "Cpu.h"
+#include "TimingModel.h"
+
+struct SimPoint
+{
+    size_t interval;    // index of the representative interval
+    double weight;      // share of all intervals it stands for
+};
+
+struct SamplingConfig
+{
+    uint64_t period = 1000000;  // instructions between the starts of detailed windows
+    uint64_t warmup = 20000;    // detailed instructions that only warm caches and predictors
+    uint64_t window = 10000;    // detailed instructions measured
+};
+
+struct SampleEstimate
+{
+    double cpi = 0;             // with no windows, of the detailed instructions; 0 if none
+    double ci95 = 0;            // half-width of the 95% confidence interval of cpi
+    size_t windows = 0;
+    uint64_t instructions = 0;  // instructions retired by the whole program
+    uint64_t detailed = 0;      // of which simulated by the timing model
+
+    uint64_t Cycles() const
+    {
+        return uint64_t(cpi * instructions);
+    }
+};
+
+// Sampled simulation: the block engine fast-forwards between windows, the
+// reference engine feeds the timing model inside them. Every window starts
+// with a warm-up whose cycles are not counted. Windows are either periodic
+// (systematic sampling, the confidence interval comes from their spread) or
+// taken at SimPoints picked from basic block vectors.
+class Sampler
+{
+public:
+    Sampler(TimingModel& model, const SamplingConfig& config)
+        : _model(model)
+        , _config(config)
+    {
+        _windowStart = config.warmup;
+    }
+
+    // config.period is the length of the intervals the SimPoints index
+    Sampler(TimingModel& model, const SamplingConfig& config, std::vector<SimPoint> points)
+        : _model(model)
+        , _config(config)
+        , _points(std::move(points))
+    {
+        std::sort(_points.begin(), _points.end(),
+                  [](const SimPoint& a, const SimPoint& b) { return a.interval < b.interval; });
+        NextPoint();
+    }
+
+    // Runs a block when fast-forwarding, a single instruction otherwise
+    void Step(Cpu& cpu)
+    {
+        uint64_t instret = cpu.Instret();
+        if (_windowStart == never || instret + _config.warmup < _windowStart)
+        {
+            cpu.ProcessBlock();
+            return;
+        }
+
+        if (instret >= _windowStart && !_measuring)
+        {
+            _measuring = true;
+            _measureStart = instret;
+            _startStats = _model.Stats();
+        }
+        cpu.ProcessInstruction(_model);
+        _detailed++;
+
+        if (_measuring && cpu.Instret() >= _measureStart + _config.window)
+        {
+            const TimingStats& stats = _model.Stats();
+            double cpi = double(stats.cycles - _startStats.cycles) / (stats.instructions - _startStats.instructions);
+            _samples.push_back({cpi, _weight});
+            _measuring = false;
+            if (_points.empty())
+                _windowStart += _config.period;
+            else
+                NextPoint();
+        }
+    }
+
+    SampleEstimate Estimate(const Cpu& cpu) const
+    {
+        SampleEstimate ret;
+        ret.instructions = cpu.Instret();
+        ret.detailed = _detailed;
+
+        // A window cut short by the end of the program still counts
+        std::vector<Sample> samples = _samples;
+        const TimingStats& stats = _model.Stats();
+        if (_measuring && stats.instructions > _startStats.instructions)
+        {
+            double cpi = double(stats.cycles - _startStats.cycles) / (stats.instructions - _startStats.instructions);
+            samples.push_back({cpi, _weight});
+        }
+        ret.windows = samples.size();
+        if (samples.empty())
+        {
+            // Over before a window was measured: the detailed instructions, warm-up
+            // included, are all there is. Often the whole of a short program.
+            ret.cpi = stats.Cpi();
+            return ret;
+        }
+
+        double weights = 0;
+        for (auto& sample : samples)
+        {
+            ret.cpi += sample.cpi * sample.weight;
+            weights += sample.weight;
+        }
+        ret.cpi /= weights;
+
+        // Normal approximation; SimPoint weights do not give a sampling error
+        if (_points.empty() && samples.size() > 1)
+        {
+            double var = 0;
+            for (auto& sample : samples)
+                var += (sample.cpi - ret.cpi) * (sample.cpi - ret.cpi);
+            var /= samples.size() - 1;
+            ret.ci95 = 1.96 * std::sqrt(var / samples.size());
+        }
+        return ret;
+    }
+
+private:
+    static constexpr uint64_t never = std::numeric_limits<uint64_t>::max();
+
+    struct Sample
+    {
+        double cpi;
+        double weight;
+    };
+
+    void NextPoint()
+    {
+        if (_nextPoint == _points.size())
+        {
+            _windowStart = never;
+            return;
+        }
+        // The window covers the start of the interval, after a warm-up inside the previous one
+        const SimPoint& point = _points[_nextPoint++];
+        _windowStart = std::max<uint64_t>(point.interval * _config.period, _config.warmup);
+        _weight = point.weight;
+    }
+
+    TimingModel& _model;
+    SamplingConfig _config;
+    std::vector<SimPoint> _points;
+    size_t _nextPoint = 0;
+    double _weight = 1;
+
+    uint64_t _windowStart = never;
+    bool _measuring = false;
+    uint64_t _measureStart = 0;
+    TimingStats _startStats;
+    uint64_t _detailed = 0;
+    std::vector<Sample> _samples;
+};
+
+// Basic block vector of an interval: instructions executed in each block, by block address
+using Bbv = std::unordered_map<Word, uint64_t>;
+
+// Collects a BBV per fixed-length interval from the execution counts the block
+// engine keeps anyway, so profiling runs at fast-forward speed.
+class BbvCollector
+{
+public:
+    explicit BbvCollector(uint64_t interval)
+        : _interval(interval)
+        , _next(interval)
+    {
+
+    }
+
+    void Step(Cpu& cpu)
+    {
+        cpu.ProcessBlock();
+        if (cpu.Instret() >= _next)
+        {
+            Snapshot(cpu);
+            _next += _interval;
+        }
+    }
+
+    // Closes the last, partial interval
+    void Finish(const Cpu& cpu)
+    {
+        Snapshot(cpu);
+    }
+
+    const std::vector<Bbv>& Intervals() const
+    {
+        return _intervals;
+    }
+
+private:
+    void Snapshot(const Cpu& cpu)
+    {
+        Bbv bbv;
+        cpu.ForEachBlock([&](const Block& block) {
+            uint64_t& last = _counts[block._ip];
+            // Counts restart if the block was flushed and rebuilt
+            uint64_t delta = block._execCount >= last ? block._execCount - last : block._execCount;
+            last = block._execCount;
+            if (delta)
+                bbv[block._ip] = delta * block._instrs.size();
+        });
+        _intervals.push_back(std::move(bbv));
+    }
+
+    uint64_t _interval;
+    uint64_t _next;
+    std::unordered_map<Word, uint64_t> _counts;
+    std::vector<Bbv> _intervals;
+};
+
+// Clusters the intervals with k-means on randomly projected, normalized BBVs
+// and returns the interval closest to each cluster centre, weighted by cluster size.
+inline std::vector<SimPoint> PickSimPoints(const std::vector<Bbv>& intervals, unsigned k)
+{
+    constexpr unsigned dims = 16;
+    using Point = std::array<double, dims>;
+
+    auto coord = [](Word ip, unsigned d) {
+        // Deterministic pseudo-random projection entry in [-1, 1)
+        uint64_t h = (uint64_t(ip) << 8 | d) * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 29;
+        return double(h & 0xffff) / 32768.0 - 1.0;
+    };
+    auto dist = [](const Point& a, const Point& b) {
+        double sum = 0;
+        for (unsigned d = 0; d < dims; ++d)
+            sum += (a[d] - b[d]) * (a[d] - b[d]);
+        return sum;
+    };
+
+    std::vector<Point> points;
+    for (auto& bbv : intervals)
+    {
+        uint64_t total = 0;
+        for (auto& [ip, count] : bbv)
+            total += count;
+        Point p{};
+        for (auto& [ip, count] : bbv)
+        {
+            for (unsigned d = 0; d < dims; ++d)
+                p[d] += coord(ip, d) * count / std::max<uint64_t>(total, 1);
+        }
+        points.push_back(p);
+    }
+    if (points.empty())
+        return {};
+    k = std::min<unsigned>(k, points.size());
+
+    // Farthest point initialization
+    std::vector<Point> centres{points[0]};
+    while (centres.size() < k)
+    {
+        size_t far = 0;
+        double farDist = -1;
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            double d = std::numeric_limits<double>::max();
+            for (auto& c : centres)
+                d = std::min(d, dist(points[i], c));
+            if (d > farDist)
+            {
+                far = i;
+                farDist = d;
+            }
+        }
+        centres.push_back(points[far]);
+    }
+
+    std::vector<unsigned> cluster(points.size());
+    for (int iter = 0; iter < 100; ++iter)
+    {
+        bool changed = false;
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            unsigned best = 0;
+            for (unsigned c = 1; c < k; ++c)
+            {
+                if (dist(points[i], centres[c]) < dist(points[i], centres[best]))
+                    best = c;
+            }
+            changed |= best != cluster[i];
+            cluster[i] = best;
+        }
+        if (!changed && iter > 0)
+            break;
+
+        std::vector<Point> sums(k, Point{});
+        std::vector<size_t> sizes(k);
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            for (unsigned d = 0; d < dims; ++d)
+                sums[cluster[i]][d] += points[i][d];
+            sizes[cluster[i]]++;
+        }
+        for (unsigned c = 0; c < k; ++c)
+        {
+            for (unsigned d = 0; sizes[c] && d < dims; ++d)
+                centres[c][d] = sums[c][d] / sizes[c];
+        }
+    }
+
+    std::vector<SimPoint> ret;
+    for (unsigned c = 0; c < k; ++c)
+    {
+        size_t best = points.size();
+        size_t size = 0;
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            if (cluster[i] != c)
+                continue;
+            size++;
+            if (best == points.size() || dist(points[i], centres[c]) < dist(points[best], centres[c]))
+                best = i;
+        }
+        if (size)
+            ret.push_back({best, double(size) / points.size()});
+    }
+    std::sort(ret.begin(), ret.end(), [](const SimPoint& a, const SimPoint& b) { return a.interval < b.interval; });
+    return ret;
+}
+
+#endif //RISCV_SIM_SAMPLER_H
@@ -0,0 +1,188 @@
+
+#ifndef RISCV_SIM_SCHEDULER_H
+#define RISCV_SIM_SCHEDULER_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Future device events kept in a hierarchical timing wheel, times are in cycles.
+// Level l has 64 slots of 64^l cycles each. An event sits on the lowest level
+// whose higher digits equal those of the current time and moves down a level
+// (cascades) when time reaches the start of its slot. Occupancy bitmaps let
+// Advance skip empty slots, so idle stretches cost nothing. Cancelled events are
+// dropped lazily when they fire or cascade.
+class Scheduler
+{
+public:
+    using Callback = std::function<void()>;
+    using EventId = uint64_t;
+
+    static constexpr uint64_t never = std::numeric_limits<uint64_t>::max();
+
+    // Events at or before the current time fire on the next Advance
+    EventId Schedule(uint64_t when, Callback callback)
+    {
+        EventId id = ++_lastId;
+        Insert({std::max(when, _now), id, std::move(callback)});
+        _nextCheck = std::min(_nextCheck, std::max(when, _now));
+        return id;
+    }
+
+    // The event must not have fired yet
+    void Cancel(EventId id)
+    {
+        _cancelled.insert(id);
+    }
+
+    // Earliest time Advance may have something to do; cheap to poll
+    uint64_t NextCheck() const
+    {
+        return _nextCheck;
+    }
+
+    // Fires all events up to and including `time`, in time order
+    void Advance(uint64_t time)
+    {
+        while (true)
+        {
+            auto [next, level] = NextInteresting();
+            if (next == never || next > time)
+                break;
+
+            if (level == 0)
+            {
+                auto& slot = _slots[0][next & slotMask];
+                std::vector<Event> events;
+                events.swap(slot);
+                _bitmap[0] &= ~(uint64_t(1) << (next & slotMask));
+                SetNow(next + 1);
+                for (auto& event : events)
+                {
+                    if (!_cancelled.erase(event.id))
+                        event.callback();
+                }
+            }
+            else
+            {
+                SetNow(next);
+            }
+        }
+        if (time + 1 > _now)
+            SetNow(time + 1);
+        _nextCheck = NextInteresting().first;
+    }
+
+    bool Empty() const
+    {
+        for (auto bits : _bitmap)
+        {
+            if (bits)
+                return false;
+        }
+        return _overflow.empty();
+    }
+
+private:
+    static constexpr unsigned levels = 4;
+    static constexpr unsigned slotBits = 6;
+    static constexpr uint64_t slotMask = (1u << slotBits) - 1;
+
+    struct Event
+    {
+        uint64_t when;
+        EventId id;
+        Callback callback;
+    };
+
+    static unsigned Digit(uint64_t time, unsigned level)
+    {
+        return (time >> (slotBits * level)) & slotMask;
+    }
+
+    void Insert(Event event)
+    {
+        if (_cancelled.erase(event.id))
+            return;
+        for (unsigned l = 0; l < levels; ++l)
+        {
+            unsigned upper = slotBits * (l + 1);
+            if ((event.when >> upper) == (_now >> upper))
+            {
+                unsigned idx = Digit(event.when, l);
+                _slots[l][idx].push_back(std::move(event));
+                _bitmap[l] |= uint64_t(1) << idx;
+                return;
+            }
+        }
+        _overflow.push_back(std::move(event));
+    }
+
+    // Moves time forward, cascading every slot whose start is `time`.
+    // Higher levels go first so that their events can cascade further down.
+    void SetNow(uint64_t time)
+    {
+        _now = time;
+        if ((time & ((uint64_t(1) << (slotBits * levels)) - 1)) == 0 && !_overflow.empty())
+        {
+            std::vector<Event> events;
+            events.swap(_overflow);
+            for (auto& event : events)
+                Insert(std::move(event));
+        }
+        for (unsigned l = levels - 1; l > 0; --l)
+        {
+            if ((time & ((uint64_t(1) << (slotBits * l)) - 1)) != 0)
+                continue;
+            unsigned idx = Digit(time, l);
+            if (!(_bitmap[l] & (uint64_t(1) << idx)))
+                continue;
+            std::vector<Event> events;
+            events.swap(_slots[l][idx]);
+            _bitmap[l] &= ~(uint64_t(1) << idx);
+            for (auto& event : events)
+                Insert(std::move(event));
+        }
+    }
+
+    // Next time something happens: an event firing (level 0) or a slot cascading (level > 0)
+    std::pair<uint64_t, unsigned> NextInteresting() const
+    {
+        for (unsigned l = 0; l < levels; ++l)
+        {
+            unsigned idx = Digit(_now, l);
+            // Slots above level 0 are cascaded when entered, so only later ones count
+            unsigned from = l == 0 ? idx : idx + 1;
+            if (from > slotMask)
+                continue;
+            uint64_t mask = _bitmap[l] & (~uint64_t(0) << from);
+            if (!mask)
+                continue;
+
+            unsigned low = slotBits * l;
+            uint64_t base = _now >> (low + slotBits) << (low + slotBits);
+            return {base | uint64_t(__builtin_ctzll(mask)) << low, l};
+        }
+        if (!_overflow.empty())
+        {
+            unsigned span = slotBits * levels;
+            return {((_now >> span) + 1) << span, levels};
+        }
+        return {never, 0};
+    }
+
+    uint64_t _now = 0;
+    uint64_t _nextCheck = never;
+    EventId _lastId = 0;
+    std::unordered_set<EventId> _cancelled;
+    std::array<std::array<std::vector<Event>, slotMask + 1>, levels> _slots;
+    std::array<uint64_t, levels> _bitmap{};
+    std::vector<Event> _overflow;
+};
+
+#endif //RISCV_SIM_SCHEDULER_H
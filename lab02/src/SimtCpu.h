@@ -0,0 +1,398 @@
+
+#ifndef RISCV_SIM_SIMTCPU_H
+#define RISCV_SIM_SIMTCPU_H
+
+#include <array>
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+#include "BitOps.h"
+#include "CsrFile.h"
+#include "Decoder.h"
+#include "Executor.h"
+#include "FpUnit.h"
+#include "VectorUnit.h"
+#include "Memory.h"
+#include "RegisterFile.h"
+#include "SyscallProxy.h"
+
+// Outcome of one guest instance
+struct LaneResult
+{
+    std::optional<Word> exitCode;
+    std::optional<MemoryFault> fault;
+    uint64_t instret = 0;
+    std::string output;     // mtohost PrintChar and PrintInt output
+};
+
+struct SimtStats
+{
+    uint64_t steps = 0;             // instructions dispatched for a group of lanes
+    uint64_t laneInstructions = 0;  // instructions retired by all lanes
+
+    // Share of lane slots doing work; divergence and finished lanes lower it
+    double Utilization(unsigned lanes) const
+    {
+        return steps ? double(laneInstructions) / (steps * lanes) : 0;
+    }
+};
+
+// Independent instances of one program run in lockstep, one lane each, with
+// the registers kept as [33][Lanes] (LaneRegisterFile) so that ALU instructions, branches and
+// jumps run as loops across the lanes the compiler vectorizes. Every step runs
+// the instruction at the lowest pc of the running lanes, for the lanes that are
+// there; the others are masked off. Lanes that split at a forward branch meet
+// again at its join point, and a lane that leaves a loop early waits at the
+// exit for the rest. Loads and stores compute their addresses across the lanes
+// and then access each lane's own memory in turn; CSRs, ecall and the rest go
+// through the scalar executor lane by lane. Code is decoded once from the first
+// lane's memory, so the program must not modify itself.
+template <unsigned Lanes>
+class SimtCpu
+{
+    static_assert(Lanes > 0 && Lanes <= 32, "lane mask is 32 bits");
+
+public:
+    SimtCpu()
+    {
+        for (unsigned lane = 0; lane < Lanes; ++lane)
+            _syscalls.emplace_back(_mem[lane]);
+    }
+
+    Memory& LaneMemory(unsigned lane)
+    {
+        return _mem[lane];
+    }
+
+    // Starts the first `active` lanes at ip; mhartid of a lane is firstId + its index
+    void Reset(Word ip, Word firstId = 0, unsigned active = Lanes)
+    {
+        _r.Reset();
+        _ip.fill(ip);
+        _running = active >= Lanes ? allLanes : (1u << active) - 1;
+        for (unsigned lane = 0; lane < Lanes; ++lane)
+        {
+            _csrf[lane].Reset(firstId + lane);
+            _syscalls[lane].Reset();
+            _reservation[lane] = {};
+            _fpu[lane] = {};
+            _vpu[lane] = {};
+            _results[lane] = {};
+        }
+        _code.clear();
+        _stats = {};
+    }
+
+    // Runs one instruction for the lanes at the lowest pc; false once all lanes are done
+    bool Step()
+    {
+        if (!_running)
+            return false;
+
+        Word pc = ~0u;
+        for (unsigned lane = 0; lane < Lanes; ++lane)
+        {
+            if (_running & (1u << lane))
+                pc = std::min(pc, _ip[lane]);
+        }
+        uint32_t mask = 0;
+        for (unsigned lane = 0; lane < Lanes; ++lane)
+            mask |= (_ip[lane] == pc) << lane;
+        mask &= _running;
+
+        Instruction* instr = Fetch(pc, mask);
+        if (!instr)
+            return _running != 0;
+
+        _stats.steps++;
+        if (instr->_type == IType::Alu)
+            ExecuteAlu(*instr, mask);
+        else if (instr->_type == IType::Br)
+            ExecuteBranch(*instr, pc, mask);
+        else if (instr->_type == IType::J || instr->_type == IType::Jr)
+            ExecuteJump(*instr, pc, mask);
+        else if (instr->_type == IType::Ld || instr->_type == IType::St)
+            ExecuteMemory(*instr, pc, mask);
+        else
+            ExecuteScalar(instr, pc, mask);
+        return _running != 0;
+    }
+
+    void Run()
+    {
+        while (Step())
+            ;
+    }
+
+    const LaneResult& Result(unsigned lane) const
+    {
+        return _results[lane];
+    }
+
+    const SimtStats& Stats() const
+    {
+        return _stats;
+    }
+
+private:
+    static constexpr uint32_t allLanes = Lanes == 32 ? ~0u : (1u << Lanes) - 1;
+
+    using LaneWords = std::array<Word, Lanes>;
+
+    Instruction* Fetch(Word pc, uint32_t mask)
+    {
+        auto it = _code.find(pc);
+        if (it != _code.end())
+            return it->second.get();
+
+        unsigned first = __builtin_ctz(mask);
+        Word word = _mem[first].Request(pc);
+        if (Memory::Faulted())
+        {
+            auto fault = _mem[first].TakeFault();
+            for (unsigned lane = 0; lane < Lanes; ++lane)
+            {
+                if (mask & (1u << lane))
+                    Stop(lane, std::nullopt, MemoryFault{fault->addr, pc});
+            }
+            return nullptr;
+        }
+        return (_code[pc] = _decoder.Decode(word)).get();
+    }
+
+    static LaneWords Expand(uint32_t mask)
+    {
+        LaneWords m;
+        for (unsigned lane = 0; lane < Lanes; ++lane)
+            m[lane] = Word(0) - ((mask >> lane) & 1u);
+        return m;
+    }
+
+    void Retire(uint32_t mask)
+    {
+        _stats.laneInstructions += __builtin_popcount(mask);
+        for (unsigned lane = 0; lane < Lanes; ++lane)
+        {
+            if (mask & (1u << lane))
+                _csrf[lane].InstructionExecuted();
+        }
+    }
+
+    void ExecuteAlu(const Instruction& instr, uint32_t mask)
+    {
+        const LaneWords& a = _r.Read(instr._src1);
+        LaneWords b;
+        if (instr._imm)
+            b.fill(*instr._imm);
+        else
+            b = _r.Read(instr._src2);
+
+        LaneWords res;
+        switch (instr._aluFunc)
+        {
+            case AluFunc::Add:  for (unsigned l = 0; l < Lanes; ++l) res[l] = a[l] + b[l]; break;
+            case AluFunc::Sub:  for (unsigned l = 0; l < Lanes; ++l) res[l] = a[l] - b[l]; break;
+            case AluFunc::And:  for (unsigned l = 0; l < Lanes; ++l) res[l] = a[l] & b[l]; break;
+            case AluFunc::Or:   for (unsigned l = 0; l < Lanes; ++l) res[l] = a[l] | b[l]; break;
+            case AluFunc::Xor:  for (unsigned l = 0; l < Lanes; ++l) res[l] = a[l] ^ b[l]; break;
+            case AluFunc::Slt:  for (unsigned l = 0; l < Lanes; ++l) res[l] = SignedWord(a[l]) < SignedWord(b[l]); break;
+            case AluFunc::Sltu: for (unsigned l = 0; l < Lanes; ++l) res[l] = a[l] < b[l]; break;
+            case AluFunc::Sll:  for (unsigned l = 0; l < Lanes; ++l) res[l] = a[l] << (b[l] % 32); break;
+            case AluFunc::Srl:  for (unsigned l = 0; l < Lanes; ++l) res[l] = a[l] >> (b[l] % 32); break;
+            case AluFunc::Sra:  for (unsigned l = 0; l < Lanes; ++l) res[l] = SignedWord(a[l]) >> (b[l] % 32); break;
+            case AluFunc::None: res = a; break;
+            default:
+                for (unsigned l = 0; l < Lanes; ++l)
+                    res[l] = bitops::Execute(instr._aluFunc, a[l], b[l]);
+                break;
+        }
+
+        LaneWords m = Expand(mask);
+        LaneWords& dst = _r.Dst(instr._dst);
+        for (unsigned l = 0; l < Lanes; ++l)
+            dst[l] = (res[l] & m[l]) | (dst[l] & ~m[l]);
+        for (unsigned l = 0; l < Lanes; ++l)
+            _ip[l] += 4 & m[l];
+        Retire(mask);
+    }
+
+    void ExecuteBranch(const Instruction& instr, Word pc, uint32_t mask)
+    {
+        const LaneWords& a = _r.Read(instr._src1);
+        const LaneWords& b = _r.Read(instr._src2);
+
+        LaneWords taken;
+        switch (instr._brFunc)
+        {
+            case BrFunc::Eq:  for (unsigned l = 0; l < Lanes; ++l) taken[l] = -Word(a[l] == b[l]); break;
+            case BrFunc::Neq: for (unsigned l = 0; l < Lanes; ++l) taken[l] = -Word(a[l] != b[l]); break;
+            case BrFunc::Lt:  for (unsigned l = 0; l < Lanes; ++l) taken[l] = -Word(SignedWord(a[l]) < SignedWord(b[l])); break;
+            case BrFunc::Ge:  for (unsigned l = 0; l < Lanes; ++l) taken[l] = -Word(SignedWord(a[l]) >= SignedWord(b[l])); break;
+            case BrFunc::Ltu: for (unsigned l = 0; l < Lanes; ++l) taken[l] = -Word(a[l] < b[l]); break;
+            case BrFunc::Geu: for (unsigned l = 0; l < Lanes; ++l) taken[l] = -Word(a[l] >= b[l]); break;
+            default: taken.fill(0); break;
+        }
+
+        Word target = pc + *instr._imm;
+        LaneWords m = Expand(mask);
+        for (unsigned l = 0; l < Lanes; ++l)
+        {
+            Word next = (target & taken[l]) | ((pc + 4) & ~taken[l]);
+            _ip[l] = (next & m[l]) | (_ip[l] & ~m[l]);
+        }
+        Retire(mask);
+    }
+
+    void ExecuteJump(const Instruction& instr, Word pc, uint32_t mask)
+    {
+        const LaneWords& base = _r.Read(instr._src1);
+        Word offset = instr._type == IType::J ? pc + *instr._imm : *instr._imm;
+        Word baseMask = instr._type == IType::J ? 0 : ~0u;
+
+        // The target first: rd may be rs1
+        LaneWords m = Expand(mask);
+        for (unsigned l = 0; l < Lanes; ++l)
+        {
+            Word next = (base[l] & baseMask) + offset;
+            _ip[l] = (next & m[l]) | (_ip[l] & ~m[l]);
+        }
+        LaneWords& dst = _r.Dst(instr._dst);
+        for (unsigned l = 0; l < Lanes; ++l)
+            dst[l] = ((pc + 4) & m[l]) | (dst[l] & ~m[l]);
+        Retire(mask);
+    }
+
+    // Addresses for all lanes at once, then a gather or scatter over the lane memories
+    void ExecuteMemory(const Instruction& instr, Word pc, uint32_t mask)
+    {
+        const LaneWords& base = _r.Read(instr._src1);
+        LaneWords addr;
+        for (unsigned l = 0; l < Lanes; ++l)
+            addr[l] = base[l] + *instr._imm;
+
+        uint32_t done = mask;
+        for (unsigned lane = 0; lane < Lanes; ++lane)
+        {
+            if (!(mask & (1u << lane)))
+                continue;
+            if (instr._type == IType::Ld)
+            {
+                Word data = _mem[lane].LoadData(addr[lane], instr._memFunc);
+                if (!Memory::Faulted())
+                    _r.Dst(instr._dst)[lane] = data;
+            }
+            else
+            {
+                _mem[lane].StoreData(addr[lane], _r.Read(instr._src2)[lane], instr._memFunc);
+            }
+            if (Memory::Faulted())
+            {
+                auto fault = _mem[lane].TakeFault();
+                Stop(lane, std::nullopt, MemoryFault{fault->addr, pc});
+                done &= ~(1u << lane);
+            }
+        }
+
+        LaneWords m = Expand(done);
+        for (unsigned l = 0; l < Lanes; ++l)
+            _ip[l] += 4 & m[l];
+        Retire(done);
+    }
+
+    // Everything else, one lane at a time through the scalar executor
+    void ExecuteScalar(Instruction* instr, Word pc, uint32_t mask)
+    {
+        for (unsigned lane = 0; lane < Lanes; ++lane)
+        {
+            if (!(mask & (1u << lane)))
+                continue;
+
+            *_scratch = *instr;
+            _scratch->_src1Val = _r.Read(instr->_src1)[lane];
+            _scratch->_src2Val = _r.Read(instr->_src2)[lane];
+            _csrf[lane].Read(_scratch);
+            _exe.Execute(_scratch, pc);
+            if (instr->_type == IType::Fp && !_fpu[lane].Execute(_scratch, _mem[lane], _csrf[lane]))
+                _scratch->_data = _r.Read(instr->_dst)[lane];
+            else if (instr->_type == IType::Vec && !_vpu[lane].Execute(_scratch, _mem[lane], _csrf[lane]))
+                _scratch->_data = _r.Read(instr->_dst)[lane];
+            else
+                _mem[lane].Request(_scratch, &_reservation[lane]);
+            if (Memory::Faulted())
+            {
+                auto fault = _mem[lane].TakeFault();
+                Stop(lane, std::nullopt, MemoryFault{fault->addr, pc});
+                continue;
+            }
+
+            _r.Dst(instr->_dst)[lane] = _scratch->_data;
+            _csrf[lane].Write(_scratch);
+            _csrf[lane].InstructionExecuted();
+            _stats.laneInstructions++;
+            _ip[lane] = _scratch->_nextIp;
+
+            if (instr->_type == IType::Ecall)
+                HandleEcall(lane);
+            if (auto msg = _csrf[lane].GetMessage())
+                HandleMessage(lane, *msg);
+        }
+    }
+
+    void HandleEcall(unsigned lane)
+    {
+        RegisterFile rf;
+        for (RId reg = 1; reg < 32; ++reg)
+            rf.Write(reg, _r.Read(reg, lane));
+        auto code = _syscalls[lane].Handle(rf);
+        for (RId reg = 1; reg < 32; ++reg)
+            _r.Write(reg, lane, rf.Read(reg));
+        if (code)
+            Stop(lane, code, std::nullopt);
+    }
+
+    void HandleMessage(unsigned lane, CpuToHostData msg)
+    {
+        LaneResult& result = _results[lane];
+        switch (msg.unpacked.type)
+        {
+            case CpuToHostType::ExitCode: Stop(lane, msg.unpacked.data, std::nullopt); break;
+            case CpuToHostType::PrintChar: result.output.push_back(char(msg.unpacked.data)); break;
+            case CpuToHostType::PrintIntLow: _printInt[lane] = msg.unpacked.data; break;
+            case CpuToHostType::PrintIntHigh:
+                _printInt[lane] |= Word(msg.unpacked.data) << 16;
+                result.output += std::to_string(SignedWord(_printInt[lane]));
+                break;
+            default: break;
+        }
+    }
+
+    void Stop(unsigned lane, std::optional<Word> exitCode, std::optional<MemoryFault> fault)
+    {
+        _running &= ~(1u << lane);
+        _results[lane].exitCode = exitCode;
+        _results[lane].fault = fault;
+        _results[lane].instret = _csrf[lane].Instret();
+    }
+
+    LaneRegisterFile<Lanes> _r;
+    alignas(64) LaneWords _ip{};
+    uint32_t _running = 0;
+
+    std::array<Memory, Lanes> _mem;
+    std::array<CsrFile, Lanes> _csrf;
+    std::deque<SyscallProxy> _syscalls;
+    std::array<Reservation, Lanes> _reservation;
+    std::array<FpUnit, Lanes> _fpu;
+    std::array<VectorUnit, Lanes> _vpu;
+    std::array<Word, Lanes> _printInt{};
+    std::array<LaneResult, Lanes> _results;
+
+    Decoder _decoder;
+    Executor _exe;
+    std::unordered_map<Word, InstructionPtr> _code;
+    InstructionPtr _scratch = std::make_unique<Instruction>();
+    SimtStats _stats;
+};
+
+#endif //RISCV_SIM_SIMTCPU_H
@@ -0,0 +1,375 @@
+
+#ifndef RISCV_SIM_SYSCALLPROXY_H
+#define RISCV_SIM_SYSCALLPROXY_H
+
+#include <cerrno>
+#include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "Memory.h"
+#include "RegisterFile.h"
+#include "ReplayLog.h"
+
+// Syscall numbers used by newlib/libgloss for RISC-V
+enum class Syscall : Word
+{
+    Openat       = 56,
+    Close        = 57,
+    Lseek        = 62,
+    Read         = 63,
+    Write        = 64,
+    Fstat        = 80,
+    Exit         = 93,
+    ExitGroup    = 94,
+    Gettimeofday = 169,
+    Brk          = 214,
+    Open         = 1024,
+};
+
+// What the harts of one guest program share: open files and the program break
+struct GuestProcess
+{
+    std::vector<int> fds;   // guest fd -> host fd, -1 for a free slot
+    Word brk = 0;
+    std::mutex lock;        // harts may run on several host threads
+
+    GuestProcess() = default;
+    GuestProcess(const GuestProcess&) = delete;
+    GuestProcess& operator=(const GuestProcess&) = delete;
+
+    ~GuestProcess()
+    {
+        CloseFiles();
+    }
+
+    void CloseFiles()
+    {
+        for (int hostFd : fds)
+        {
+            if (hostFd > STDERR_FILENO)
+                close(hostFd);
+        }
+        fds.clear();
+    }
+};
+
+// Services ecall on the host: the syscall number is in a7, arguments in a0..a5,
+// the result (or -errno) goes to a0. Guest buffers are passed to the host
+// syscalls in place, without copying. Every proxy starts with a process of its
+// own; the harts of a program share one (Share), like threads of a process.
+class SyscallProxy
+{
+public:
+    explicit SyscallProxy(Memory& mem)
+        : _mem(mem)
+        , _process(std::make_shared<GuestProcess>())
+    {
+        Reset();
+    }
+
+    SyscallProxy(const SyscallProxy&) = delete;
+    SyscallProxy& operator=(const SyscallProxy&) = delete;
+
+    // Closes the files of the process and moves the break back to the end of the program
+    void Reset()
+    {
+        _process->CloseFiles();
+        _process->fds = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+        _process->brk = (_mem.ProgramEnd() + 15u) & ~15u;
+    }
+
+    // From now on in the process of another proxy on the same memory
+    void Share(const SyscallProxy& other)
+    {
+        _process = other._process;
+    }
+
+    // Called before the guest writes to the host stdout or stderr, so that
+    // buffered console output comes out first
+    void SetOutputHook(std::function<void()> hook)
+    {
+        _beforeOutput = std::move(hook);
+    }
+
+    // Syscalls of the hart are recorded to or replayed from the log
+    void SetLog(ReplayLog* log, Word hart)
+    {
+        _log = log;
+        _hart = hart;
+    }
+
+    // Returns the exit code when the guest exits, or 1 when a replay diverges
+    std::optional<Word> Handle(RegisterFile& rf, uint64_t instret = 0)
+    {
+        auto num = static_cast<Syscall>(rf.Read(a7));
+        Word a[4] = {rf.Read(a0), rf.Read(a0 + 1), rf.Read(a0 + 2), rf.Read(a0 + 3)};
+
+        if (num == Syscall::Exit || num == Syscall::ExitGroup)
+            return a[0];
+        if (_log && _log->Replaying())
+            return Replay(rf, num, a, instret);
+
+        std::lock_guard<std::mutex> lock{_process->lock};
+        SignedWord ret;
+        _written = {};
+        switch (num)
+        {
+            case Syscall::Read:         ret = DoRead(a[0], a[1], a[2]); break;
+            case Syscall::Write:        ret = DoWrite(a[0], a[1], a[2]); break;
+            case Syscall::Open:         ret = DoOpen(a[0], a[1], a[2]); break;
+            case Syscall::Openat:       ret = DoOpen(a[1], a[2], a[3]); break;
+            case Syscall::Close:        ret = DoClose(a[0]); break;
+            case Syscall::Lseek:        ret = DoLseek(a[0], a[1], a[2]); break;
+            case Syscall::Fstat:        ret = DoFstat(a[0], a[1]); break;
+            case Syscall::Gettimeofday: ret = DoGettimeofday(a[0]); break;
+            case Syscall::Brk:          ret = DoBrk(a[0]); break;
+            default:                    ret = -ENOSYS; break;
+        }
+        rf.Write(a0, ret);
+        if (_log)
+            Record(num, ret, instret);
+        return std::nullopt;
+    }
+
+private:
+    static constexpr RId a0 = 10;
+    static constexpr RId a7 = 17;
+
+    // Flags of newlib's sys/_default_fcntl.h
+    static constexpr Word guestAccMode = 0x0003;
+    static constexpr Word guestAppend  = 0x0008;
+    static constexpr Word guestCreat   = 0x0200;
+    static constexpr Word guestTrunc   = 0x0400;
+    static constexpr Word guestExcl    = 0x0800;
+
+    // struct kernel_stat of libgloss for rv32
+    struct GuestStat
+    {
+        uint64_t dev;
+        uint64_t ino;
+        uint32_t mode;
+        uint32_t nlink;
+        uint32_t uid;
+        uint32_t gid;
+        uint64_t rdev;
+        uint64_t pad1;
+        int64_t size;
+        int32_t blksize;
+        int32_t pad2;
+        int64_t blocks;
+        struct { int64_t sec; int32_t nsec; int32_t pad; } atim, mtim, ctim;
+        int32_t reserved[2];
+    };
+    static_assert(sizeof(GuestStat) == 128, "kernel_stat layout mismatch");
+
+    // struct timeval with 64-bit time_t
+    struct GuestTimeval
+    {
+        int64_t sec;
+        int32_t usec;
+        int32_t pad;
+    };
+
+    int HostFd(Word fd) const
+    {
+        auto& fds = _process->fds;
+        return fd < fds.size() ? fds[fd] : -1;
+    }
+
+    void BeforeOutput(int hostFd)
+    {
+        if (_beforeOutput && (hostFd == STDOUT_FILENO || hostFd == STDERR_FILENO))
+            _beforeOutput();
+    }
+
+    static SignedWord Result(ssize_t ret)
+    {
+        return ret < 0 ? -errno : SignedWord(ret);
+    }
+
+    SignedWord DoRead(Word fd, Word buf, Word len)
+    {
+        int hostFd = HostFd(fd);
+        char* ptr = _mem.HostPtr(buf, len);
+        if (hostFd < 0)
+            return -EBADF;
+        if (!ptr)
+            return -EFAULT;
+        SignedWord ret = Result(read(hostFd, ptr, len));
+        if (ret > 0)
+            _written = {buf, Word(ret)};
+        return ret;
+    }
+
+    SignedWord DoWrite(Word fd, Word buf, Word len)
+    {
+        int hostFd = HostFd(fd);
+        const char* ptr = std::as_const(_mem).HostPtr(buf, len);
+        if (hostFd < 0)
+            return -EBADF;
+        if (!ptr)
+            return -EFAULT;
+        BeforeOutput(hostFd);
+        return Result(write(hostFd, ptr, len));
+    }
+
+    SignedWord DoOpen(Word path, Word flags, Word mode)
+    {
+        const char* name = GuestString(path);
+        if (!name)
+            return -EFAULT;
+
+        int hostFlags = (flags & guestAccMode) == 1 ? O_WRONLY
+                      : (flags & guestAccMode) == 2 ? O_RDWR : O_RDONLY;
+        if (flags & guestAppend) hostFlags |= O_APPEND;
+        if (flags & guestCreat)  hostFlags |= O_CREAT;
+        if (flags & guestTrunc)  hostFlags |= O_TRUNC;
+        if (flags & guestExcl)   hostFlags |= O_EXCL;
+
+        int hostFd = open(name, hostFlags, mode);
+        if (hostFd < 0)
+            return -errno;
+
+        auto& fds = _process->fds;
+        for (Word fd = 0; fd < fds.size(); ++fd)
+        {
+            if (fds[fd] < 0)
+            {
+                fds[fd] = hostFd;
+                return fd;
+            }
+        }
+        fds.push_back(hostFd);
+        return fds.size() - 1;
+    }
+
+    SignedWord DoClose(Word fd)
+    {
+        int hostFd = HostFd(fd);
+        if (hostFd < 0)
+            return -EBADF;
+        _process->fds[fd] = -1;
+        // The simulator's own standard streams stay open
+        if (hostFd <= STDERR_FILENO)
+            return 0;
+        return Result(close(hostFd));
+    }
+
+    SignedWord DoLseek(Word fd, Word offset, Word whence)
+    {
+        int hostFd = HostFd(fd);
+        if (hostFd < 0)
+            return -EBADF;
+        return Result(lseek(hostFd, SignedWord(offset), whence));
+    }
+
+    SignedWord DoFstat(Word fd, Word buf)
+    {
+        int hostFd = HostFd(fd);
+        char* ptr = _mem.HostPtr(buf, sizeof(GuestStat));
+        if (hostFd < 0)
+            return -EBADF;
+        if (!ptr)
+            return -EFAULT;
+
+        struct stat st{};
+        if (fstat(hostFd, &st) != 0)
+            return -errno;
+
+        GuestStat gst{};
+        gst.dev = st.st_dev;
+        gst.ino = st.st_ino;
+        gst.mode = st.st_mode;
+        gst.nlink = st.st_nlink;
+        gst.uid = st.st_uid;
+        gst.gid = st.st_gid;
+        gst.rdev = st.st_rdev;
+        gst.size = st.st_size;
+        gst.blksize = st.st_blksize;
+        gst.blocks = st.st_blocks;
+        gst.atim = {st.st_atim.tv_sec, int32_t(st.st_atim.tv_nsec), 0};
+        gst.mtim = {st.st_mtim.tv_sec, int32_t(st.st_mtim.tv_nsec), 0};
+        gst.ctim = {st.st_ctim.tv_sec, int32_t(st.st_ctim.tv_nsec), 0};
+        std::memcpy(ptr, &gst, sizeof(gst));
+        _written = {buf, sizeof(gst)};
+        return 0;
+    }
+
+    SignedWord DoGettimeofday(Word buf)
+    {
+        char* ptr = _mem.HostPtr(buf, sizeof(GuestTimeval));
+        if (!ptr)
+            return -EFAULT;
+
+        timeval tv{};
+        gettimeofday(&tv, nullptr);
+        GuestTimeval gtv{tv.tv_sec, int32_t(tv.tv_usec), 0};
+        std::memcpy(ptr, &gtv, sizeof(gtv));
+        _written = {buf, sizeof(gtv)};
+        return 0;
+    }
+
+    // brk(0) queries the break; a failed request returns the old break
+    SignedWord DoBrk(Word addr)
+    {
+        if (addr >= _mem.ProgramEnd() && addr <= Memory::ramBytes)
+            _process->brk = addr;
+        return _process->brk;
+    }
+
+    const char* GuestString(Word addr)
+    {
+        const char* ptr = std::as_const(_mem).HostPtr(addr, 0);
+        if (!ptr)
+            return nullptr;
+        size_t maxLen = Memory::ramBytes - addr;
+        return std::memchr(ptr, 0, maxLen) ? ptr : nullptr;
+    }
+
+    void Record(Syscall num, SignedWord ret, uint64_t instret)
+    {
+        SyscallRecord rec{_hart, instret, Word(num), ret, _written.addr, {}};
+        if (const char* ptr = std::as_const(_mem).HostPtr(_written.addr, _written.len))
+            rec.data.assign(ptr, ptr + _written.len);
+        _log->Write(rec);
+    }
+
+    // Nothing is asked of the host but the guest's console output
+    std::optional<Word> Replay(RegisterFile& rf, Syscall num, const Word* a, uint64_t instret)
+    {
+        auto rec = _log->Next();
+        if (!rec || rec->hart != _hart || rec->num != Word(num) || rec->instret != instret)
+        {
+            _log->Diverge(_hart, instret);
+            return 1;
+        }
+        if (num == Syscall::Write && a[0] <= STDERR_FILENO && rec->ret > 0 && _log->Echoes())
+        {
+            if (const char* ptr = std::as_const(_mem).HostPtr(a[1], rec->ret))
+            {
+                BeforeOutput(HostFd(a[0]));
+                Result(write(HostFd(a[0]), ptr, rec->ret));
+            }
+        }
+        if (char* ptr = _mem.HostPtr(rec->addr, rec->data.size()))
+            std::memcpy(ptr, rec->data.data(), rec->data.size());
+        rf.Write(a0, rec->ret);
+        return std::nullopt;
+    }
+
+    Memory& _mem;
+    std::shared_ptr<GuestProcess> _process;
+    std::function<void()> _beforeOutput;
+    ReplayLog* _log = nullptr;
+    Word _hart = 0;
+    struct { Word addr, len; } _written{};  // guest memory the last syscall wrote
+};
+
+#endif //RISCV_SIM_SYSCALLPROXY_H
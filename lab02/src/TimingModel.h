@@ -0,0 +1,253 @@
+
+#ifndef RISCV_SIM_TIMINGMODEL_H
+#define RISCV_SIM_TIMINGMODEL_H
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include "Instruction.h"
+#include "Memory.h"
+
+struct CacheConfig
+{
+    unsigned sets = 64;
+    unsigned ways = 4;
+    unsigned lineBytes = 64;
+};
+
+// Set-associative cache with LRU replacement, tags only
+class CacheModel
+{
+public:
+    explicit CacheModel(const CacheConfig& config = {})
+        : _config(config)
+        , _lines(config.sets * config.ways)
+    {
+
+    }
+
+    // Returns true on a hit; a miss allocates the line
+    bool Access(Word addr)
+    {
+        _accesses++;
+        Word line = addr / _config.lineBytes;
+        Line* set = &_lines[(line % _config.sets) * _config.ways];
+        Line* victim = set;
+        for (unsigned w = 0; w < _config.ways; ++w)
+        {
+            if (set[w].valid && set[w].tag == line)
+            {
+                set[w].lastUse = ++_clock;
+                return true;
+            }
+            if (!set[w].valid || (victim->valid && set[w].lastUse < victim->lastUse))
+                victim = &set[w];
+        }
+        _misses++;
+        *victim = {line, ++_clock, true};
+        return false;
+    }
+
+    // Both lines of an access that straddles a line boundary
+    bool Access(Word addr, unsigned size)
+    {
+        bool hit = Access(addr);
+        Word last = addr + size - 1;
+        if (last / _config.lineBytes != addr / _config.lineBytes)
+            hit = Access(last) && hit;
+        return hit;
+    }
+
+    void Flush()
+    {
+        std::fill(_lines.begin(), _lines.end(), Line{});
+    }
+
+    uint64_t Accesses() const { return _accesses; }
+    uint64_t Misses() const { return _misses; }
+
+private:
+    struct Line
+    {
+        Word tag = 0;
+        uint64_t lastUse = 0;
+        bool valid = false;
+    };
+
+    CacheConfig _config;
+    std::vector<Line> _lines;
+    uint64_t _clock = 0;
+    uint64_t _accesses = 0;
+    uint64_t _misses = 0;
+};
+
+// gshare direction predictor, a direct mapped jalr target table and a return address stack
+class BranchPredictor
+{
+public:
+    static constexpr unsigned tableBits = 12;
+    static constexpr unsigned historyBits = 8;
+    static constexpr unsigned targetEntries = 256;
+    static constexpr unsigned rasSize = 8;
+
+    // Returns true if the instruction was predicted correctly
+    bool Predict(Word ip, const Instruction& instr)
+    {
+        switch (instr._type)
+        {
+            case IType::Br:
+            {
+                bool taken = instr._nextIp != ip + 4;
+                uint8_t& counter = _counters[((ip >> 2) ^ _history) & (_counters.size() - 1)];
+                bool predicted = counter >= 2;
+                counter = taken ? std::min(counter + 1, 3) : std::max(counter - 1, 0);
+                _history = ((_history << 1) | taken) & ((1u << historyBits) - 1);
+                return predicted == taken;
+            }
+            case IType::J:
+                if (IsLink(instr._dst))
+                    Push(ip + 4);
+                return true;
+            case IType::Jr:
+            {
+                bool correct;
+                if (IsLink(instr._src1) && !IsLink(instr._dst))
+                {
+                    correct = Pop() == instr._nextIp;
+                }
+                else
+                {
+                    Word& target = _targets[(ip >> 2) % targetEntries];
+                    correct = target == instr._nextIp;
+                    target = instr._nextIp;
+                }
+                if (IsLink(instr._dst))
+                    Push(ip + 4);
+                return correct;
+            }
+            case IType::Mret:
+                return false;
+            default:
+                return true;
+        }
+    }
+
+private:
+    static bool IsLink(const std::optional<RId>& reg)
+    {
+        return reg == RId(1) || reg == RId(5);
+    }
+
+    void Push(Word ip)
+    {
+        _rasTop = (_rasTop + 1) % rasSize;
+        _ras[_rasTop] = ip;
+    }
+
+    Word Pop()
+    {
+        Word ip = _ras[_rasTop];
+        _rasTop = (_rasTop + rasSize - 1) % rasSize;
+        return ip;
+    }
+
+    std::array<uint8_t, 1u << tableBits> _counters{};
+    Word _history = 0;
+    std::array<Word, targetEntries> _targets{};
+    std::array<Word, rasSize> _ras{};
+    unsigned _rasTop = 0;
+};
+
+struct TimingConfig
+{
+    CacheConfig icache;
+    CacheConfig dcache;
+    unsigned missPenalty = 20;
+    unsigned mispredictPenalty = 3;
+    unsigned loadUsePenalty = 1;
+};
+
+struct TimingStats
+{
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    uint64_t icacheMisses = 0;
+    uint64_t dcacheMisses = 0;
+    uint64_t branches = 0;
+    uint64_t mispredicts = 0;
+    uint64_t loadUseStalls = 0;
+
+    double Cpi() const
+    {
+        return instructions ? double(cycles) / instructions : 0;
+    }
+};
+
+// Timing of a single issue in-order pipeline fed by the retired instruction
+// stream of the functional cpu: one cycle per instruction plus cache miss,
+// branch misprediction and load-use penalties.
+class TimingModel
+{
+public:
+    explicit TimingModel(const TimingConfig& config = {})
+        : _config(config)
+        , _icache(config.icache)
+        , _dcache(config.dcache)
+    {
+
+    }
+
+    void operator()(Word ip, const Instruction& instr)
+    {
+        uint64_t cycles = 1;
+
+        if (!_icache.Access(ip))
+        {
+            _stats.icacheMisses++;
+            cycles += _config.missPenalty;
+        }
+
+        if ((instr._type == IType::Ld || instr._type == IType::St) && instr._addr < Memory::ramBytes)
+        {
+            if (!_dcache.Access(instr._addr, AccessSize(instr._memFunc)))
+            {
+                _stats.dcacheMisses++;
+                cycles += _config.missPenalty;
+            }
+        }
+
+        if (_loadDst && (instr._src1 == _loadDst || instr._src2 == _loadDst))
+        {
+            _stats.loadUseStalls++;
+            cycles += _config.loadUsePenalty;
+        }
+        _loadDst = instr._type == IType::Ld ? instr._dst : std::nullopt;
+
+        if (instr._type == IType::Br || instr._type == IType::Jr || instr._type == IType::Mret)
+            _stats.branches++;
+        if (!_predictor.Predict(ip, instr))
+        {
+            _stats.mispredicts++;
+            cycles += _config.mispredictPenalty;
+        }
+
+        _stats.instructions++;
+        _stats.cycles += cycles;
+    }
+
+    const TimingStats& Stats() const
+    {
+        return _stats;
+    }
+
+private:
+    TimingConfig _config;
+    CacheModel _icache;
+    CacheModel _dcache;
+    BranchPredictor _predictor;
+    std::optional<RId> _loadDst;
+    TimingStats _stats;
+};
+
+#endif //RISCV_SIM_TIMINGMODEL_H
@@ -0,0 +1,148 @@
+
+#ifndef RISCV_SIM_TRACEPIPE_H
+#define RISCV_SIM_TRACEPIPE_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <type_traits>
+
+#include "Instruction.h"
+
+// Bounded single producer, single consumer ring. The producer and the consumer
+// each own an index on its own cache line and keep a stale copy of the other's,
+// so the shared lines only move when the ring looks full or empty.
+template <typename T, size_t Size>
+class SpscRing
+{
+    static_assert((Size & (Size - 1)) == 0, "ring size must be a power of two");
+
+public:
+    bool TryPush(const T& value)
+    {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _headCache == Size)
+        {
+            _headCache = _head.load(std::memory_order_acquire);
+            if (tail - _headCache == Size)
+                return false;
+        }
+        _slots[tail & (Size - 1)] = value;
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T& value)
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tailCache)
+        {
+            _tailCache = _tail.load(std::memory_order_acquire);
+            if (head == _tailCache)
+                return false;
+        }
+        value = _slots[head & (Size - 1)];
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    alignas(cacheLineSize) std::atomic<size_t> _tail{0};
+    size_t _headCache = 0;                  // producer's view of _head
+    alignas(cacheLineSize) std::atomic<size_t> _head{0};
+    size_t _tailCache = 0;                  // consumer's view of _tail
+    alignas(cacheLineSize) T _slots[Size];
+};
+
+// A retired instruction on its way to the model, one slot per cache line pair
+struct alignas(cacheLineSize) TraceEntry
+{
+    Instruction instr;
+    Word ip;
+};
+
+static_assert(std::is_trivially_copyable_v<Instruction>, "trace entries are copied between threads");
+
+// Runs a timing model on a thread of its own, fed through a ring by the
+// functional cpu: cpu.ProcessInstruction(pipe) instead of (model). The
+// functional engine only ever executes the correct path and the models charge
+// mispredictions as penalties, so nothing has to flow back to the front end.
+// The model may only be looked at after Finish().
+template <typename Model>
+class PipelinedModel
+{
+public:
+    explicit PipelinedModel(Model& model)
+        : _model(model)
+        , _ring(std::make_unique<Ring>())
+        , _thread([this] { Consume(); })
+    {
+
+    }
+
+    ~PipelinedModel()
+    {
+        Finish();
+    }
+
+    PipelinedModel(const PipelinedModel&) = delete;
+    PipelinedModel& operator=(const PipelinedModel&) = delete;
+
+    void operator()(Word ip, const Instruction& instr)
+    {
+        TraceEntry entry{instr, ip};
+        for (unsigned spins = 0; !_ring->TryPush(entry); ++spins)
+            Backoff(spins);
+    }
+
+    // Waits until the model has seen every instruction
+    void Finish()
+    {
+        if (!_thread.joinable())
+            return;
+        _done.store(true, std::memory_order_release);
+        _thread.join();
+    }
+
+private:
+    static constexpr size_t ringSize = 1024;
+    using Ring = SpscRing<TraceEntry, ringSize>;
+
+    // With fewer host cores than threads the other side only runs if we yield
+    static void Backoff(unsigned spins)
+    {
+        if (spins >= 64)
+            std::this_thread::yield();
+    }
+
+    void Consume()
+    {
+        TraceEntry entry;
+        for (unsigned spins = 0;; ++spins)
+        {
+            if (_ring->TryPop(entry))
+            {
+                _model(entry.ip, entry.instr);
+                spins = 0;
+            }
+            else if (_done.load(std::memory_order_acquire))
+            {
+                // The producer has stopped, whatever is left is in the ring
+                while (_ring->TryPop(entry))
+                    _model(entry.ip, entry.instr);
+                return;
+            }
+            else
+            {
+                Backoff(spins);
+            }
+        }
+    }
+
+    Model& _model;
+    std::unique_ptr<Ring> _ring;
+    std::atomic<bool> _done{false};
+    std::thread _thread;
+};
+
+#endif //RISCV_SIM_TRACEPIPE_H
@@ -0,0 +1,332 @@
+
+#ifndef RISCV_SIM_VECTORUNIT_H
+#define RISCV_SIM_VECTORUNIT_H
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#include "CsrFile.h"
+#include "Memory.h"
+
+// Vector registers and a subset of RVV on them: vsetvl*, unit-stride and
+// strided loads and stores, integer arithmetic, compares into masks,
+// reductions and masking by v0, for SEW of 8, 16 and 32 bits (ELEN = 32).
+// VLEN is 128 or 256 bits, it is read from vlenb of the CsrFile.
+// The registers are one flat byte array, so a register group of LMUL > 1 is
+// simply a longer run of elements. Unmasked operations are plain loops over
+// it that the compiler turns into host SIMD (SSE2, or AVX2 with
+// RISCV_SIM_NATIVE); unmasked unit-stride accesses are a single memcpy.
+// Masked-off and tail elements are left undisturbed. Encodings the subset
+// does not cover, a vill vtype and register groups past v31 leave the state,
+// rd included, as it is instead of raising an illegal instruction.
+class VectorUnit
+{
+public:
+    static constexpr Word maxVlenb = 32;
+
+    // False when rd gets no value (vmv.x.s doing nothing), the caller keeps it as it was
+    bool Execute(InstructionPtr& instr, Memory& mem, CsrFile& csrf)
+    {
+        Instruction& in = *instr;
+        if (in._vecFunc == VecFunc::SetVli || in._vecFunc == VecFunc::SetIvli || in._vecFunc == VecFunc::SetVl)
+        {
+            Configure(in, csrf);
+            return true;
+        }
+
+        Word vtype = csrf.VectorType();
+        if (vtype & CsrFile::vtypeVill)
+            return false;
+        _vlenb = std::min(csrf.Vlenb(), maxVlenb);
+        Word vl = csrf.VectorLength();
+
+        if (in._vecFunc >= VecFunc::Load && in._vecFunc <= VecFunc::StoreStrided)
+        {
+            switch (in._memFunc)
+            {
+                case MemFunc::B: Access<uint8_t>(in, vl, mem); break;
+                case MemFunc::H: Access<uint16_t>(in, vl, mem); break;
+                default:         Access<uint32_t>(in, vl, mem); break;
+            }
+            return true;
+        }
+        switch ((vtype >> 3) & 7)
+        {
+            case 0:  return Compute<uint8_t>(in, vl);
+            case 1:  return Compute<uint16_t>(in, vl);
+            default: return Compute<uint32_t>(in, vl);
+        }
+    }
+
+private:
+    // Element pointers that may alias the bytes of the register file
+    template <typename U>
+    struct Alias
+    {
+        typedef U __attribute__((may_alias)) Type;
+    };
+
+    template <typename U>
+    using Ptr = typename Alias<U>::Type*;
+
+    static constexpr Word maxBytes = 32 * maxVlenb;
+
+    // VLMAX, or 0 if vtype is not supported
+    static Word VlMax(Word vtype, Word vlenb)
+    {
+        Word sew = (vtype >> 3) & 7;
+        Word lmul = vtype & 7;
+        if (vtype >> 8 || sew > 2 || lmul == 4)
+            return 0;
+        // A fractional LMUL needs SEW <= ELEN * LMUL
+        if (lmul > 4 && (8u << sew) > (32u >> (8 - lmul)))
+            return 0;
+        Word elems = vlenb * 8 >> (3 + sew);
+        return lmul < 4 ? elems << lmul : elems >> (8 - lmul);
+    }
+
+    void Configure(Instruction& in, CsrFile& csrf)
+    {
+        Word vtype, avl;
+        if (in._vecFunc == VecFunc::SetIvli)
+        {
+            vtype = *in._imm & 0x3ffu;
+            avl = *in._imm >> 16u;
+        }
+        else
+        {
+            vtype = in._vecFunc == VecFunc::SetVl ? in._src2Val : *in._imm;
+            // x0 as AVL asks for VLMAX, or keeps vl if rd is x0 too (no destination)
+            avl = *in._src1 ? in._src1Val : in._dst.has_value() ? ~0u : csrf.VectorLength();
+        }
+
+        Word vlmax = VlMax(vtype, std::min(csrf.Vlenb(), maxVlenb));
+        if (!vlmax)
+        {
+            csrf.SetVectorConfig(0, CsrFile::vtypeVill);
+            in._data = 0;
+            return;
+        }
+        in._data = std::min(avl, vlmax);
+        csrf.SetVectorConfig(in._data, vtype);
+    }
+
+    template <typename U>
+    Ptr<U> Reg(unsigned reg)
+    {
+        return reinterpret_cast<Ptr<U>>(_v.data() + reg * _vlenb);
+    }
+
+    // The register group starting at reg holds count elements of U
+    bool Fits(const std::optional<uint8_t>& reg, Word count, Word size) const
+    {
+        return !reg || *reg * _vlenb + count * size <= 32 * _vlenb;
+    }
+
+    bool Active(Word i) const
+    {
+        return _v[i / 8] >> (i % 8) & 1;
+    }
+
+    template <typename U>
+    void Access(Instruction& in, Word vl, Memory& mem)
+    {
+        bool load = in._vecFunc == VecFunc::Load || in._vecFunc == VecFunc::LoadStrided;
+        bool strided = in._vecFunc == VecFunc::LoadStrided || in._vecFunc == VecFunc::StoreStrided;
+        auto reg = load ? in._fdst : in._fsrc2;
+        if (!Fits(reg, vl, sizeof(U)))
+            return;
+
+        Ptr<U> v = Reg<U>(*reg);
+        Word base = in._src1Val;
+        Word stride = strided ? in._src2Val : sizeof(U);
+        in._addr = base;
+        if (!in._fsrc3 && stride == sizeof(U))
+        {
+            if (load)
+            {
+                if (const char* host = std::as_const(mem).HostPtr(base, vl * sizeof(U)))
+                {
+                    std::memcpy(v, host, vl * sizeof(U));
+                    return;
+                }
+            }
+            else if (char* host = mem.HostPtr(base, vl * sizeof(U)))
+            {
+                std::memcpy(host, v, vl * sizeof(U));
+                return;
+            }
+        }
+        // Elements past the end of RAM fault one by one
+        for (Word i = 0; i < vl; ++i)
+        {
+            if (in._fsrc3 && !Active(i))
+                continue;
+            if (load)
+                v[i] = mem.Load<U>(base + i * stride);
+            else
+                mem.Store<U>(base + i * stride, v[i]);
+        }
+    }
+
+    // Calls op(i, b) for the active elements, b being vs1[i] or the scalar operand
+    template <typename U, typename Op>
+    void ForActive(const Instruction& in, Word vl, Op op)
+    {
+        Ptr<U> vs1 = in._fsrc1 ? Reg<U>(*in._fsrc1) : nullptr;
+        U scalar = U(in._src1 ? in._src1Val : in._imm.value_or(0));
+        if (in._fsrc3)
+        {
+            for (Word i = 0; i < vl; ++i)
+            {
+                if (Active(i))
+                    op(i, vs1 ? vs1[i] : scalar);
+            }
+        }
+        else if (vs1)
+        {
+            for (Word i = 0; i < vl; ++i)
+                op(i, vs1[i]);
+        }
+        else
+        {
+            for (Word i = 0; i < vl; ++i)
+                op(i, scalar);
+        }
+    }
+
+    template <typename U>
+    bool Compute(Instruction& in, Word vl)
+    {
+        using S = std::make_signed_t<U>;
+        switch (in._vecFunc)
+        {
+            case VecFunc::MvXS:
+                if (!Fits(in._fsrc2, 1, sizeof(U)))
+                    return false;
+                in._data = Word(SignedWord(S(Reg<U>(*in._fsrc2)[0])));
+                return true;
+            case VecFunc::MvSX:
+                if (vl && Fits(in._fdst, 1, sizeof(U)))
+                    Reg<U>(*in._fdst)[0] = U(in._src1Val);
+                return true;
+            case VecFunc::RedSum:
+            case VecFunc::RedMinu:
+            case VecFunc::RedMin:
+            case VecFunc::RedMaxu:
+            case VecFunc::RedMax:
+                Reduce<U>(in, vl);
+                return true;
+            case VecFunc::Seq:
+            case VecFunc::Sne:
+            case VecFunc::Sltu:
+            case VecFunc::Slt:
+            case VecFunc::Sleu:
+            case VecFunc::Sle:
+            case VecFunc::Sgtu:
+            case VecFunc::Sgt:
+                Compare<U>(in, vl);
+                return true;
+            default:
+                break;
+        }
+
+        if (!Fits(in._fdst, vl, sizeof(U)) || !Fits(in._fsrc1, vl, sizeof(U)) || !Fits(in._fsrc2, vl, sizeof(U)))
+            return true;
+        Ptr<U> d = Reg<U>(*in._fdst);
+        Ptr<U> a = Reg<U>(*in._fsrc2);
+        switch (in._vecFunc)
+        {
+            case VecFunc::Add:  ForActive<U>(in, vl, [&](Word i, U b) { d[i] = U(a[i] + b); }); break;
+            case VecFunc::Sub:  ForActive<U>(in, vl, [&](Word i, U b) { d[i] = U(a[i] - b); }); break;
+            case VecFunc::Rsub: ForActive<U>(in, vl, [&](Word i, U b) { d[i] = U(b - a[i]); }); break;
+            case VecFunc::And:  ForActive<U>(in, vl, [&](Word i, U b) { d[i] = a[i] & b; }); break;
+            case VecFunc::Or:   ForActive<U>(in, vl, [&](Word i, U b) { d[i] = a[i] | b; }); break;
+            case VecFunc::Xor:  ForActive<U>(in, vl, [&](Word i, U b) { d[i] = a[i] ^ b; }); break;
+            case VecFunc::Minu: ForActive<U>(in, vl, [&](Word i, U b) { d[i] = std::min<U>(a[i], b); }); break;
+            case VecFunc::Maxu: ForActive<U>(in, vl, [&](Word i, U b) { d[i] = std::max<U>(a[i], b); }); break;
+            case VecFunc::Min:  ForActive<U>(in, vl, [&](Word i, U b) { d[i] = U(std::min<S>(a[i], b)); }); break;
+            case VecFunc::Max:  ForActive<U>(in, vl, [&](Word i, U b) { d[i] = U(std::max<S>(a[i], b)); }); break;
+            case VecFunc::Mul:  ForActive<U>(in, vl, [&](Word i, U b) { d[i] = U(Word(a[i]) * b); }); break;
+            case VecFunc::Macc: ForActive<U>(in, vl, [&](Word i, U b) { d[i] = U(Word(a[i]) * b + d[i]); }); break;
+            case VecFunc::Merge:
+                if (!in._fsrc3)
+                {
+                    ForActive<U>(in, vl, [&](Word i, U b) { d[i] = b; });
+                    break;
+                }
+                // vmerge picks by v0 and writes every element
+                for (Word i = 0; i < vl; ++i)
+                {
+                    U b = in._fsrc1 ? Reg<U>(*in._fsrc1)[i] : U(in._src1 ? in._src1Val : *in._imm);
+                    d[i] = Active(i) ? b : a[i];
+                }
+                break;
+            default:
+                break;
+        }
+        return true;
+    }
+
+    // vd[0] = vs1[0] op the active elements of vs2
+    template <typename U>
+    void Reduce(Instruction& in, Word vl)
+    {
+        using S = std::make_signed_t<U>;
+        if (!vl || !Fits(in._fsrc2, vl, sizeof(U)) || !Fits(in._fsrc1, 1, sizeof(U)) || !Fits(in._fdst, 1, sizeof(U)))
+            return;
+        Ptr<U> a = Reg<U>(*in._fsrc2);
+        U acc = Reg<U>(*in._fsrc1)[0];
+        for (Word i = 0; i < vl; ++i)
+        {
+            if (in._fsrc3 && !Active(i))
+                continue;
+            switch (in._vecFunc)
+            {
+                case VecFunc::RedSum:  acc = U(acc + a[i]); break;
+                case VecFunc::RedMinu: acc = std::min<U>(acc, a[i]); break;
+                case VecFunc::RedMaxu: acc = std::max<U>(acc, a[i]); break;
+                case VecFunc::RedMin:  acc = U(std::min<S>(acc, a[i])); break;
+                default:               acc = U(std::max<S>(acc, a[i])); break;
+            }
+        }
+        Reg<U>(*in._fdst)[0] = acc;
+    }
+
+    // One mask bit per element of vs2; vd may be a source, so the bits are built aside
+    template <typename U>
+    void Compare(Instruction& in, Word vl)
+    {
+        using S = std::make_signed_t<U>;
+        Word bytes = (vl + 7) / 8;
+        if (!Fits(in._fsrc1, vl, sizeof(U)) || !Fits(in._fsrc2, vl, sizeof(U)) || !Fits(in._fdst, bytes, 1))
+            return;
+        std::array<uint8_t, maxBytes / 8> bits;
+        std::memcpy(bits.data(), _v.data() + *in._fdst * _vlenb, bytes);
+        Ptr<U> a = Reg<U>(*in._fsrc2);
+        ForActive<U>(in, vl, [&](Word i, U b) {
+            bool res;
+            switch (in._vecFunc)
+            {
+                case VecFunc::Seq:  res = a[i] == b; break;
+                case VecFunc::Sne:  res = a[i] != b; break;
+                case VecFunc::Sltu: res = a[i] < b; break;
+                case VecFunc::Slt:  res = S(a[i]) < S(b); break;
+                case VecFunc::Sleu: res = a[i] <= b; break;
+                case VecFunc::Sle:  res = S(a[i]) <= S(b); break;
+                case VecFunc::Sgtu: res = a[i] > b; break;
+                default:            res = S(a[i]) > S(b); break;
+            }
+            bits[i / 8] = (bits[i / 8] & ~(1u << (i % 8))) | res << (i % 8);
+        });
+        std::memcpy(_v.data() + *in._fdst * _vlenb, bits.data(), bytes);
+    }
+
+    alignas(32) std::array<uint8_t, maxBytes> _v{};
+    Word _vlenb = 16;
+};
+
+#endif //RISCV_SIM_VECTORUNIT_H
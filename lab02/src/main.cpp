@@ -1,43 +1,528 @@
 #include "Cpu.h"
 #include "Memory.h"
 #include "BaseTypes.h"
+#include "Benchmarks.h"
+#include "Console.h"
+#include "Clint.h"
+#include "CoherenceModel.h"
+#include "Sampler.h"
+#include "SimtCpu.h"
+#include "ReplayLog.h"
+#include "HartScheduler.h"
+#include "LockstepChecker.h"
 
+#include <chrono>
+#include <deque>
+#include <fcntl.h>
 #include <optional>
+#include <cstring>
+#include <type_traits>
 
-int main()
+// Sets up the memory, harts, console and CLINT of a program and hands the harts to
+// run(cpus, service). service(cpu) takes what a hart left for the host and returns
+// the exit status once the program is over; done(cpu) is called when it exits.
+// Several harts share the memory; the CLINT drives hart 0.
+template <typename Run, typename Done>
+int RunPlatform(const char* elf, Run run, Done done, int consoleFd, unsigned harts,
+                ReplayLog* log, AccessProfiler* profiler)
 {
     Memory mem;
-    mem.LoadElf("program");
-    Cpu cpu{mem};
-    cpu.Reset(0x200);
+    if (!mem.LoadElf(elf))
+        return 1;
+    std::deque<Cpu> cpus;
+    for (unsigned hart = 0; hart < harts; ++hart)
+        cpus.emplace_back(mem, hart).Reset(0x200);
+    Cpu& boot = cpus.front();
+    for (auto& cpu : cpus)
+        cpu.ShareProcess(boot);
+    Console console{mem, consoleFd};
 
-    int32_t print_int = 0;
-    while (true)
+    Scheduler scheduler;
+    DeviceBus bus;
+    Clint clint{scheduler, [&] { return boot.Cycles(); },
+                [&](Word bits, bool set) { boot.SetInterruptPending(bits, set); }};
+    bus.Map(Clint::base, Clint::size, clint);
+    for (auto& cpu : cpus)
     {
-        cpu.ProcessInstruction();
+        cpu.Attach(bus, scheduler);
+        cpu.AttachProfiler(profiler);
+        cpu.AttachConsole(console);
+        if (log)
+            cpu.AttachLog(*log);
+    }
+
+    std::vector<int32_t> print_int(harts);
+    auto service = [&](Cpu& cpu) -> std::optional<int> {
         std::optional<CpuToHostData> msg = cpu.GetMessage();
         if (!msg)
-            continue;
+        {
+            if (auto& fault = cpu.GetFault())
+            {
+                console.Flush(cpu.ConsoleAddr());
+                fprintf(stderr, "FAILED: access fault at 0x%08x (ip = 0x%08x, hart %u)\n",
+                        fault->addr, fault->ip, cpu.HartId());
+                return 1;
+            }
+            return std::nullopt;
+        }
 
         auto type = msg.value().unpacked.type;
         auto data = msg.value().unpacked.data;
 
         if(type == CpuToHostType::ExitCode) {
-            if(data == 0) {
+            console.Flush(cpu.ConsoleAddr());
+            done(cpu);
+            Word code = cpu.ExitCode().value_or(data);
+            if(code == 0) {
                 fprintf(stderr, "PASSED\n");
                 return 0;
             } else {
-                fprintf(stderr, "FAILED: exit code = %d\n", data);
-                return data;
+                fprintf(stderr, "FAILED: exit code = %d\n", SignedWord(code));
+                // The host keeps only the low 8 bits of the status
+                return (code & 0xff) != 0 ? int(code) : 1;
             }
-            break;
         } else if(type == CpuToHostType::PrintChar) {
-            fprintf(stderr, "%c", (char)data);
+            console.PutChar((char)data, cpu.ConsoleAddr());
         } else if(type == CpuToHostType::PrintIntLow) {
-            print_int = uint32_t(data);
+            print_int[cpu.HartId()] = uint32_t(data);
         } else if(type == CpuToHostType::PrintIntHigh) {
-            print_int |= uint32_t(data) << 16;
-            fprintf(stderr, "%d", print_int);
+            print_int[cpu.HartId()] |= uint32_t(data) << 16;
+            console.PutInt(print_int[cpu.HartId()], cpu.ConsoleAddr());
+        } else if(type == CpuToHostType::ConsoleFlush) {
+            console.Flush(cpu.ConsoleAddr());
+        }
+        return std::nullopt;
+    };
+    return run(cpus, service);
+}
+
+// step(cpu) runs the program for a while, e.g. one block, and may return false to give up the run;
+// done(cpu) is called when it exits.
+// The harts take turns on the calling thread.
+template <typename Step, typename Done>
+int RunProgram(const char* elf, Step step, Done done, int consoleFd = STDERR_FILENO, unsigned harts = 1,
+               ReplayLog* log = nullptr, AccessProfiler* profiler = nullptr)
+{
+    auto run = [&](std::deque<Cpu>& cpus, auto& service) {
+        while (true)
+        {
+            for (auto& cpu : cpus)
+            {
+                if constexpr (std::is_same_v<decltype(step(cpu)), bool>)
+                {
+                    if (!step(cpu))
+                        return 1;
+                }
+                else
+                {
+                    step(cpu);
+                }
+                if (std::optional<int> ret = service(cpu))
+                    return *ret;
+            }
         }
+    };
+    return RunPlatform(elf, run, done, consoleFd, harts, log, profiler);
+}
+
+int RunProgram(const char* elf)
+{
+    return RunProgram(elf, [](Cpu& cpu) { cpu.ProcessBlock(); }, [](Cpu&) {});
+}
+
+// Harts on the block engine with their host syscalls recorded to or replayed from a log
+int RunLogged(const char* elf, const char* path, ReplayLog::Mode mode, unsigned harts)
+{
+    ReplayLog log{path, mode, harts};
+    if (!log.Ok())
+    {
+        fprintf(stderr, mode == ReplayLog::Mode::Record ? "cannot write %s\n" : "%s is not a log of %u harts\n",
+                path, harts);
+        return 1;
+    }
+    int ret = RunProgram(elf, [](Cpu& cpu) { cpu.ProcessBlock(); }, [](Cpu&) {}, STDERR_FILENO, harts, &log);
+    if (!log.Divergence().empty())
+        fprintf(stderr, "%s\n", log.Divergence().c_str());
+    else if (!log.Ok() && mode == ReplayLog::Mode::Record)
+        fprintf(stderr, "failed to write %s\n", path);
+    return ret;
+}
+
+// The block engine checked against the reference engine at every block
+int RunChecked(const char* elf)
+{
+    LockstepChecker checker;
+    if (!checker.RefMemory().LoadElf(elf))
+        return 1;
+    bool diverged = false;
+    int ret = RunProgram(elf, [&](Cpu& cpu) { return checker.Step(cpu); },
+                         [&](Cpu& cpu) { diverged = !checker.Finish(cpu); });
+    auto& stats = checker.Stats();
+    if (!checker.Report().empty())
+    {
+        fprintf(stderr, "%s", checker.Report().c_str());
+        if (diverged)
+            fprintf(stderr, "FAILED: engines diverged\n");
+        return 1;
+    }
+    fprintf(stderr, "checked %" PRIu64 " instructions in %" PRIu64 " blocks\n", stats.instructions, stats.blocks);
+    return ret;
+}
+
+// The block engine with the data accesses sampled into heatmaps, reuse distances and working set sizes
+int RunProfiled(const char* elf, const char* prefix, const AccessProfilerConfig& config)
+{
+    AccessProfiler profiler{config};
+    auto report = [&](Cpu&) {
+        profiler.Finish();
+        uint64_t peak = 0;
+        for (auto& point : profiler.WorkingSet())
+            peak = std::max(peak, point.lines);
+        printf("%" PRIu64 " data accesses, 1 in %u sampled: %zu pages, %zu lines, peak working set %" PRIu64
+               " lines (%" PRIu64 " KB)\n", profiler.Accesses(), profiler.Rate(), profiler.Pages().size(),
+               profiler.Lines().size(), peak, peak * AccessProfiler::lineBytes / 1024);
+    };
+    int ret = RunProgram(elf, [](Cpu& cpu) { cpu.ProcessBlock(); }, report, STDERR_FILENO, 1, nullptr, &profiler);
+    if (!profiler.WriteCsv(prefix))
+    {
+        fprintf(stderr, "failed to write %s-*.csv\n", prefix);
+        return 1;
+    }
+    return ret;
+}
+
+void PrintEstimate(const SampleEstimate& est, const TimingStats& stats)
+{
+    printf("instructions %" PRIu64 ", detailed %.2f%% in %zu windows\n",
+           est.instructions, 100.0 * est.detailed / std::max<uint64_t>(est.instructions, 1), est.windows);
+    if (est.windows)
+        printf("estimated CPI %.3f +- %.3f (95%%), cycles %" PRIu64 "\n", est.cpi, est.ci95, est.Cycles());
+    else if (est.detailed)
+        printf("no window measured, CPI %.3f of the detailed instructions, cycles %" PRIu64 "\n",
+               est.cpi, est.Cycles());
+    else
+        printf("no window measured, no estimate\n");
+    printf("detailed: icache misses %" PRIu64 ", dcache misses %" PRIu64 ", mispredicts %" PRIu64
+           " of %" PRIu64 " branches, load-use stalls %" PRIu64 "\n",
+           stats.icacheMisses, stats.dcacheMisses, stats.mispredicts, stats.branches, stats.loadUseStalls);
+}
+
+// Fast-forward with detailed timing windows, either periodic or at SimPoints
+int RunSampled(const char* elf, const SamplingConfig& config, unsigned simPoints)
+{
+    TimingModel model;
+    auto report = [&](Sampler& sampler) {
+        return [&model, s = &sampler](Cpu& cpu) { PrintEstimate(s->Estimate(cpu), model.Stats()); };
+    };
+    if (simPoints == 0)
+    {
+        Sampler sampler{model, config};
+        return RunProgram(elf, [&](Cpu& cpu) { sampler.Step(cpu); }, report(sampler));
     }
+
+    // Profiling pass with the guest output discarded
+    BbvCollector bbvs{config.period};
+    int devNull = open("/dev/null", O_WRONLY);
+    int ret = RunProgram(elf, [&](Cpu& cpu) { bbvs.Step(cpu); }, [&](Cpu& cpu) { bbvs.Finish(cpu); }, devNull);
+    close(devNull);
+    if (ret != 0)
+        return ret;
+
+    auto points = PickSimPoints(bbvs.Intervals(), simPoints);
+    printf("%zu intervals of %" PRIu64 " instructions, simpoints:", bbvs.Intervals().size(), config.period);
+    for (auto& point : points)
+        printf(" %zu (%.2f)", point.interval, point.weight);
+    printf("\n");
+
+    SamplingConfig detailed = config;
+    detailed.window = config.period;
+    Sampler sampler{model, detailed, points};
+    return RunProgram(elf, [&](Cpu& cpu) { sampler.Step(cpu); }, report(sampler));
+}
+
+// Harts interleaved an instruction at a time, their data accesses fed to coherent L1 models
+int RunCoherent(const char* elf, unsigned harts, CoherenceProtocol protocol)
+{
+    CoherenceModel model{harts, protocol};
+    auto step = [&](Cpu& cpu) {
+        cpu.ProcessInstruction([&](Word, const Instruction& instr) { model(cpu.HartId(), instr); });
+    };
+    auto report = [&](Cpu&) {
+        printf("hart      reads     writes     misses  coh.true coh.false   upgrades     invals wrbacks\n");
+        for (unsigned hart = 0; hart < harts; ++hart)
+        {
+            auto& s = model.Stats(hart);
+            printf("%4u %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %9" PRIu64 " %9" PRIu64 " %10" PRIu64
+                   " %10" PRIu64 " %7" PRIu64 "\n", hart, s.reads, s.writes, s.misses, s.trueSharing,
+                   s.falseSharing, s.upgrades, s.invalidations, s.writebacks);
+        }
+        printf("bus transactions %" PRIu64 "\n", model.BusTransactions());
+    };
+    return RunProgram(elf, step, report, STDERR_FILENO, harts);
+}
+
+// Harts on the block engine in turns of quantum instructions, spinning harts parked.
+// With several threads only hart 0 keeps the devices; the other harts run on worker
+// threads and do not see the CLINT.
+int RunScheduled(const char* elf, unsigned harts, uint64_t quantum, unsigned threads)
+{
+    HartScheduler scheduler{quantum};
+    auto report = [&](Cpu&) {
+        auto s = scheduler.Stats();
+        printf("quanta %" PRIu64 ", parked %" PRIu64 " times, %" PRIu64 " turns skipped\n",
+               s.quanta, s.parks, s.skipped);
+    };
+    if (threads <= 1)
+        return RunProgram(elf, [&](Cpu& cpu) { scheduler.Step(cpu); }, report, STDERR_FILENO, harts);
+
+    auto run = [&](std::deque<Cpu>& cpus, auto& service) {
+        for (size_t i = 1; i < cpus.size(); ++i)
+            cpus[i].Detach();
+        int ret = 1;
+        scheduler.Run(cpus, threads, [&](Cpu& cpu) {
+            std::optional<int> status = service(cpu);
+            if (status)
+                ret = *status;
+            return !status;
+        });
+        return ret;
+    };
+    return RunPlatform(elf, run, report, STDERR_FILENO, harts, nullptr, nullptr);
+}
+
+// Instances of a program run in lockstep lanes; mhartid is the instance index, so each picks its own input
+template <unsigned Lanes>
+int RunSimt(const char* elf, unsigned instances)
+{
+    unsigned failed = 0;
+    SimtStats total;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned first = 0; first < instances; first += Lanes)
+    {
+        // Fresh memories for every batch
+        auto simt = std::make_unique<SimtCpu<Lanes>>();
+        unsigned active = std::min(Lanes, instances - first);
+        for (unsigned lane = 0; lane < active; ++lane)
+        {
+            if (!simt->LaneMemory(lane).LoadElf(elf))
+                return 1;
+        }
+        simt->Reset(0x200, first, active);
+        simt->Run();
+
+        for (unsigned lane = 0; lane < active; ++lane)
+        {
+            auto& result = simt->Result(lane);
+            if (!result.output.empty())
+                printf("[%u] %s\n", first + lane, result.output.c_str());
+            if (result.fault)
+                printf("instance %u: access fault at 0x%08x (ip = 0x%08x)\n", first + lane, result.fault->addr, result.fault->ip);
+            else if (result.exitCode != 0u)
+                printf("instance %u: exit code = %d\n", first + lane, *result.exitCode);
+            failed += result.fault || result.exitCode != 0u;
+        }
+        total.steps += simt->Stats().steps;
+        total.laneInstructions += simt->Stats().laneInstructions;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%u instances on %u lanes: %" PRIu64 " instructions, lane utilization %.1f%%, %.1f MIPS\n",
+           instances, Lanes, total.laneInstructions, 100 * total.Utilization(Lanes),
+           total.laneInstructions / seconds / 1e6);
+    fflush(stdout);
+
+    if (failed)
+    {
+        fprintf(stderr, "FAILED: %u of %u instances\n", failed, instances);
+        return 1;
+    }
+    fprintf(stderr, "PASSED\n");
+    return 0;
+}
+
+// riscv_sim [elf]                      run a program ("program" by default)
+// riscv_sim --bench [--scale N] [--repeat N] [kernel...]
+// riscv_sim --ooo [--width N] [--scale N] [--pipeline] [kernel...]
+// riscv_sim --sample [--period N] [--window N] [--warmup N] [elf]
+// riscv_sim --simpoints K [--interval N] [--warmup N] [elf]
+// riscv_sim --harts N [--msi | --mesi | --quantum N [--threads N]] [elf]
+// riscv_sim --simt N [--lanes 8|16] [elf]
+// riscv_sim --record FILE | --replay FILE [--harts N] [elf]
+// riscv_sim --check [elf] | --check --bench [--scale N] [kernel...]
+// riscv_sim --memprof PREFIX [--rate N] [--interval N] [elf]
+int main(int argc, char** argv)
+{
+    if (argc > 1 && std::strcmp(argv[1], "--bench") == 0)
+    {
+        std::vector<std::string> kernels;
+        unsigned scale = 1;
+        unsigned repeat = 5;
+        for (int i = 2; i < argc; ++i)
+        {
+            if (std::strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+                scale = std::max(1, std::atoi(argv[++i]));
+            else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+                repeat = std::max(1, std::atoi(argv[++i]));
+            else
+                kernels.emplace_back(argv[i]);
+        }
+        return RunBenchmarks(kernels, scale, repeat);
+    }
+
+    if (argc > 1 && std::strcmp(argv[1], "--ooo") == 0)
+    {
+        std::vector<std::string> kernels;
+        std::vector<unsigned> widths;
+        unsigned scale = 1;
+        bool pipelined = false;
+        for (int i = 2; i < argc; ++i)
+        {
+            if (std::strcmp(argv[i], "--width") == 0 && i + 1 < argc)
+                widths.push_back(std::max(1, std::atoi(argv[++i])));
+            else if (std::strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+                scale = std::max(1, std::atoi(argv[++i]));
+            else if (std::strcmp(argv[i], "--pipeline") == 0)
+                pipelined = true;
+            else
+                kernels.emplace_back(argv[i]);
+        }
+        if (widths.empty())
+            widths = {1, 2, 4, 8};
+        return RunScaling(kernels, widths, scale, pipelined);
+    }
+
+    if (argc > 1 && (std::strcmp(argv[1], "--sample") == 0 || std::strcmp(argv[1], "--simpoints") == 0))
+    {
+        SamplingConfig config;
+        unsigned simPoints = 0;
+        const char* elf = "program";
+        for (int i = 1; i < argc; ++i)
+        {
+            bool hasArg = i + 1 < argc;
+            if (std::strcmp(argv[i], "--simpoints") == 0 && hasArg)
+                simPoints = std::max(1, std::atoi(argv[++i]));
+            else if ((std::strcmp(argv[i], "--period") == 0 || std::strcmp(argv[i], "--interval") == 0) && hasArg)
+                config.period = std::strtoull(argv[++i], nullptr, 0);
+            else if (std::strcmp(argv[i], "--window") == 0 && hasArg)
+                config.window = std::strtoull(argv[++i], nullptr, 0);
+            else if (std::strcmp(argv[i], "--warmup") == 0 && hasArg)
+                config.warmup = std::strtoull(argv[++i], nullptr, 0);
+            else if (argv[i][0] != '-')
+                elf = argv[i];
+        }
+        config.period = std::max<uint64_t>(config.period, 1);
+        return RunSampled(elf, config, simPoints);
+    }
+
+    if (argc > 1 && std::strcmp(argv[1], "--harts") == 0)
+    {
+        unsigned harts = 1;
+        auto protocol = CoherenceProtocol::Mesi;
+        uint64_t quantum = 0;
+        unsigned threads = 1;
+        const char* elf = "program";
+        for (int i = 1; i < argc; ++i)
+        {
+            if (std::strcmp(argv[i], "--harts") == 0 && i + 1 < argc)
+                harts = std::max(1, std::atoi(argv[++i]));
+            else if (std::strcmp(argv[i], "--quantum") == 0 && i + 1 < argc)
+                quantum = std::strtoull(argv[++i], nullptr, 0);
+            else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+                threads = std::max(1, std::atoi(argv[++i]));
+            else if (std::strcmp(argv[i], "--record") == 0 || std::strcmp(argv[i], "--replay") == 0)
+            {
+                fprintf(stderr, "%s runs the harts block by block, without --quantum\n", argv[i]);
+                return 1;
+            }
+            else if (std::strcmp(argv[i], "--msi") == 0)
+                protocol = CoherenceProtocol::Msi;
+            else if (std::strcmp(argv[i], "--mesi") == 0)
+                protocol = CoherenceProtocol::Mesi;
+            else if (argv[i][0] != '-')
+                elf = argv[i];
+        }
+        if (quantum)
+            return RunScheduled(elf, harts, quantum, threads);
+        return RunCoherent(elf, harts, protocol);
+    }
+
+    if (argc > 1 && std::strcmp(argv[1], "--simt") == 0)
+    {
+        unsigned instances = 1;
+        unsigned lanes = 16;
+        const char* elf = "program";
+        for (int i = 1; i < argc; ++i)
+        {
+            if (std::strcmp(argv[i], "--simt") == 0 && i + 1 < argc)
+                instances = std::max(1, std::atoi(argv[++i]));
+            else if (std::strcmp(argv[i], "--lanes") == 0 && i + 1 < argc)
+                lanes = std::atoi(argv[++i]);
+            else if (argv[i][0] != '-')
+                elf = argv[i];
+        }
+        return lanes == 8 ? RunSimt<8>(elf, instances) : RunSimt<16>(elf, instances);
+    }
+
+    if (argc > 2 && (std::strcmp(argv[1], "--record") == 0 || std::strcmp(argv[1], "--replay") == 0))
+    {
+        auto mode = std::strcmp(argv[1], "--record") == 0 ? ReplayLog::Mode::Record : ReplayLog::Mode::Replay;
+        const char* path = argv[2];
+        unsigned harts = 1;
+        const char* elf = "program";
+        for (int i = 3; i < argc; ++i)
+        {
+            if (std::strcmp(argv[i], "--harts") == 0 && i + 1 < argc)
+            {
+                harts = std::max(1, std::atoi(argv[++i]));
+            }
+            else if (std::strcmp(argv[i], "--quantum") == 0 || std::strcmp(argv[i], "--threads") == 0)
+            {
+                // Harts on several threads interleave differently on every run
+                fprintf(stderr, "%s runs the harts block by block, without %s\n", argv[1], argv[i]);
+                return 1;
+            }
+            else if (argv[i][0] != '-')
+            {
+                elf = argv[i];
+            }
+        }
+        return RunLogged(elf, path, mode, harts);
+    }
+
+    if (argc > 1 && std::strcmp(argv[1], "--check") == 0)
+    {
+        bool bench = false;
+        unsigned scale = 1;
+        std::vector<std::string> names;
+        for (int i = 2; i < argc; ++i)
+        {
+            if (std::strcmp(argv[i], "--bench") == 0)
+                bench = true;
+            else if (std::strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+                scale = std::max(1, std::atoi(argv[++i]));
+            else if (argv[i][0] != '-')
+                names.emplace_back(argv[i]);
+        }
+        if (bench)
+            return CheckKernels(names, scale);
+        return RunChecked(names.empty() ? "program" : names.front().c_str());
+    }
+
+    if (argc > 2 && std::strcmp(argv[1], "--memprof") == 0)
+    {
+        const char* prefix = argv[2];
+        AccessProfilerConfig config;
+        const char* elf = "program";
+        for (int i = 3; i < argc; ++i)
+        {
+            if (std::strcmp(argv[i], "--rate") == 0 && i + 1 < argc)
+                config.rate = std::max(1, std::atoi(argv[++i]));
+            else if (std::strcmp(argv[i], "--interval") == 0 && i + 1 < argc)
+                config.interval = std::strtoull(argv[++i], nullptr, 0);
+            else if (argv[i][0] != '-')
+                elf = argv[i];
+        }
+        return RunProfiled(elf, prefix, config);
+    }
+
+    return RunProgram(argc > 1 ? argv[1] : "program");
 }
@@ -0,0 +1,69 @@
+#include "doctest.h"
+
+#include "TestPrograms.h"
+
+TEST_SUITE("Access profiler"){
+    TEST_CASE("Reuse distances and working set"){
+        AccessProfiler profiler{{1, 4}};
+        for (int round = 0; round < 3; ++round) {
+            for (Word line = 0; line < 4; ++line)
+                profiler.Access(0x1000 + line * AccessProfiler::lineBytes, line == 0);
+        }
+        profiler.Finish();
+
+        // Three other lines between two accesses to a line
+        CHECK_EQ(profiler.ColdAccesses(), 4);
+        CHECK_EQ(profiler.ReuseHistogram()[2], 8);
+        CHECK_EQ(profiler.BucketLines(2), std::make_pair(uint64_t(2), uint64_t(4)));
+
+        auto& wss = profiler.WorkingSet();
+        REQUIRE_EQ(wss.size(), 3);
+        CHECK_EQ(wss[2].accesses, 12);
+        CHECK_EQ(wss[2].lines, 4);
+
+        REQUIRE_EQ(profiler.Pages().size(), 1);
+        CHECK_EQ(profiler.Pages().at(0x1000).reads, 9);
+        CHECK_EQ(profiler.Pages().at(0x1000).writes, 3);
+        CHECK_EQ(profiler.Lines().at(0x1040).reads, 3);
+    }
+
+    TEST_CASE("Long runs renumber the access times"){
+        AccessProfiler profiler{{1, 1000}};
+        for (int i = 0; i < 200000; ++i)
+            profiler.Access(Word(i % 10) * AccessProfiler::lineBytes, false);
+        profiler.Finish();
+        CHECK_EQ(profiler.ColdAccesses(), 10);
+        CHECK_EQ(profiler.ReuseHistogram()[4], 199990);
+        CHECK_EQ(profiler.WorkingSet().size(), 200);
+        CHECK_EQ(profiler.WorkingSet().back().lines, 10);
+    }
+
+    TEST_CASE("The cpu feeds its loads and stores"){
+        // 100 times: load a word and store it to the next page
+        Assembler as{0x200};
+        auto loop = as.NewLabel();
+        as.Li(reg::a0, 0x2000);
+        as.Li(reg::a2, 0x3000);
+        as.Li(reg::a1, 100);
+        as.Bind(loop);
+        as.Lw(reg::t0, reg::a0, 0);
+        as.Sw(reg::t0, reg::a2, 0);
+        as.Addi(reg::a1, reg::a1, -1);
+        as.Bne(reg::a1, reg::zero, loop);
+        as.Csrw(CsrIdx::Mtohost, reg::zero);
+
+        Memory mem;
+        loadProgram(mem, as);
+        AccessProfiler profiler{{5, 1000}};
+        Cpu cpu{mem};
+        cpu.Reset(0x200);
+        cpu.AttachProfiler(&profiler);
+        REQUIRE(runHart(cpu));
+
+        // Every fifth access is sampled and counts for five; loads and stores take turns
+        CHECK_EQ(profiler.Accesses(), 200);
+        CHECK_EQ(profiler.Pages().at(0x2000).reads, 100);
+        CHECK_EQ(profiler.Pages().at(0x3000).writes, 100);
+        CHECK_EQ(profiler.Pages().count(0), 0);
+    }
+}
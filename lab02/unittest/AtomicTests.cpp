@@ -0,0 +1,121 @@
+#include "doctest.h"
+
+#include <thread>
+
+#include "TestPrograms.h"
+
+TEST_SUITE("Atomics"){
+    TEST_CASE("AMO results"){
+        Assembler as{0x200};
+        as.Li(reg::t0, 0x1000);
+        as.Li(reg::t1, -5);
+        as.Sw(reg::t1, reg::t0, 0);
+        as.Li(reg::t2, 3);
+        as.Amo(AmoFunc::Add, reg::s0, reg::t2, reg::t0);    // -5 -> -2
+        as.Amo(AmoFunc::Max, reg::s1, reg::t2, reg::t0);    // -2 -> 3
+        as.Amo(AmoFunc::Minu, reg::s2, reg::t1, reg::t0);   // 3 -> 3, -5 is huge unsigned
+        as.Amo(AmoFunc::Min, reg::s3, reg::t1, reg::t0);    // 3 -> -5
+        as.Amo(AmoFunc::Swap, reg::s4, reg::t2, reg::t0);   // -5 -> 3
+        as.Amo(AmoFunc::Xor, reg::s5, reg::t2, reg::t0);    // 3 -> 0
+        as.Fence();
+        as.Lw(reg::s6, reg::t0, 0);
+        storeResults(as, {reg::s0, reg::s1, reg::s2, reg::s3, reg::s4, reg::s5, reg::s6});
+
+        Memory mem;
+        loadProgram(mem, as);
+        Cpu cpu{mem};
+        cpu.Reset(0x200);
+        REQUIRE(runHart(cpu));
+        CHECK_EQ(mem.Load<Word>(results + 0), Word(-5));
+        CHECK_EQ(mem.Load<Word>(results + 4), Word(-2));
+        CHECK_EQ(mem.Load<Word>(results + 8), 3);
+        CHECK_EQ(mem.Load<Word>(results + 12), 3);
+        CHECK_EQ(mem.Load<Word>(results + 16), Word(-5));
+        CHECK_EQ(mem.Load<Word>(results + 20), 3);
+        CHECK_EQ(mem.Load<Word>(results + 24), 0);
+    }
+
+    TEST_CASE("SC needs a reservation on the same address"){
+        Assembler as{0x200};
+        as.Li(reg::t0, 0x1000);
+        as.Li(reg::t1, 7);
+        as.ScW(reg::s0, reg::t1, reg::t0);                  // no reservation
+        as.LrW(reg::a0, reg::t0);
+        as.ScW(reg::s1, reg::t1, reg::t0);
+        as.ScW(reg::s2, reg::t1, reg::t0);                  // used up by the first SC
+        as.LrW(reg::a0, reg::t0);
+        as.Sw(reg::zero, reg::t0, 0);                       // the reserved word changes
+        as.ScW(reg::s3, reg::t1, reg::t0);
+        as.Lw(reg::s4, reg::t0, 0);
+        storeResults(as, {reg::s0, reg::s1, reg::s2, reg::s3, reg::s4});
+
+        Memory mem;
+        loadProgram(mem, as);
+        Cpu cpu{mem};
+        cpu.Reset(0x200);
+        REQUIRE(runHart(cpu));
+        CHECK_EQ(mem.Load<Word>(results + 0), 1);
+        CHECK_EQ(mem.Load<Word>(results + 4), 0);
+        CHECK_EQ(mem.Load<Word>(results + 8), 1);
+        CHECK_EQ(mem.Load<Word>(results + 12), 1);
+        CHECK_EQ(mem.Load<Word>(results + 16), 0);
+    }
+
+    TEST_CASE("Misaligned AMO faults"){
+        Assembler as{0x200};
+        as.Li(reg::t0, 0x1002);
+        as.Amo(AmoFunc::Add, reg::a0, reg::t0, reg::t0);
+        as.Csrw(CsrIdx::Mtohost, reg::zero);
+
+        Memory mem;
+        loadProgram(mem, as);
+        Cpu cpu{mem};
+        cpu.Reset(0x200);
+        CHECK_FALSE(runHart(cpu));
+        REQUIRE(cpu.GetFault());
+        CHECK_EQ(cpu.GetFault()->addr, 0x1002);
+    }
+
+    TEST_CASE("Counters shared by harts on host threads"){
+        // Every hart bumps one counter with an LR/SC loop and another with amoadd
+        constexpr int32_t iterations = 20000;
+        Assembler as{0x200};
+        auto loop = as.NewLabel();
+        auto retry = as.NewLabel();
+        as.Li(reg::t0, 0x1000);
+        as.Li(reg::t1, 0x1004);
+        as.Li(reg::t2, 1);
+        as.Li(reg::s0, iterations);
+        as.Bind(loop);
+        as.Bind(retry);
+        as.LrW(reg::a0, reg::t0);
+        as.Addi(reg::a0, reg::a0, 1);
+        as.ScW(reg::a1, reg::a0, reg::t0);
+        as.Bne(reg::a1, reg::zero, retry);
+        as.Amo(AmoFunc::Add, reg::zero, reg::t2, reg::t1);
+        as.Addi(reg::s0, reg::s0, -1);
+        as.Bne(reg::s0, reg::zero, loop);
+        as.Fence();
+        as.Csrw(CsrIdx::Mtohost, reg::zero);
+
+        constexpr unsigned harts = 4;
+        Memory mem;
+        loadProgram(mem, as);
+        std::vector<std::thread> threads;
+        std::vector<char> exited(harts);
+        for (unsigned hart = 0; hart < harts; ++hart) {
+            threads.emplace_back([&, hart] {
+                Cpu cpu{mem, hart};
+                cpu.Reset(0x200);
+                exited[hart] = runHart(cpu).has_value();
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+
+        for (unsigned hart = 0; hart < harts; ++hart)
+            CHECK(exited[hart]);
+        CHECK_EQ(mem.Load<Word>(0x1000), harts * iterations);
+        CHECK_EQ(mem.Load<Word>(0x1004), harts * iterations);
+    }
+}
@@ -0,0 +1,21 @@
+#include "doctest.h"
+
+#include "Benchmarks.h"
+
+TEST_SUITE("Benchmarks"){
+    TEST_CASE("Kernels match their host reference"){
+        for (auto& kernel : BenchKernels()) {
+            SUBCASE(kernel.name){
+                BenchRun run = RunKernel(kernel, 1);
+                CHECK_EQ(run.result, kernel.expected(1));
+                CHECK(run.passed);
+                CHECK_EQ(run.instret, run.cycles);
+
+                uint64_t total = 0;
+                for (auto& [type, n] : run.mix)
+                    total += n;
+                CHECK_EQ(total, run.instret);
+            }
+        }
+    }
+}
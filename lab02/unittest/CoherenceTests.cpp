@@ -0,0 +1,143 @@
+#include "doctest.h"
+
+#include <deque>
+
+#include "CoherenceModel.h"
+#include "TestPrograms.h"
+
+CoherenceModel runHarts(Assembler &as, unsigned harts);
+
+TEST_SUITE("Coherence"){
+    TEST_CASE("cache.S scenario under MSI"){
+        // Direct mapped 8 KB: the lines at 0x4000 and 0x6000 share a set
+        CoherenceModel model{1, CoherenceProtocol::Msi, {128, 1, 64}};
+        constexpr Word x1 = 0x4000, x2 = 0x6000;
+        auto read = [&](Word addr) { model.Access(0, addr, 4, false); };
+        auto write = [&](Word addr) { model.Access(0, addr, 4, true); };
+
+        write(x1);              // I -> M
+        CHECK_EQ(model.State(0, x1), LineState::M);
+        write(x1 + 4);          // write hit
+        write(x2);              // M -> I -> M
+        CHECK_EQ(model.State(0, x1), LineState::I);
+        CHECK_EQ(model.State(0, x2), LineState::M);
+        write(x2 + 4);
+        read(x1);               // M -> I -> S
+        CHECK_EQ(model.State(0, x2), LineState::I);
+        CHECK_EQ(model.State(0, x1), LineState::S);
+        read(x1 + 4);
+        read(x1);
+        write(x1);              // S -> M
+        CHECK_EQ(model.State(0, x1), LineState::M);
+        read(x1 + 4);
+        write(x1 + 4);
+        read(x2);               // M -> I -> S
+        CHECK_EQ(model.State(0, x1), LineState::I);
+        CHECK_EQ(model.State(0, x2), LineState::S);
+        read(x2 + 4);
+        read(x1);               // S -> I -> S
+        CHECK_EQ(model.State(0, x2), LineState::I);
+        CHECK_EQ(model.State(0, x1), LineState::S);
+        read(x1 + 4);
+
+        auto& stats = model.Stats(0);
+        CHECK_EQ(stats.reads, 8);
+        CHECK_EQ(stats.writes, 6);
+        CHECK_EQ(stats.misses, 5);
+        CHECK_EQ(stats.upgrades, 1);
+        CHECK_EQ(stats.writebacks, 3);
+        CHECK_EQ(stats.CoherenceMisses(), 0);
+        CHECK_EQ(model.BusTransactions(), 5 + 1 + 3);
+    }
+
+    TEST_CASE("Sharing between two harts"){
+        constexpr Word line = 0x1000;
+        CoherenceModel mesi{2, CoherenceProtocol::Mesi};
+        mesi.Access(0, line, 4, false);
+        CHECK_EQ(mesi.State(0, line), LineState::E);
+        mesi.Access(0, line, 4, true);      // silent E -> M
+        CHECK_EQ(mesi.State(0, line), LineState::M);
+        CHECK_EQ(mesi.Stats(0).upgrades, 0);
+
+        mesi.Access(1, line, 4, false);     // served by hart 0, which keeps a shared copy
+        CHECK_EQ(mesi.State(0, line), LineState::S);
+        CHECK_EQ(mesi.State(1, line), LineState::S);
+        CHECK_EQ(mesi.Stats(0).writebacks, 1);
+        CHECK_EQ(mesi.Stats(0).interventions, 1);
+
+        mesi.Access(1, line, 4, true);      // S -> M invalidates hart 0
+        CHECK_EQ(mesi.State(0, line), LineState::I);
+        CHECK_EQ(mesi.Stats(1).upgrades, 1);
+        CHECK_EQ(mesi.Stats(0).invalidations, 1);
+
+        mesi.Access(0, line, 4, false);     // the word hart 1 wrote
+        CHECK_EQ(mesi.Stats(0).trueSharing, 1);
+        mesi.Access(1, line + 8, 4, true);
+        mesi.Access(0, line + 4, 4, false); // a word nobody wrote
+        CHECK_EQ(mesi.Stats(0).falseSharing, 1);
+        CHECK_EQ(mesi.Stats(0).invalidations, 2);
+
+        // Without E the first write of a private line needs an upgrade
+        CoherenceModel msi{2, CoherenceProtocol::Msi};
+        msi.Access(0, line, 4, false);
+        msi.Access(0, line, 4, true);
+        CHECK_EQ(msi.Stats(0).upgrades, 1);
+    }
+
+    TEST_CASE("False sharing in guest code"){
+        // Every hart increments its own counter, 4 or 64 bytes apart
+        auto build = [](unsigned shift) {
+            Assembler as{0x200};
+            auto loop = as.NewLabel();
+            as.Csrr(reg::a0, CsrIdx::Mhartid);
+            as.Slli(reg::a0, reg::a0, shift);
+            as.Li(reg::t0, 0x1000);
+            as.Add(reg::t0, reg::t0, reg::a0);
+            as.Li(reg::s0, 100);
+            as.Bind(loop);
+            as.Lw(reg::t1, reg::t0, 0);
+            as.Addi(reg::t1, reg::t1, 1);
+            as.Sw(reg::t1, reg::t0, 0);
+            as.Addi(reg::s0, reg::s0, -1);
+            as.Bne(reg::s0, reg::zero, loop);
+            as.Csrw(CsrIdx::Mtohost, reg::s0);
+            return as;
+        };
+        auto shared = build(2);
+        auto separate = build(6);
+
+        CoherenceModel falseSharing = runHarts(shared, 2);
+        CoherenceModel privateLines = runHarts(separate, 2);
+        for (unsigned hart = 0; hart < 2; ++hart) {
+            CHECK_GT(falseSharing.Stats(hart).falseSharing, 90);
+            CHECK_EQ(falseSharing.Stats(hart).trueSharing, 0);
+            CHECK_EQ(privateLines.Stats(hart).CoherenceMisses(), 0);
+            CHECK_EQ(privateLines.Stats(hart).invalidations, 0);
+        }
+        CHECK_GT(falseSharing.BusTransactions(), 10 * privateLines.BusTransactions());
+    }
+}
+
+// Runs the program on harts sharing one memory, interleaved an instruction at a time
+CoherenceModel runHarts(Assembler &as, unsigned harts){
+    Memory mem;
+    loadProgram(mem, as);
+    CoherenceModel model{harts, CoherenceProtocol::Mesi};
+    std::deque<Cpu> cpus;
+    for (unsigned hart = 0; hart < harts; ++hart)
+        cpus.emplace_back(mem, hart).Reset(0x200);
+
+    std::vector<bool> done(harts);
+    for (unsigned running = harts; running;) {
+        for (auto& cpu : cpus) {
+            if (done[cpu.HartId()])
+                continue;
+            cpu.ProcessInstruction([&](Word, const Instruction& instr) { model(cpu.HartId(), instr); });
+            if (cpu.GetMessage()) {
+                done[cpu.HartId()] = true;
+                running--;
+            }
+        }
+    }
+    return model;
+}
@@ -0,0 +1,133 @@
+#include "doctest.h"
+
+#include <cstdlib>
+
+#include "Console.h"
+#include "TestPrograms.h"
+
+constexpr Word RING_ADDR = 0x1000;
+constexpr Word RING_SIZE = 8;
+
+std::string readAll(int fd);
+void ringPut(Memory &mem, const std::string &s);
+
+TEST_SUITE("Console"){
+    TEST_CASE("Ring and mtohost output"){
+        char path[] = "/tmp/riscv_sim_consoleXXXXXX";
+        int fd = mkstemp(path);
+        REQUIRE(fd >= 0);
+        unlink(path);
+
+        Memory mem;
+        mem.Store<ConsoleRing>(RING_ADDR, {0, 0, RING_SIZE});
+        Console console{mem, fd};
+
+        SUBCASE("Flush drains the ring"){
+            ringPut(mem, "hello");
+            console.Flush(RING_ADDR);
+            CHECK_EQ(readAll(fd), "hello");
+            CHECK_EQ(mem.Load<Word>(RING_ADDR + 4), 5);   // tail
+
+            // Wraps around the end of the ring
+            ringPut(mem, "world!");
+            console.Flush(RING_ADDR);
+            CHECK_EQ(readAll(fd), "helloworld!");
+        }
+
+        SUBCASE("mtohost characters keep their order"){
+            ringPut(mem, "ab");
+            console.PutChar('c', RING_ADDR);
+            ringPut(mem, "d");
+            console.PutInt(-12, RING_ADDR);
+            CHECK_EQ(readAll(fd), "");
+            console.Flush(RING_ADDR);
+            CHECK_EQ(readAll(fd), "abcd-12");
+        }
+
+        SUBCASE("Invalid ring is ignored"){
+            mem.Store<ConsoleRing>(RING_ADDR, {3, 0, 6});
+            console.PutChar('x', RING_ADDR);
+            console.Flush(RING_ADDR);
+            console.Flush(0);
+            CHECK_EQ(readAll(fd), "x");
+        }
+        close(fd);
+    }
+
+    TEST_CASE("Guest registers the ring"){
+        Assembler as{0x200};
+        as.Li(reg::t0, RING_ADDR);
+        as.Csrw(CsrIdx::Mconsole, reg::t0);
+        as.Li(reg::t1, 0x00040000);     // ConsoleFlush
+        as.Csrw(CsrIdx::Mtohost, reg::t1);
+
+        Memory mem;
+        Word addr = 0x200;
+        for (Word w : as.Code()) {
+            mem.Store(addr, w);
+            addr += 4;
+        }
+        Cpu cpu{mem};
+        cpu.Reset(0x200);
+        std::optional<CpuToHostData> msg;
+        for (int i = 0; i < 10 && !msg; ++i) {
+            cpu.ProcessBlock();
+            msg = cpu.GetMessage();
+        }
+        REQUIRE(msg);
+        CHECK(msg->unpacked.type == CpuToHostType::ConsoleFlush);
+        CHECK_EQ(cpu.ConsoleAddr(), RING_ADDR);
+    }
+
+    TEST_CASE("Console output goes out before a write to stdout"){
+        char path[] = "/tmp/riscv_sim_consoleXXXXXX";
+        int fd = mkstemp(path);
+        REQUIRE(fd >= 0);
+        unlink(path);
+
+        Assembler as{0x200};
+        as.Li(reg::t0, RING_ADDR);
+        as.Csrw(CsrIdx::Mconsole, reg::t0);
+        as.Li(reg::a0, STDOUT_FILENO);
+        as.Li(reg::a1, RING_ADDR);
+        as.Li(reg::a2, 0);
+        syscall(as, Syscall::Write);
+        as.Li(reg::a0, 0);
+        syscall(as, Syscall::Exit);
+
+        Memory mem;
+        Word addr = 0x200;
+        for (Word w : as.Code()) {
+            mem.Store(addr, w);
+            addr += 4;
+        }
+        mem.Store<ConsoleRing>(RING_ADDR, {0, 0, RING_SIZE});
+        ringPut(mem, "ab");
+        Console console{mem, fd};
+        console.PutChar('c', 0);
+
+        Cpu cpu{mem};
+        cpu.Reset(0x200);
+        cpu.AttachConsole(console);
+        for (int i = 0; i < 10 && !cpu.GetMessage(); ++i)
+            cpu.ProcessBlock();
+        CHECK_EQ(readAll(fd), "cab");
+        close(fd);
+    }
+}
+
+std::string readAll(int fd){
+    std::string s(256, '\0');
+    ssize_t n = pread(fd, s.data(), s.size(), 0);
+    s.resize(n > 0 ? n : 0);
+    return s;
+}
+
+void ringPut(Memory &mem, const std::string &s){
+    Word head = mem.Load<Word>(RING_ADDR);
+    for (char c : s) {
+        mem.Store<char>(RING_ADDR + sizeof(ConsoleRing) + (head % RING_SIZE), c);
+        head++;
+    }
+    mem.Store<Word>(RING_ADDR, head);
+}
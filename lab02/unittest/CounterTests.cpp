@@ -0,0 +1,112 @@
+#include "doctest.h"
+
+#include "TestPrograms.h"
+
+CsrIdx hpm(CsrIdx first, Word n){
+    return CsrIdx(Word(first) + n - 3);
+}
+
+void selectEvent(Assembler &as, Word n, HpmEvent event){
+    as.Li(reg::t0, int32_t(event));
+    as.Csrw(hpm(CsrIdx::Mhpmevent3, n), reg::t0);
+}
+
+TEST_SUITE("Performance counters"){
+    TEST_CASE("Loads and branches in both engines"){
+        Assembler as{0x200};
+        auto loop = as.NewLabel();
+        selectEvent(as, 3, HpmEvent::Loads);
+        selectEvent(as, 4, HpmEvent::Branches);
+        selectEvent(as, 5, HpmEvent::TakenBranches);
+        selectEvent(as, 6, HpmEvent::Count);                  // not an event
+        as.Lw(reg::t1, reg::zero, 0x200);
+        as.Lw(reg::t1, reg::zero, 0x204);
+        as.Csrr(reg::a2, hpm(CsrIdx::Mhpmcounter3, 3));       // in the middle of a block
+        as.Li(reg::a0, 10);
+        as.Li(reg::a1, 0x2000);
+        as.Bind(loop);
+        as.Lw(reg::t1, reg::a1, 0);
+        as.Addi(reg::a1, reg::a1, 4);
+        as.Addi(reg::a0, reg::a0, -1);
+        as.Bne(reg::a0, reg::zero, loop);
+        as.Csrr(reg::s0, hpm(CsrIdx::Mhpmcounter3, 3));
+        as.Csrr(reg::s1, hpm(CsrIdx::Hpmcounter3, 4));
+        as.Csrr(reg::s2, hpm(CsrIdx::Mhpmcounter3, 5));
+        as.Csrr(reg::s3, hpm(CsrIdx::Mhpmevent3, 4));
+        as.Csrr(reg::s4, hpm(CsrIdx::Mhpmevent3, 6));
+        as.Csrr(reg::s5, hpm(CsrIdx::Mhpmcounter3h, 3));
+        as.Csrr(reg::s6, CsrIdx::Instreth);
+        as.Csrr(reg::s7, CsrIdx(0x7ff));                      // unknown
+        storeResults(as, {reg::s0, reg::s1, reg::s2, reg::s3, reg::s4, reg::s5, reg::s6, reg::s7, reg::a2});
+
+        for (bool blocks : {false, true}) {
+            CAPTURE(blocks);
+            Memory mem;
+            loadProgram(mem, as);
+            Cpu cpu{mem};
+            cpu.Reset(0x200);
+            if (blocks) {
+                REQUIRE(runHart(cpu));
+            } else {
+                for (int i = 0; i < 1000 && !cpu.GetMessage(); ++i)
+                    cpu.ProcessInstruction();
+            }
+            CHECK_EQ(mem.Load<Word>(results + 0), 12);
+            CHECK_EQ(mem.Load<Word>(results + 4), 10);
+            CHECK_EQ(mem.Load<Word>(results + 8), 9);
+            CHECK_EQ(mem.Load<Word>(results + 12), Word(HpmEvent::Branches));
+            CHECK_EQ(mem.Load<Word>(results + 16), Word(HpmEvent::None));
+            CHECK_EQ(mem.Load<Word>(results + 20), 0);
+            CHECK_EQ(mem.Load<Word>(results + 24), 0);
+            CHECK_EQ(mem.Load<Word>(results + 28), 0);
+            CHECK_EQ(mem.Load<Word>(results + 32), 2);
+        }
+    }
+
+    TEST_CASE("Cache misses come from the timing model"){
+        Assembler as{0x200};
+        auto loop = as.NewLabel();
+        selectEvent(as, 3, HpmEvent::DCacheMisses);
+        as.Li(reg::a0, 8);
+        as.Li(reg::a1, 0x3000);
+        as.Bind(loop);
+        as.Lw(reg::t1, reg::a1, 0);
+        as.Lw(reg::t2, reg::a1, 4);                           // same line
+        as.Addi(reg::a1, reg::a1, 64);
+        as.Addi(reg::a0, reg::a0, -1);
+        as.Bne(reg::a0, reg::zero, loop);
+        as.Csrr(reg::s0, CsrIdx::Mhpmcounter3);
+        storeResults(as, {reg::s0});
+
+        Memory mem;
+        loadProgram(mem, as);
+        Cpu cpu{mem};
+        cpu.Reset(0x200);
+        TimingModel model;
+        for (int i = 0; i < 1000 && !cpu.GetMessage(); ++i)
+            cpu.ProcessInstruction(model);
+        CHECK_EQ(mem.Load<Word>(results), 8);
+
+        // Without a model nobody sees the misses
+        cpu.Reset(0x200);
+        REQUIRE(runHart(cpu));
+        CHECK_EQ(mem.Load<Word>(results), 0);
+    }
+
+    TEST_CASE("High halves keep counting past 2^32"){
+        CsrFile csrf;
+        csrf.Reset();
+        csrf.SkipCycles((5ull << 32) + 7);
+        auto read = [&](CsrIdx csr) {
+            auto instr = std::make_unique<Instruction>();
+            instr->_csr = csr;
+            csrf.Read(instr);
+            return instr->_csrVal;
+        };
+        CHECK_EQ(read(CsrIdx::Cycle), 7);
+        CHECK_EQ(read(CsrIdx::Cycleh), 5);
+        CHECK_EQ(read(CsrIdx::Mcycleh), 5);
+        CHECK_EQ(read(CsrIdx::Instreth), 0);
+        CHECK_EQ(read(CsrIdx::Mtohost), 0);
+    }
+}
@@ -0,0 +1,200 @@
+#include "doctest.h"
+
+#include "TestPrograms.h"
+
+constexpr Word START_IP = 0x200;
+
+std::optional<CpuToHostData> runReference(Memory &mem);
+
+TEST_SUITE("Cpu"){
+    TEST_CASE("Calls and returns"){
+        // x10 += 3 in a function called 100 times
+        Assembler as{START_IP};
+        auto loop = as.NewLabel();
+        auto func = as.NewLabel();
+        as.Li(10, 0);
+        as.Li(11, 100);
+        as.Bind(loop);
+        as.Jal(1, func);
+        as.Addi(11, 11, -1);
+        as.Bne(11, 0, loop);
+        as.Csrw(CsrIdx::Mtohost, 10);
+        as.Bind(func);
+        as.Addi(10, 10, 3);
+        as.Ret();
+
+        Memory mem;
+        loadProgram(mem, as);
+        auto expected = runReference(mem);
+        REQUIRE(expected);
+        CHECK_EQ(expected->unpacked.data, 300);
+
+        Cpu cpu{mem};
+        cpu.Reset(START_IP);
+        auto msg = runHart(cpu);
+        REQUIRE(msg);
+        CHECK_EQ(msg->payload, expected->payload);
+
+        auto& stats = cpu.GetBlockStats();
+        CHECK_EQ(stats.rasHits, 100);
+        CHECK_LT(stats.lookups, 10);
+    }
+
+    TEST_CASE("Function pointers"){
+        // Alternately call two functions through a register
+        Assembler as{START_IP};
+        auto loop = as.NewLabel();
+        auto inc = as.NewLabel();
+        auto dbl = as.NewLabel();
+        as.Li(10, 1);
+        as.Li(11, 10);
+        as.La(6, inc);
+        as.La(7, dbl);
+        as.Bind(loop);
+        as.Jalr(1, 6, 0);
+        as.Xor(6, 6, 7);    // swap x6 and x7
+        as.Xor(7, 6, 7);
+        as.Xor(6, 6, 7);
+        as.Addi(11, 11, -1);
+        as.Bne(11, 0, loop);
+        as.Csrw(CsrIdx::Mtohost, 10);
+        as.Bind(inc);
+        as.Addi(10, 10, 1);
+        as.Ret();
+        as.Bind(dbl);
+        as.Add(10, 10, 10);
+        as.Ret();
+
+        Memory mem;
+        loadProgram(mem, as);
+        auto expected = runReference(mem);
+        REQUIRE(expected);
+
+        Cpu cpu{mem};
+        cpu.Reset(START_IP);
+        auto msg = runHart(cpu);
+        REQUIRE(msg);
+        CHECK_EQ(msg->payload, expected->payload);
+
+        // The first call is made from the entry block; the loop's call site
+        // misses once per target and then keeps both cached
+        auto& stats = cpu.GetBlockStats();
+        CHECK_EQ(stats.jrHits, 7);
+        CHECK_EQ(stats.rasHits, 10);
+    }
+
+    TEST_CASE("Byte copy"){
+        // Copy 7 bytes with lb/sb, then read them back as a signed halfword and bytes
+        Assembler as{START_IP};
+        auto loop = as.NewLabel();
+        as.Li(5, 0x1000);
+        as.Li(6, 0x2001);
+        as.Li(7, 7);
+        as.Bind(loop);
+        as.Lb(8, 5, 0);
+        as.Sb(8, 6, 0);
+        as.Addi(5, 5, 1);
+        as.Addi(6, 6, 1);
+        as.Addi(7, 7, -1);
+        as.Bne(7, 0, loop);
+        as.Li(6, 0x2000);
+        as.Lh(9, 6, 5);     // bytes 4 and 5 of the source
+        as.Lbu(10, 6, 7);   // byte 6 of the source
+        as.Add(10, 10, 9);
+        as.Csrw(CsrIdx::Mtohost, 10);
+
+        Memory mem;
+        loadProgram(mem, as);
+        mem.Store<Word>(0x1000, 0x04030201);
+        mem.Store<Word>(0x1004, 0x0007ff05);
+
+        Cpu cpu{mem};
+        cpu.Reset(START_IP);
+        auto msg = runHart(cpu);
+        REQUIRE(msg);
+        CHECK_EQ(mem.Load<Word>(0x2000), 0x03020100);
+        CHECK_EQ(mem.Load<Word>(0x2004), 0x07ff0504);
+        CHECK_EQ(msg->unpacked.data, Word(0xff05 - 0x10000 + 0x07) & 0xffff);
+    }
+
+    TEST_CASE("Writes to x0 go nowhere"){
+        Assembler as{START_IP};
+        as.Addi(reg::zero, reg::zero, 5);
+        as.Lw(reg::zero, reg::zero, START_IP);
+        as.Add(reg::t0, reg::zero, reg::zero);
+        as.Addi(reg::t1, reg::zero, 7);
+        as.Csrw(CsrIdx::Mtohost, reg::zero);
+
+        for (bool blocks : {false, true}) {
+            CAPTURE(blocks);
+            Memory mem;
+            loadProgram(mem, as);
+            Cpu cpu{mem};
+            cpu.Reset(START_IP);
+            if (blocks) {
+                REQUIRE(runHart(cpu));
+            } else {
+                for (int i = 0; i < 5; ++i)
+                    cpu.ProcessInstruction();
+            }
+            CHECK_EQ(cpu.Reg(reg::zero), 0);
+            CHECK_EQ(cpu.Reg(reg::t0), 0);
+            CHECK_EQ(cpu.Reg(reg::t1), 7);
+        }
+
+        LaneRegisterFile<4> lanes;
+        lanes.Reset();
+        lanes.Write(reg::zero, 1, 9);
+        lanes.Write(reg::a0, 2, 9);
+        lanes.Dst(std::nullopt).fill(3);
+        CHECK_EQ(lanes.Read(reg::zero, 1), 0);
+        CHECK_EQ(lanes.Read(reg::a0, 2), 9);
+        CHECK_EQ(lanes.Read(std::optional<RId>{})[0], 0);
+    }
+
+    TEST_CASE("Self-modifying code"){
+        // Patches the addi of a function after calling it once, and calls it again
+        Assembler patch{0};
+        patch.Addi(reg::a0, reg::a0, 10);
+
+        Assembler as{START_IP};
+        auto func = as.NewLabel();
+        as.Li(reg::a0, 0);
+        as.Call(func);
+        as.La(reg::t0, func);
+        as.Li(reg::t1, SignedWord(patch.Code()[0]));
+        as.Sw(reg::t1, reg::t0, 0);
+        as.FenceI();
+        as.Call(func);
+        as.Csrw(CsrIdx::Mtohost, reg::a0);
+        as.Bind(func);
+        as.Addi(reg::a0, reg::a0, 1);
+        as.Ret();
+
+        Memory mem;
+        loadProgram(mem, as);
+        mem.Snapshot();
+        auto expected = runReference(mem);
+        REQUIRE(expected);
+        CHECK_EQ(expected->unpacked.data, 11);
+
+        mem.Restore();
+        Cpu cpu{mem};
+        cpu.Reset(START_IP);
+        auto msg = runHart(cpu);
+        REQUIRE(msg);
+        CHECK_EQ(msg->payload, expected->payload);
+        CHECK_EQ(cpu.GetBlockStats().dropped, 1);
+    }
+}
+
+std::optional<CpuToHostData> runReference(Memory &mem){
+    Cpu cpu{mem};
+    cpu.Reset(START_IP);
+    for (int i = 0; i < 100000; ++i) {
+        cpu.ProcessInstruction();
+        if (auto msg = cpu.GetMessage())
+            return msg;
+    }
+    return std::nullopt;
+}
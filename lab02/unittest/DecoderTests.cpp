@@ -10,6 +10,8 @@ void testR(InstructionPtr &instruction);
 void testU(InstructionPtr &instruction);
 void testUJ(InstructionPtr &instruction);
 void testAlu(InstructionPtr &instruction);
+void testLoad(InstructionPtr &instruction);
+void testStore(InstructionPtr &instruction);
 
 TEST_SUITE("Decoder"){
     Decoder _decoder;
@@ -139,6 +141,31 @@ TEST_SUITE("Decoder"){
             CHECK(instruction->_dst.value() == 15);
             CHECK(instruction->_type == IType::Ld);
             CHECK(instruction->_aluFunc == AluFunc::Add);
+            CHECK(instruction->_memFunc == MemFunc::W);
+        }
+
+        SUBCASE("LB"){
+            auto instruction = _decoder.Decode(LB);
+            testLoad(instruction);
+            CHECK(instruction->_memFunc == MemFunc::B);
+        }
+
+        SUBCASE("LH"){
+            auto instruction = _decoder.Decode(LH);
+            testLoad(instruction);
+            CHECK(instruction->_memFunc == MemFunc::H);
+        }
+
+        SUBCASE("LBU"){
+            auto instruction = _decoder.Decode(LBU);
+            testLoad(instruction);
+            CHECK(instruction->_memFunc == MemFunc::Bu);
+        }
+
+        SUBCASE("LHU"){
+            auto instruction = _decoder.Decode(LHU);
+            testLoad(instruction);
+            CHECK(instruction->_memFunc == MemFunc::Hu);
         }
     }
 
@@ -165,6 +192,19 @@ TEST_SUITE("Decoder"){
             CHECK(instruction->_src2.value() == 15);
             CHECK(instruction->_src1.value() == 15);
             CHECK(instruction->_type == IType::St);
+            CHECK(instruction->_memFunc == MemFunc::W);
+        }
+
+        SUBCASE("SB"){
+            auto instruction = _decoder.Decode(SB);
+            testStore(instruction);
+            CHECK(instruction->_memFunc == MemFunc::B);
+        }
+
+        SUBCASE("SH"){
+            auto instruction = _decoder.Decode(SH);
+            testStore(instruction);
+            CHECK(instruction->_memFunc == MemFunc::H);
         }
     }
 
@@ -272,3 +312,18 @@ void testAlu(InstructionPtr &instruction){
     CHECK(instruction->_dst.value() == 15);
     CHECK(instruction->_type == IType::Alu);
 }
+
+void testLoad(InstructionPtr &instruction){
+    CHECK(instruction->_imm.value() == IMM);
+    CHECK(instruction->_src1.value() == 1);
+    CHECK(instruction->_dst.value() == 15);
+    CHECK(instruction->_type == IType::Ld);
+    CHECK(instruction->_aluFunc == AluFunc::Add);
+}
+
+void testStore(InstructionPtr &instruction){
+    CHECK(instruction->_imm.value() == IMM_S);
+    CHECK(instruction->_src2.value() == 15);
+    CHECK(instruction->_src1.value() == 15);
+    CHECK(instruction->_type == IType::St);
+}
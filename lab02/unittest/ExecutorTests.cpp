@@ -3,6 +3,7 @@
 #include "Instructions.h"
 #include "Decoder.h"
 #include "Executor.h"
+#include "Assembler.h"
 
 constexpr Word IP        = 0x200;
 constexpr Word SRCVAL1   = 1;
@@ -251,6 +252,43 @@ TEST_SUITE("Executor"){
             CHECK_EQ(instruction->_data, SRCVAL1 | IMM);
         }
     }
+
+    TEST_CASE("Zba and Zbb"){
+        // Encoded by the assembler; the decoder must not take them for base instructions
+        Assembler as{IP};
+        as.Sh2add(1, 2, 3);
+        as.Andn(1, 2, 3);
+        as.Xnor(1, 2, 3);
+        as.Min(1, 2, 3);
+        as.Maxu(1, 2, 3);
+        as.Rol(1, 2, 3);
+        as.Rori(1, 2, 8);
+        as.Clz(1, 2);
+        as.Ctz(1, 2);
+        as.Cpop(1, 2);
+        as.SextB(1, 2);
+        as.ZextH(1, 2);
+        as.OrcB(1, 2);
+        as.Rev8(1, 2);
+        as.Addi(1, 2, 0x600);
+        as.Clz(1, 0);
+
+        const Word a = 0x80f00100, b = 4;
+        const Word expected[] = {0x03c00404, 0x80f00100, 0x7f0ffefb, 0x80f00100, 0x80f00100,
+                                 0x0f001008, 0x0080f001, 0, 8, 6, 0, 0x0100, 0xffffff00,
+                                 0x0001f080, a + 0x600, 32};
+        auto& code = as.Code();
+        REQUIRE_EQ(code.size(), std::size(expected));
+        for (size_t i = 0; i < code.size(); ++i) {
+            CAPTURE(i);
+            auto instruction = _decoder.Decode(code[i]);
+            REQUIRE(instruction->_type == IType::Alu);
+            instruction->_src1Val = *instruction->_src1 ? a : 0;
+            instruction->_src2Val = b;
+            _exe.Execute(instruction, IP);
+            CHECK_EQ(instruction->_data, expected[i]);
+        }
+    }
 }
 
 void testAlu(InstructionPtr &instruction, Executor &exe){
@@ -0,0 +1,237 @@
+#include "doctest.h"
+
+#include <cfenv>
+#include <cstring>
+
+#include "TestPrograms.h"
+
+// Puts the single with the given bits into an F register
+void loadSingle(Assembler &as, RId fd, Word bits){
+    as.Li(reg::t5, SignedWord(bits));
+    as.Fp(FpFunc::MvWX, false, fd, reg::t5);
+}
+
+std::vector<Word> runFp(Assembler &as, size_t count, Memory &mem){
+    loadProgram(mem, as);
+    Cpu cpu{mem};
+    cpu.Reset(0x200);
+    REQUIRE(runHart(cpu));
+    std::vector<Word> values;
+    for (size_t i = 0; i < count; ++i)
+        values.push_back(mem.Load<Word>(results + 4 * i));
+    return values;
+}
+
+TEST_SUITE("Floating point"){
+    TEST_CASE("Arithmetic raises fflags"){
+        Assembler as{0x200};
+        loadSingle(as, 1, 0x3f800000);                      // 1.0
+        loadSingle(as, 2, 0x40400000);                      // 3.0
+        loadSingle(as, 0, 0);
+        as.Fp(FpFunc::Div, false, 3, 1, 2);
+        as.Fp(FpFunc::MvXW, false, reg::s0, 3);
+        as.Csrr(reg::s1, CsrIdx::Fflags);
+        as.Csrw(CsrIdx::Fflags, reg::zero);
+        as.Fma(FpFunc::Madd, false, 4, 2, 2, 1);            // 3 * 3 + 1
+        as.Fp(FpFunc::MvXW, false, reg::s2, 4);
+        as.Csrr(reg::s3, CsrIdx::Fflags);
+        as.Fp(FpFunc::Div, false, 5, 1, 0);
+        as.Csrr(reg::s4, CsrIdx::Fflags);
+        as.Csrw(CsrIdx::Fflags, reg::zero);
+        as.Fp(FpFunc::Sub, false, 6, 0, 1);
+        as.Fp(FpFunc::Sqrt, false, 6, 6);
+        as.Fp(FpFunc::MvXW, false, reg::s5, 6);
+        as.Csrr(reg::s6, CsrIdx::Fflags);
+        storeResults(as, {reg::s0, reg::s1, reg::s2, reg::s3, reg::s4, reg::s5, reg::s6});
+
+        Memory mem;
+        auto r = runFp(as, 7, mem);
+        CHECK_EQ(r[0], 0x3eaaaaab);
+        CHECK_EQ(r[1], fpflags::NX);
+        CHECK_EQ(r[2], 0x41200000);
+        CHECK_EQ(r[3], 0);
+        CHECK_EQ(r[4], fpflags::DZ);
+        CHECK_EQ(r[5], 0x7fc00000);                         // canonical NaN
+        CHECK_EQ(r[6], fpflags::NV);
+    }
+
+    TEST_CASE("Rounding modes leave the host rounding alone"){
+        Assembler as{0x200};
+        loadSingle(as, 1, 0x3f800000);
+        loadSingle(as, 2, 0x40400000);
+        as.Li(reg::t0, int32_t(RoundingMode::Rdn));
+        as.Csrw(CsrIdx::Frm, reg::t0);
+        as.Fp(FpFunc::Div, false, 3, 1, 2);
+        as.Fp(FpFunc::MvXW, false, reg::s0, 3);
+        as.Fp(FpFunc::Div, false, 3, 1, 2, RoundingMode::Rne);
+        as.Fp(FpFunc::MvXW, false, reg::s1, 3);
+        as.Fp(FpFunc::Div, false, 3, 1, 2, RoundingMode::Rtz);
+        as.Fp(FpFunc::MvXW, false, reg::s2, 3);
+        as.Csrr(reg::s3, CsrIdx::Fcsr);
+        storeResults(as, {reg::s0, reg::s1, reg::s2, reg::s3});
+
+        Memory mem;
+        auto r = runFp(as, 4, mem);
+        CHECK_EQ(r[0], 0x3eaaaaaa);
+        CHECK_EQ(r[1], 0x3eaaaaab);
+        CHECK_EQ(r[2], 0x3eaaaaaa);
+        CHECK_EQ(r[3], Word(RoundingMode::Rdn) << 5 | fpflags::NX);
+        CHECK_EQ(std::fegetround(), FE_TONEAREST);
+    }
+
+    TEST_CASE("Conversions to integers round and saturate"){
+        Assembler as{0x200};
+        loadSingle(as, 1, 0x40200000);                      // 2.5
+        loadSingle(as, 2, 0xc0200000);                      // -2.5
+        loadSingle(as, 3, 0x4f32d05e);                      // 3e9
+        loadSingle(as, 4, 0x7fc00000);
+        as.Fp(FpFunc::CvtWF, false, reg::s0, 1, 0, RoundingMode::Rne);
+        as.Fp(FpFunc::CvtWF, false, reg::s1, 1, 0, RoundingMode::Rmm);
+        as.Fp(FpFunc::CvtWF, false, reg::s2, 2, 0, RoundingMode::Rdn);
+        as.Fp(FpFunc::CvtWF, false, reg::s3, 2, 0, RoundingMode::Rtz);
+        as.Csrr(reg::s4, CsrIdx::Fflags);
+        as.Csrw(CsrIdx::Fflags, reg::zero);
+        as.Fp(FpFunc::CvtWF, false, reg::s5, 3, 0, RoundingMode::Rtz);
+        as.Fp(FpFunc::CvtWuF, false, reg::s6, 3, 0, RoundingMode::Rtz);
+        as.Fp(FpFunc::CvtWuF, false, reg::s7, 2, 0, RoundingMode::Rtz);
+        as.Fp(FpFunc::CvtWF, false, reg::a0, 4, 0, RoundingMode::Rtz);
+        as.Csrr(reg::a1, CsrIdx::Fflags);
+        as.Li(reg::t0, -7);
+        as.Fp(FpFunc::CvtFW, false, 5, reg::t0);
+        as.Fp(FpFunc::MvXW, false, reg::a2, 5);
+        storeResults(as, {reg::s0, reg::s1, reg::s2, reg::s3, reg::s4, reg::s5, reg::s6, reg::s7,
+                          reg::a0, reg::a1, reg::a2});
+
+        Memory mem;
+        auto r = runFp(as, 11, mem);
+        CHECK_EQ(r[0], 2);
+        CHECK_EQ(r[1], 3);
+        CHECK_EQ(r[2], Word(-3));
+        CHECK_EQ(r[3], Word(-2));
+        CHECK_EQ(r[4], fpflags::NX);
+        CHECK_EQ(r[5], 0x7fffffff);
+        CHECK_EQ(r[6], 3000000000u);
+        CHECK_EQ(r[7], 0);
+        CHECK_EQ(r[8], 0x7fffffff);
+        CHECK_EQ(r[9], fpflags::NV);
+        CHECK_EQ(r[10], 0xc0e00000);
+    }
+
+    TEST_CASE("Reserved rounding modes are illegal"){
+        Assembler as{0x200};
+        loadSingle(as, 1, 0x3f800000);                      // 1.0
+        loadSingle(as, 2, 0xcf32d05e);                      // -3e9
+        loadSingle(as, 3, 0x40000000);                      // 2.0
+        as.Li(reg::s1, 77);
+        as.Li(reg::s3, 77);
+        as.Fp(FpFunc::Add, false, 3, 1, 1, RoundingMode(5));
+        as.Fp(FpFunc::MvXW, false, reg::s0, 3);
+        as.Fp(FpFunc::CvtWF, false, reg::s1, 2, 0, RoundingMode(6));
+        as.Li(reg::t0, 5);
+        as.Csrw(CsrIdx::Frm, reg::t0);
+        as.Fp(FpFunc::Add, false, 3, 1, 1);
+        as.Fp(FpFunc::MvXW, false, reg::s2, 3);
+        as.Fp(FpFunc::CvtWF, false, reg::s3, 2);
+        as.Csrr(reg::s4, CsrIdx::Fflags);
+        as.Fp(FpFunc::CvtWF, false, reg::s5, 2, 0, RoundingMode::Rtz);
+        storeResults(as, {reg::s0, reg::s1, reg::s2, reg::s3, reg::s4, reg::s5});
+
+        Memory mem;
+        auto r = runFp(as, 6, mem);
+        CHECK_EQ(r[0], 0x40000000);
+        CHECK_EQ(r[1], 77);
+        CHECK_EQ(r[2], 0x40000000);
+        CHECK_EQ(r[3], 77);
+        CHECK_EQ(r[4], 0);
+        CHECK_EQ(r[5], 0x80000000);                         // saturates at INT32_MIN
+    }
+
+    TEST_CASE("RMM is illegal where the host rounds"){
+        Assembler as{0x200};
+        loadSingle(as, 1, 0x3f800000);                      // 1.0
+        loadSingle(as, 2, 0x40200000);                      // 2.5
+        loadSingle(as, 3, 0x40000000);                      // 2.0
+        as.Fp(FpFunc::Add, false, 3, 1, 1, RoundingMode::Rmm);
+        as.Fp(FpFunc::MvXW, false, reg::s0, 3);
+        as.Li(reg::t0, int32_t(RoundingMode::Rmm));
+        as.Csrw(CsrIdx::Frm, reg::t0);
+        as.Fma(FpFunc::Madd, false, 3, 1, 1, 1);
+        as.Fp(FpFunc::MvXW, false, reg::s1, 3);
+        as.Fp(FpFunc::CvtWF, false, reg::s2, 2);            // ties away from zero
+        as.Li(reg::s3, 77);
+        as.Fp(FpFunc::CvtFW, false, 3, reg::s3, 0, RoundingMode::Rmm);
+        as.Fp(FpFunc::MvXW, false, reg::s3, 3);
+        storeResults(as, {reg::s0, reg::s1, reg::s2, reg::s3});
+
+        Memory mem;
+        auto r = runFp(as, 4, mem);
+        CHECK_EQ(r[0], 0x40000000);
+        CHECK_EQ(r[1], 0x40000000);
+        CHECK_EQ(r[2], 3);
+        CHECK_EQ(r[3], 0x40000000);
+    }
+
+    TEST_CASE("Min, max, compares and classes"){
+        Assembler as{0x200};
+        loadSingle(as, 1, 0x00000000);                      // +0
+        loadSingle(as, 2, 0x80000000);                      // -0
+        loadSingle(as, 3, 0x7fc00000);                      // quiet NaN
+        loadSingle(as, 4, 0x7f800001);                      // signaling NaN
+        loadSingle(as, 5, 0x3f800000);
+        as.Fp(FpFunc::Min, false, 6, 1, 2);
+        as.Fp(FpFunc::MvXW, false, reg::s0, 6);
+        as.Fp(FpFunc::Max, false, 6, 2, 1);
+        as.Fp(FpFunc::MvXW, false, reg::s1, 6);
+        as.Fp(FpFunc::Min, false, 6, 3, 5);
+        as.Fp(FpFunc::MvXW, false, reg::s2, 6);
+        as.Fp(FpFunc::Eq, false, reg::s3, 1, 2);
+        as.Fp(FpFunc::Eq, false, reg::s4, 3, 3);
+        as.Csrr(reg::s5, CsrIdx::Fflags);                   // a quiet NaN is fine for feq
+        as.Fp(FpFunc::Max, false, 6, 4, 4);
+        as.Fp(FpFunc::MvXW, false, reg::s6, 6);
+        as.Csrr(reg::s7, CsrIdx::Fflags);
+        as.Fp(FpFunc::Class, false, reg::a0, 2);
+        as.Fp(FpFunc::Class, false, reg::a1, 4);
+        storeResults(as, {reg::s0, reg::s1, reg::s2, reg::s3, reg::s4, reg::s5, reg::s6, reg::s7,
+                          reg::a0, reg::a1});
+
+        Memory mem;
+        auto r = runFp(as, 10, mem);
+        CHECK_EQ(r[0], 0x80000000);
+        CHECK_EQ(r[1], 0);
+        CHECK_EQ(r[2], 0x3f800000);
+        CHECK_EQ(r[3], 1);
+        CHECK_EQ(r[4], 0);
+        CHECK_EQ(r[5], 0);
+        CHECK_EQ(r[6], 0x7fc00000);
+        CHECK_EQ(r[7], fpflags::NV);
+        CHECK_EQ(r[8], 1u << 3);
+        CHECK_EQ(r[9], 1u << 8);
+    }
+
+    TEST_CASE("Doubles and NaN-boxing"){
+        constexpr Word data = 0x1000;
+        Assembler as{0x200};
+        as.Li(reg::t0, data);
+        as.Fld(1, reg::t0, 0);                              // 1.5
+        as.Fld(2, reg::t0, 8);                              // 0.25
+        as.Fp(FpFunc::Add, true, 3, 1, 2);
+        as.Fsd(3, reg::t0, 16);
+        as.Fp(FpFunc::Add, false, 5, 3, 3);                 // not a boxed single
+        as.Fp(FpFunc::MvXW, false, reg::s0, 5);
+        as.Fp(FpFunc::CvtFF, false, 4, 3);
+        as.Fsw(4, reg::t0, 24);
+        as.Fp(FpFunc::Lt, true, reg::s1, 2, 1);
+        storeResults(as, {reg::s0, reg::s1});
+
+        auto bitsOf = [](double d) { uint64_t b; std::memcpy(&b, &d, 8); return b; };
+        Memory mem;
+        mem.Store<uint64_t>(data, bitsOf(1.5));
+        mem.Store<uint64_t>(data + 8, bitsOf(0.25));
+        auto r = runFp(as, 2, mem);
+        CHECK_EQ(r[0], 0x7fc00000);
+        CHECK_EQ(r[1], 1);
+        CHECK_EQ(mem.Load<uint64_t>(data + 16), bitsOf(1.75));
+        CHECK_EQ(mem.Load<Word>(data + 24), 0x3fe00000);
+    }
+}
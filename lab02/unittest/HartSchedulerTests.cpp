@@ -0,0 +1,117 @@
+#include "doctest.h"
+
+#include <deque>
+
+#include "HartScheduler.h"
+#include "TestPrograms.h"
+
+TEST_SUITE("Hart scheduler"){
+    TEST_CASE("A hart spinning on a flag is parked until it is written"){
+        constexpr Word flag = 0x3000, done = 0x3004;
+        constexpr int32_t work = 20000;
+        Assembler as{0x200};
+        auto waiter = as.NewLabel();
+        auto count = as.NewLabel();
+        auto spin = as.NewLabel();
+        as.Csrr(reg::t0, CsrIdx::Mhartid);
+        as.Li(reg::a0, flag);
+        as.Bne(reg::t0, reg::zero, waiter);
+        // hart 0 works for a while, raises the flag and waits for the answer
+        as.Li(reg::t1, work);
+        as.Bind(count);
+        as.Addi(reg::t1, reg::t1, -1);
+        as.Bne(reg::t1, reg::zero, count);
+        as.Li(reg::t2, 1);
+        as.Sw(reg::t2, reg::a0, 0);
+        as.Bind(spin);
+        as.Lw(reg::t2, reg::a0, 4);
+        as.Beq(reg::t2, reg::zero, spin);
+        as.Csrw(CsrIdx::Mtohost, reg::zero);
+        // the other harts spin on the flag, then answer
+        as.Bind(waiter);
+        as.Lw(reg::t2, reg::a0, 0);
+        as.Beq(reg::t2, reg::zero, waiter);
+        as.Sw(reg::t2, reg::a0, 4);
+        auto idle = as.NewLabel();
+        as.Bind(idle);
+        as.J(idle);
+
+        Memory mem;
+        loadProgram(mem, as);
+        std::deque<Cpu> cpus;
+        for (Word hart = 0; hart < 4; ++hart)
+            cpus.emplace_back(mem, hart).Reset(0x200);
+
+        HartScheduler scheduler{1000};
+        bool exited = false;
+        for (int turn = 0; turn < 1000 && !exited; ++turn) {
+            for (auto& cpu : cpus) {
+                scheduler.Step(cpu);
+                if (cpu.GetMessage()) {
+                    CHECK_EQ(cpu.HartId(), 0);
+                    exited = true;
+                    break;
+                }
+            }
+        }
+        REQUIRE(exited);
+        CHECK_EQ(mem.Load<Word>(done), 1);
+        CHECK_GE(scheduler.Stats().parks, 3);
+        CHECK_GT(scheduler.Stats().skipped, 0);
+        // Parked harts did not burn instructions while hart 0 worked
+        for (Word hart = 1; hart < 4; ++hart)
+            CHECK_LT(cpus[hart].Instret(), work / 4);
+        CHECK_GT(cpus[0].Instret(), 2 * work);
+    }
+
+    TEST_CASE("Harts run on several host threads"){
+        constexpr Word counter = 0x3000, finished = 0x3004;
+        constexpr int32_t adds = 5000;
+        constexpr Word harts = 8;
+        Assembler as{0x200};
+        auto worker = as.NewLabel();
+        auto wait = as.NewLabel();
+        auto add = as.NewLabel();
+        as.Csrr(reg::t0, CsrIdx::Mhartid);
+        as.Li(reg::a0, counter);
+        as.Li(reg::a1, finished);
+        as.Li(reg::t1, 1);
+        as.Bne(reg::t0, reg::zero, worker);
+        // hart 0 waits for the others and exits
+        as.Li(reg::t2, harts - 1);
+        as.Bind(wait);
+        as.Lw(reg::t3, reg::a1, 0);
+        as.Bne(reg::t3, reg::t2, wait);
+        as.Csrw(CsrIdx::Mtohost, reg::zero);
+        // the others count up the shared counter, then report
+        as.Bind(worker);
+        as.Li(reg::t2, adds);
+        as.Bind(add);
+        as.Amo(AmoFunc::Add, reg::zero, reg::t1, reg::a0);
+        as.Addi(reg::t2, reg::t2, -1);
+        as.Bne(reg::t2, reg::zero, add);
+        as.Amo(AmoFunc::Add, reg::zero, reg::t1, reg::a1);
+        auto idle = as.NewLabel();
+        as.Bind(idle);
+        as.J(idle);
+
+        Memory mem;
+        loadProgram(mem, as);
+        std::deque<Cpu> cpus;
+        for (Word hart = 0; hart < harts; ++hart)
+            cpus.emplace_back(mem, hart).Reset(0x200);
+
+        HartScheduler scheduler{500};
+        int messages = 0;
+        scheduler.Run(cpus, 3, [&](Cpu& cpu) {
+            CHECK_EQ(cpu.HartId(), 0);
+            CHECK(cpu.GetMessage());
+            messages++;
+            return false;
+        });
+        CHECK_EQ(messages, 1);
+        CHECK_EQ(mem.Load<Word>(counter), (harts - 1) * adds);
+        CHECK_EQ(mem.Load<Word>(finished), harts - 1);
+        CHECK_GT(scheduler.Stats().quanta, harts);
+    }
+}
@@ -32,9 +32,15 @@ constexpr Word SLTI   = 0b00000000001100001010011110010011;
 constexpr Word SLTU   = 0b00000000001100001011011110110011;
 constexpr Word SLTIU  = 0b00000000001100001011011110010011;
 constexpr Word LW     = 0b00000000001100001010011110000011;
+constexpr Word LB     = 0b00000000001100001000011110000011;
+constexpr Word LH     = 0b00000000001100001001011110000011;
+constexpr Word LBU    = 0b00000000001100001100011110000011;
+constexpr Word LHU    = 0b00000000001100001101011110000011;
 
 // S: imm = 12
 constexpr Word SW     = 0b00000000111101111010011000100011;
+constexpr Word SB     = 0b00000000111101111000011000100011;
+constexpr Word SH     = 0b00000000111101111001011000100011;
 
 // SB(Branch): imm = 12
 constexpr Word BEQ    = 0b0000000111101111000011001100011;
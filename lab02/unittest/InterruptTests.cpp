@@ -0,0 +1,172 @@
+#include "doctest.h"
+
+#include "Clint.h"
+#include "TestPrograms.h"
+
+constexpr Word IRQ_START_IP = 0x200;
+constexpr Word MTIMECMP = Clint::base + Clint::mtimecmpOffset;
+constexpr Word MTIME = Clint::base + Clint::mtimeOffset;
+
+struct Platform {
+    Memory mem;
+    Cpu cpu{mem};
+    Scheduler scheduler;
+    DeviceBus bus;
+    Clint clint{scheduler, [this] { return cpu.Cycles(); },
+                [this](Word bits, bool set) { cpu.SetInterruptPending(bits, set); }};
+
+    Platform() {
+        bus.Map(Clint::base, Clint::size, clint);
+        cpu.Attach(bus, scheduler);
+    }
+
+    std::optional<CpuToHostData> run() {
+        cpu.Reset(IRQ_START_IP);
+        for (int i = 0; i < 1000000; ++i) {
+            cpu.ProcessBlock();
+            if (auto msg = cpu.GetMessage())
+                return msg;
+            if (cpu.GetFault())
+                break;
+        }
+        return std::nullopt;
+    }
+};
+
+// Programs mtimecmp = mtime + delta, enables the timer interrupt and points mtvec at handler
+void armTimer(Assembler &as, Assembler::Label handler, int32_t delta);
+
+TEST_SUITE("Interrupts"){
+    TEST_CASE("Timing wheel"){
+        Scheduler scheduler;
+        std::vector<uint64_t> fired;
+        uint64_t now = 0;
+        auto at = [&](uint64_t when) {
+            return scheduler.Schedule(when, [&, when] { fired.push_back(when); CHECK_LE(when, now); });
+        };
+
+        // One event per level and one beyond the wheel
+        at(100000);
+        at(5);
+        at(1u << 25);
+        at(70);
+        at(5000);
+        auto cancelled = at(300);
+        scheduler.Cancel(cancelled);
+        CHECK_EQ(scheduler.NextCheck(), 5);
+
+        for (now = 0; now < (1u << 25) + 37; now += 37) {
+            if (now >= scheduler.NextCheck())
+                scheduler.Advance(now);
+        }
+        CHECK_EQ(fired, std::vector<uint64_t>{5, 70, 5000, 100000, 1u << 25});
+        CHECK(scheduler.Empty());
+        CHECK_EQ(scheduler.NextCheck(), Scheduler::never);
+
+        SUBCASE("Events scheduled in the past fire on the next advance"){
+            fired.clear();
+            at(10);
+            scheduler.Advance(now);
+            CHECK_EQ(fired.size(), 1);
+        }
+    }
+
+    TEST_CASE("Timer interrupt"){
+        // Spin until the handler sees the timer, then report mcause
+        Assembler as{IRQ_START_IP};
+        auto handler = as.NewLabel();
+        auto loop = as.NewLabel();
+        auto done = as.NewLabel();
+        as.Li(reg::s0, 0);
+        as.Li(reg::s1, 0);
+        armTimer(as, handler, 500);
+        as.Bind(loop);
+        as.Addi(reg::s0, reg::s0, 1);
+        as.Beq(reg::s1, reg::zero, loop);
+        as.J(done);
+
+        as.Bind(handler);
+        as.Csrr(reg::s1, CsrIdx::Mcause);
+        as.Li(reg::t0, MTIMECMP);
+        as.Li(reg::t1, -1);
+        as.Sw(reg::t1, reg::t0, 4);     // push mtimecmp to the far future, clearing MTIP
+        as.Mret();
+
+        as.Bind(done);
+        as.Li(reg::t0, 0x1000);
+        as.Sw(reg::s0, reg::t0, 0);
+        as.Csrw(CsrIdx::Mtohost, reg::s1);
+
+        Platform p;
+        loadProgram(p.mem, as);
+        auto msg = p.run();
+        REQUIRE(msg);
+        CHECK_EQ(msg->payload, CsrFile::interruptBit | CsrFile::causeMTI);
+
+        // The interrupt is taken at the first block boundary after mtimecmp
+        Word iterations = p.mem.Load<Word>(0x1000);
+        CHECK_GT(iterations, 100);
+        CHECK_LT(iterations, 300);
+        CHECK_EQ(p.clint.TimeCmp() >> 32, 0xffffffff);
+    }
+
+    TEST_CASE("Wfi skips idle cycles"){
+        Assembler as{IRQ_START_IP};
+        auto handler = as.NewLabel();
+        auto idle = as.NewLabel();
+        auto done = as.NewLabel();
+        as.Li(reg::s1, 0);
+        armTimer(as, handler, 1000000);
+        as.Bind(idle);
+        as.Wfi();
+        as.Beq(reg::s1, reg::zero, idle);
+        as.J(done);
+
+        as.Bind(handler);
+        as.Li(reg::s1, 1);
+        as.Li(reg::t0, MTIMECMP);
+        as.Li(reg::t1, -1);
+        as.Sw(reg::t1, reg::t0, 4);
+        as.Mret();
+
+        as.Bind(done);
+        as.Csrw(CsrIdx::Mtohost, reg::s1);
+
+        Platform p;
+        loadProgram(p.mem, as);
+        auto msg = p.run();
+        REQUIRE(msg);
+        CHECK_EQ(msg->unpacked.data, 1);
+        CHECK_GE(p.cpu.Cycles(), 1000000);
+        CHECK_LT(p.cpu.Instret(), 100);
+    }
+
+    TEST_CASE("Unmapped addresses still fault"){
+        Assembler as{IRQ_START_IP};
+        as.Li(reg::t0, Clint::base + Clint::size);
+        as.Lw(reg::t1, reg::t0, 0);
+        as.Csrw(CsrIdx::Mtohost, reg::t1);
+
+        Platform p;
+        loadProgram(p.mem, as);
+        CHECK_FALSE(p.run());
+        REQUIRE(p.cpu.GetFault());
+        CHECK_EQ(p.cpu.GetFault()->addr, Clint::base + Clint::size);
+    }
+}
+
+void armTimer(Assembler &as, Assembler::Label handler, int32_t delta){
+    as.La(reg::t0, handler);
+    as.Csrw(CsrIdx::Mtvec, reg::t0);
+    as.Li(reg::t0, MTIME);
+    as.Lw(reg::t1, reg::t0, 0);
+    as.Li(reg::t2, delta);
+    as.Add(reg::t1, reg::t1, reg::t2);
+    as.Li(reg::t0, MTIMECMP);
+    as.Sw(reg::zero, reg::t0, 4);
+    as.Sw(reg::t1, reg::t0, 0);
+    as.Li(reg::t0, 1 << 7);     // MTIE
+    as.Csrw(CsrIdx::Mie, reg::t0);
+    as.Li(reg::t0, 1 << 3);     // MIE
+    as.Csrw(CsrIdx::Mstatus, reg::t0);
+}
@@ -0,0 +1,84 @@
+#include "doctest.h"
+
+#include "Benchmarks.h"
+#include "LockstepChecker.h"
+#include "TestPrograms.h"
+
+// Steps the cpu under the checker until it exits or the engines disagree
+bool runChecked(Cpu &cpu, LockstepChecker &checker){
+    bool agree;
+    do {
+        agree = checker.Step(cpu);
+    } while (agree && !cpu.GetMessage() && !cpu.GetFault());
+    return agree && checker.Finish(cpu);
+}
+
+TEST_SUITE("Lockstep checker"){
+    TEST_CASE("The engines agree on every kernel"){
+        for (auto& kernel : BenchKernels()) {
+            CAPTURE(kernel.name);
+            Memory mem;
+            LoadKernel(kernel, mem, 1);
+            Cpu cpu{mem};
+            cpu.Reset(benchCodeAddr);
+            LockstepChecker checker;
+            LoadKernel(kernel, checker.RefMemory(), 1);
+            CHECK(runChecked(cpu, checker));
+            CHECK_EQ(checker.Report(), "");
+            CHECK_EQ(checker.Stats().instructions, cpu.Instret());
+            CHECK_EQ(mem.Load<Word>(benchResultAddr), kernel.expected(1));
+        }
+    }
+
+    TEST_CASE("The first difference is reported"){
+        constexpr Word data = 0x3000;
+        Assembler as{0x200};
+        auto loop = as.NewLabel();
+        as.Li(reg::a0, data);
+        as.Li(reg::a1, 4);
+        as.Bind(loop);
+        as.Addi(reg::a1, reg::a1, -1);
+        as.Bne(reg::a1, reg::zero, loop);
+        as.Lw(reg::t1, reg::a0, 0);
+        as.Sw(reg::t1, reg::a0, 4);
+        as.Csrw(CsrIdx::Mtohost, reg::zero);
+
+        Memory mem;
+        loadProgram(mem, as);
+        Cpu cpu{mem};
+        cpu.Reset(0x200);
+        LockstepChecker checker;
+        loadProgram(checker.RefMemory(), as);
+        // Stands in for a wrong load of the fast engine
+        mem.Store<Word>(data, 7);
+
+        CHECK_FALSE(runChecked(cpu, checker));
+        auto& report = checker.Report();
+        CHECK_NE(report.find("instret " + std::to_string(cpu.Instret()) + ":"), std::string::npos);
+        CHECK_NE(report.find("x6 0x00000007, reference 0x00000000"), std::string::npos);
+        CHECK_NE(report.find("mem[0x00003004] 0x00000007, reference 0x00000000"), std::string::npos);
+        CHECK_FALSE(checker.Step(cpu));
+    }
+
+    TEST_CASE("The reference replays the host syscalls"){
+        constexpr Word time = 0x1300;
+        Assembler as{0x200};
+        as.Li(reg::a0, time);
+        as.Li(reg::a1, 0);
+        syscall(as, Syscall::Gettimeofday);
+        as.Li(reg::a0, time);
+        as.Lw(reg::t0, reg::a0, 0);
+        as.Lw(reg::t1, reg::a0, 4);
+        as.Csrw(CsrIdx::Mtohost, reg::zero);
+
+        Memory mem;
+        loadProgram(mem, as);
+        Cpu cpu{mem};
+        cpu.Reset(0x200);
+        LockstepChecker checker;
+        loadProgram(checker.RefMemory(), as);
+        CHECK(runChecked(cpu, checker));
+        CHECK_EQ(checker.Report(), "");
+        CHECK_NE(cpu.Reg(reg::t0), 0);
+    }
+}
@@ -0,0 +1,198 @@
+#include "doctest.h"
+
+#include <thread>
+
+#include "Assembler.h"
+#include "Cpu.h"
+
+constexpr Word OUT_OF_RAM = 0x10000000;
+
+TEST_SUITE("Memory"){
+    TEST_CASE("Guard pages"){
+        Memory mem;
+
+        SUBCASE("RAM access does not fault"){
+            auto st = std::make_unique<Instruction>();
+            st->_type = IType::St;
+            st->_addr = Memory::ramBytes - 4;
+            st->_data = 0x12345678;
+            mem.Request(st);
+            CHECK_FALSE(Memory::Faulted());
+            CHECK_EQ(mem.Request(Memory::ramBytes - 4), 0x12345678);
+        }
+
+        SUBCASE("Load past RAM reports a fault"){
+            CHECK_EQ(mem.Request(OUT_OF_RAM), 0);
+            REQUIRE(Memory::Faulted());
+            auto fault = mem.TakeFault();
+            REQUIRE(fault);
+            CHECK_EQ(fault->addr, OUT_OF_RAM);
+            CHECK_FALSE(Memory::Faulted());
+        }
+
+        SUBCASE("Store past RAM is discarded"){
+            auto st = std::make_unique<Instruction>();
+            st->_type = IType::St;
+            st->_addr = Memory::ramBytes;
+            st->_data = 0xdead;
+            mem.Request(st);
+            REQUIRE(mem.TakeFault());
+
+            // The guard page is back in place and reads as zero again
+            CHECK_EQ(mem.Request(Memory::ramBytes), 0);
+            REQUIRE(mem.TakeFault());
+        }
+    }
+
+    TEST_CASE("Sub-word access"){
+        Memory mem;
+        mem.Store<Word>(0x100, 0x80ff7f01);
+
+        SUBCASE("Loads"){
+            CHECK_EQ(mem.LoadData(0x100, MemFunc::B), 0x01);
+            CHECK_EQ(mem.LoadData(0x103, MemFunc::B), 0xffffff80);
+            CHECK_EQ(mem.LoadData(0x103, MemFunc::Bu), 0x80);
+            CHECK_EQ(mem.LoadData(0x102, MemFunc::H), 0xffff80ff);
+            CHECK_EQ(mem.LoadData(0x102, MemFunc::Hu), 0x80ff);
+            CHECK_EQ(mem.LoadData(0x100, MemFunc::W), 0x80ff7f01);
+        }
+
+        SUBCASE("Stores"){
+            mem.StoreData(0x101, 0xaabbccdd, MemFunc::B);
+            CHECK_EQ(mem.Load<Word>(0x100), 0x80ffdd01);
+            mem.StoreData(0x102, 0xaabbccdd, MemFunc::H);
+            CHECK_EQ(mem.Load<Word>(0x100), 0xccdddd01);
+        }
+
+        SUBCASE("Misaligned word"){
+            mem.Store<Word>(0x104, 0x55667788);
+            CHECK_EQ(mem.LoadData(0x102, MemFunc::W), 0x778880ff);
+            mem.StoreData(0x103, 0x11223344, MemFunc::W);
+            CHECK_EQ(mem.Load<Word>(0x100), 0x44ff7f01);
+            CHECK_EQ(mem.Load<Word>(0x104), 0x55112233);
+        }
+
+        SUBCASE("Misaligned word across the end of RAM"){
+            CHECK_EQ(mem.LoadData(Memory::ramBytes - 2, MemFunc::W), 0);
+            auto fault = mem.TakeFault();
+            REQUIRE(fault);
+            CHECK_EQ(fault->addr, Memory::ramBytes);
+
+            // The store faults before writing the half inside RAM
+            mem.StoreData(Memory::ramBytes - 2, 0xaabbccdd, MemFunc::W);
+            fault = mem.TakeFault();
+            REQUIRE(fault);
+            CHECK_EQ(fault->addr, Memory::ramBytes);
+            CHECK_EQ(mem.Load<uint16_t>(Memory::ramBytes - 2), 0);
+        }
+
+        SUBCASE("Word wrapping past the address space"){
+            CHECK_EQ(mem.LoadData(0xfffffffe, MemFunc::W), 0);
+            REQUIRE(mem.TakeFault());
+        }
+    }
+
+    TEST_CASE("Stores to translated code are logged"){
+        Memory mem;
+        mem.MarkCode(0x200, 0x208);
+
+        // Data next to the code is not
+        mem.Store<Word>(0x300, 1);
+        CHECK_EQ(mem.CodeEpoch(), 0);
+
+        mem.StoreData(0x205, 0xff, MemFunc::B);
+        REQUIRE_EQ(mem.CodeEpoch(), 1);
+        auto write = mem.CodeWriteAt(0);
+        REQUIRE(write);
+        CHECK_EQ(write->begin, 0x205);
+        CHECK_EQ(write->end, 0x206);
+
+        // The word is data now until translated again
+        mem.Store<Word>(0x204, 2);
+        CHECK_EQ(mem.CodeEpoch(), 1);
+        mem.Store<Word>(0x1fe, 3);
+        CHECK_EQ(mem.CodeEpoch(), 2);
+
+        // The oldest writes fall out of the log
+        for (size_t i = 0; i < Memory::codeLogSize; ++i) {
+            mem.MarkCode(0x200, 0x204);
+            mem.Store<Word>(0x200, 0);
+        }
+        CHECK_FALSE(mem.CodeWriteAt(1));
+        CHECK(mem.CodeWriteAt(2));
+    }
+
+    TEST_CASE("Code marked on one thread survives stores to the page on another"){
+        constexpr Word page = 0x4000;
+        constexpr int rounds = 20000;
+        Memory mem;
+        std::thread other([&] {
+            for (int i = 0; i < rounds; ++i) {
+                mem.MarkCode(page + 4, page + 8);
+                mem.Store<Word>(page + 4, i);
+            }
+        });
+        for (int i = 0; i < rounds; ++i)
+            mem.MarkCode(page + 8 * (i % 64) + 8, page + 8 * (i % 64) + 12);
+        other.join();
+
+        // Every word marked here is still code
+        uint64_t epoch = mem.CodeEpoch();
+        CHECK_EQ(epoch, rounds);
+        for (Word word = 0; word < 64; ++word) {
+            mem.Store<Word>(page + 8 * word + 8, 0);
+            CHECK_EQ(mem.CodeEpoch(), ++epoch);
+        }
+    }
+
+    TEST_CASE("Restore copies back the dirty pages"){
+        Memory mem;
+        mem.Store<Word>(0x1000, 1);
+        mem.Snapshot();
+        CHECK(mem.DirtyPages().empty());
+
+        mem.Store<Word>(0x1000, 2);
+        mem.Store<Word>(0x1ffe, 3);     // ends on the next page
+        mem.Store<Word>(0x5000, 4);
+        std::vector<Word> dirty = {1, 2, 5};
+        CHECK_EQ(mem.DirtyPages(), dirty);
+
+        CHECK_EQ(mem.Restore(), 3);
+        CHECK_EQ(mem.Load<Word>(0x1000), 1);
+        CHECK_EQ(mem.Load<Word>(0x1ffe), 0);
+        CHECK_EQ(mem.Load<Word>(0x5000), 0);
+        CHECK(mem.DirtyPages().empty());
+
+        // Pages are tracked again after a restore
+        mem.Store<uint8_t>(0x1000, 5);
+        CHECK_EQ(mem.DirtyPages().size(), 1);
+        CHECK_EQ(mem.Restore(), 1);
+        CHECK_EQ(mem.Load<Word>(0x1000), 1);
+    }
+
+    TEST_CASE("Guest access fault stops the cpu"){
+        Assembler as{0x200};
+        as.Li(1, 42);
+        as.Lui(2, OUT_OF_RAM);
+        as.Sw(1, 2, 8);
+        as.Csrw(CsrIdx::Mtohost, 0);
+
+        Memory mem;
+        Word addr = 0x200;
+        for (Word w : as.Code()) {
+            mem.Store(addr, w);
+            addr += 4;
+        }
+
+        Cpu cpu{mem};
+        cpu.Reset(0x200);
+        for (int i = 0; i < 10; ++i)
+            cpu.ProcessBlock();
+
+        CHECK_FALSE(cpu.GetMessage());
+        auto& fault = cpu.GetFault();
+        REQUIRE(fault);
+        CHECK_EQ(fault->addr, OUT_OF_RAM + 8);
+        CHECK_EQ(fault->ip, 0x208);
+    }
+}
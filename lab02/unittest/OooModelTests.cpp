@@ -0,0 +1,121 @@
+#include "doctest.h"
+
+#include "Benchmarks.h"
+#include "OooModel.h"
+#include "TracePipe.h"
+
+OooStats runOoo(Assembler &as, const OooConfig &config);
+
+TEST_SUITE("OooModel"){
+    TEST_CASE("Independent and dependent chains"){
+        // 64 additions per iteration, either all into one register or into four
+        auto build = [](bool independent) {
+            Assembler as{0x200};
+            auto loop = as.NewLabel();
+            as.Li(reg::s0, 200);
+            as.Bind(loop);
+            for (int i = 0; i < 64; ++i) {
+                RId rd = independent ? RId(reg::a0 + i % 4) : reg::a0;
+                as.Addi(rd, rd, 1);
+            }
+            as.Addi(reg::s0, reg::s0, -1);
+            as.Bne(reg::s0, reg::zero, loop);
+            as.Csrw(CsrIdx::Mtohost, reg::s0);
+            return as;
+        };
+        auto wide = OooConfigForWidth(4);
+        auto dependent = build(false);
+        auto independent = build(true);
+
+        OooStats dep = runOoo(dependent, wide);
+        OooStats indep = runOoo(independent, wide);
+        CHECK_LT(dep.Ipc(), 1.05);
+        CHECK_GT(indep.Ipc(), 2.8);
+        CHECK_GT(dep.StallShare(Stall::Dependency), 0.7);
+
+        // Every commit slot but those after the last commit is used or charged to a cause
+        uint64_t stalls = 0;
+        for (auto stall : indep.stalls)
+            stalls += stall;
+        CHECK_LE(indep.instructions + stalls, indep.cycles * indep.width);
+        CHECK_GT(indep.instructions + stalls, (indep.cycles - 1) * indep.width);
+
+        // A scalar core cannot exceed one instruction per cycle
+        auto scalarBuild = build(true);
+        CHECK_LE(runOoo(scalarBuild, OooConfigForWidth(1)).Ipc(), 1.0);
+    }
+
+    TEST_CASE("Store to load forwarding"){
+        Assembler as{0x200};
+        auto loop = as.NewLabel();
+        as.Li(reg::s0, 100);
+        as.Li(reg::t0, 0x1000);
+        as.Bind(loop);
+        as.Sw(reg::s0, reg::t0, 0);
+        as.Lw(reg::t1, reg::t0, 0);
+        as.Addi(reg::s0, reg::s0, -1);
+        as.Bne(reg::s0, reg::zero, loop);
+        as.Csrw(CsrIdx::Mtohost, reg::s0);
+
+        OooStats stats = runOoo(as, OooConfigForWidth(4));
+        CHECK_EQ(stats.forwardedLoads, 100);
+    }
+
+    TEST_CASE("Kernels scale with width"){
+        auto& kernel = *FindKernel("sort");
+        double ipc[2];
+        unsigned widths[2] = {1, 4};
+        for (int i = 0; i < 2; ++i) {
+            Memory mem;
+            LoadKernel(kernel, mem, 1);
+            Cpu cpu{mem};
+            cpu.Reset(benchCodeAddr);
+            OooModel model{OooConfigForWidth(widths[i])};
+            while (!cpu.GetMessage())
+                cpu.ProcessInstruction(model);
+            REQUIRE_EQ(mem.Load<Word>(benchResultAddr), kernel.expected(1));
+            CHECK_EQ(model.Stats().instructions, cpu.Instret());
+            ipc[i] = model.Stats().Ipc();
+        }
+        CHECK_LE(ipc[0], 1.0);
+        CHECK_GT(ipc[1], 2 * ipc[0]);
+    }
+
+    TEST_CASE("The model behind a ring sees the same stream"){
+        auto& kernel = *FindKernel("list");
+        OooStats stats[2];
+        for (int pipelined = 0; pipelined < 2; ++pipelined) {
+            Memory mem;
+            LoadKernel(kernel, mem, 1);
+            Cpu cpu{mem};
+            cpu.Reset(benchCodeAddr);
+            OooModel model{OooConfigForWidth(4)};
+            if (pipelined) {
+                PipelinedModel<OooModel> pipe{model};
+                while (!cpu.GetMessage())
+                    cpu.ProcessInstruction(pipe);
+            } else {
+                while (!cpu.GetMessage())
+                    cpu.ProcessInstruction(model);
+            }
+            REQUIRE_EQ(mem.Load<Word>(benchResultAddr), kernel.expected(1));
+            stats[pipelined] = model.Stats();
+        }
+        CHECK_EQ(stats[1].instructions, stats[0].instructions);
+        CHECK_EQ(stats[1].cycles, stats[0].cycles);
+        CHECK_EQ(stats[1].mispredicts, stats[0].mispredicts);
+        CHECK_EQ(stats[1].forwardedLoads, stats[0].forwardedLoads);
+    }
+}
+
+OooStats runOoo(Assembler &as, const OooConfig &config){
+    Memory mem;
+    auto& code = as.Code();
+    std::memcpy(mem.HostPtr(0x200, 4 * code.size()), code.data(), 4 * code.size());
+    Cpu cpu{mem};
+    cpu.Reset(0x200);
+    OooModel model{config};
+    while (!cpu.GetMessage())
+        cpu.ProcessInstruction(model);
+    return model.Stats();
+}
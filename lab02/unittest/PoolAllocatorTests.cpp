@@ -0,0 +1,97 @@
+#include "doctest.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Instruction.h"
+
+TEST_SUITE("Pool allocator"){
+    TEST_CASE("Chunks are cache-line aligned and reused"){
+        SlabPool pool{64, 3};                               // 256 byte slabs
+        CHECK_EQ(pool.ChunkSize(), 64);
+        void* a = pool.Allocate();
+        void* b = pool.Allocate();
+        CHECK_EQ(reinterpret_cast<uintptr_t>(a) % cacheLineSize, 0);
+        CHECK_EQ(static_cast<char*>(b) - static_cast<char*>(a), 64);
+        pool.Deallocate(a);
+        CHECK_EQ(pool.Allocate(), a);
+
+        // The fourth chunk needs a second slab
+        for (int i = 0; i < 2; ++i)
+            pool.Allocate();
+        CHECK_EQ(pool.Stats().slabs, 2);
+        CHECK_EQ(pool.Stats().allocations, 5);
+        CHECK_EQ(pool.Stats().Live(), 4);
+
+        // Reset frees everything at once and starts over at the first slab
+        pool.Reset();
+        CHECK_EQ(pool.Stats().Live(), 0);
+        CHECK_EQ(pool.Allocate(), a);
+        CHECK_EQ(pool.Stats().slabs, 2);
+
+        pool.Release();
+        CHECK_EQ(pool.Stats().slabs, 0);
+        CHECK_EQ(pool.Stats().bytes, 0);
+
+        // Smaller chunks take a whole line too
+        SlabPool small{40, 3};
+        CHECK_EQ(small.ChunkSize(), cacheLineSize);
+        void* c = small.Allocate();
+        void* d = small.Allocate();
+        CHECK_EQ(reinterpret_cast<uintptr_t>(c) % cacheLineSize, 0);
+        CHECK_EQ(reinterpret_cast<uintptr_t>(d) % cacheLineSize, 0);
+        small.Release();
+    }
+
+    TEST_CASE("Every thread allocates from a pool of its own"){
+        auto instr = std::make_unique<Instruction>();
+        SlabPool* main = &Instruction::Pool();
+        uint64_t allocations = main->Stats().allocations;
+
+        SlabPool* other = nullptr;
+        uint64_t otherLive = 1;
+        std::unique_ptr<Instruction> handedOver;
+        std::thread thread([&] {
+            other = &Instruction::Pool();
+            auto local = std::make_unique<Instruction>();
+            handedOver = std::make_unique<Instruction>();
+            local.reset();
+            otherLive = Instruction::Pool().Stats().Live();
+        });
+        thread.join();
+
+        CHECK_NE(other, main);
+        CHECK_EQ(otherLive, 1);
+        CHECK_EQ(main->Stats().allocations, allocations);
+        // Freed here, the chunk goes back to the pool of the exited thread
+        uint64_t frees = main->Stats().frees;
+        handedOver.reset();
+        CHECK_EQ(main->Stats().frees, frees);
+        CHECK_EQ(reinterpret_cast<uintptr_t>(instr.get()) % cacheLineSize, 0);
+    }
+
+    TEST_CASE("A chunk freed by another thread goes back to its pool"){
+        Instruction* a = new Instruction;
+        Instruction* b = nullptr;
+        std::thread thread([&] {
+            b = new Instruction;
+            delete a;
+        });
+        thread.join();
+
+        // The pool of the exited thread kept the slab of b
+        b->_data = 42;
+        CHECK_EQ(b->_data, 42);
+        delete b;
+
+        // a is handed out here again once this pool runs out of other chunks
+        std::vector<std::unique_ptr<Instruction>> instrs;
+        bool reused = false;
+        for (int i = 0; i < 100000 && !reused; ++i) {
+            instrs.push_back(std::make_unique<Instruction>());
+            reused = instrs.back().get() == a;
+        }
+        CHECK(reused);
+    }
+}
@@ -0,0 +1,140 @@
+#include "doctest.h"
+
+#include "Benchmarks.h"
+#include "Sampler.h"
+
+void loadKernel(Memory &mem, const char *name, unsigned reps);
+
+TEST_SUITE("Sampling"){
+    TEST_CASE("Cache model"){
+        // 4 ways: the fifth line of a set evicts the least recently used one
+        CacheModel cache{{16, 4, 64}};
+        constexpr Word setStride = 16 * 64;
+        for (Word i = 0; i < 4; ++i)
+            CHECK_FALSE(cache.Access(i * setStride));
+        CHECK(cache.Access(0));
+        CHECK_FALSE(cache.Access(4 * setStride));
+        CHECK(cache.Access(0));
+        CHECK_FALSE(cache.Access(setStride));
+        CHECK_EQ(cache.Misses(), 6);
+
+        // Straddling access touches both lines
+        CHECK_FALSE(cache.Access(5 * 64 + 62, 4));
+        CHECK_EQ(cache.Accesses(), 10);
+    }
+
+    TEST_CASE("Load-use and misprediction"){
+        Assembler as{0x200};
+        auto loop = as.NewLabel();
+        as.Li(reg::t0, 0x1000);
+        as.Li(reg::t2, 100);
+        as.Bind(loop);
+        as.Lw(reg::t1, reg::t0, 0);
+        as.Add(reg::t3, reg::t1, reg::t1);      // uses the loaded value right away
+        as.Addi(reg::t2, reg::t2, -1);
+        as.Bne(reg::t2, reg::zero, loop);
+        as.Csrw(CsrIdx::Mtohost, reg::t2);
+
+        Memory mem;
+        auto& code = as.Code();
+        std::memcpy(mem.HostPtr(0x200, 4 * code.size()), code.data(), 4 * code.size());
+        Cpu cpu{mem};
+        cpu.Reset(0x200);
+        TimingModel model;
+        while (!cpu.GetMessage())
+            cpu.ProcessInstruction(model);
+
+        auto& stats = model.Stats();
+        CHECK_EQ(stats.instructions, cpu.Instret());
+        CHECK_EQ(stats.loadUseStalls, 100);
+        CHECK_EQ(stats.branches, 100);
+        // 9 while the global history fills up, 1 to train the counter, 1 on exit
+        CHECK_EQ(stats.mispredicts, 11);
+        CHECK_EQ(stats.dcacheMisses, 1);
+    }
+
+    TEST_CASE("Sampled CPI matches full detailed simulation"){
+        Memory full;
+        loadKernel(full, "sort", 1);
+        Cpu cpu{full};
+        cpu.Reset(benchCodeAddr);
+        TimingModel fullModel;
+        while (!cpu.GetMessage())
+            cpu.ProcessInstruction(fullModel);
+        double cpi = fullModel.Stats().Cpi();
+        CHECK_GT(cpi, 1.0);
+
+        Memory mem;
+        loadKernel(mem, "sort", 1);
+        Cpu sampled{mem};
+        sampled.Reset(benchCodeAddr);
+        TimingModel model;
+        Sampler sampler{model, {50000, 2000, 2000}};
+        while (!sampled.GetMessage())
+            sampler.Step(sampled);
+
+        auto est = sampler.Estimate(sampled);
+        CHECK_EQ(est.instructions, cpu.Instret());
+        CHECK_LT(est.detailed, est.instructions / 5);
+        CHECK_GT(est.windows, 5);
+        CHECK_GT(est.ci95, 0);
+        CHECK_LT(std::abs(est.cpi - cpi), std::max(est.ci95, 0.05 * cpi));
+    }
+
+    TEST_CASE("A program shorter than the warm-up is all detailed"){
+        Memory mem;
+        loadKernel(mem, "sort", 1);
+        Cpu cpu{mem};
+        cpu.Reset(benchCodeAddr);
+        TimingModel model;
+        Sampler sampler{model, {1000000, 100000000, 10000}};
+        while (!cpu.GetMessage())
+            sampler.Step(cpu);
+
+        auto est = sampler.Estimate(cpu);
+        CHECK_EQ(est.windows, 0);
+        CHECK_EQ(est.detailed, est.instructions);
+        CHECK_GT(est.cpi, 1.0);
+        CHECK_EQ(est.cpi, model.Stats().Cpi());
+        CHECK_EQ(est.ci95, 0);
+    }
+
+    TEST_CASE("SimPoints of a two phase program"){
+        // Ten intervals of one loop, then ten of another
+        std::vector<Bbv> intervals;
+        for (int i = 0; i < 20; ++i) {
+            if (i < 10)
+                intervals.push_back({{0x200, 600}, {0x240, 400}});
+            else
+                intervals.push_back({{0x300, 1000 + i}});
+        }
+        auto points = PickSimPoints(intervals, 2);
+        REQUIRE_EQ(points.size(), 2);
+        CHECK_LT(points[0].interval, 10);
+        CHECK_GE(points[1].interval, 10);
+        CHECK_EQ(points[0].weight, doctest::Approx(0.5));
+        CHECK_EQ(points[1].weight, doctest::Approx(0.5));
+    }
+
+    TEST_CASE("BBV collector"){
+        Memory mem;
+        loadKernel(mem, "lfsr", 1);
+        Cpu cpu{mem};
+        cpu.Reset(benchCodeAddr);
+        BbvCollector bbvs{10000};
+        while (!cpu.GetMessage())
+            bbvs.Step(cpu);
+        bbvs.Finish(cpu);
+
+        uint64_t total = 0;
+        for (auto& bbv : bbvs.Intervals())
+            for (auto& [ip, count] : bbv)
+                total += count;
+        CHECK_EQ(total, cpu.Instret());
+        CHECK_EQ(bbvs.Intervals().size(), cpu.Instret() / 10000 + 1);
+    }
+}
+
+void loadKernel(Memory &mem, const char *name, unsigned reps){
+    LoadKernel(*FindKernel(name), mem, reps);
+}
@@ -0,0 +1,125 @@
+#include "doctest.h"
+
+#include "Benchmarks.h"
+#include "SimtCpu.h"
+#include "TestPrograms.h"
+
+TEST_SUITE("SIMT"){
+    TEST_CASE("Divergent lanes match scalar runs"){
+        // Collatz steps of mhartid + 1, returned as the exit code
+        Assembler as{0x200};
+        auto loop = as.NewLabel();
+        auto odd = as.NewLabel();
+        auto next = as.NewLabel();
+        auto exit = as.NewLabel();
+        as.Csrr(reg::t0, CsrIdx::Mhartid);
+        as.Addi(reg::t0, reg::t0, 1);
+        as.Li(reg::a0, 0);
+        as.Li(reg::t2, 1);
+        as.Bind(loop);
+        as.Beq(reg::t0, reg::t2, exit);
+        as.Andi(reg::t1, reg::t0, 1);
+        as.Bne(reg::t1, reg::zero, odd);
+        as.Srli(reg::t0, reg::t0, 1);
+        as.J(next);
+        as.Bind(odd);
+        as.Add(reg::t1, reg::t0, reg::t0);
+        as.Add(reg::t0, reg::t0, reg::t1);
+        as.Addi(reg::t0, reg::t0, 1);
+        as.Bind(next);
+        as.Addi(reg::a0, reg::a0, 1);
+        as.J(loop);
+        as.Bind(exit);
+        as.Li(reg::a7, 93);
+        as.Ecall();
+
+        constexpr unsigned lanes = 16;
+        auto simt = std::make_unique<SimtCpu<lanes>>();
+        for (unsigned lane = 0; lane < lanes; ++lane)
+            loadProgram(simt->LaneMemory(lane), as);
+        simt->Reset(0x200);
+        simt->Run();
+
+        for (Word lane = 0; lane < lanes; ++lane) {
+            Memory mem;
+            loadProgram(mem, as);
+            Cpu cpu{mem, lane};
+            cpu.Reset(0x200);
+            std::optional<CpuToHostData> msg;
+            while (!(msg = cpu.GetMessage()))
+                cpu.ProcessBlock();
+
+            auto& result = simt->Result(lane);
+            REQUIRE(result.exitCode);
+            CHECK_EQ(*result.exitCode, msg->unpacked.data);
+            CHECK_EQ(result.instret, cpu.Instret());
+        }
+        // 1 takes no steps and 9 takes 19, so most lanes idle for a while
+        CHECK_EQ(simt->Result(8).exitCode, 19u);
+        CHECK_LT(simt->Stats().Utilization(lanes), 0.8);
+    }
+
+    TEST_CASE("Kernel on every lane"){
+        auto& kernel = *FindKernel("sort");
+        auto simt = std::make_unique<SimtCpu<8>>();
+        for (unsigned lane = 0; lane < 8; ++lane)
+            LoadKernel(kernel, simt->LaneMemory(lane), 1);
+        simt->Reset(benchCodeAddr, 0, 6);
+        simt->Run();
+
+        for (unsigned lane = 0; lane < 6; ++lane) {
+            CHECK_EQ(simt->Result(lane).exitCode, 0u);
+            CHECK_EQ(simt->LaneMemory(lane).Load<Word>(benchResultAddr), kernel.expected(1));
+        }
+        CHECK_FALSE(simt->Result(6).exitCode);
+        // Same control flow everywhere: no lane ever waits
+        CHECK_EQ(simt->Stats().laneInstructions, 6 * simt->Stats().steps);
+    }
+
+    TEST_CASE("jalr through its own link register"){
+        // The target comes from ra before the jump overwrites it
+        Assembler as{0x200};
+        as.Auipc(reg::ra, 0);
+        as.Jalr(reg::ra, reg::ra, 20);
+        as.Li(reg::a0, 1);
+        as.Li(reg::a7, 93);
+        as.Ecall();
+        as.Mv(reg::a0, reg::ra);            // 0x214
+        as.Li(reg::a7, 93);
+        as.Ecall();
+
+        auto simt = std::make_unique<SimtCpu<4>>();
+        for (unsigned lane = 0; lane < 4; ++lane)
+            loadProgram(simt->LaneMemory(lane), as);
+        simt->Reset(0x200);
+        simt->Run();
+
+        for (unsigned lane = 0; lane < 4; ++lane)
+            CHECK_EQ(simt->Result(lane).exitCode, 0x208u);
+    }
+
+    TEST_CASE("A faulting lane stops alone"){
+        // Lane 2 loads from past the end of RAM
+        Assembler as{0x200};
+        as.Csrr(reg::t0, CsrIdx::Mhartid);
+        as.Slli(reg::t0, reg::t0, 18);
+        as.Lw(reg::t1, reg::t0, 0);
+        as.Li(reg::a0, 0);
+        as.Li(reg::a7, 93);
+        as.Ecall();
+
+        auto simt = std::make_unique<SimtCpu<4>>();
+        for (unsigned lane = 0; lane < 4; ++lane)
+            loadProgram(simt->LaneMemory(lane), as);
+        simt->Reset(0x200);
+        simt->Run();
+
+        for (unsigned lane = 0; lane < 4; ++lane) {
+            auto& result = simt->Result(lane);
+            CHECK_EQ(result.exitCode.has_value(), lane < 2);
+            CHECK_EQ(result.fault.has_value(), lane >= 2);
+        }
+        CHECK_EQ(simt->Result(2).fault->addr, 2u << 18);
+        CHECK_EQ(simt->Result(2).fault->ip, 0x208);
+    }
+}
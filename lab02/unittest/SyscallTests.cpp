@@ -0,0 +1,271 @@
+#include "doctest.h"
+
+#include <cstdlib>
+#include <fstream>
+
+#include "TestPrograms.h"
+
+constexpr RId A0 = 10, A1 = 11, A2 = 12, A7 = 17, S0 = 8, S1 = 9;
+constexpr Word PATH_ADDR   = 0x1000;
+constexpr Word BUF_ADDR    = 0x1100;
+constexpr Word STAT_ADDR   = 0x1200;
+constexpr Word TIME_ADDR   = 0x1300;
+constexpr Word RESULT_ADDR = 0x700;
+
+std::optional<CpuToHostData> runProgram(Memory &mem, Assembler &as, ReplayLog *log = nullptr);
+
+TEST_SUITE("Syscalls"){
+    TEST_CASE("File I/O and exit"){
+        char path[] = "/tmp/riscv_sim_syscallXXXXXX";
+        int fd = mkstemp(path);
+        REQUIRE(fd >= 0);
+        close(fd);
+
+        Assembler as{0x200};
+        as.Li(A0, PATH_ADDR);
+        as.Li(A1, 0x601);       // O_WRONLY | O_CREAT | O_TRUNC
+        as.Li(A2, 0644);
+        syscall(as, Syscall::Open);
+        as.Mv(S0, A0);
+
+        as.Mv(A0, S0);
+        as.Li(A1, BUF_ADDR);
+        as.Li(A2, 5);
+        syscall(as, Syscall::Write);
+        as.Mv(S1, A0);
+
+        as.Mv(A0, S0);
+        as.Li(A1, STAT_ADDR);
+        syscall(as, Syscall::Fstat);
+
+        as.Mv(A0, S0);
+        syscall(as, Syscall::Close);
+        as.Mv(A0, S0);
+        syscall(as, Syscall::Close);   // already closed
+        as.Sw(A0, 0, RESULT_ADDR);
+
+        as.Li(A0, TIME_ADDR);
+        syscall(as, Syscall::Gettimeofday);
+
+        as.Mv(A0, S1);
+        syscall(as, Syscall::Exit);
+
+        Memory mem;
+        std::memcpy(mem.HostPtr(PATH_ADDR, sizeof(path)), path, sizeof(path));
+        std::memcpy(mem.HostPtr(BUF_ADDR, 5), "hello", 5);
+
+        auto msg = runProgram(mem, as);
+        REQUIRE(msg);
+        CHECK(msg->unpacked.type == CpuToHostType::ExitCode);
+        CHECK_EQ(msg->unpacked.data, 5);
+
+        std::ifstream file(path);
+        std::string content;
+        std::getline(file, content);
+        CHECK_EQ(content, "hello");
+        unlink(path);
+
+        CHECK_EQ(mem.Load<int64_t>(STAT_ADDR + 48), 5);   // st_size
+        CHECK_GT(mem.Load<int64_t>(TIME_ADDR), 0);        // tv_sec
+        CHECK_EQ(mem.Load<SignedWord>(RESULT_ADDR), -EBADF);
+    }
+
+    TEST_CASE("Errors and brk"){
+        Assembler as{0x200};
+        as.Li(A0, 42);
+        as.Li(A1, BUF_ADDR);
+        as.Li(A2, 1);
+        syscall(as, Syscall::Write);        // bad fd
+        as.Sw(A0, 0, RESULT_ADDR);
+        as.Li(A0, 1);
+        as.Li(A1, 0x10000000);
+        syscall(as, Syscall::Write);        // buffer outside of RAM
+        as.Sw(A0, 0, RESULT_ADDR + 4);
+        as.Li(A0, 0);
+        syscall(as, Syscall::Brk);
+        as.Sw(A0, 0, RESULT_ADDR + 8);
+        as.Addi(A0, A0, 0x100);
+        syscall(as, Syscall::Brk);
+        as.Sw(A0, 0, RESULT_ADDR + 12);
+        as.Li(A0, -1);
+        syscall(as, Syscall::Brk);          // past RAM, the break stays
+        as.Sw(A0, 0, RESULT_ADDR + 16);
+        as.Li(A7, 12345);
+        as.Ecall();
+        as.Sw(A0, 0, RESULT_ADDR + 20);
+        as.Li(A0, 0);
+        syscall(as, Syscall::Exit);
+
+        Memory mem;
+        auto msg = runProgram(mem, as);
+        REQUIRE(msg);
+        CHECK_EQ(msg->unpacked.data, 0);
+
+        CHECK_EQ(mem.Load<SignedWord>(RESULT_ADDR), -EBADF);
+        CHECK_EQ(mem.Load<SignedWord>(RESULT_ADDR + 4), -EFAULT);
+        Word brk = mem.Load<Word>(RESULT_ADDR + 8);
+        CHECK_EQ(mem.Load<Word>(RESULT_ADDR + 12), brk + 0x100);
+        CHECK_EQ(mem.Load<Word>(RESULT_ADDR + 16), brk + 0x100);
+        CHECK_EQ(mem.Load<SignedWord>(RESULT_ADDR + 20), -ENOSYS);
+    }
+
+    TEST_CASE("Exit codes wider than the message"){
+        Assembler as{0x200};
+        as.Li(A0, 256);
+        syscall(as, Syscall::Exit);
+
+        Memory mem;
+        auto msg = runProgram(mem, as);
+        REQUIRE(msg);
+        CHECK_NE(msg->unpacked.data, 0);
+
+        Cpu cpu{mem};
+        cpu.Reset(0x200);
+        for (int i = 0; i < 10 && !cpu.GetMessage(); ++i)
+            cpu.ProcessBlock();
+        CHECK_EQ(cpu.ExitCode(), 256);
+    }
+
+    TEST_CASE("Harts of a program share files and the break"){
+        char path[] = "/tmp/riscv_sim_hartsXXXXXX";
+        int fd = mkstemp(path);
+        REQUIRE(fd >= 0);
+        close(fd);
+
+        // Hart 0 opens the file and grows the heap, hart 1 writes to the file
+        Assembler as{0x200};
+        auto second = as.NewLabel();
+        as.Csrr(reg::t0, CsrIdx::Mhartid);
+        as.Bne(reg::t0, reg::zero, second);
+        as.Li(A0, PATH_ADDR);
+        as.Li(A1, 0x601);       // O_WRONLY | O_CREAT | O_TRUNC
+        as.Li(A2, 0644);
+        syscall(as, Syscall::Open);
+        as.Sw(A0, 0, RESULT_ADDR);
+        as.Li(A0, 0);
+        syscall(as, Syscall::Brk);
+        as.Addi(A0, A0, 0x100);
+        syscall(as, Syscall::Brk);
+        as.Sw(A0, 0, RESULT_ADDR + 4);
+        as.Li(A0, 0);
+        syscall(as, Syscall::Exit);
+        as.Bind(second);
+        as.Lw(A0, 0, RESULT_ADDR);
+        as.Li(A1, BUF_ADDR);
+        as.Li(A2, 5);
+        syscall(as, Syscall::Write);
+        as.Sw(A0, 0, RESULT_ADDR + 8);
+        as.Li(A0, -1);
+        syscall(as, Syscall::Brk);          // past RAM: only reads the break
+        as.Sw(A0, 0, RESULT_ADDR + 12);
+        as.Li(A0, 0);
+        syscall(as, Syscall::Exit);
+
+        Memory mem;
+        loadProgram(mem, as);
+        std::memcpy(mem.HostPtr(PATH_ADDR, sizeof(path)), path, sizeof(path));
+        std::memcpy(mem.HostPtr(BUF_ADDR, 5), "hello", 5);
+        {
+            Cpu boot{mem, 0};
+            Cpu other{mem, 1};
+            boot.Reset(0x200);
+            other.Reset(0x200);
+            other.ShareProcess(boot);
+            for (Cpu* cpu : {&boot, &other}) {
+                for (int i = 0; i < 1000 && !cpu->GetMessage(); ++i)
+                    cpu->ProcessBlock();
+            }
+        }
+
+        CHECK_EQ(mem.Load<SignedWord>(RESULT_ADDR + 8), 5);
+        CHECK_EQ(mem.Load<Word>(RESULT_ADDR + 12), mem.Load<Word>(RESULT_ADDR + 4));
+
+        std::ifstream file(path);
+        std::string content;
+        std::getline(file, content);
+        CHECK_EQ(content, "hello");
+        unlink(path);
+    }
+
+    TEST_CASE("Replay feeds back recorded results"){
+        char path[] = "/tmp/riscv_sim_replayXXXXXX";
+        int fd = mkstemp(path);
+        REQUIRE(fd >= 0);
+        REQUIRE(write(fd, "abc", 3) == 3);
+        close(fd);
+        std::string logPath = std::string(path) + ".log";
+
+        Assembler as{0x200};
+        as.Li(A0, PATH_ADDR);
+        as.Li(A1, 0);
+        as.Li(A2, 0);
+        syscall(as, Syscall::Open);
+        as.Li(A1, BUF_ADDR);
+        as.Li(A2, 16);
+        syscall(as, Syscall::Read);
+        as.Mv(S0, A0);
+        as.Li(A0, TIME_ADDR);
+        syscall(as, Syscall::Gettimeofday);
+        as.Mv(A0, S0);
+        syscall(as, Syscall::Exit);
+
+        auto run = [&](ReplayLog &log) {
+            Memory mem;
+            std::memcpy(mem.HostPtr(PATH_ADDR, sizeof(path)), path, sizeof(path));
+            auto msg = runProgram(mem, as, &log);
+            REQUIRE(msg);
+            CHECK_EQ(msg->unpacked.data, 3);
+            CHECK_EQ(std::string(mem.HostPtr(BUF_ADDR, 3), 3), "abc");
+            return mem.Load<int64_t>(TIME_ADDR + 8) << 32 | mem.Load<int64_t>(TIME_ADDR);
+        };
+
+        int64_t recorded;
+        {
+            ReplayLog log{logPath.c_str(), ReplayLog::Mode::Record, 1};
+            REQUIRE(log.Ok());
+            recorded = run(log);
+            CHECK(log.Ok());
+        }
+        // The file is gone and time went on, yet the guest sees the same
+        unlink(path);
+        usleep(2000);
+        {
+            ReplayLog log{logPath.c_str(), ReplayLog::Mode::Replay, 1};
+            REQUIRE(log.Ok());
+            CHECK_EQ(run(log), recorded);
+            CHECK(log.Divergence().empty());
+        }
+
+        // Another program does not follow the log
+        Assembler other{0x200};
+        other.Li(A0, 0);
+        syscall(other, Syscall::Brk);
+        syscall(other, Syscall::Exit);
+        ReplayLog log{logPath.c_str(), ReplayLog::Mode::Replay, 1};
+        Memory mem;
+        auto msg = runProgram(mem, other, &log);
+        REQUIRE(msg);
+        CHECK_EQ(msg->unpacked.data, 1);
+        CHECK_FALSE(log.Divergence().empty());
+        CHECK_FALSE(ReplayLog(logPath.c_str(), ReplayLog::Mode::Replay, 2).Ok());
+        unlink(logPath.c_str());
+    }
+}
+
+std::optional<CpuToHostData> runProgram(Memory &mem, Assembler &as, ReplayLog *log){
+    Word addr = 0x200;
+    for (Word w : as.Code()) {
+        mem.Store(addr, w);
+        addr += 4;
+    }
+    Cpu cpu{mem};
+    cpu.Reset(0x200);
+    if (log)
+        cpu.AttachLog(*log);
+    for (int i = 0; i < 1000; ++i) {
+        cpu.ProcessBlock();
+        if (auto msg = cpu.GetMessage())
+            return msg;
+    }
+    return std::nullopt;
+}
@@ -0,0 +1,35 @@
+#include "TestPrograms.h"
+
+void loadProgram(Memory &mem, Assembler &as){
+    Word addr = 0x200;
+    for (Word w : as.Code()) {
+        mem.Store(addr, w);
+        addr += 4;
+    }
+}
+
+std::optional<CpuToHostData> runHart(Cpu &cpu){
+    for (int i = 0; i < 10000000; ++i) {
+        cpu.ProcessBlock();
+        if (auto msg = cpu.GetMessage())
+            return msg;
+        if (cpu.GetFault())
+            break;
+    }
+    return std::nullopt;
+}
+
+void storeResults(Assembler &as, std::initializer_list<RId> regs){
+    as.Li(reg::t6, results);
+    int32_t offset = 0;
+    for (RId r : regs) {
+        as.Sw(r, reg::t6, offset);
+        offset += 4;
+    }
+    as.Csrw(CsrIdx::Mtohost, reg::zero);
+}
+
+void syscall(Assembler &as, Syscall num){
+    as.Li(reg::a7, int32_t(num));
+    as.Ecall();
+}
@@ -0,0 +1,25 @@
+#ifndef RISCV_SIM_TESTPROGRAMS_H
+#define RISCV_SIM_TESTPROGRAMS_H
+
+#include <initializer_list>
+#include <optional>
+
+#include "Assembler.h"
+#include "Cpu.h"
+
+// Where storeResults puts the registers of a test program
+constexpr Word results = 0x1100;
+
+// Copies the program to its start address, 0x200
+void loadProgram(Memory &mem, Assembler &as);
+
+// Runs the block engine until the hart posts a message or faults
+std::optional<CpuToHostData> runHart(Cpu &cpu);
+
+// Stores the registers to consecutive words at results and exits
+void storeResults(Assembler &as, std::initializer_list<RId> regs);
+
+// Calls the host syscall num with the arguments already in a0..a5
+void syscall(Assembler &as, Syscall num);
+
+#endif //RISCV_SIM_TESTPROGRAMS_H
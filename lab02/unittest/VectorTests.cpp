@@ -0,0 +1,182 @@
+#include "doctest.h"
+
+#include "SimtCpu.h"
+#include "TestPrograms.h"
+
+TEST_SUITE("Vector"){
+    TEST_CASE("vsetvli follows VLEN"){
+        Assembler as{0x200};
+        as.Li(reg::t0, 10);
+        as.Vsetvli(reg::s0, reg::t0, Assembler::VType(32));
+        as.Vsetvli(reg::s1, reg::t0, Assembler::VType(32, 2));
+        as.Vsetvli(reg::s2, reg::zero, Assembler::VType(8));      // VLMAX
+        as.Csrr(reg::s3, CsrIdx::Vlenb);
+        as.Vsetvli(reg::s4, reg::t0, 3 << 3);                     // e64 is past ELEN
+        as.Csrr(reg::s5, CsrIdx::Vtype);
+        as.Vsetivli(reg::s6, 3, Assembler::VType(16));
+        as.Vsetvli(reg::zero, reg::zero, Assembler::VType(32));   // keeps vl
+        as.Csrr(reg::s7, CsrIdx::Vl);
+        storeResults(as, {reg::s0, reg::s1, reg::s2, reg::s3, reg::s4, reg::s5, reg::s6, reg::s7});
+
+        for (Word vlen : {128, 256}) {
+            CAPTURE(vlen);
+            Memory mem;
+            loadProgram(mem, as);
+            Cpu cpu{mem};
+            cpu.SetVlen(vlen);
+            cpu.Reset(0x200);
+            REQUIRE(runHart(cpu));
+            CHECK_EQ(mem.Load<Word>(results + 0), std::min(10u, vlen / 32));
+            CHECK_EQ(mem.Load<Word>(results + 4), std::min(10u, vlen / 16));
+            CHECK_EQ(mem.Load<Word>(results + 8), vlen / 8);
+            CHECK_EQ(mem.Load<Word>(results + 12), vlen / 8);
+            CHECK_EQ(mem.Load<Word>(results + 16), 0);
+            CHECK_EQ(mem.Load<Word>(results + 20), CsrFile::vtypeVill);
+            CHECK_EQ(mem.Load<Word>(results + 24), 3);
+            CHECK_EQ(mem.Load<Word>(results + 28), 3);
+        }
+    }
+
+    TEST_CASE("Strip-mined F = (A - B) + C * D"){
+        constexpr int32_t n = 13;
+        constexpr Word a = 0x2000, b = 0x2100, c = 0x2200, d = 0x2300, f = 0x2400;
+        Assembler as{0x200};
+        auto loop = as.NewLabel();
+        as.Li(reg::a0, n);
+        as.Li(reg::a1, a);
+        as.Li(reg::a2, b);
+        as.Li(reg::a3, c);
+        as.Li(reg::a4, d);
+        as.Li(reg::a5, f);
+        as.Bind(loop);
+        as.Vsetvli(reg::t0, reg::a0, Assembler::VType(32));
+        as.Vle(32, 1, reg::a1);
+        as.Vle(32, 2, reg::a2);
+        as.Vle(32, 3, reg::a3);
+        as.Vle(32, 4, reg::a4);
+        as.Vv(VecFunc::Sub, 5, 1, 2);
+        as.Vv(VecFunc::Macc, 5, 4, 3);
+        as.Vse(32, 5, reg::a5);
+        as.Slli(reg::t1, reg::t0, 2);
+        as.Add(reg::a1, reg::a1, reg::t1);
+        as.Add(reg::a2, reg::a2, reg::t1);
+        as.Add(reg::a3, reg::a3, reg::t1);
+        as.Add(reg::a4, reg::a4, reg::t1);
+        as.Add(reg::a5, reg::a5, reg::t1);
+        as.Sub(reg::a0, reg::a0, reg::t0);
+        as.Bne(reg::a0, reg::zero, loop);
+        as.Csrw(CsrIdx::Mtohost, reg::zero);
+
+        uint64_t instret[2];
+        for (Word vlen : {128, 256}) {
+            CAPTURE(vlen);
+            Memory mem;
+            loadProgram(mem, as);
+            for (int32_t i = 0; i < n; ++i) {
+                mem.Store<int32_t>(a + 4 * i, 100 * i);
+                mem.Store<int32_t>(b + 4 * i, 7 - i);
+                mem.Store<int32_t>(c + 4 * i, i - 5);
+                mem.Store<int32_t>(d + 4 * i, 3 * i);
+            }
+            mem.Store<int32_t>(f + 4 * n, 12345);
+            Cpu cpu{mem};
+            cpu.SetVlen(vlen);
+            cpu.Reset(0x200);
+            REQUIRE(runHart(cpu));
+            for (int32_t i = 0; i < n; ++i)
+                CHECK_EQ(mem.Load<int32_t>(f + 4 * i), (100 * i - (7 - i)) + (i - 5) * 3 * i);
+            CHECK_EQ(mem.Load<int32_t>(f + 4 * n), 12345);
+            instret[vlen / 256] = cpu.Instret();
+        }
+        // Half as many strips on the wider vectors
+        CHECK_LT(instret[1], instret[0]);
+    }
+
+    TEST_CASE("Strides, masks and reductions"){
+        constexpr Word data = 0x2000, out = 0x2100;
+        Assembler as{0x200};
+        as.Li(reg::a1, data);
+        as.Li(reg::a2, out);
+        as.Li(reg::t0, 8);
+        as.Vsetivli(reg::zero, 8, Assembler::VType(32, 2));
+        as.Vlse(32, 2, reg::a1, reg::t0);                         // every other word
+        as.Li(reg::t1, 7);
+        as.Vx(VecFunc::Slt, 0, 2, reg::t1);
+        as.Vi(VecFunc::Add, 2, 2, 10, true);                      // only where v2 < 7
+        as.Vse(32, 2, reg::a2);
+        as.Vi(VecFunc::Merge, 4, 2, -1, true);
+        as.Addi(reg::a3, reg::a2, 32);
+        as.Vse(32, 4, reg::a3);
+        as.VmvSX(8, reg::zero);
+        as.Vv(VecFunc::RedSum, 8, 2, 8);
+        as.VmvXS(reg::s0, 8);
+        as.VmvSX(8, reg::zero);
+        as.Vv(VecFunc::RedMax, 8, 2, 8);
+        as.VmvXS(reg::s1, 8);
+        as.Vv(VecFunc::RedSum, 10, 2, 8, true);                   // seeded with the max
+        as.VmvXS(reg::s2, 10);
+        storeResults(as, {reg::s0, reg::s1, reg::s2});
+
+        Memory mem;
+        loadProgram(mem, as);
+        for (Word i = 0; i < 16; ++i)
+            mem.Store<Word>(data + 4 * i, i);
+        Cpu cpu{mem};
+        cpu.Reset(0x200);
+        REQUIRE(runHart(cpu));
+
+        const Word added[] = {10, 12, 14, 16, 8, 10, 12, 14};
+        for (Word i = 0; i < 8; ++i) {
+            CAPTURE(i);
+            CHECK_EQ(mem.Load<Word>(out + 4 * i), added[i]);
+            CHECK_EQ(mem.Load<Word>(out + 32 + 4 * i), i < 4 ? Word(-1) : added[i]);
+        }
+        CHECK_EQ(mem.Load<Word>(results + 0), 96);
+        CHECK_EQ(mem.Load<Word>(results + 4), 16);
+        CHECK_EQ(mem.Load<Word>(results + 8), 16 + 10 + 12 + 14 + 16);
+    }
+
+    TEST_CASE("vmv.x.s under a vill vtype keeps rd"){
+        Assembler as{0x200};
+        as.Li(reg::t0, 4);
+        as.Vsetvli(reg::zero, reg::t0, 3 << 3);                   // e64: vill
+        as.Li(reg::a0, 1234);
+        as.VmvXS(reg::a0, 8);
+        as.Li(reg::a7, 93);
+        as.Ecall();
+
+        Memory mem;
+        loadProgram(mem, as);
+        Cpu cpu{mem};
+        cpu.Reset(0x200);
+        REQUIRE(runHart(cpu));
+        CHECK_EQ(cpu.ExitCode(), 1234u);
+
+        auto simt = std::make_unique<SimtCpu<8>>();
+        for (unsigned lane = 0; lane < 8; ++lane)
+            loadProgram(simt->LaneMemory(lane), as);
+        simt->Reset(0x200);
+        simt->Run();
+        CHECK_EQ(simt->Result(5).exitCode, 1234u);
+    }
+
+    TEST_CASE("Loading the program's own code keeps its blocks"){
+        Assembler as{0x200};
+        auto loop = as.NewLabel();
+        as.Li(reg::a0, 0x200);
+        as.Li(reg::a1, 10);
+        as.Vsetivli(reg::zero, 4, Assembler::VType(32));
+        as.Bind(loop);
+        as.Vle(32, 1, reg::a0);
+        as.Addi(reg::a1, reg::a1, -1);
+        as.Bne(reg::a1, reg::zero, loop);
+        as.Csrw(CsrIdx::Mtohost, reg::zero);
+
+        Memory mem;
+        loadProgram(mem, as);
+        Cpu cpu{mem};
+        cpu.Reset(0x200);
+        REQUIRE(runHart(cpu));
+        CHECK_EQ(cpu.GetBlockStats().dropped, 0);
+    }
+}